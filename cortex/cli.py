@@ -893,7 +893,11 @@ class CortexCLI:
                 if parallel:
                     import asyncio
 
-                    from cortex.install_parallel import run_parallel_install
+                    from cortex.install_parallel import (
+                        plan_for_commands,
+                        run_parallel_install,
+                        timing_report,
+                    )
 
                     def parallel_log_callback(message: str, level: str = "info"):
                         if level == "success":
@@ -904,16 +908,27 @@ class CortexCLI:
                             cx_print(f"  ℹ {message}", "info")
 
                     try:
+                        # Plain apt installs run as the resolver's dependency graph
+                        plan_commands, plan_descriptions, plan_deps = plan_for_commands(
+                            commands, packages
+                        )
                         success, parallel_tasks = asyncio.run(
                             run_parallel_install(
-                                commands=commands,
-                                descriptions=[f"Step {i + 1}" for i in range(len(commands))],
+                                commands=plan_commands,
+                                descriptions=plan_descriptions,
+                                dependencies=plan_deps,
                                 timeout=300,
                                 stop_on_error=True,
                                 log_callback=parallel_log_callback,
+                                prefetch=True,
                             )
                         )
 
+                        if self.verbose:
+                            print("\nPer-task timings:")
+                            for line in timing_report(parallel_tasks):
+                                print(f"  {line}")
+
                         total_duration = 0.0
                         if parallel_tasks:
                             max_end = max(
@@ -938,8 +953,12 @@ class CortexCLI:
 
                             return 0
 
+                        # A failed prefetch only means its install downloads for itself
                         failed_tasks = [
-                            t for t in parallel_tasks if getattr(t.status, "value", "") == "failed"
+                            t
+                            for t in parallel_tasks
+                            if getattr(t.status, "value", "") == "failed"
+                            and not getattr(t, "optional", False)
                         ]
                         error_msg = failed_tasks[0].error if failed_tasks else "Installation failed"
 
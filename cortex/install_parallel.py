@@ -1,7 +1,10 @@
 import asyncio
 import concurrent.futures
+import os
 import re
+import shutil
 import subprocess
+import tempfile
 import time
 from collections.abc import Callable
 from concurrent.futures import Executor
@@ -10,6 +13,26 @@ from enum import Enum
 
 from cortex.validators import DANGEROUS_PATTERNS
 
+# Tasks in the same lock domain never overlap. apt, apt-get, aptitude and
+# dpkg all take the dpkg lock; pip and everything else run concurrently.
+DPKG_LOCK = "dpkg"
+# Prefetches share the link, so they download one at a time in
+# critical-path order rather than splitting the bandwidth
+DOWNLOAD_LOCK = "apt-download"
+DEFAULT_TASK_COST = 1.0
+_DPKG_TOOL = re.compile(r"(?<![\w-])(?:apt|apt-get|aptitude|dpkg|add-apt-repository)(?![\w-])")
+# A plain "[sudo] apt-get [opts] install pkgs" with nothing chained after it
+_APT_INSTALL = re.compile(
+    r"^\s*(?P<prefix>(?:sudo\s+)?)(?P<tool>apt-get|apt)\s+"
+    r"(?P<args>(?:-\S+\s+)*install\s[^;&|<>`$()]+)$"
+)
+_APT_UPDATE = re.compile(r"^\s*(?:sudo\s+)?apt(?:-get)?\s+(?:-\S+\s+)*update(?:\s+-\S+)*\s*$")
+# An install of plain package names: no options but -y, no versions, releases or architectures
+_BARE_APT_INSTALL = re.compile(
+    r"^\s*(?:sudo\s+)?apt(?:-get)?\s+(?:-y\s+)?install\s+(?:-y\s+)?"
+    r"(?P<names>[a-z0-9][a-z0-9+.-]*(?:\s+[a-z0-9][a-z0-9+.-]*)*)\s*$"
+)
+
 
 class TaskStatus(Enum):
     PENDING = "pending"
@@ -32,12 +55,47 @@ class ParallelTask:
     error: str = ""
     start_time: float | None = None
     end_time: float | None = None
+    # Ordering-only edges: wait for these, but run whether or not they succeed
+    soft_dependencies: list[str] = field(default_factory=list)
+    domain: str | None = None
+    # Length of the longest chain from here to the end of the graph
+    priority: float = 0.0
+    # A failed optional task (a download prefetch) does not fail the install
+    optional: bool = False
+    ready_time: float | None = None
 
     def duration(self) -> float | None:
         if self.start_time and self.end_time:
             return self.end_time - self.start_time
         return None
 
+    def wait_time(self) -> float | None:
+        """Seconds between the task becoming runnable and starting."""
+        if self.ready_time and self.start_time:
+            return max(0.0, self.start_time - self.ready_time)
+        return None
+
+
+def lock_domain(command: str) -> str | None:
+    """The lock a command holds while it runs, or None if it can share."""
+    return DPKG_LOCK if _DPKG_TOOL.search(command) else None
+
+
+def prefetch_commands(command: str, archive_dir: str) -> tuple[str, str] | None:
+    """Split an apt install into a download-only prefetch and the install.
+
+    Both use archive_dir as the package cache, so the prefetch downloads
+    without the dpkg lock while another install holds it, and the install
+    then finds its .debs in place. Anything but a plain apt install
+    returns None.
+    """
+    match = _APT_INSTALL.match(command)
+    if not match:
+        return None
+    head = f"{match['prefix']}{match['tool']} -o Dir::Cache::Archives={archive_dir}"
+    args = match["args"].strip()
+    return f"{head} --download-only -y {args}", f"{head} {args}"
+
 
 async def run_single_task(
     task: ParallelTask,
@@ -99,12 +157,12 @@ async def run_single_task(
         if result.returncode == 0:
             task.status = TaskStatus.SUCCESS
             if log_callback:
-                log_callback(f"Finished {task.name} (ok)", "success")
+                log_callback(f"Finished {task.name} (ok, {task.duration():.2f}s)", "success")
             return True
         else:
             task.status = TaskStatus.FAILED
             if log_callback:
-                log_callback(f"Finished {task.name} (failed)", "error")
+                log_callback(f"Finished {task.name} (failed, {task.duration():.2f}s)", "error")
             return False
 
     except asyncio.TimeoutError:
@@ -124,6 +182,93 @@ async def run_single_task(
         return False
 
 
+def _dependents(tasks: dict[str, ParallelTask]) -> dict[str, list[str]]:
+    dependents: dict[str, list[str]] = {name: [] for name in tasks}
+    for task in tasks.values():
+        for dep in task.dependencies + task.soft_dependencies:
+            if dep in dependents:
+                dependents[dep].append(task.name)
+    return dependents
+
+
+def critical_path_priorities(tasks: dict[str, ParallelTask], costs: dict[str, float]) -> None:
+    """Set each task's priority to the cost of its longest chain to the end.
+
+    Starting the task at the head of the longest remaining chain first keeps
+    the critical path moving while shorter branches fill idle workers. An
+    edge that closes a cycle is ignored; the scheduler skips those tasks.
+    """
+    dependents = _dependents(tasks)
+    rank: dict[str, float] = {}
+    for root in tasks:
+        if root in rank:
+            continue
+        stack = [(root, iter(dependents[root]))]
+        on_stack = {root}
+        while stack:
+            name, children = stack[-1]
+            child = next(children, None)
+            if child is None:
+                stack.pop()
+                on_stack.discard(name)
+                tail = max((rank[c] for c in dependents[name] if c in rank), default=0.0)
+                rank[name] = costs.get(name, DEFAULT_TASK_COST) + tail
+            elif child not in rank and child not in on_stack:
+                stack.append((child, iter(dependents[child])))
+                on_stack.add(child)
+    for name, task in tasks.items():
+        task.priority = rank[name]
+
+
+def _chain_lock_domains(tasks: dict[str, ParallelTask]) -> None:
+    """Keep list order within a lock domain when no dependencies were given.
+
+    Those tasks run one at a time anyway, and "apt-get update" has to
+    finish before the installs that follow it.
+    """
+    last: dict[str, str] = {}
+    for task in tasks.values():
+        if task.domain is None:
+            continue
+        if task.domain in last:
+            task.dependencies.append(last[task.domain])
+        last[task.domain] = task.name
+
+
+def _add_prefetches(tasks: dict[str, ParallelTask], archive_root: str) -> None:
+    """Give every plain apt install a download-only prefetch task.
+
+    A prefetch waits only for the setup its install depends on (apt-get
+    update, repository keys), not for earlier installs, so downloads run
+    under whichever install holds the dpkg lock. The install waits for
+    its prefetch but runs whether or not it succeeded.
+    """
+    installs = {
+        name: task for name, task in tasks.items() if _APT_INSTALL.match(task.command) is not None
+    }
+
+    def setup(names: list[str]) -> list[str]:
+        found: list[str] = []
+        for name in names:
+            deps = setup(installs[name].dependencies) if name in installs else [name]
+            found.extend(dep for dep in deps if dep not in found)
+        return found
+
+    for i, (name, task) in enumerate(installs.items(), 1):
+        archive_dir = os.path.join(archive_root, str(i))
+        os.makedirs(os.path.join(archive_dir, "partial"))
+        prefetch, task.command = prefetch_commands(task.command, archive_dir)
+        tasks[f"Prefetch {i}"] = ParallelTask(
+            name=f"Prefetch {i}",
+            command=prefetch,
+            description=f"Download packages for {name}",
+            dependencies=setup(task.dependencies),
+            domain=DOWNLOAD_LOCK,
+            optional=True,
+        )
+        task.soft_dependencies.append(f"Prefetch {i}")
+
+
 async def run_parallel_install(
     commands: list[str],
     descriptions: list[str] | None = None,
@@ -131,20 +276,35 @@ async def run_parallel_install(
     timeout: int = 300,
     stop_on_error: bool = True,
     log_callback: Callable[[str, str], None] | None = None,
+    max_workers: int = 4,
+    prefetch: bool = False,
+    estimates: dict[int, float] | None = None,
 ) -> tuple[bool, list[ParallelTask]]:
     """Execute installation tasks in parallel based on dependency graph.
 
+    Whenever a worker is free it takes the ready task with the longest
+    chain of work left behind it. If that task's lock domain is held (one
+    dpkg at a time), the worker steals the next ready task it can run
+    instead of idling behind the lock.
+
     Args:
         commands: List of commands to execute
         descriptions: Optional list of descriptions for each command
         dependencies: Optional dict mapping command index to list of dependent indices
-                     e.g., {0: [], 1: [0]} means task 1 depends on task 0
+                     e.g., {0: [], 1: [0]} means task 1 depends on task 0.
+                     Without it, tasks sharing a lock domain keep their list order.
         timeout: Timeout per command in seconds
-        stop_on_error: If True, cancel dependent tasks when a task fails
+        stop_on_error: If True, skip tasks that depend on a failed task
         log_callback: Optional callback for logging (called with message and level)
+        max_workers: Tasks run at once
+        prefetch: Download the packages of each apt install while other
+                  tasks hold the dpkg lock
+        estimates: Optional expected seconds per command index, used to find
+                   the critical path (each task counts as one second otherwise)
 
     Returns:
-        tuple[bool, list[ParallelTask]]: Success status and list of all tasks
+        tuple[bool, list[ParallelTask]]: Success status and list of all tasks,
+        the tasks for commands first and any prefetch tasks after them
     """
     if not commands:
         return True, []
@@ -158,122 +318,246 @@ async def run_parallel_install(
         task_name = f"Task {i + 1}"
         desc = descriptions[i] if descriptions else f"Step {i + 1}"
 
-        # Get dependencies for this task (if any commands depend on it, don't use that)
-        # Instead, find which tasks this task depends on
-        task_deps: list[str] = []
-        if dependencies:
-            # Dependencies format: key=task_index -> list of indices it depends on
-            for dep_idx in dependencies.get(i, []):
-                task_deps.append(f"Task {dep_idx + 1}")
+        # Dependencies format: key=task_index -> list of indices it depends on
+        task_deps = [f"Task {dep_idx + 1}" for dep_idx in (dependencies or {}).get(i, [])]
 
         tasks[task_name] = ParallelTask(
             name=task_name,
             command=command,
             description=desc,
             dependencies=task_deps,
+            domain=lock_domain(command),
         )
 
+    if dependencies is None:
+        _chain_lock_domains(tasks)
+
+    archive_root = tempfile.mkdtemp(prefix="cortex-prefetch-") if prefetch else None
+    if archive_root:
+        _add_prefetches(tasks, archive_root)
+
+    costs = {f"Task {i + 1}": cost for i, cost in (estimates or {}).items()}
+    critical_path_priorities(tasks, costs)
+
     # Execution tracking
-    completed = set()
-    running = {}
-    pending = set(tasks.keys())
-    failed = set()
+    dependents = _dependents(tasks)
+    position = {name: i for i, name in enumerate(tasks)}
+    unmet = {name: set(t.dependencies + t.soft_dependencies) for name, t in tasks.items()}
+    ready: list[str] = []
+    held: set[str] = set()
+    running: dict[asyncio.Task, str] = {}
+    failed: set[str] = set()
+
+    def make_ready(name: str) -> None:
+        del unmet[name]
+        tasks[name].ready_time = time.time()
+        ready.append(name)
+
+    def resolve(name: str) -> None:
+        for child in dependents[name]:
+            if child in unmet:
+                unmet[child].discard(name)
+                if not unmet[child]:
+                    make_ready(child)
+
+    def skip_dependents(name: str, cause: str) -> None:
+        for child in dependents[name]:
+            if child not in unmet:
+                continue
+            task = tasks[child]
+            if name not in task.dependencies:
+                unmet[child].discard(name)
+                if not unmet[child]:
+                    make_ready(child)
+                continue
+            del unmet[child]
+            task.status = TaskStatus.SKIPPED
+            task.error = f"Skipped because {cause} failed"
+            if not task.optional:
+                failed.add(child)
+            if log_callback:
+                log_callback(f"{child} skipped because {cause} failed", "error")
+            skip_dependents(child, cause)
+
+    for name in list(unmet):
+        if not unmet[name]:
+            make_ready(name)
 
     # Thread pool for subprocess calls
-    executor = concurrent.futures.ThreadPoolExecutor(max_workers=4)
+    executor = concurrent.futures.ThreadPoolExecutor(max_workers=max_workers)
 
     try:
-        while pending or running:
-            # Start tasks whose dependencies are met
-            ready_to_start = []
-            for task_name in pending.copy():
+        while ready or running:
+            ready.sort(key=lambda n: (-tasks[n].priority, position[n]))
+            for task_name in list(ready):
+                if len(running) >= max_workers:
+                    break
                 task = tasks[task_name]
-                # When stop_on_error=False, accept both completed and failed dependencies
-                if stop_on_error:
-                    deps_met = all(dep in completed for dep in task.dependencies)
-                else:
-                    deps_met = all(dep in completed or dep in failed for dep in task.dependencies)
-
-                if deps_met:
-                    ready_to_start.append(task_name)
-                    pending.remove(task_name)
-
-            # If no tasks can be started and none are running, we're stuck (deadlock/cycle detection)
-            if not ready_to_start and not running and pending:
-                # Mark remaining tasks as skipped - they have unresolvable dependencies
-                for task_name in pending:
-                    task = tasks[task_name]
-                    if task.status == TaskStatus.PENDING:
-                        task.status = TaskStatus.SKIPPED
-                        task.error = "Task could not run because dependencies never completed"
-                        if log_callback:
-                            log_callback(
-                                f"{task_name} skipped due to unresolved dependencies", "error"
-                            )
-                failed.update(pending)
+                if task.domain in held:
+                    continue
+                ready.remove(task_name)
+                if task.domain:
+                    held.add(task.domain)
+                coro = run_single_task(task, executor, timeout, log_callback)
+                running[asyncio.create_task(coro)] = task_name
+
+            if not running:
                 break
 
-            # Create tasks for ready items
-            for task_name in ready_to_start:
-                coro = run_single_task(tasks[task_name], executor, timeout, log_callback)
-                running[task_name] = asyncio.create_task(coro)
-
-            # If nothing is running and nothing is pending, we're done
-            if not running and not pending:
-                break
-
-            # Wait for at least one task to finish
-            if running:
-                done, _ = await asyncio.wait(
-                    running.values(),
-                    return_when=asyncio.FIRST_COMPLETED,
-                )
-
-                # Process completed tasks
-                for task_coro in done:
-                    # Find which task this is
-                    for task_name, running_coro in running.items():
-                        if running_coro is task_coro:
-                            task = tasks[task_name]
-
-                            # Handle cancelled tasks
-                            try:
-                                success = task_coro.result()
-                            except asyncio.CancelledError:
-                                # Task was cancelled due to stop_on_error
-                                task.status = TaskStatus.SKIPPED
-                                task.error = "Task cancelled due to dependency failure"
-                                failed.add(task_name)
-                                del running[task_name]
-                                break
-
-                            if success:
-                                completed.add(task_name)
-                            else:
-                                failed.add(task_name)
-
-                                # If stop_on_error, skip dependent tasks
-                                if stop_on_error:
-                                    dependent_tasks = [
-                                        name
-                                        for name, t in tasks.items()
-                                        if task_name in t.dependencies
-                                    ]
-                                    for dep_task_name in dependent_tasks:
-                                        if dep_task_name in pending:
-                                            pending.remove(dep_task_name)
-                                            tasks[dep_task_name].status = TaskStatus.SKIPPED
-                                        elif dep_task_name in running:
-                                            running[dep_task_name].cancel()
-
-                            del running[task_name]
-                            break
+            done, _ = await asyncio.wait(running, return_when=asyncio.FIRST_COMPLETED)
+            for task_coro in done:
+                task_name = running.pop(task_coro)
+                task = tasks[task_name]
+                held.discard(task.domain)
+                if task_coro.result() or task.optional:
+                    resolve(task_name)
+                elif stop_on_error:
+                    failed.add(task_name)
+                    skip_dependents(task_name, task_name)
+                else:
+                    failed.add(task_name)
+                    resolve(task_name)
+
+        # Whatever still waits sits on a cycle or on a task that doesn't exist
+        for task_name in unmet:
+            task = tasks[task_name]
+            task.status = TaskStatus.SKIPPED
+            task.error = "Task could not run because dependencies never completed"
+            if not task.optional:
+                failed.add(task_name)
+            if log_callback:
+                log_callback(f"{task_name} skipped due to unresolved dependencies", "error")
 
     finally:
+        for task_coro in running:
+            task_coro.cancel()
         executor.shutdown(wait=True)
+        if archive_root:
+            shutil.rmtree(archive_root, ignore_errors=True)
 
     # Check overall success
     all_success = len(failed) == 0
     task_list = list(tasks.values())
 
     return all_success, task_list
+
+
+def timing_report(tasks: list[ParallelTask]) -> list[str]:
+    """Per-task timings in start order, then wall time and lock hold times.
+
+    "wait" is time a task spent runnable but queued behind a held lock or
+    busy workers; a long wait on the dpkg lock is where bring-up time goes.
+    """
+    ran = sorted((t for t in tasks if t.start_time), key=lambda t: t.start_time)
+    if not ran:
+        return []
+    origin = ran[0].start_time
+    lines = []
+    held: dict[str, float] = {}
+    for task in ran:
+        run = task.duration() or 0.0
+        if task.domain:
+            held[task.domain] = held.get(task.domain, 0.0) + run
+        lines.append(
+            f"{task.name:<12} +{task.start_time - origin:7.2f}s  run {run:7.2f}s  "
+            f"wait {task.wait_time() or 0.0:6.2f}s  {task.status.value:<7}  "
+            f"{task.domain or '-':<12}  {task.description}"
+        )
+    wall = max((t.end_time or t.start_time) for t in ran) - origin
+    busy = sum(t.duration() or 0.0 for t in ran)
+    locks = "".join(f", {domain} held {secs:.2f}s" for domain, secs in sorted(held.items()))
+    lines.append(f"wall {wall:.2f}s, task time {busy:.2f}s{locks}")
+    return lines
+
+
+# Reasons dependency_resolver gives packages apt installs only on request
+_OPTIONAL_REASONS = ("Recommended package", "Optional enhancement")
+
+
+def plan_from_resolver(
+    resolver, packages: list[str]
+) -> tuple[list[str], list[str], dict[int, list[int]]]:
+    """Commands, descriptions and dependencies for run_parallel_install.
+
+    Follows the resolver's direct dependencies from each requested package
+    through everything not yet installed, so each apt install waits only
+    on the packages it needs, after one apt-get update. An edge closing a
+    dependency cycle is dropped; apt installs the rest of the cycle with
+    the package anyway.
+    """
+    edges: dict[str, list[str]] = {}
+    queue = [p for p in packages if not resolver.is_package_installed(p)]
+    while queue:
+        pkg = queue.pop()
+        if pkg in edges:
+            continue
+        graph = resolver.resolve_dependencies(pkg, recursive=False)
+        needed = [
+            dep.name
+            for dep in graph.direct_dependencies
+            if not dep.is_satisfied
+            and dep.reason not in _OPTIONAL_REASONS
+            and not dep.name.startswith("<")  # Virtual packages
+        ]
+        edges[pkg] = needed
+        queue.extend(needed)
+
+    # Depth-first, dependencies before dependents
+    order: list[str] = []
+    kept: dict[str, list[str]] = {}
+    visiting: set[str] = set()
+
+    def visit(pkg: str) -> None:
+        visiting.add(pkg)
+        kept[pkg] = []
+        for dep in edges[pkg]:
+            if dep in visiting or dep in kept[pkg]:
+                continue
+            if dep not in kept:
+                visit(dep)
+            kept[pkg].append(dep)
+        visiting.discard(pkg)
+        order.append(pkg)
+
+    for pkg in edges:
+        if pkg not in kept:
+            visit(pkg)
+
+    if not order:
+        return [], [], {}
+    index = {pkg: i for i, pkg in enumerate(order, 1)}
+    commands = ["sudo apt-get update"] + [f"sudo apt-get install -y {pkg}" for pkg in order]
+    descriptions = ["Update package lists"] + [f"Install {pkg}" for pkg in order]
+    deps = {0: []} | {index[pkg]: [0] + [index[dep] for dep in kept[pkg]] for pkg in order}
+    return commands, descriptions, deps
+
+
+def plan_for_commands(
+    commands: list[str], packages: list[str], resolver=None
+) -> tuple[list[str], list[str], dict[int, list[int]] | None]:
+    """What run_parallel_install should run for a list of install commands.
+
+    Commands that only update and install plain package names are replaced
+    by the resolver's graph for those packages (see plan_from_resolver), so
+    each install waits only on what it needs. The packages are read from
+    the commands themselves and must be exactly `packages`. Anything else
+    (pip, repository setup, pipes, apt options, version pins, target
+    releases) runs as given, without dependencies.
+    """
+    as_given = commands, [f"Step {i + 1}" for i in range(len(commands))], None
+    names: list[str] = []
+    for command in commands:
+        if _APT_UPDATE.match(command):
+            continue
+        match = _BARE_APT_INSTALL.match(command)
+        if not match:
+            return as_given
+        names.extend(n for n in match["names"].split() if n not in names)
+    if not names or set(names) != set(packages):
+        return as_given
+    if resolver is None:
+        from cortex.dependency_resolver import DependencyResolver
+
+        resolver = DependencyResolver()
+    planned, descriptions, deps = plan_from_resolver(resolver, names)
+    return (planned, descriptions, deps) if planned else as_given
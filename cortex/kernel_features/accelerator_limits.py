@@ -3,10 +3,16 @@
 Cortex Accelerator-Aware Resource Limits
 
 cgroups v2 wrapper for AI workloads.
+
+cgroups have no controller for device memory, so a profile's GPU memory
+caps (gpu_memory_high, gpu_memory_max) are enforced by gpu_memory.py:
+`monitor` charges each process's device memory to its profile, and
+`admit` tells a server whether the profile may take a new session.
 """
 
 import json
 import sqlite3
+import sys
 from dataclasses import asdict, dataclass
 from enum import Enum
 from pathlib import Path
@@ -32,6 +38,24 @@ PRESETS = {
 }
 
 
+UNITS = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30, "T": 1 << 40}
+
+
+def parse_memory_limit(value: str, total: int) -> int | None:
+    """Bytes of a cap given as bytes ("24G", "512M") or a share of total ("80%").
+
+    None (no cap) for an empty value.
+    """
+    value = value.strip().upper().removesuffix("B").removesuffix("I")
+    if not value:
+        return None
+    if value.endswith("%"):
+        return int(total * float(value[:-1]) / 100)
+    if value[-1] in UNITS:
+        return int(float(value[:-1]) * UNITS[value[-1]])
+    return int(value)
+
+
 @dataclass
 class ResourceLimits:
     name: str
@@ -40,6 +64,12 @@ class ResourceLimits:
     memory_max: int = 32 * 1024**3
     gpu_ids: list[int] = None
     oom_score_adj: int = 0
+    # Per device; see parse_memory_limit(). Over high, new sessions are
+    # refused while the device is short of memory; over max, always.
+    gpu_memory_high: str = ""
+    gpu_memory_max: str = ""
+    # Unit or cgroup path of the profile's processes (default cortex-model@<name>.service)
+    cgroup: str = ""
 
     def __post_init__(self):
         self.gpu_ids = self.gpu_ids or []
@@ -48,7 +78,13 @@ class ResourceLimits:
     def from_preset(cls, name: str, preset: str, gpus: int = 0):
         p = PRESETS.get(preset, PRESETS["inference"])
         return cls(
-            name, preset, p["cpu"], int(p["memory_gb"] * 1e9), list(range(gpus)), p["oom_adj"]
+            name,
+            preset,
+            p["cpu"],
+            int(p["memory_gb"] * 1e9),
+            list(range(gpus)),
+            p["oom_adj"],
+            gpu_memory_max=f"{p['gpu_pct']}%" if p["gpu_pct"] < 100 else "",
         )
 
 
@@ -65,6 +101,7 @@ class LimitsDatabase:
                 "INSERT OR REPLACE INTO profiles VALUES (?,?)",
                 (limits.name, json.dumps(asdict(limits))),
             )
+            conn.commit()
 
     def get(self, name: str) -> ResourceLimits | None:
         with self._pool.get_connection() as conn:
@@ -94,14 +131,25 @@ class AcceleratorLimitsManager:
             return {}
         return {"CUDA_VISIBLE_DEVICES": ",".join(map(str, limits.gpu_ids))}
 
+    def admit(self, name: str) -> tuple[bool, str]:
+        """Whether profile name may start a new session, and why not."""
+        from cortex.kernel_features.gpu_memory import admit
+
+        return admit(name)
+
     def status(self):
         profiles = self.db.list_all()
-        print(f"\n{'NAME':<20} {'PRESET':<12} {'CPU':<8} {'MEMORY':<10} {'GPUS':<10}")
-        print("-" * 65)
+        print(
+            f"\n{'NAME':<20} {'PRESET':<12} {'CPU':<8} {'MEMORY':<10} {'GPUS':<10} "
+            f"{'GPU MEM HIGH/MAX':<18}"
+        )
+        print("-" * 84)
         for p in profiles:
             gpus = ",".join(map(str, p.gpu_ids)) or "-"
+            caps = f"{p.gpu_memory_high or '-'}/{p.gpu_memory_max or '-'}"
             print(
-                f"{p.name:<20} {p.preset:<12} {p.cpu_quota / 100:.0f}{'':<5} {p.memory_max / 1e9:.0f}G{'':<5} {gpus:<10}"
+                f"{p.name:<20} {p.preset:<12} {p.cpu_quota / 100:.0f}{'':<5} {p.memory_max / 1e9:.0f}G{'':<5} {gpus:<10} "
+                f"{caps:<18}"
             )
 
 
@@ -115,21 +163,57 @@ def main():
     c.add_argument("name")
     c.add_argument("--preset", default="inference")
     c.add_argument("--gpus", type=int, default=0)
+    c.add_argument("--gpu-memory-high", help="soft cap per GPU, bytes (24G) or share (80%%)")
+    c.add_argument("--gpu-memory-max", help="hard cap per GPU, bytes (24G) or share (80%%)")
+    c.add_argument("--cgroup", default="", help="unit or cgroup path of the profile's processes")
 
     sub.add_parser("env").add_argument("name")
     sub.add_parser("status")
     sub.add_parser("list")
+    sub.add_parser("admit").add_argument("name")  # Exits 1 if a session would be refused
+    m = sub.add_parser("monitor")
+    m.add_argument("--interval", type=float, default=None, help="seconds between samples")
+    sub.add_parser("usage")
 
     args = parser.parse_args()
+    if args.cmd == "admit":
+        # Reads only the monitor's state file: runs as the service's user,
+        # which has no profile database
+        from cortex.kernel_features.gpu_memory import admit
+
+        ok, reason = admit(args.name)
+        if not ok:
+            print(f"{args.name}: {reason}", file=sys.stderr)
+            sys.exit(1)
+        return
+
     mgr = AcceleratorLimitsManager()
 
     if args.cmd == "create":
-        mgr.create(ResourceLimits.from_preset(args.name, args.preset, args.gpus))
+        limits = ResourceLimits.from_preset(args.name, args.preset, args.gpus)
+        if args.gpu_memory_high is not None:
+            limits.gpu_memory_high = args.gpu_memory_high
+        if args.gpu_memory_max is not None:
+            limits.gpu_memory_max = args.gpu_memory_max
+        limits.cgroup = args.cgroup
+        mgr.create(limits)
     elif args.cmd == "env":
         for k, v in mgr.get_env(args.name).items():
             print(f"export {k}={v}")
     elif args.cmd in ("status", "list"):
         mgr.status()
+    elif args.cmd in ("monitor", "usage"):
+        from cortex.kernel_features.gpu_memory import SAMPLE_INTERVAL, GPUMemoryAccountant
+
+        interval = getattr(args, "interval", None) or SAMPLE_INTERVAL
+        accountant = GPUMemoryAccountant(mgr, interval=interval)
+        if accountant.sampler is None:
+            print("No NVML or ROCm SMI library to sample GPU memory with", file=sys.stderr)
+            sys.exit(1)
+        if args.cmd == "usage":
+            accountant.report(accountant.sample())
+        else:
+            accountant.run()
 
 
 if __name__ == "__main__":
@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: GPL-2.0
+// Cortex Linux ML Workload Scheduler - sched_ext policy
+//
+// Optional scheduling policy that acts on what cortex_sched.bpf.c detects.
+// Tasks of processes marked is_inference in process_metrics (shared with
+// the telemetry object) go to a dedicated dispatch queue with short,
+// boost-scaled slices; a waking inference task preempts a CPU running
+// anything else. CPUs next to the GPUs (preferred_cpus, from the devices'
+// local_cpulist) serve that queue first, so tokenization, sampling and
+// kernel-launch threads stay near the PCIe root. Everything else shares
+// a weighted vtime queue, as under CFS.
+//
+// If the policy misbehaves (or cortex-schedd exits) the kernel ejects it
+// and every task falls back to CFS.
+//
+// Compile with (scx headers from https://github.com/sched-ext/scx):
+//   clang -O2 -g -target bpf -D__TARGET_ARCH_x86 -I$SCX/scheds/include \
+//       -c cortex_ext.bpf.c -o cortex_ext.bpf.o
+//   bpftool gen skeleton cortex_ext.bpf.o > cortex_ext.skel.h
+//
+// Loaded by cortex-schedd --sched-ext. Requires Linux 6.12+ with
+// CONFIG_SCHED_CLASS_EXT.
+
+#include <scx/common.bpf.h>
+
+#include "cortex_sched.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+// Dispatch queues
+#define INFER_DSQ   0           // Inference tasks, FIFO
+#define SHARED_DSQ  1           // Everything else, vtime ordered
+
+// Inference slice: 3ms at boost 0 down to 1ms at boost 10
+#define INFER_SLICE_MAX_NS  (3ULL * 1000 * 1000)
+#define INFER_SLICE_STEP_NS (200ULL * 1000)
+
+// A preferred CPU serves at most this many inference tasks in a row
+// before giving a shared task a turn, so batch work is never starved
+#define INFER_STREAK_MAX    8
+
+#define MAX_CPUS        512
+#define MAX_PREFERRED   64
+
+// CPUs local to the GPUs, set by the loader. With none set every CPU
+// counts as preferred.
+const volatile __u32 nr_preferred = 0;
+const volatile __u32 preferred_cpus[MAX_PREFERRED];
+const volatile __u8 cpu_preferred[MAX_CPUS];
+
+// Why the kernel disabled the policy, for cortex-schedd to report
+__s32 exit_kind;
+char exit_reason[128];
+
+// Detection state, reused from the map pinned by cortex_sched.bpf.c.
+// Type must match its definition there; the size is that of the reused map.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 10240);
+    __type(key, __u32);
+    __type(value, struct inference_metrics);
+} process_metrics SEC(".maps");
+
+struct cpu_ctx {
+    __u32 running_inference;    // Current task is an inference task
+    __u32 streak;               // Consecutive inference dispatches
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct cpu_ctx);
+} cpu_ctx SEC(".maps");
+
+// Virtual time of the shared queue
+static __u64 vtime_now;
+
+static __always_inline bool vtime_lt(__u64 a, __u64 b) {
+    return (__s64)(a - b) < 0;
+}
+
+// =============================================================================
+// HELPERS
+// =============================================================================
+
+static __always_inline struct inference_metrics *inference_task(struct task_struct *p) {
+    __u32 tgid = p->tgid;
+    struct inference_metrics *metrics = bpf_map_lookup_elem(&process_metrics, &tgid);
+
+    return metrics && metrics->is_inference ? metrics : NULL;
+}
+
+static __always_inline __u64 inference_slice(struct inference_metrics *metrics) {
+    __u32 boost = metrics->priority_boost;
+
+    if (boost > 10)
+        boost = 10;
+    return INFER_SLICE_MAX_NS - boost * INFER_SLICE_STEP_NS;
+}
+
+static __always_inline bool is_preferred(s32 cpu) {
+    if (!nr_preferred)
+        return true;
+    return cpu >= 0 && cpu < MAX_CPUS && cpu_preferred[cpu];
+}
+
+static __always_inline struct cpu_ctx *lookup_cpu_ctx(s32 cpu) {
+    __u32 zero = 0;
+
+    if (cpu < 0)
+        return bpf_map_lookup_elem(&cpu_ctx, &zero);
+    return bpf_map_lookup_percpu_elem(&cpu_ctx, &zero, cpu);
+}
+
+// Claim an idle preferred CPU the task may run on, trying prev_cpu first
+static __always_inline s32 pick_preferred_idle(struct task_struct *p, s32 prev_cpu) {
+    __u32 i;
+
+    if (is_preferred(prev_cpu) && bpf_cpumask_test_cpu(prev_cpu, p->cpus_ptr) &&
+        scx_bpf_test_and_clear_cpu_idle(prev_cpu))
+        return prev_cpu;
+
+    bpf_for(i, 0, nr_preferred) {
+        if (i >= MAX_PREFERRED)
+            break;
+        s32 cpu = preferred_cpus[i];
+        if (bpf_cpumask_test_cpu(cpu, p->cpus_ptr) && scx_bpf_test_and_clear_cpu_idle(cpu))
+            return cpu;
+    }
+    return -1;
+}
+
+// Wake-up preemption: kick one preferred CPU that is running a
+// non-inference task, so it picks the inference queue right away
+static __always_inline void preempt_for(struct task_struct *p) {
+    __u32 i;
+
+    if (!nr_preferred) {
+        s32 cpu = scx_bpf_task_cpu(p);
+        struct cpu_ctx *cctx = lookup_cpu_ctx(cpu);
+        if (cctx && !cctx->running_inference)
+            scx_bpf_kick_cpu(cpu, SCX_KICK_PREEMPT);
+        return;
+    }
+
+    bpf_for(i, 0, nr_preferred) {
+        if (i >= MAX_PREFERRED)
+            break;
+        s32 cpu = preferred_cpus[i];
+        if (!bpf_cpumask_test_cpu(cpu, p->cpus_ptr))
+            continue;
+        struct cpu_ctx *cctx = lookup_cpu_ctx(cpu);
+        if (cctx && !cctx->running_inference) {
+            scx_bpf_kick_cpu(cpu, SCX_KICK_PREEMPT);
+            return;
+        }
+    }
+}
+
+// =============================================================================
+// SCHED_EXT OPERATIONS
+// =============================================================================
+
+s32 BPF_STRUCT_OPS(cortex_select_cpu, struct task_struct *p, s32 prev_cpu, u64 wake_flags) {
+    struct inference_metrics *metrics = inference_task(p);
+    bool is_idle = false;
+    s32 cpu;
+
+    if (metrics) {
+        cpu = pick_preferred_idle(p, prev_cpu);
+        if (cpu >= 0) {
+            scx_bpf_dsq_insert(p, SCX_DSQ_LOCAL, inference_slice(metrics), 0);
+            return cpu;
+        }
+    }
+
+    cpu = scx_bpf_select_cpu_dfl(p, prev_cpu, wake_flags, &is_idle);
+    if (is_idle && !metrics)
+        scx_bpf_dsq_insert(p, SCX_DSQ_LOCAL, SCX_SLICE_DFL, 0);
+    return cpu;
+}
+
+void BPF_STRUCT_OPS(cortex_enqueue, struct task_struct *p, u64 enq_flags) {
+    struct inference_metrics *metrics = inference_task(p);
+
+    if (metrics) {
+        scx_bpf_dsq_insert(p, INFER_DSQ, inference_slice(metrics), enq_flags);
+        if (enq_flags & SCX_ENQ_WAKEUP)
+            preempt_for(p);
+        return;
+    }
+
+    // Limit the credit a long sleeper can bank to one slice
+    __u64 vtime = p->scx.dsq_vtime;
+    if (vtime_lt(vtime, vtime_now - SCX_SLICE_DFL))
+        vtime = vtime_now - SCX_SLICE_DFL;
+    scx_bpf_dsq_insert_vtime(p, SHARED_DSQ, SCX_SLICE_DFL, vtime, enq_flags);
+}
+
+void BPF_STRUCT_OPS(cortex_dispatch, s32 cpu, struct task_struct *prev) {
+    struct cpu_ctx *cctx = lookup_cpu_ctx(-1);
+    if (!cctx)
+        return;
+
+    if (is_preferred(cpu)) {
+        if (cctx->streak < INFER_STREAK_MAX && scx_bpf_dsq_move_to_local(INFER_DSQ)) {
+            cctx->streak++;
+            return;
+        }
+        cctx->streak = 0;
+        if (!scx_bpf_dsq_move_to_local(SHARED_DSQ))
+            scx_bpf_dsq_move_to_local(INFER_DSQ);
+        return;
+    }
+
+    // Away from the GPU: take inference work only rather than go idle
+    if (!scx_bpf_dsq_move_to_local(SHARED_DSQ))
+        scx_bpf_dsq_move_to_local(INFER_DSQ);
+}
+
+void BPF_STRUCT_OPS(cortex_running, struct task_struct *p) {
+    struct cpu_ctx *cctx = lookup_cpu_ctx(-1);
+    bool inference = inference_task(p) != NULL;
+
+    if (cctx)
+        cctx->running_inference = inference;
+    if (!inference && vtime_lt(vtime_now, p->scx.dsq_vtime))
+        vtime_now = p->scx.dsq_vtime;
+}
+
+void BPF_STRUCT_OPS(cortex_stopping, struct task_struct *p, bool runnable) {
+    struct cpu_ctx *cctx = lookup_cpu_ctx(-1);
+
+    if (cctx)
+        cctx->running_inference = 0;
+
+    // Charge the used part of the slice, scaled by weight (nice level)
+    if (!inference_task(p))
+        p->scx.dsq_vtime += (SCX_SLICE_DFL - p->scx.slice) * 100 / p->scx.weight;
+}
+
+void BPF_STRUCT_OPS(cortex_enable, struct task_struct *p) {
+    p->scx.dsq_vtime = vtime_now;
+}
+
+s32 BPF_STRUCT_OPS_SLEEPABLE(cortex_init) {
+    s32 err = scx_bpf_create_dsq(INFER_DSQ, -1);
+    if (err)
+        return err;
+    return scx_bpf_create_dsq(SHARED_DSQ, -1);
+}
+
+void BPF_STRUCT_OPS(cortex_exit, struct scx_exit_info *ei) {
+    bpf_probe_read_kernel_str(exit_reason, sizeof(exit_reason), ei->reason);
+    exit_kind = ei->kind;
+}
+
+SCX_OPS_DEFINE(cortex_ops,
+               .select_cpu = (void *)cortex_select_cpu,
+               .enqueue = (void *)cortex_enqueue,
+               .dispatch = (void *)cortex_dispatch,
+               .running = (void *)cortex_running,
+               .stopping = (void *)cortex_stopping,
+               .enable = (void *)cortex_enable,
+               .init = (void *)cortex_init,
+               .exit = (void *)cortex_exit,
+               .name = "cortex");
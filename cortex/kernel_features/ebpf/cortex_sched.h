@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-2.0
+// Cortex Linux ML Workload Scheduler - types shared by the BPF programs
+// (cortex_sched.bpf.c, cortex_ext.bpf.c) and cortex-schedd.
+//
+// Include after vmlinux.h (BPF) or <linux/types.h> (userspace).
+
+#ifndef __CORTEX_SCHED_H
+#define __CORTEX_SCHED_H
+
+#define COMM_LEN 16
+
+// Process inference metrics (cold state, shared across CPUs)
+struct inference_metrics {
+    __u64 memory_alloc_bytes;   // Memory allocated
+    __u64 last_update_ns;       // Last GPU ioctl timestamp
+    __u32 priority_boost;       // Current priority boost level
+    __u32 is_inference;         // Flag: detected as inference workload
+    char comm[COMM_LEN];        // Process name, captured in-kernel
+};
+
+// Reasons a tgid is in the tracked set (bitmask)
+#define TRACK_USER  (1 << 0)    // Added by the loader
+#define TRACK_EXEC  (1 << 1)    // Known inference process name at exec
+#define TRACK_MMAP  (1 << 2)    // Large (model-sized) mmap
+#define TRACK_GPU   (1 << 3)    // Talks to the GPU driver
+#define TRACK_CLASSIFIED (1 << 4) // Not a reason: detected as inference (adaptive sampling)
+
+// Probe sampling, set at run time through the sample_config map
+#define SAMPLE_FULL     0       // Account every event
+#define SAMPLE_FIXED    1       // About 1 in rate events per CPU, of every process
+#define SAMPLE_ADAPTIVE 2       // Every event until a process is classified, then 1 in rate
+#define MAX_SAMPLE_RATE 65536
+
+struct sample_config {
+    __u32 mode;                 // SAMPLE_*
+    __u32 rate;                 // Mean events per sample (0 and 1: every event)
+};
+
+// Event streamed to the daemon through the events ring buffer
+#define EVENT_EXEC      1       // Known inference process exec'ed
+#define EVENT_DETECTED  2       // Behaviour pattern classified a process
+#define EVENT_BOOST     3       // priority_boost changed
+#define EVENT_EXIT      4       // Inference process exited
+#define EVENT_GPU_PRESSURE 5    // Cgroup allocated past its GPU memory headroom
+
+struct sched_event {
+    __u64 timestamp_ns;
+    __u32 type;                 // EVENT_*
+    __u32 tgid;
+    __u32 priority_boost;       // New boost (EVENT_BOOST), else current
+    __u32 pad;
+    char comm[COMM_LEN];
+};
+
+#endif /* __CORTEX_SCHED_H */
@@ -2,12 +2,17 @@
 """
 Cortex Linux eBPF ML Scheduler Loader
 
-Loads and manages the eBPF program that detects and prioritizes ML inference workloads.
+Manages the eBPF program that detects and prioritizes ML inference workloads.
+
+The programs are loaded by the native cortex-schedd daemon from the
+precompiled CO-RE object (cortex_sched.bpf.c, embedded in its libbpf
+skeleton). The daemon pins the maps under /sys/fs/bpf/cortex; status,
+monitor and json attach read-only to those pins instead of loading anything.
 
 Requirements:
-    - Linux 5.15+ with BTF support
-    - bcc (BPF Compiler Collection) or libbpf
-    - Root privileges
+    - Linux 5.19+ with BTF support
+    - cortex-schedd (built from cortex_schedd.c, see its header)
+    - Root privileges (CAP_BPF)
 
 Usage:
     sudo python3 cortex_sched_loader.py start
@@ -18,29 +23,31 @@ Usage:
 import argparse
 import ctypes
 import json
+import math
 import os
+import select
+import shutil
 import signal
+import subprocess
 import sys
 import time
-from dataclasses import asdict, dataclass
+from dataclasses import asdict, dataclass, field
 from pathlib import Path
 
-# Check for root
-if os.geteuid() != 0:
-    print("ERROR: This script requires root privileges")
-    print("Run with: sudo python3 cortex_sched_loader.py")
-    sys.exit(1)
-
-# Try to import BCC (BPF Compiler Collection)
 try:
-    from bcc import BPF, PerfSWConfig, PerfType
+    from .pinned_maps import PinnedMap
+    from .probe_bench import ProgramCost, SchedulerPrograms, stats_enabled
+except ImportError:  # Run as a script
+    from pinned_maps import PinnedMap
+    from probe_bench import ProgramCost, SchedulerPrograms, stats_enabled
 
-    HAS_BCC = True
-except ImportError:
-    HAS_BCC = False
-    print("WARNING: bcc not installed. Install with:")
-    print("  Ubuntu: sudo apt install python3-bcc bpfcc-tools")
-    print("  Fedora: sudo dnf install python3-bcc bcc-tools")
+# Where cortex-schedd pins its maps and records its PID
+PIN_DIR = Path("/sys/fs/bpf/cortex")
+PID_FILE = Path("/run/cortex-schedd.pid")
+LOG_FILE = Path("/var/log/cortex-schedd.log")  # Event log of a background daemon
+CGROUP_ROOT = Path("/sys/fs/cgroup")
+DAEMON_NAME = "cortex-schedd"
+DEFAULT_MAX_PROCS = 10240  # Size of the per-process LRU maps (--max-procs)
 
 
 # Known inference process names to detect
@@ -62,9 +69,329 @@ INFERENCE_PROCESSES = [
 ]
 
 
+# Tracked-set reason bits (see TRACK_* in cortex_sched.bpf.c)
+TRACK_USER = 1 << 0
+TRACK_EXEC = 1 << 1
+TRACK_MMAP = 1 << 2
+TRACK_GPU = 1 << 3
+TRACK_CLASSIFIED = 1 << 4  # Not a reason: detected as inference
+
+# Probe sampling modes, indexed by SAMPLE_* (see struct sample_config)
+SAMPLE_MODES = ("full", "fixed", "adaptive")
+DEFAULT_SAMPLE_RATE = 16
+MAX_SAMPLE_RATE = 65536
+
+# Per-CPU counter fields summed in userspace (see struct cpu_counters)
+HOT_COUNTERS = (
+    "gpu_wait_ns",
+    "cpu_compute_ns",
+    "context_switches",
+    "inference_count",
+    "kernel_launches",
+)
+_EMPTY_COUNTERS = dict.fromkeys(HOT_COUNTERS, 0)
+
+
+# Latency histograms (see struct latency_hist): slot i counts intervals of
+# [2^i, 2^(i+1)) microseconds, the last slot is open-ended
+HIST_SLOTS = 26
+HIST_KINDS = ("runq", "oncpu", "offcpu")
+
+
+# Model-load counters (see struct load_counters); io_read_max_ns is a
+# per-CPU maximum, the others are summed
+LOAD_COUNTERS = (
+    "minor_faults",
+    "major_faults",
+    "file_faults",
+    "hugetlb_faults",
+    "thp_faults",
+    "io_read_bytes",
+    "io_read_reqs",
+    "io_read_ns",
+    "io_read_max_ns",
+)
+LOAD_FILES = 4
+
+
+# Per-cgroup counters (see struct cgroup_counters), all summed
+CGROUP_COUNTERS = (
+    "cpu_compute_ns",
+    "gpu_wait_ns",
+    "context_switches",
+    "inference_count",
+    "kernel_launches",
+    "minor_faults",
+    "major_faults",
+)
+CGROUP_NAME_LEN = 64
+
+# Slots of struct numa_counters (nodes beyond this are not counted)
+MAX_NUMA_NODES = 8
+
+
+def _sum_percpu(values) -> dict[str, int]:
+    """Sum one per-CPU map value (one struct per possible CPU) into totals."""
+    totals = dict(_EMPTY_COUNTERS)
+    for cpu_value in values:
+        for field in HOT_COUNTERS:
+            totals[field] += getattr(cpu_value, field)
+    return totals
+
+
+def _sum_hist(values) -> dict[str, list[int]]:
+    """Sum one per-CPU latency_hist value into buckets per histogram kind."""
+    totals = {kind: [0] * HIST_SLOTS for kind in HIST_KINDS}
+    for cpu_value in values:
+        for row, kind in zip(cpu_value.slots, HIST_KINDS):
+            buckets = totals[kind]
+            for slot, count in enumerate(row):
+                buckets[slot] += count
+    return totals
+
+
+def _sum_load(values) -> dict[str, int]:
+    """Combine one per-CPU load_profile value into process totals."""
+    totals = dict.fromkeys(LOAD_COUNTERS, 0)
+    for cpu_value in values:
+        for name in LOAD_COUNTERS:
+            if name == "io_read_max_ns":
+                totals[name] = max(totals[name], cpu_value.io_read_max_ns)
+            else:
+                totals[name] += getattr(cpu_value, name)
+    return totals
+
+
+def _sum_cgroup(values) -> dict[str, int]:
+    """Sum one per-CPU cgroup_stats value into totals."""
+    totals = dict.fromkeys(CGROUP_COUNTERS, 0)
+    for cpu_value in values:
+        for name in CGROUP_COUNTERS:
+            totals[name] += getattr(cpu_value, name)
+    return totals
+
+
+def _sum_numa(values) -> dict[str, list[int]]:
+    """Sum one per-CPU numa_placement value into per-node totals."""
+    totals = {"oncpu_ns": [0] * MAX_NUMA_NODES, "alloc_bytes": [0] * MAX_NUMA_NODES}
+    for cpu_value in values:
+        for name, per_node in totals.items():
+            for node, value in enumerate(getattr(cpu_value, name)):
+                per_node[node] += value
+    return totals
+
+
+def cgroup_paths(ids, root: Path = CGROUP_ROOT) -> dict[int, str]:
+    """Map cgroup v2 ids to paths below root; ids of removed cgroups are absent.
+
+    A cgroup's id is the inode number of its directory. The walk stops as
+    soon as every id has been found.
+    """
+    wanted = set(ids)
+    paths: dict[int, str] = {}
+    for dirpath, _dirs, _files in os.walk(root):
+        try:
+            ino = os.stat(dirpath).st_ino
+        except OSError:
+            continue
+        if ino in wanted:
+            paths[ino] = "/" + os.path.relpath(dirpath, root).removeprefix(".")
+            if len(paths) == len(wanted):
+                break
+    return paths
+
+
+def unit_of_cgroup(path: str) -> tuple[str, str | None]:
+    """(unit, slice) owning a cgroup path such as
+    /cortex-inference.slice/cortex-model@llama3.service/payload.
+
+    The unit is the innermost .service or .scope component (a delegated
+    service may create sub-cgroups below it), else the last component.
+    """
+    parts = [p for p in path.split("/") if p]
+    unit_index = next(
+        (i for i in range(len(parts) - 1, -1, -1) if parts[i].endswith((".service", ".scope"))),
+        len(parts) - 1,
+    )
+    unit = parts[unit_index] if parts else "/"
+    slice_name = next((p for p in reversed(parts[:unit_index]) if p.endswith(".slice")), None)
+    return unit, slice_name
+
+
+def kernel_dev(dev: int) -> str:
+    """Format a kernel dev_t (MKDEV: 12-bit major, 20-bit minor) as /proc maps do."""
+    return f"{dev >> 20:02x}:{dev & 0xFFFFF:02x}"
+
+
+def find_mapped_file(maps_text: str, dev: int, ino: int) -> str | None:
+    """Path of the file with this device and inode in a /proc/<pid>/maps text."""
+    want_dev = kernel_dev(dev)
+    for line in maps_text.splitlines():
+        parts = line.split(maxsplit=5)
+        if len(parts) == 6 and parts[4] == str(ino) and parts[3] == want_dev:
+            return parts[5]
+    return None
+
+
+def hugepages_reserved() -> int:
+    """HugePages_Total from /proc/meminfo (0 if unavailable)."""
+    try:
+        for line in Path("/proc/meminfo").read_text().splitlines():
+            if line.startswith("HugePages_Total:"):
+                return int(line.split()[1])
+    except (OSError, ValueError, IndexError):
+        pass
+    return 0
+
+
+def hist_delta(current: list[int], previous: list[int] | None) -> list[int]:
+    """Buckets counted since an earlier reading of the same histogram."""
+    if not previous:
+        return list(current)
+    return [max(0, now - then) for now, then in zip(current, previous)]
+
+
+def hist_percentile(buckets: list[int], pct: float) -> float:
+    """Upper bound in microseconds of the bucket holding the pct-th percentile.
+
+    Log2 buckets only bound a percentile to within a factor of two, which is
+    enough to tell a 50us run-queue wait from a 5ms one. Returns 0 when the
+    histogram is empty.
+    """
+    total = sum(buckets)
+    if not total:
+        return 0.0
+    rank = total * pct / 100
+    seen = 0
+    for slot, count in enumerate(buckets):
+        seen += count
+        if seen >= rank:
+            return float(1 << (slot + 1))
+    return float(1 << len(buckets))
+
+
+# ctypes mirrors of the map value layouts in cortex_sched.bpf.c
+class InferenceMetricsValue(ctypes.Structure):
+    _fields_ = [
+        ("memory_alloc_bytes", ctypes.c_uint64),
+        ("last_update_ns", ctypes.c_uint64),
+        ("priority_boost", ctypes.c_uint32),
+        ("is_inference", ctypes.c_uint32),
+        ("comm", ctypes.c_char * 16),
+    ]
+
+
+class CpuCountersValue(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in HOT_COUNTERS]
+
+
+class ThreadRuntimeValue(ctypes.Structure):
+    _fields_ = [
+        ("tgid", ctypes.c_uint32),
+        ("last_cpu", ctypes.c_uint32),
+        ("cpu_compute_ns", ctypes.c_uint64),
+        ("context_switches", ctypes.c_uint64),
+        ("offcpu_since_ns", ctypes.c_uint64),
+        ("wakeup_ns", ctypes.c_uint64),
+        ("comm", ctypes.c_char * 16),
+        ("nr_switches", ctypes.c_uint64),
+        ("weight", ctypes.c_uint32),
+        ("pad", ctypes.c_uint32),
+    ]
+
+
+class LatencyHistValue(ctypes.Structure):
+    _fields_ = [("slots", (ctypes.c_uint64 * HIST_SLOTS) * len(HIST_KINDS))]
+
+
+class LoadCountersValue(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in LOAD_COUNTERS]
+
+
+class LoadFileValue(ctypes.Structure):
+    _fields_ = [
+        ("dev", ctypes.c_uint32),
+        ("pad", ctypes.c_uint32),
+        ("ino", ctypes.c_uint64),
+        ("mapped_bytes", ctypes.c_uint64),
+    ]
+
+
+class LoadPhaseValue(ctypes.Structure):
+    _fields_ = [
+        ("start_ns", ctypes.c_uint64),
+        ("last_ns", ctypes.c_uint64),
+        ("end_ns", ctypes.c_uint64),
+        ("nr_files", ctypes.c_uint32),
+        ("pad", ctypes.c_uint32),
+        ("files", LoadFileValue * LOAD_FILES),
+    ]
+
+
+class NumaCountersValue(ctypes.Structure):
+    _fields_ = [
+        ("oncpu_ns", ctypes.c_uint64 * MAX_NUMA_NODES),
+        ("alloc_bytes", ctypes.c_uint64 * MAX_NUMA_NODES),
+    ]
+
+
+class CgroupCountersValue(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in CGROUP_COUNTERS]
+
+
+class CgroupNameValue(ctypes.Structure):
+    _fields_ = [
+        ("first_seen_ns", ctypes.c_uint64),
+        ("name", ctypes.c_char * CGROUP_NAME_LEN),
+    ]
+
+
+class GlobalStatsValue(ctypes.Structure):
+    _fields_ = [
+        ("total_inference_procs", ctypes.c_uint64),
+        ("total_boosted_ns", ctypes.c_uint64),
+        ("total_memory_saved", ctypes.c_uint64),
+        ("detection_count", ctypes.c_uint64),
+        ("metrics_inserts", ctypes.c_uint64),
+        ("metrics_deletes", ctypes.c_uint64),
+        ("insert_failures", ctypes.c_uint64),
+    ]
+
+
+class SampleConfigValue(ctypes.Structure):
+    _fields_ = [("mode", ctypes.c_uint32), ("rate", ctypes.c_uint32)]
+
+
+# Pinned maps read by the loader: name -> (key type, value type)
+PINNED_MAPS = {
+    "process_metrics": (ctypes.c_uint32, InferenceMetricsValue),
+    "process_counters": (ctypes.c_uint32, CpuCountersValue),
+    "thread_runtime": (ctypes.c_uint32, ThreadRuntimeValue),
+    "latency_hist": (ctypes.c_uint32, LatencyHistValue),
+    "load_profile": (ctypes.c_uint32, LoadCountersValue),
+    "load_phase": (ctypes.c_uint32, LoadPhaseValue),
+    "numa_placement": (ctypes.c_uint32, NumaCountersValue),
+    "cgroup_stats": (ctypes.c_uint64, CgroupCountersValue),
+    "cgroup_names": (ctypes.c_uint64, CgroupNameValue),
+    "global_stats": (ctypes.c_uint32, GlobalStatsValue),
+    "sample_config": (ctypes.c_uint32, SampleConfigValue),
+}
+
+
+@dataclass
+class ThreadMetrics:
+    """Run time of a single thread of a tracked process."""
+
+    tid: int
+    comm: str
+    cpu_compute_ns: int
+    context_switches: int
+    last_cpu: int = -1
+
+
 @dataclass
 class ProcessMetrics:
-    """Metrics for a single process."""
+    """Metrics for a single process (rolled up over its threads)."""
 
     pid: int
     comm: str
@@ -73,8 +400,15 @@ class ProcessMetrics:
     memory_alloc_mb: float
     context_switches: int
     inference_count: int
+    kernel_launches: int
     is_inference: bool
     priority_boost: int
+    threads: list[ThreadMetrics] = field(default_factory=list)
+    # Log2 microsecond buckets per HIST_KINDS entry
+    latency: dict[str, list[int]] = field(default_factory=dict)
+
+    def latency_percentile(self, kind: str, pct: float) -> float:
+        return hist_percentile(self.latency.get(kind, []), pct)
 
     @property
     def gpu_ratio(self) -> float:
@@ -84,6 +418,63 @@ class ProcessMetrics:
         return (self.gpu_wait_ns / total) * 100
 
 
+@dataclass
+class ModelFile:
+    """A model-sized file mapping of a process (path resolved if still mapped)."""
+
+    dev: str
+    inode: int
+    mapped_mb: float
+    path: str | None = None
+
+
+@dataclass
+class LoadProfile:
+    """How a process loaded its model: faults, block reads and mapped files."""
+
+    pid: int
+    comm: str
+    loading: bool
+    duration_s: float
+    minor_faults: int
+    major_faults: int
+    file_faults: int
+    hugetlb_faults: int
+    thp_faults: int
+    io_read_mb: float
+    io_read_reqs: int
+    io_avg_latency_us: float
+    io_max_latency_us: float
+    files: list[ModelFile] = field(default_factory=list)
+
+    @property
+    def io_read_mb_per_s(self) -> float:
+        return self.io_read_mb / self.duration_s if self.duration_s > 0 else 0.0
+
+
+@dataclass
+class ServiceStats:
+    """Totals of the tracked processes of one unit (usually a model service),
+    summed over every cgroup it has had: a restarted unit gets a new cgroup."""
+
+    unit: str
+    slice: str | None
+    active: bool  # Its current cgroup still exists
+    cgroups: int
+    cpu_compute_ns: int
+    gpu_wait_ns: int
+    context_switches: int
+    inference_count: int
+    kernel_launches: int
+    minor_faults: int
+    major_faults: int
+
+    @property
+    def gpu_ratio(self) -> float:
+        total = self.gpu_wait_ns + self.cpu_compute_ns
+        return self.gpu_wait_ns / total * 100 if total else 0.0
+
+
 @dataclass
 class GlobalStats:
     """Global scheduler statistics."""
@@ -92,249 +483,630 @@ class GlobalStats:
     total_boosted_ns: int
     detection_count: int
     uptime_seconds: float
+    # Per-process LRU maps: processes evicted to make room, and inserts that
+    # failed outright. Either means --max-procs is too small.
+    tracker_entries: int = 0
+    tracker_capacity: int = 0
+    tracker_evictions: int = 0
+    insert_failures: int = 0
 
+    @property
+    def tracker_saturated(self) -> bool:
+        return bool(self.tracker_evictions or self.insert_failures)
 
-class CortexScheduler:
-    """
-    Manages the eBPF-based ML workload scheduler.
+
+@dataclass
+class Sampling:
+    """Probe sampling: mode (SAMPLE_MODES) and mean events per sample."""
+
+    mode: str = "full"
+    rate: int = 1
+
+    @property
+    def full(self) -> bool:
+        return self.mode == "full" or self.rate <= 1
+
+    def describe(self) -> str:
+        if self.full:
+            return "full, every event"
+        scope = "of classified processes" if self.mode == "adaptive" else "of every process"
+        return f"{self.mode}, 1 in {self.rate} switches and GPU ioctls {scope}"
+
+
+def next_sampling(current: Sampling, overhead_pct: float, max_pct: float) -> Sampling:
+    """Sampling that brings a measured probe overhead under max_pct.
+
+    Over the ceiling the rate grows in proportion to the excess (at least
+    doubling) and sampling becomes fixed, the only mode that also thins out
+    switches of untracked processes. Under a quarter of the ceiling the rate
+    halves, down to full tracing; halving at most doubles the sampled cost,
+    so it cannot push overhead back over. In between nothing changes.
     """
+    rate = 1 if current.full else current.rate
+    if overhead_pct > max_pct:
+        wanted = max(rate * 2, math.ceil(rate * overhead_pct / max_pct))
+        return Sampling("fixed", min(MAX_SAMPLE_RATE, wanted))
+    if overhead_pct < max_pct / 4 and rate > 1:
+        rate //= 2
+        return Sampling(current.mode, rate) if rate > 1 else Sampling()
+    return current
 
-    # Inline eBPF program (used if compiled .o file not found)
-    BPF_PROGRAM = """
-#include <uapi/linux/ptrace.h>
-#include <linux/sched.h>
-
-// Process metrics structure
-struct metrics_t {
-    u64 gpu_wait_ns;
-    u64 cpu_compute_ns;
-    u64 memory_alloc_bytes;
-    u64 context_switches;
-    u64 inference_count;
-    u64 last_update_ns;
-    u32 priority_boost;
-    u32 is_inference;
-};
-
-// Per-process metrics
-BPF_HASH(process_metrics, u32, struct metrics_t);
-
-// Known inference PIDs (populated from userspace)
-BPF_HASH(inference_pids, u32, u32);
-
-// Event for userspace notification
-struct event_t {
-    u32 pid;
-    char comm[16];
-    u32 event_type;  // 1=detected, 2=boosted, 3=released
-};
-BPF_PERF_OUTPUT(events);
-
-// Track context switches
-TRACEPOINT_PROBE(sched, sched_switch) {
-    u32 prev_pid = args->prev_pid;
-    u32 next_pid = args->next_pid;
-    u64 now = bpf_ktime_get_ns();
-
-    struct metrics_t *prev = process_metrics.lookup(&prev_pid);
-    if (prev) {
-        prev->context_switches++;
-        if (prev->last_update_ns > 0) {
-            prev->cpu_compute_ns += now - prev->last_update_ns;
-        }
-        prev->last_update_ns = now;
-    }
 
-    struct metrics_t *next = process_metrics.lookup(&next_pid);
-    if (next) {
-        next->last_update_ns = now;
-    }
+@dataclass
+class ProbeOverhead:
+    """What the scheduler's BPF programs cost over a window, from the
+    kernel's run-time statistics (run_time_ns / run_cnt)."""
 
-    return 0;
-}
+    window_s: float
+    cpus: int
+    sampling: Sampling
+    programs: dict[str, ProgramCost] = field(default_factory=dict)
 
-// Track large memory allocations
-TRACEPOINT_PROBE(syscalls, sys_enter_mmap) {
-    u32 pid = bpf_get_current_pid_tgid() >> 32;
-    u64 len = args->len;
-
-    if (len > 100 * 1024 * 1024) {  // >100MB
-        struct metrics_t zero = {};
-        struct metrics_t *m = process_metrics.lookup_or_try_init(&pid, &zero);
-        if (m) {
-            m->memory_alloc_bytes += len;
-            if (len > 1024 * 1024 * 1024) {  // >1GB likely model
-                m->is_inference = 1;
-            }
-        }
-    }
-    return 0;
-}
+    @property
+    def run_time_ns(self) -> int:
+        return sum(cost.run_time_ns for cost in self.programs.values())
 
-// Track NVIDIA ioctl (GPU interaction)
-TRACEPOINT_PROBE(syscalls, sys_enter_ioctl) {
-    u32 pid = bpf_get_current_pid_tgid() >> 32;
-    unsigned long cmd = args->cmd;
-
-    // NVIDIA uses 0x46 magic
-    if ((cmd >> 8) == 0x46) {
-        struct metrics_t zero = {};
-        struct metrics_t *m = process_metrics.lookup_or_try_init(&pid, &zero);
-        if (m) {
-            u64 now = bpf_ktime_get_ns();
-            if (m->last_update_ns > 0) {
-                m->gpu_wait_ns += now - m->last_update_ns;
-            }
-            m->last_update_ns = now;
-            m->inference_count++;
-        }
-    }
-    return 0;
-}
+    @property
+    def cpu_pct(self) -> float:
+        """Share of all CPUs' time spent in the programs."""
+        capacity_ns = self.window_s * 1e9 * self.cpus
+        return self.run_time_ns / capacity_ns * 100 if capacity_ns else 0.0
 
-// Track process exec (detect inference by name)
-TRACEPOINT_PROBE(sched, sched_process_exec) {
-    u32 pid = bpf_get_current_pid_tgid() >> 32;
-
-    // Check if PID is in known inference list
-    u32 *known = inference_pids.lookup(&pid);
-    if (known) {
-        struct metrics_t zero = {};
-        struct metrics_t *m = process_metrics.lookup_or_try_init(&pid, &zero);
-        if (m) {
-            m->is_inference = 1;
-
-            // Send event to userspace
-            struct event_t evt = {};
-            evt.pid = pid;
-            evt.event_type = 1;
-            bpf_get_current_comm(&evt.comm, sizeof(evt.comm));
-            events.perf_submit(args, &evt, sizeof(evt));
-        }
-    }
-    return 0;
-}
 
-// Cleanup on exit
-TRACEPOINT_PROBE(sched, sched_process_exit) {
-    u32 pid = args->pid;
-    process_metrics.delete(&pid);
-    inference_pids.delete(&pid);
-    return 0;
-}
-"""
+class CortexScheduler:
+    """
+    Manages the eBPF-based ML workload scheduler.
+    """
 
-    def __init__(self):
-        self.bpf: BPF | None = None
+    def __init__(
+        self,
+        pin_dir: Path = PIN_DIR,
+        pid_file: Path = PID_FILE,
+        sweep_ms: int = 10,
+        sched_ext: bool = False,
+        gpu_uprobes: bool = False,
+        ioctl_probe: bool = True,
+        max_procs: int = DEFAULT_MAX_PROCS,
+        sampling: Sampling | None = None,
+    ):
+        self.pin_dir = Path(pin_dir)
+        self.pid_file = Path(pid_file)
+        self.sweep_ms = sweep_ms
+        self.sched_ext = sched_ext
+        self.gpu_uprobes = gpu_uprobes
+        self.ioctl_probe = ioctl_probe
+        self.max_procs = max_procs
+        self.sampling = sampling or Sampling()
+        self.maps: dict[str, PinnedMap] = {}
         self.start_time: float = 0
         self.running = False
+        self._metrics_entries = 0  # process_metrics entries in the last snapshot
+        # cgroup id -> path of live cgroups, and ids known to be removed
+        self._cgroup_paths: dict[int, str] = {}
+        self._cgroups_gone: set[int] = set()
 
-    def start(self) -> bool:
-        """Load and start the eBPF program."""
-        if not HAS_BCC:
-            print("ERROR: BCC not installed")
-            return False
-
+    def daemon_pid(self) -> int | None:
+        """PID of the running cortex-schedd, if any."""
         try:
-            print("Loading eBPF program...")
-            self.bpf = BPF(text=self.BPF_PROGRAM)
-            self.start_time = time.time()
-            self.running = True
-
-            # Populate known inference PIDs
-            self._populate_inference_pids()
-
-            print("eBPF ML scheduler loaded successfully")
+            pid = int(self.pid_file.read_text().strip())
+            os.kill(pid, 0)
+        except (FileNotFoundError, ValueError, ProcessLookupError):
+            return None
+        except PermissionError:
+            pass  # Alive, owned by someone else
+        return pid
+
+    @staticmethod
+    def find_daemon() -> str | None:
+        """Locate the cortex-schedd binary ($CORTEX_SCHEDD, next to us, or PATH)."""
+        candidates = [os.environ.get("CORTEX_SCHEDD"), Path(__file__).with_name(DAEMON_NAME)]
+        for candidate in candidates:
+            if candidate and os.access(candidate, os.X_OK):
+                return str(candidate)
+        return shutil.which(DAEMON_NAME)
+
+    def daemon_command(self) -> list[str] | None:
+        daemon = self.find_daemon()
+        if not daemon:
+            return None
+        cmd = [daemon, "--pin-dir", str(self.pin_dir), "--pid-file", str(self.pid_file)]
+        cmd += ["--sweep-ms", str(self.sweep_ms), "--max-procs", str(self.max_procs)]
+        if self.sched_ext:
+            cmd.append("--sched-ext")
+        if self.gpu_uprobes:
+            cmd.append("--gpu-uprobes")
+            if not self.ioctl_probe:
+                cmd.append("--no-ioctl")
+        if not self.sampling.full:
+            cmd += ["--sample", f"{self.sampling.mode}:{self.sampling.rate}"]
+        for comm in INFERENCE_PROCESSES:
+            cmd += ["--comm", comm]
+        return cmd
+
+    def start(self, timeout: float = 5.0) -> bool:
+        """Start cortex-schedd in the background and wait until it has loaded."""
+        if pid := self.daemon_pid():
+            print(f"Scheduler already running (PID {pid})")
             return True
 
-        except Exception as e:
-            print(f"ERROR loading eBPF: {e}")
+        cmd = self.daemon_command()
+        if not cmd:
+            print(f"ERROR: {DAEMON_NAME} not found (set CORTEX_SCHEDD or add it to PATH)")
             return False
 
-    def _populate_inference_pids(self):
-        """Find and mark known inference processes."""
-        if not self.bpf:
-            return
+        # Pinned maps are no sign of success: the daemon reuses those of a
+        # crashed instance, and can still fail to load. It writes a newline
+        # to this pipe once everything is attached.
+        ready_r, ready_w = os.pipe()
+        cmd += ["--ready-fd", str(ready_w)]
+        print("Loading eBPF program...")
+        try:
+            with open(LOG_FILE, "a") as log:
+                proc = subprocess.Popen(
+                    cmd,
+                    stdout=log,
+                    stderr=subprocess.STDOUT,
+                    start_new_session=True,
+                    pass_fds=(ready_w,),
+                )
+        finally:
+            os.close(ready_w)
+
+        with os.fdopen(ready_r, "rb", buffering=0) as ready:
+            if select.select([ready], [], [], timeout)[0]:
+                if ready.read(1) == b"\n":
+                    print(f"eBPF ML scheduler loaded successfully (PID {proc.pid})")
+                    return True
+                # End of file: the daemon exited without loading
+                try:
+                    proc.wait(timeout=1.0)
+                except subprocess.TimeoutExpired:
+                    pass
+                status = proc.returncode if proc.returncode is not None else "unknown"
+                print(f"ERROR: {DAEMON_NAME} exited with status {status} (see {LOG_FILE})")
+                return False
+
+        print(f"ERROR: {DAEMON_NAME} did not load within {timeout:.0f}s (see {LOG_FILE})")
+        return False
+
+    def attach(self) -> bool:
+        """Open the pinned maps read-only. Loads nothing into the kernel."""
+        if not (self.pin_dir / "process_metrics").exists():
+            print(f"Scheduler not running (no maps pinned at {self.pin_dir})")
+            return False
 
-        inference_pids = self.bpf["inference_pids"]
+        try:
+            for name, (key_type, value_type) in PINNED_MAPS.items():
+                self.maps[name] = PinnedMap(self.pin_dir / name, key_type, value_type)
+        except (OSError, ValueError) as e:
+            print(f"ERROR attaching to pinned maps: {e}")
+            self.detach()
+            return False
 
-        # Scan /proc for matching processes
-        for pid_dir in Path("/proc").iterdir():
-            if not pid_dir.name.isdigit():
-                continue
+        # The daemon writes its PID file right before loading
+        try:
+            self.start_time = self.pid_file.stat().st_mtime
+        except FileNotFoundError:
+            self.start_time = time.time()
+        self.running = True
+        return True
+
+    def detach(self):
+        """Close the pinned maps (the scheduler keeps running)."""
+        for m in self.maps.values():
+            m.close()
+        self.maps.clear()
+        self.running = False
 
-            try:
-                comm_file = pid_dir / "comm"
-                if comm_file.exists():
-                    comm = comm_file.read_text().strip()
-                    if any(proc in comm for proc in INFERENCE_PROCESSES):
-                        pid = int(pid_dir.name)
-                        inference_pids[ctypes.c_uint32(pid)] = ctypes.c_uint32(1)
-                        print(f"  Marked inference process: {comm} (PID {pid})")
-            except (PermissionError, FileNotFoundError):
-                continue
+    def stop(self, timeout: float = 5.0) -> bool:
+        """Stop cortex-schedd; it detaches the programs and removes the pins."""
+        self.detach()
+        pid = self.daemon_pid()
+        if not pid:
+            print("Scheduler not running")
+            return False
 
-    def stop(self):
-        """Unload the eBPF program."""
-        if self.bpf:
-            self.bpf.cleanup()
-            self.bpf = None
-        self.running = False
+        os.kill(pid, signal.SIGTERM)
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline and self.daemon_pid():
+            time.sleep(0.05)
+        if self.daemon_pid():
+            print(f"ERROR: {DAEMON_NAME} (PID {pid}) did not stop within {timeout:.0f}s")
+            return False
         print("eBPF ML scheduler stopped")
+        return True
 
     def get_process_metrics(self) -> list[ProcessMetrics]:
-        """Get metrics for all tracked processes."""
-        if not self.bpf:
+        """Get metrics for all tracked processes.
+
+        Each map is read with one batched snapshot and process names come
+        from the maps, so the cost does not grow with one syscall or /proc
+        read per process.
+        """
+        if not self.maps:
             return []
 
-        metrics_map = self.bpf["process_metrics"]
+        metrics_map = self.maps["process_metrics"]
+        counters_map = self.maps["process_counters"]
         results = []
 
-        for pid, metrics in metrics_map.items():
-            pid_val = pid.value
+        # Cold state is keyed like the counters; a pid may appear in either map
+        cold = {pid.value: metrics for pid, metrics in metrics_map.items()}
+        self._metrics_entries = len(cold)
+        hot = {pid.value: _sum_percpu(values) for pid, values in counters_map.items()}
+        threads = self.get_thread_metrics()
+        latency = {
+            pid.value: _sum_hist(values) for pid, values in self.maps["latency_hist"].items()
+        }
+
+        for pid_val in cold.keys() | hot.keys():
+            metrics = cold.get(pid_val)
+            counters = hot.get(pid_val, _EMPTY_COUNTERS)
+            proc_threads = threads.get(pid_val, [])
 
-            # Get process name
-            try:
-                comm = Path(f"/proc/{pid_val}/comm").read_text().strip()
-            except (FileNotFoundError, PermissionError):
-                comm = "<unknown>"
+            # Captured in-kernel; processes admitted only by userspace have no
+            # process_metrics entry yet, so fall back to the leader thread
+            comm = metrics.comm.decode(errors="replace") if metrics else ""
+            if not comm:
+                leader = next((t for t in proc_threads if t.tid == pid_val), None)
+                comm = leader.comm if leader else "<unknown>"
 
             results.append(
                 ProcessMetrics(
                     pid=pid_val,
                     comm=comm,
-                    gpu_wait_ns=metrics.gpu_wait_ns,
-                    cpu_compute_ns=metrics.cpu_compute_ns,
-                    memory_alloc_mb=metrics.memory_alloc_bytes / (1024 * 1024),
-                    context_switches=metrics.context_switches,
-                    inference_count=metrics.inference_count,
-                    is_inference=bool(metrics.is_inference),
-                    priority_boost=metrics.priority_boost,
+                    gpu_wait_ns=counters["gpu_wait_ns"],
+                    cpu_compute_ns=counters["cpu_compute_ns"],
+                    memory_alloc_mb=(metrics.memory_alloc_bytes if metrics else 0) / (1024 * 1024),
+                    context_switches=counters["context_switches"],
+                    inference_count=counters["inference_count"],
+                    kernel_launches=counters["kernel_launches"],
+                    is_inference=bool(metrics and metrics.is_inference),
+                    priority_boost=metrics.priority_boost if metrics else 0,
+                    threads=proc_threads,
+                    latency=latency.get(pid_val, {}),
                 )
             )
 
         return results
 
-    def get_global_stats(self) -> GlobalStats:
-        """Get global scheduler statistics."""
-        metrics = self.get_process_metrics()
+    def get_thread_metrics(self) -> dict[int, list[ThreadMetrics]]:
+        """Get per-thread run time grouped by tgid, busiest thread first."""
+        if not self.maps:
+            return {}
+
+        by_tgid: dict[int, list[ThreadMetrics]] = {}
+        for tid, thread in self.maps["thread_runtime"].items():
+            by_tgid.setdefault(thread.tgid, []).append(
+                ThreadMetrics(
+                    tid=tid.value,
+                    comm=thread.comm.decode(errors="replace"),
+                    cpu_compute_ns=thread.cpu_compute_ns,
+                    context_switches=thread.context_switches,
+                    # Set on the first switch-out; slotted-at-wakeup threads have not run yet
+                    last_cpu=thread.last_cpu if thread.context_switches else -1,
+                )
+            )
+
+        for threads in by_tgid.values():
+            threads.sort(key=lambda t: t.cpu_compute_ns, reverse=True)
+        return by_tgid
+
+    def get_numa_placement(self) -> dict[int, dict[str, list[int]]]:
+        """Per-node on-CPU time and first-touch allocations of tracked processes."""
+        if not self.maps:
+            return {}
+        return {
+            pid.value: _sum_numa(values) for pid, values in self.maps["numa_placement"].items()
+        }
+
+    def get_global_stats(self, metrics: list[ProcessMetrics] | None = None) -> GlobalStats:
+        """Get global scheduler statistics (from metrics, if already read)."""
+        if metrics is None:
+            metrics = self.get_process_metrics()
         inference_procs = sum(1 for m in metrics if m.is_inference)
+        kernel_stats = self.maps["global_stats"].lookup(0) if self.maps else None
+
+        # LRU evictions are silent in-kernel: whatever was inserted and is
+        # neither deleted on exit nor still present was evicted
+        evictions = failures = 0
+        if kernel_stats:
+            gone = kernel_stats.metrics_inserts - kernel_stats.metrics_deletes
+            evictions = max(0, gone - self._metrics_entries)
+            failures = kernel_stats.insert_failures
 
         return GlobalStats(
             total_inference_procs=inference_procs,
             total_boosted_ns=sum(m.gpu_wait_ns for m in metrics if m.is_inference),
-            detection_count=inference_procs,
+            detection_count=kernel_stats.detection_count if kernel_stats else inference_procs,
             uptime_seconds=time.time() - self.start_time if self.running else 0,
+            tracker_entries=self._metrics_entries,
+            tracker_capacity=self.maps["process_metrics"].max_entries if self.maps else 0,
+            tracker_evictions=evictions,
+            insert_failures=failures,
         )
 
-    def print_status(self):
-        """Print current scheduler status."""
-        if not self.running:
-            print("Scheduler not running")
+    def get_load_profiles(self) -> list[LoadProfile]:
+        """Load profile of every process that went through a load phase."""
+        if not self.maps:
+            return []
+
+        counters = {
+            pid.value: _sum_load(values) for pid, values in self.maps["load_profile"].items()
+        }
+        comms = {
+            pid.value: m.comm.decode(errors="replace")
+            for pid, m in self.maps["process_metrics"].items()
+        }
+        # Same clock as bpf_ktime_get_ns()
+        now_ns = time.clock_gettime_ns(time.CLOCK_MONOTONIC)
+        profiles = []
+
+        for pid, phase in self.maps["load_phase"].items():
+            pid = pid.value
+            c = counters.get(pid, dict.fromkeys(LOAD_COUNTERS, 0))
+            end_ns = phase.end_ns or now_ns
+            try:
+                maps_text = Path(f"/proc/{pid}/maps").read_text()
+            except OSError:
+                maps_text = ""
+
+            files = []
+            for f in phase.files[: min(phase.nr_files, LOAD_FILES)]:
+                files.append(
+                    ModelFile(
+                        dev=kernel_dev(f.dev),
+                        inode=f.ino,
+                        mapped_mb=f.mapped_bytes / (1024 * 1024),
+                        path=find_mapped_file(maps_text, f.dev, f.ino),
+                    )
+                )
+            files.sort(key=lambda f: f.mapped_mb, reverse=True)
+
+            reqs = c["io_read_reqs"]
+            profiles.append(
+                LoadProfile(
+                    pid=pid,
+                    comm=comms.get(pid) or "<unknown>",
+                    loading=not phase.end_ns,
+                    duration_s=max(0, end_ns - phase.start_ns) / 1e9,
+                    minor_faults=c["minor_faults"],
+                    major_faults=c["major_faults"],
+                    file_faults=c["file_faults"],
+                    hugetlb_faults=c["hugetlb_faults"],
+                    thp_faults=c["thp_faults"],
+                    io_read_mb=c["io_read_bytes"] / (1024 * 1024),
+                    io_read_reqs=reqs,
+                    io_avg_latency_us=c["io_read_ns"] / reqs / 1000 if reqs else 0.0,
+                    io_max_latency_us=c["io_read_max_ns"] / 1000,
+                    files=files,
+                )
+            )
+
+        return sorted(profiles, key=lambda p: p.pid)
+
+    def get_service_stats(self, cgroup_root: Path = CGROUP_ROOT) -> list[ServiceStats]:
+        """Per-unit totals from the cgroup-keyed counters, busiest first.
+
+        Live cgroups are named from their path (so sub-cgroups of a delegated
+        service roll up into the service); removed ones by the name the
+        kernel captured when it first saw them.
+        """
+        if not self.maps:
+            return []
+
+        totals = {
+            cgid.value: _sum_cgroup(values) for cgid, values in self.maps["cgroup_stats"].items()
+        }
+        names = {
+            cgid.value: n.name.decode(errors="replace")
+            for cgid, n in self.maps["cgroup_names"].items()
+        }
+        paths = self._resolve_cgroups(totals, cgroup_root)
+        services: dict[str, ServiceStats] = {}
+
+        for cgid, counters in totals.items():
+            if cgid in paths:
+                unit, slice_name = unit_of_cgroup(paths[cgid])
+            else:
+                unit, slice_name = names.get(cgid) or f"cgroup-{cgid}", None
+
+            svc = services.get(unit)
+            if svc is None:
+                svc = services[unit] = ServiceStats(
+                    unit=unit,
+                    slice=slice_name,
+                    active=False,
+                    cgroups=0,
+                    **dict.fromkeys(CGROUP_COUNTERS, 0),
+                )
+            svc.cgroups += 1
+            svc.active |= cgid in paths
+            svc.slice = svc.slice or slice_name
+            for name in CGROUP_COUNTERS:
+                setattr(svc, name, getattr(svc, name) + counters[name])
+
+        return sorted(services.values(), key=lambda s: s.cpu_compute_ns, reverse=True)
+
+    def _resolve_cgroups(self, ids, root: Path) -> dict[int, str]:
+        """cgroup_paths() with memory, for callers that poll (monitor, export).
+
+        Known cgroups are re-checked with one stat each; the hierarchy is
+        only walked when a new id shows up. Ids are never reused, so a
+        removed cgroup stays removed.
+        """
+        paths = {}
+        for cgid in ids:
+            path = self._cgroup_paths.get(cgid)
+            if path is None:
+                continue
+            try:
+                alive = os.stat(root / path.lstrip("/")).st_ino == cgid
+            except OSError:
+                alive = False
+            if alive:
+                paths[cgid] = path
+            else:
+                del self._cgroup_paths[cgid]
+                self._cgroups_gone.add(cgid)
+
+        new = set(ids) - paths.keys() - self._cgroups_gone
+        if new:
+            found = cgroup_paths(new, root)
+            self._cgroup_paths.update(found)
+            self._cgroups_gone |= new - found.keys()
+            paths.update(found)
+        return paths
+
+    def print_service_stats(self):
+        """Print per-service cost and contention totals."""
+        services = self.get_service_stats()
+        if not services:
+            print("No tracked processes seen in any cgroup yet")
+            return
+
+        print(
+            f"{'UNIT':<36} {'CPU(s)':<9} {'GPU%':<6} {'CTX':<10} {'SYNCS':<10} "
+            f"{'MAJFLT':<8} {'RUNS':<5}"
+        )
+        print("-" * 90)
+        for svc in services:
+            unit = svc.unit if svc.active else f"{svc.unit} (gone)"
+            print(
+                f"{unit[:35]:<36} {svc.cpu_compute_ns / 1e9:<9.1f} {svc.gpu_ratio:<6.1f} "
+                f"{svc.context_switches:<10} {svc.inference_count:<10} "
+                f"{svc.major_faults:<8} {svc.cgroups:<5}"
+            )
+
+    def print_load_profiles(self):
+        """Print the model-load profile of each process."""
+        profiles = self.get_load_profiles()
+        if not profiles:
+            print("No model loads observed")
             return
 
-        stats = self.get_global_stats()
+        print(
+            f"{'PID':<8} {'COMM':<16} {'STATE':<8} {'TIME(s)':<8} {'READ(MB)':<9} "
+            f"{'MB/s':<7} {'IO(us)':<7} {'MAJFLT':<8} {'MINFLT':<8} {'HUGETLB':<8}"
+        )
+        print("-" * 100)
+        for p in profiles:
+            state = "loading" if p.loading else "loaded"
+            print(
+                f"{p.pid:<8} {p.comm[:15]:<16} {state:<8} {p.duration_s:<8.1f} "
+                f"{p.io_read_mb:<9.0f} {p.io_read_mb_per_s:<7.0f} {p.io_avg_latency_us:<7.0f} "
+                f"{p.major_faults:<8} {p.minor_faults:<8} {p.hugetlb_faults:<8}"
+            )
+            for f in p.files:
+                print(f"{'':<8} {f.mapped_mb:>9.0f} MB  {f.path or f'dev {f.dev} inode {f.inode}'}")
+
+        if hugepages_reserved() and not any(p.hugetlb_faults for p in profiles):
+            print()
+            print("Note: hugepages are reserved (vm.nr_hugepages) but no load faulted any in;")
+            print("      the models are not mapped from hugetlbfs.")
+
+    def get_sampling(self) -> Sampling:
+        """Probe sampling the running probes use."""
+        config = self.maps["sample_config"].lookup(0) if "sample_config" in self.maps else None
+        if not config or config.mode >= len(SAMPLE_MODES) or config.rate <= 1:
+            return Sampling()
+        return Sampling(SAMPLE_MODES[config.mode], config.rate)
+
+    def set_sampling(self, sampling: Sampling):
+        """Change probe sampling; the probes pick it up at their next event."""
+        if sampling.mode not in SAMPLE_MODES or not 1 <= sampling.rate <= MAX_SAMPLE_RATE:
+            raise ValueError(f"invalid sampling {sampling.mode}:{sampling.rate}")
+        value = SampleConfigValue(
+            mode=SAMPLE_MODES.index(sampling.mode), rate=1 if sampling.full else sampling.rate
+        )
+        path = self.pin_dir / "sample_config"
+        with PinnedMap(path, ctypes.c_uint32, SampleConfigValue, writable=True) as config:
+            config.update(0, value)
+
+    def measure_overhead(self, window: float = 5.0) -> ProbeOverhead:
+        """Measure what the programs cost over window seconds.
+
+        BPF run-time statistics are only turned on for the window: they
+        add two clock reads to every program run themselves.
+        """
+        programs = SchedulerPrograms(self.pin_dir)
+        try:
+            with stats_enabled():
+                before = programs.costs()
+                start = time.monotonic()
+                time.sleep(window)
+                after = programs.costs()
+                elapsed = time.monotonic() - start
+        finally:
+            programs.close()
+
+        costs = {
+            name: ProgramCost(
+                run_cnt=cost.run_cnt - before[name].run_cnt,
+                run_time_ns=cost.run_time_ns - before[name].run_time_ns,
+            )
+            for name, cost in after.items()
+        }
+        return ProbeOverhead(
+            window_s=round(elapsed, 3),
+            cpus=os.cpu_count() or 1,
+            sampling=self.get_sampling(),
+            programs=costs,
+        )
+
+    @staticmethod
+    def print_overhead(overhead: ProbeOverhead):
+        """Print per-program event rates and costs, busiest first."""
+        print(f"Probe overhead over {overhead.window_s:.1f}s ({overhead.sampling.describe()})")
+        print(f"{'PROGRAM':<18} {'EVENTS/s':<12} {'NS/EVENT':<10} {'CPU%':<8}")
+        print("-" * 50)
+        capacity_ns = overhead.window_s * 1e9 * overhead.cpus
+        ranked = sorted(overhead.programs.items(), key=lambda p: p[1].run_time_ns, reverse=True)
+        for name, cost in ranked:
+            print(
+                f"{name:<18} {cost.run_cnt / overhead.window_s:<12.0f} "
+                f"{cost.ns_per_event:<10.0f} {cost.run_time_ns / capacity_ns * 100:<8.4f}"
+            )
+        print(f"Total: {overhead.cpu_pct:.4f}% of {overhead.cpus} CPUs")
+
+    def govern_overhead(self, max_pct: float, window: float = 5.0, interval: float = 60.0):
+        """Keep the measured probe overhead under max_pct of all CPUs.
+
+        Every interval seconds, measures for window seconds and adjusts the
+        sampling with next_sampling().
+        """
+        print(f"Keeping probe overhead under {max_pct}% of all CPUs (Ctrl+C to stop)...")
+        try:
+            while True:
+                overhead = self.measure_overhead(window)
+                sampling = next_sampling(overhead.sampling, overhead.cpu_pct, max_pct)
+                if sampling != overhead.sampling:
+                    self.set_sampling(sampling)
+                    print(f"{overhead.cpu_pct:.4f}% of CPUs: sampling {sampling.describe()}")
+                elif overhead.cpu_pct > max_pct:
+                    print(f"WARNING: {overhead.cpu_pct:.4f}% of CPUs at the highest sampling rate")
+                sys.stdout.flush()
+                time.sleep(interval)
+        except KeyboardInterrupt:
+            print("\nStopping...")
+
+    def snapshot(self) -> tuple[list[ProcessMetrics], GlobalStats]:
+        """Read process metrics and global stats with a single pass over the maps."""
         metrics = self.get_process_metrics()
+        return metrics, self.get_global_stats(metrics)
+
+    def print_status(self, previous: dict | None = None) -> dict:
+        """Print current scheduler status.
+
+        Latency percentiles cover everything since the process was first
+        tracked, or only what happened since `previous` (the value returned
+        by an earlier call) when given. Returns the histograms read.
+        """
+        if not self.running:
+            print("Scheduler not running")
+            return {}
+
+        metrics, stats = self.snapshot()
 
         print("=" * 70)
         print("CORTEX ML SCHEDULER STATUS")
@@ -342,6 +1114,13 @@ TRACEPOINT_PROBE(sched, sched_process_exit) {
         print(f"Uptime: {stats.uptime_seconds:.1f} seconds")
         print(f"Inference processes detected: {stats.total_inference_procs}")
         print(f"Total GPU time tracked: {stats.total_boosted_ns / 1e9:.2f} seconds")
+        print(
+            f"Process tracker: {stats.tracker_entries}/{stats.tracker_capacity} entries, "
+            f"{stats.tracker_evictions} evicted, {stats.insert_failures} failed inserts"
+        )
+        if stats.tracker_saturated:
+            print("WARNING: process tracker is saturated; restart with a larger --max-procs")
+        print(f"Probe sampling: {self.get_sampling().describe()}")
         print()
 
         # Sort by inference flag and GPU time
@@ -359,14 +1138,50 @@ TRACEPOINT_PROBE(sched, sched_process_exit) {
                 f"{m.memory_alloc_mb:<10.1f} {m.context_switches:<8} {m.priority_boost:<6}"
             )
 
+        # CPU-side bottlenecks: busiest worker threads of inference processes
+        hot_threads = [
+            (m, t) for m in metrics if m.is_inference for t in m.threads[:3] if t.cpu_compute_ns
+        ]
+        if hot_threads:
+            print()
+            print(f"{'PID':<8} {'TID':<8} {'THREAD':<20} {'CPU(s)':<10} {'%PROC':<6}")
+            print("-" * 70)
+            for m, t in hot_threads[:20]:
+                share = 100 * t.cpu_compute_ns / m.cpu_compute_ns if m.cpu_compute_ns else 0.0
+                print(
+                    f"{m.pid:<8} {t.tid:<8} {t.comm[:19]:<20} "
+                    f"{t.cpu_compute_ns / 1e9:<10.2f} {share:<6.1f}"
+                )
+
+        # Scheduler interference: run-queue waits and slice/off-CPU lengths
+        latency = {m.pid: m.latency for m in metrics if m.is_inference and m.latency}
+        if latency:
+            window = "since last refresh" if previous else "since tracked"
+            print()
+            print(f"Latency p50/p99 in microseconds ({window})")
+            print(f"{'PID':<8} {'COMM':<20} {'RUNQ':<16} {'ONCPU':<16} {'OFFCPU':<16}")
+            print("-" * 70)
+            comms = {m.pid: m.comm for m in metrics}
+            for pid, hists in list(latency.items())[:20]:
+                before = (previous or {}).get(pid, {})
+                cells = []
+                for kind in HIST_KINDS:
+                    buckets = hist_delta(hists[kind], before.get(kind))
+                    p50, p99 = hist_percentile(buckets, 50), hist_percentile(buckets, 99)
+                    cells.append(f"{p50:.0f}/{p99:.0f}")
+                print(f"{pid:<8} {comms[pid][:19]:<20} " + " ".join(f"{c:<16}" for c in cells))
+
+        return latency
+
     def run_monitor(self, interval: float = 2.0):
         """Run continuous monitoring."""
         print("Starting monitor (Ctrl+C to stop)...")
 
+        previous: dict = {}
         try:
             while self.running:
-                os.system("clear")
-                self.print_status()
+                print("\033[H\033[2J", end="")  # Clear the terminal
+                previous = self.print_status(previous)
                 time.sleep(interval)
         except KeyboardInterrupt:
             print("\nStopping monitor...")
@@ -381,60 +1196,255 @@ Examples:
     sudo python3 cortex_sched_loader.py start
     sudo python3 cortex_sched_loader.py status
     sudo python3 cortex_sched_loader.py monitor
+    sudo python3 cortex_sched_loader.py profile
+    sudo python3 cortex_sched_loader.py services
+    sudo python3 cortex_sched_loader.py placement --apply
+    sudo python3 cortex_sched_loader.py export --listen 127.0.0.1:9521
+    sudo python3 cortex_sched_loader.py sampling --sample-mode adaptive --sample-rate 16
+    sudo python3 cortex_sched_loader.py overhead --max-overhead 0.5
+    sudo python3 cortex_sched_loader.py push --aggregator fleet-host:9522 --node gpu-07
+    python3 cortex_sched_loader.py aggregate --listen :9522
     sudo python3 cortex_sched_loader.py stop
         """,
     )
 
     parser.add_argument(
-        "command", choices=["start", "stop", "status", "monitor", "json"], help="Command to execute"
+        "command",
+        choices=[
+            "start",
+            "stop",
+            "status",
+            "monitor",
+            "json",
+            "profile",
+            "services",
+            "placement",
+            "export",
+            "sampling",
+            "overhead",
+            "push",
+            "aggregate",
+        ],
+        help="Command to execute",
+    )
+    parser.add_argument(
+        "--interval",
+        type=float,
+        help="Monitor update interval (default 2), overhead --max-overhead period (default 60), "
+        "or push/aggregate period (default 10)",
+    )
+    parser.add_argument(
+        "--foreground",
+        action="store_true",
+        help="start: run cortex-schedd in the foreground (e.g. under systemd)",
+    )
+    parser.add_argument("--pin-dir", type=Path, default=PIN_DIR, help="BPF map pin directory")
+    parser.add_argument(
+        "--listen",
+        help="export: serve /metrics on HOST:PORT or unix:PATH (default 127.0.0.1:9521); "
+        "aggregate: receive frames on HOST:PORT (default :9522)",
+    )
+    parser.add_argument("--aggregator", help="push: HOST:PORT of the fleet aggregator")
+    parser.add_argument("--node", help="push: name of this node (default the hostname)")
+    parser.add_argument(
+        "--apply",
+        action="store_true",
+        help="placement: pin misplaced cortex-model@ units to their GPUs' NUMA node",
     )
     parser.add_argument(
-        "--interval", type=float, default=2.0, help="Monitor update interval (seconds)"
+        "--sweep-ms", type=int, default=10, help="start: detection sweep period (milliseconds)"
+    )
+    parser.add_argument(
+        "--sched-ext",
+        action="store_true",
+        help="start: schedule detected inference processes with the sched_ext policy",
+    )
+    parser.add_argument(
+        "--gpu-uprobes",
+        action="store_true",
+        help="start: measure GPU waits with uprobes on libcuda/libamdhip64",
+    )
+    parser.add_argument(
+        "--max-procs",
+        type=int,
+        default=DEFAULT_MAX_PROCS,
+        help="start: processes tracked before the least recently active are evicted",
+    )
+    parser.add_argument(
+        "--no-ioctl",
+        action="store_true",
+        help="start: with --gpu-uprobes, skip the system-wide ioctl tracepoint",
+    )
+    parser.add_argument(
+        "--sample-mode",
+        choices=SAMPLE_MODES,
+        help="start, sampling: trace every event (full), about 1 in --sample-rate (fixed), "
+        "or every event until a process is classified and 1 in --sample-rate after (adaptive)",
+    )
+    parser.add_argument(
+        "--sample-rate",
+        type=int,
+        help=f"start, sampling: mean events per sample (default {DEFAULT_SAMPLE_RATE})",
+    )
+    parser.add_argument(
+        "--window", type=float, default=5.0, help="overhead: measurement window (seconds)"
+    )
+    parser.add_argument(
+        "--max-overhead",
+        type=float,
+        help="overhead: keep running, sampling more sparsely while the probes use more "
+        "than this percentage of all CPUs",
     )
 
     args = parser.parse_args()
 
-    scheduler = CortexScheduler()
+    if args.command == "push" and not args.aggregator:
+        parser.error("push requires --aggregator")
+    if args.command == "aggregate":
+        try:
+            from .fleet import DEFAULT_LISTEN, DEFAULT_PUSH_INTERVAL, aggregate
+        except ImportError:  # Run as a script
+            from fleet import DEFAULT_LISTEN, DEFAULT_PUSH_INTERVAL, aggregate
+        # Only receives frames: needs neither root nor the maps
+        aggregate(args.listen or DEFAULT_LISTEN, args.interval or DEFAULT_PUSH_INTERVAL)
+        return
+
+    # Check for root
+    if os.geteuid() != 0:
+        print("ERROR: This script requires root privileges")
+        print("Run with: sudo python3 cortex_sched_loader.py")
+        sys.exit(1)
+
+    if args.no_ioctl and not args.gpu_uprobes:
+        parser.error("--no-ioctl requires --gpu-uprobes")
+    if args.sample_rate is not None and not args.sample_mode:
+        parser.error("--sample-rate requires --sample-mode")
+    if args.sample_rate is not None and not 1 <= args.sample_rate <= MAX_SAMPLE_RATE:
+        parser.error(f"--sample-rate must be 1-{MAX_SAMPLE_RATE}")
+    sampling = None
+    if args.sample_mode:
+        sampling = Sampling(args.sample_mode, args.sample_rate or DEFAULT_SAMPLE_RATE)
+
+    scheduler = CortexScheduler(
+        pin_dir=args.pin_dir,
+        sweep_ms=args.sweep_ms,
+        sched_ext=args.sched_ext,
+        gpu_uprobes=args.gpu_uprobes,
+        ioctl_probe=not args.no_ioctl,
+        max_procs=args.max_procs,
+        sampling=sampling,
+    )
 
     if args.command == "start":
-        if scheduler.start():
-            # Keep running and handle signals
-            def signal_handler(sig, frame):
-                scheduler.stop()
-                sys.exit(0)
-
-            signal.signal(signal.SIGINT, signal_handler)
-            signal.signal(signal.SIGTERM, signal_handler)
-
-            print("Scheduler running. Press Ctrl+C to stop.")
-            while scheduler.running:
-                time.sleep(1)
-                scheduler._populate_inference_pids()  # Refresh known processes
+        if args.foreground:
+            cmd = scheduler.daemon_command()
+            if not cmd:
+                print(f"ERROR: {DAEMON_NAME} not found (set CORTEX_SCHEDD or add it to PATH)")
+                sys.exit(1)
+            os.execv(cmd[0], cmd)
+        sys.exit(0 if scheduler.start() else 1)
 
     elif args.command == "stop":
         scheduler.stop()
 
     elif args.command == "status":
-        if scheduler.start():
-            time.sleep(0.5)  # Let it collect some data
+        if scheduler.attach():
             scheduler.print_status()
-            scheduler.stop()
+            scheduler.detach()
 
     elif args.command == "monitor":
-        if scheduler.start():
-            scheduler.run_monitor(args.interval)
-            scheduler.stop()
-
-    elif args.command == "json" and scheduler.start():
-        time.sleep(0.5)
-        metrics = scheduler.get_process_metrics()
-        stats = scheduler.get_global_stats()
+        if scheduler.attach():
+            scheduler.run_monitor(args.interval or 2.0)
+            scheduler.detach()
+
+    elif args.command == "sampling":
+        if scheduler.attach():
+            if sampling:
+                scheduler.set_sampling(sampling)
+            print(f"Probe sampling: {scheduler.get_sampling().describe()}")
+            scheduler.detach()
+
+    elif args.command == "overhead":
+        if scheduler.attach():
+            try:
+                if args.max_overhead:
+                    scheduler.govern_overhead(args.max_overhead, args.window, args.interval or 60.0)
+                else:
+                    scheduler.print_overhead(scheduler.measure_overhead(args.window))
+            except (OSError, RuntimeError) as e:
+                print(f"ERROR: cannot measure probe overhead: {e}")
+                sys.exit(1)
+            finally:
+                scheduler.detach()
+
+    elif args.command == "profile":
+        if scheduler.attach():
+            scheduler.print_load_profiles()
+            scheduler.detach()
+
+    elif args.command == "export":
+        try:
+            from .metrics_exporter import DEFAULT_LISTEN, serve
+        except ImportError:  # Run as a script
+            from metrics_exporter import DEFAULT_LISTEN, serve
+        if scheduler.attach():
+            serve(scheduler, args.listen or DEFAULT_LISTEN)
+            scheduler.detach()
+
+    elif args.command == "push":
+        try:
+            from .fleet import DEFAULT_PUSH_INTERVAL, FleetPusher, NodeDeltas
+        except ImportError:  # Run as a script
+            from fleet import DEFAULT_PUSH_INTERVAL, FleetPusher, NodeDeltas
+        if scheduler.attach():
+            interval = args.interval or DEFAULT_PUSH_INTERVAL
+            FleetPusher(NodeDeltas(scheduler), args.aggregator, args.node, interval).run()
+            scheduler.detach()
+
+    elif args.command == "services":
+        if scheduler.attach():
+            scheduler.print_service_stats()
+            scheduler.detach()
+
+    elif args.command == "placement":
+        try:
+            from .placement import print_placements
+        except ImportError:  # Run as a script
+            from placement import print_placements
+        if scheduler.attach():
+            unfixed = print_placements(scheduler, apply=args.apply)
+            scheduler.detach()
+            sys.exit(1 if unfixed else 0)
+
+    elif args.command == "json" and scheduler.attach():
+        metrics, stats = scheduler.snapshot()
         output = {
-            "stats": asdict(stats),
-            "processes": [asdict(m) for m in metrics if m.is_inference],
+            "stats": {**asdict(stats), "tracker_saturated": stats.tracker_saturated},
+            "sampling": asdict(scheduler.get_sampling()),
+            "processes": [
+                {
+                    **asdict(m),
+                    "latency_us": {
+                        kind: {
+                            "p50": m.latency_percentile(kind, 50),
+                            "p99": m.latency_percentile(kind, 99),
+                        }
+                        for kind in HIST_KINDS
+                    },
+                }
+                for m in metrics
+                if m.is_inference
+            ],
+            "load_profiles": [
+                {**asdict(p), "io_read_mb_per_s": p.io_read_mb_per_s}
+                for p in scheduler.get_load_profiles()
+            ],
+            "services": [
+                {**asdict(svc), "gpu_ratio": svc.gpu_ratio} for svc in scheduler.get_service_stats()
+            ],
         }
         print(json.dumps(output, indent=2))
-        scheduler.stop()
+        scheduler.detach()
 
 
 if __name__ == "__main__":
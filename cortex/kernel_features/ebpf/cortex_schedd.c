@@ -0,0 +1,906 @@
+// SPDX-License-Identifier: GPL-2.0
+// Cortex Linux ML Workload Scheduler - loader daemon
+//
+// Loads the precompiled CO-RE object (embedded in the generated skeleton),
+// pins its maps under /sys/fs/bpf/cortex and keeps the programs attached
+// until SIGINT/SIGTERM. While attached it logs the exec, detection, boost
+// and exit events the programs stream through the events ring buffer.
+// cortex_sched_loader.py attaches read-only to the pinned maps for status,
+// monitor and json.
+//
+// With --sched-ext it also loads the cortex_ext.bpf.c sched_ext policy,
+// which schedules the detected inference processes. With --gpu-uprobes it
+// measures GPU waits with uprobes on the CUDA/HIP runtime instead of
+// inferring them from driver ioctls, and charges device memory
+// allocations to the GPU memory budgets gpu_memory.py keeps. --sample sets
+// the initial probe sampling; cortex_sched_loader.py sampling changes it
+// while the probes run. --ready-fd tells whoever started it when all of
+// that is done.
+//
+// Build with:
+//   bpftool btf dump file /sys/kernel/btf/vmlinux format c > vmlinux.h
+//   clang -O2 -g -target bpf -D__TARGET_ARCH_x86 -c cortex_sched.bpf.c -o cortex_sched.bpf.o
+//   bpftool gen skeleton cortex_sched.bpf.o > cortex_sched.skel.h
+//   (build cortex_ext.skel.h the same way, see cortex_ext.bpf.c)
+//   cc -O2 -Wall -o cortex-schedd cortex_schedd.c -lbpf -lelf -lz
+//
+// Usage:
+//   cortex-schedd [--pin-dir DIR] [--pid-file FILE] [--comm NAME]...
+//                 [--sweep-ms MS] [--max-procs N] [--sched-ext [--gpu-cpus LIST]]
+//                 [--gpu-uprobes [--gpu-lib PATH]... [--no-ioctl]]
+//                 [--sample MODE[:RATE]] [--ready-fd FD] [--verbose]
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "cortex_sched.h"
+#include "cortex_ext.skel.h"
+#include "cortex_sched.skel.h"
+
+#define DEFAULT_PIN_DIR  "/sys/fs/bpf/cortex"
+#define DEFAULT_PID_FILE "/run/cortex-schedd.pid"
+#define MAX_COMMS        64
+#define DEFAULT_SWEEP_MS 10
+#define DEFAULT_MAX_PROCS 10240
+#define MAX_PROCS_LIMIT  (1 << 22)
+#define DEFAULT_SAMPLE_RATE 16
+
+// Must match MAX_CPUS and MAX_PREFERRED in cortex_ext.bpf.c
+#define EXT_MAX_CPUS      512
+#define EXT_MAX_PREFERRED 64
+
+#define PCI_DEVICES      "/sys/bus/pci/devices"
+#define PCI_CLASS_DISPLAY 0x03
+#define PCI_VENDOR_NVIDIA 0x10de
+#define PCI_VENDOR_AMD    0x1002
+
+#define MAX_GPU_LIBS     8
+#define MAX_GPU_LINKS    64
+
+// Routine events are submitted without a wakeup; drain them at least
+// this often
+#define EVENT_FLUSH_MS   100
+
+struct options {
+    const char *pin_dir;
+    const char *pid_file;
+    const char *comms[MAX_COMMS];
+    int n_comms;
+    unsigned long sweep_ms;
+    unsigned long max_procs;
+    int sched_ext;
+    const char *gpu_cpus;
+    int gpu_uprobes;
+    const char *gpu_libs[MAX_GPU_LIBS];
+    int n_gpu_libs;
+    int no_ioctl;
+    struct sample_config sample;
+    int ready_fd;
+    int verbose;
+};
+
+static struct options opts = {
+    .pin_dir = DEFAULT_PIN_DIR,
+    .pid_file = DEFAULT_PID_FILE,
+    .sweep_ms = DEFAULT_SWEEP_MS,
+    .max_procs = DEFAULT_MAX_PROCS,
+    .sample = { .mode = SAMPLE_FULL, .rate = 1 },
+    .ready_fd = -1,
+};
+
+static volatile sig_atomic_t exiting;
+
+static void on_signal(int sig) {
+    (void)sig;
+    exiting = 1;
+}
+
+static int print_libbpf(enum libbpf_print_level level, const char *fmt, va_list args) {
+    if (level == LIBBPF_DEBUG && !opts.verbose)
+        return 0;
+    return vfprintf(stderr, fmt, args);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--pin-dir DIR] [--pid-file FILE] [--comm NAME]...\n"
+            "       [--sweep-ms MS] [--max-procs N] [--sched-ext [--gpu-cpus LIST]]\n"
+            "       [--gpu-uprobes [--gpu-lib PATH]... [--no-ioctl]]\n"
+            "       [--sample MODE[:RATE]] [--ready-fd FD] [--verbose]\n"
+            "\n"
+            "  --pin-dir DIR    Where to pin the scheduler maps (default %s)\n"
+            "  --pid-file FILE  PID file (default %s)\n"
+            "  --comm NAME      Known inference process name (repeatable)\n"
+            "  --sweep-ms MS    Detection sweep period (default %d)\n"
+            "  --max-procs N    Processes tracked before the oldest are evicted\n"
+            "                   (default %d)\n"
+            "  --sched-ext      Schedule detected inference tasks with sched_ext\n"
+            "  --gpu-cpus LIST  CPUs to keep them on (default: local to the GPUs)\n"
+            "  --gpu-uprobes    Measure GPU waits with uprobes on libcuda/libamdhip64\n"
+            "                   (and charge allocations to GPU memory budgets)\n"
+            "  --gpu-lib PATH   GPU runtime library to probe (repeatable)\n"
+            "  --no-ioctl       Do not attach the system-wide ioctl tracepoint\n"
+            "  --sample MODE[:RATE]\n"
+            "                   Probe sampling: full, fixed or adaptive, about 1 in\n"
+            "                   RATE switches and GPU ioctls (default full, rate %d)\n"
+            "  --ready-fd FD    Write a newline to FD once loaded and attached\n"
+            "  --verbose        Show libbpf debug output\n",
+            prog, DEFAULT_PIN_DIR, DEFAULT_PID_FILE, DEFAULT_SWEEP_MS, DEFAULT_MAX_PROCS,
+            DEFAULT_SAMPLE_RATE);
+}
+
+// MODE[:RATE], MODE one of full, fixed, adaptive (SAMPLE_*)
+static int parse_sample(const char *arg, struct sample_config *cfg) {
+    static const char *const modes[] = {
+        [SAMPLE_FULL] = "full", [SAMPLE_FIXED] = "fixed", [SAMPLE_ADAPTIVE] = "adaptive",
+    };
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    unsigned long rate = DEFAULT_SAMPLE_RATE;
+
+    if (colon) {
+        char *end;
+        rate = strtoul(colon + 1, &end, 10);
+        if (*end || !rate || rate > MAX_SAMPLE_RATE)
+            return -1;
+    }
+    for (__u32 mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++) {
+        if (strlen(modes[mode]) == len && !strncmp(arg, modes[mode], len)) {
+            cfg->mode = mode;
+            cfg->rate = mode == SAMPLE_FULL ? 1 : rate;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int parse_args(int argc, char **argv) {
+    static const struct option long_opts[] = {
+        {"pin-dir", required_argument, NULL, 'p'},
+        {"pid-file", required_argument, NULL, 'f'},
+        {"comm", required_argument, NULL, 'c'},
+        {"sweep-ms", required_argument, NULL, 's'},
+        {"max-procs", required_argument, NULL, 'm'},
+        {"sched-ext", no_argument, NULL, 'x'},
+        {"gpu-cpus", required_argument, NULL, 'g'},
+        {"gpu-uprobes", no_argument, NULL, 'u'},
+        {"gpu-lib", required_argument, NULL, 'l'},
+        {"no-ioctl", no_argument, NULL, 'n'},
+        {"sample", required_argument, NULL, 'r'},
+        {"ready-fd", required_argument, NULL, 'R'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {},
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "p:f:c:s:m:xg:ul:nr:R:vh", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            opts.pin_dir = optarg;
+            break;
+        case 'f':
+            opts.pid_file = optarg;
+            break;
+        case 'c':
+            if (opts.n_comms == MAX_COMMS) {
+                fprintf(stderr, "Too many --comm names (max %d)\n", MAX_COMMS);
+                return -1;
+            }
+            opts.comms[opts.n_comms++] = optarg;
+            break;
+        case 's':
+            opts.sweep_ms = strtoul(optarg, NULL, 10);
+            if (!opts.sweep_ms) {
+                fprintf(stderr, "--sweep-ms must be a positive number\n");
+                return -1;
+            }
+            break;
+        case 'm':
+            opts.max_procs = strtoul(optarg, NULL, 10);
+            if (!opts.max_procs || opts.max_procs > MAX_PROCS_LIMIT) {
+                fprintf(stderr, "--max-procs must be 1-%d\n", MAX_PROCS_LIMIT);
+                return -1;
+            }
+            break;
+        case 'x':
+            opts.sched_ext = 1;
+            break;
+        case 'g':
+            opts.gpu_cpus = optarg;
+            break;
+        case 'u':
+            opts.gpu_uprobes = 1;
+            break;
+        case 'l':
+            if (opts.n_gpu_libs == MAX_GPU_LIBS) {
+                fprintf(stderr, "Too many --gpu-lib paths (max %d)\n", MAX_GPU_LIBS);
+                return -1;
+            }
+            opts.gpu_libs[opts.n_gpu_libs++] = optarg;
+            break;
+        case 'n':
+            opts.no_ioctl = 1;
+            break;
+        case 'r':
+            if (parse_sample(optarg, &opts.sample)) {
+                fprintf(stderr, "--sample must be full, fixed[:RATE] or adaptive[:RATE], "
+                        "RATE 1-%d\n", MAX_SAMPLE_RATE);
+                return -1;
+            }
+            break;
+        case 'R': {
+            char *end;
+            long fd = strtol(optarg, &end, 10);
+            if (end == optarg || *end || fd < 0 || fd > INT_MAX) {
+                fprintf(stderr, "--ready-fd must be a file descriptor\n");
+                return -1;
+            }
+            opts.ready_fd = fd;
+            break;
+        }
+        case 'v':
+            opts.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if ((opts.n_gpu_libs || opts.no_ioctl) && !opts.gpu_uprobes) {
+        fprintf(stderr, "--gpu-lib and --no-ioctl require --gpu-uprobes\n");
+        return -1;
+    }
+    return 0;
+}
+
+// =============================================================================
+// PID FILE
+// =============================================================================
+
+// Refuse to run twice: a second instance would attach every probe again
+static int claim_pid_file(void) {
+    FILE *f = fopen(opts.pid_file, "r");
+    if (f) {
+        int pid = 0;
+        if (fscanf(f, "%d", &pid) == 1 && pid > 0 && kill(pid, 0) == 0) {
+            fclose(f);
+            fprintf(stderr, "cortex-schedd already running (PID %d)\n", pid);
+            return -EEXIST;
+        }
+        fclose(f);
+    }
+
+    f = fopen(opts.pid_file, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s: %s\n", opts.pid_file, strerror(errno));
+        return -errno;
+    }
+    fprintf(f, "%d\n", getpid());
+    fclose(f);
+    return 0;
+}
+
+// =============================================================================
+// MAP PINNING
+// =============================================================================
+
+// Set pin paths before load. libbpf then pins new maps at load time, or
+// reuses maps already pinned there by a previous (crashed) instance.
+static int set_pin_paths(struct bpf_object *obj) {
+    struct bpf_map *map;
+    char path[256];
+
+    if (mkdir(opts.pin_dir, 0700) && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", opts.pin_dir, strerror(errno));
+        return -errno;
+    }
+
+    bpf_object__for_each_map(map, obj) {
+        // The sweep timer must not outlive the daemon, so it stays unpinned
+        if (bpf_map__is_internal(map) || !strcmp(bpf_map__name(map), "sweep"))
+            continue;
+        int len = snprintf(path, sizeof(path), "%s/%s", opts.pin_dir, bpf_map__name(map));
+        if (len >= (int)sizeof(path))
+            return -ENAMETOOLONG;
+        int err = bpf_map__set_pin_path(map, path);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+static void unpin_maps(struct bpf_object *obj) {
+    struct bpf_map *map;
+
+    bpf_object__for_each_map(map, obj) {
+        if (bpf_map__is_pinned(map))
+            bpf_map__unpin(map, NULL);
+    }
+    rmdir(opts.pin_dir);
+}
+
+// =============================================================================
+// KNOWN INFERENCE PROCESSES
+// =============================================================================
+
+static int load_known_comms(struct cortex_sched_bpf *skel) {
+    int fd = bpf_map__fd(skel->maps.inference_procs);
+    __u32 one = 1;
+
+    for (int i = 0; i < opts.n_comms; i++) {
+        char key[COMM_LEN] = {};
+        strncpy(key, opts.comms[i], COMM_LEN - 1);
+        if (bpf_map_update_elem(fd, key, &one, BPF_ANY)) {
+            fprintf(stderr, "Cannot add '%s' to inference_procs: %s\n", key, strerror(errno));
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+// Exact match, like the kernel's inference_procs lookup: both sides are
+// cut to the COMM_LEN - 1 characters the kernel keeps of a name
+static int is_known_comm(const char *comm) {
+    for (int i = 0; i < opts.n_comms; i++) {
+        if (strncmp(comm, opts.comms[i], COMM_LEN - 1) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Processes that exec'ed before we attached are invisible to handle_exec;
+// admit the ones with known names once at startup.
+static int track_running(struct cortex_sched_bpf *skel) {
+    int fd = bpf_map__fd(skel->maps.tracked_tgids);
+    struct dirent *ent;
+    int tracked = 0;
+    DIR *proc;
+
+    proc = opendir("/proc");
+    if (!proc)
+        return -errno;
+
+    while ((ent = readdir(proc))) {
+        char path[64], comm[COMM_LEN + 1] = {};
+        __u32 tgid, reasons = 0;
+        FILE *f;
+
+        if (!isdigit((unsigned char)ent->d_name[0]))
+            continue;
+        tgid = strtoul(ent->d_name, NULL, 10);
+
+        snprintf(path, sizeof(path), "/proc/%u/comm", tgid);
+        f = fopen(path, "r");
+        if (!f)
+            continue;
+        if (!fgets(comm, sizeof(comm), f)) {
+            fclose(f);
+            continue;
+        }
+        fclose(f);
+        comm[strcspn(comm, "\n")] = '\0';
+
+        if (!is_known_comm(comm))
+            continue;
+
+        bpf_map_lookup_elem(fd, &tgid, &reasons);
+        reasons |= TRACK_USER;
+        if (bpf_map_update_elem(fd, &tgid, &reasons, BPF_ANY) == 0) {
+            printf("  Marked inference process: %s (PID %u)\n", comm, tgid);
+            tracked++;
+        }
+    }
+
+    closedir(proc);
+    return tracked;
+}
+
+// The pinned config may be left over from a previous instance; start
+// from what we were asked for
+static int write_sample_config(struct cortex_sched_bpf *skel) {
+    __u32 zero = 0;
+
+    if (bpf_map_update_elem(bpf_map__fd(skel->maps.sample_config), &zero, &opts.sample, BPF_ANY))
+        return -errno;
+    if (opts.sample.mode != SAMPLE_FULL)
+        printf("Probe sampling: %s, 1 in %u events\n",
+               opts.sample.mode == SAMPLE_FIXED ? "fixed" : "adaptive", opts.sample.rate);
+    return 0;
+}
+
+// =============================================================================
+// DETECTION SWEEP
+// =============================================================================
+
+// start_sweep is a syscall program: run it once to arm the bpf_timer
+static int start_sweep(struct cortex_sched_bpf *skel) {
+    LIBBPF_OPTS(bpf_test_run_opts, run);
+    int err;
+
+    err = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.start_sweep), &run);
+    if (err)
+        return err;
+    return run.retval ? -EINVAL : 0;
+}
+
+// =============================================================================
+// GPU RUNTIME UPROBES
+// =============================================================================
+
+// Entry points that block on the GPU, and those that launch kernels.
+// Missing symbols (older runtimes lack the _ptsz/Ex variants) are skipped.
+static const char *const cuda_sync[] = {
+    "cuStreamSynchronize", "cuStreamSynchronize_ptsz", "cuEventSynchronize",
+    "cuCtxSynchronize", NULL,
+};
+static const char *const cuda_launch[] = {
+    "cuLaunchKernel", "cuLaunchKernel_ptsz", "cuLaunchKernelEx", "cuLaunchKernelEx_ptsz", NULL,
+};
+static const char *const hip_sync[] = {
+    "hipStreamSynchronize", "hipEventSynchronize", "hipDeviceSynchronize", NULL,
+};
+static const char *const hip_launch[] = {
+    "hipLaunchKernel", "hipModuleLaunchKernel", "hipExtModuleLaunchKernel", NULL,
+};
+// Device memory allocations, size second; charged to GPU memory budgets
+static const char *const cuda_alloc[] = {
+    "cuMemAlloc_v2", "cuMemAllocManaged", "cuMemAllocAsync", "cuMemCreate", NULL,
+};
+static const char *const hip_alloc[] = {
+    "hipMalloc", "hipMallocManaged", "hipExtMallocWithFlags", "hipMallocAsync", NULL,
+};
+// Pitched allocations: (ptr, *pitch, width, height), charged width * height
+static const char *const cuda_alloc_pitch[] = { "cuMemAllocPitch_v2", NULL };
+static const char *const hip_alloc_pitch[] = { "hipMallocPitch", NULL };
+
+// Probed when no --gpu-lib is given; libbpf resolves the names through the
+// standard library paths and skips the ones that are not installed
+static const char *const default_gpu_libs[] = {
+    "libcuda.so.1", "libamdhip64.so.6", "libamdhip64.so.5", NULL,
+};
+
+static struct bpf_link *gpu_links[MAX_GPU_LINKS];
+static int n_gpu_links;
+
+static int attach_uprobe(const struct bpf_program *prog, const char *lib, const char *func,
+                         bool retprobe) {
+    LIBBPF_OPTS(bpf_uprobe_opts, uopts, .func_name = func, .retprobe = retprobe);
+    struct bpf_link *link;
+
+    if (n_gpu_links == MAX_GPU_LINKS)
+        return -E2BIG;
+    link = bpf_program__attach_uprobe_opts(prog, -1, lib, 0, &uopts);
+    if (!link)
+        return -errno;
+    gpu_links[n_gpu_links++] = link;
+    return 0;
+}
+
+// Attach to every known entry point of one library; returns how many
+static int attach_gpu_lib(struct cortex_sched_bpf *skel, const char *lib) {
+    const bool hip = strstr(lib, "amdhip") != NULL;
+    const char *const *sync = hip ? hip_sync : cuda_sync;
+    const char *const *launch = hip ? hip_launch : cuda_launch;
+    const char *const *alloc = hip ? hip_alloc : cuda_alloc;
+    const char *const *alloc_pitch = hip ? hip_alloc_pitch : cuda_alloc_pitch;
+    int attached = 0;
+
+    for (; *sync; sync++) {
+        if (attach_uprobe(skel->progs.handle_sync_enter, lib, *sync, false))
+            continue;
+        if (attach_uprobe(skel->progs.handle_sync_exit, lib, *sync, true)) {
+            bpf_link__destroy(gpu_links[--n_gpu_links]);
+            continue;
+        }
+        attached++;
+    }
+    for (; *launch; launch++) {
+        if (!attach_uprobe(skel->progs.handle_launch, lib, *launch, false))
+            attached++;
+    }
+    for (; *alloc; alloc++) {
+        if (!attach_uprobe(skel->progs.handle_gpu_alloc, lib, *alloc, false))
+            attached++;
+    }
+    for (; *alloc_pitch; alloc_pitch++) {
+        if (!attach_uprobe(skel->progs.handle_gpu_alloc_pitch, lib, *alloc_pitch, false))
+            attached++;
+    }
+
+    if (attached)
+        printf("GPU uprobes: %d entry points in %s\n", attached, lib);
+    return attached;
+}
+
+static int attach_gpu_uprobes(struct cortex_sched_bpf *skel) {
+    int attached = 0;
+
+    if (opts.n_gpu_libs) {
+        for (int i = 0; i < opts.n_gpu_libs; i++)
+            attached += attach_gpu_lib(skel, opts.gpu_libs[i]);
+    } else {
+        for (const char *const *lib = default_gpu_libs; *lib; lib++)
+            attached += attach_gpu_lib(skel, *lib);
+    }
+
+    if (!attached) {
+        fprintf(stderr, "No CUDA/HIP runtime symbols found to probe (use --gpu-lib)\n");
+        return -ENOENT;
+    }
+    return 0;
+}
+
+static void detach_gpu_uprobes(void) {
+    while (n_gpu_links)
+        bpf_link__destroy(gpu_links[--n_gpu_links]);
+}
+
+// =============================================================================
+// SCHED_EXT POLICY
+// =============================================================================
+
+static int read_sysfs(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -errno;
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return -EIO;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+// Parse a kernel CPU list ("0-3,8-11") into mask[]
+static int parse_cpu_list(const char *list, __u8 *mask, int max) {
+    const char *s = list;
+
+    while (*s) {
+        char *end;
+        unsigned long lo = strtoul(s, &end, 10), hi = lo;
+
+        if (end == s)
+            return -EINVAL;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtoul(s, &end, 10);
+            if (end == s || hi < lo)
+                return -EINVAL;
+        }
+        for (unsigned long cpu = lo; cpu <= hi && cpu < (unsigned long)max; cpu++)
+            mask[cpu] = 1;
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return -EINVAL;
+    }
+    return 0;
+}
+
+// Union of local_cpulist over NVIDIA and AMD display-class PCI devices
+static int find_gpu_cpus(__u8 *mask, int max) {
+    struct dirent *ent;
+    int gpus = 0;
+    DIR *dir;
+
+    dir = opendir(PCI_DEVICES);
+    if (!dir)
+        return -errno;
+
+    while ((ent = readdir(dir))) {
+        char path[512], buf[4096];
+        unsigned long class, vendor;
+
+        if (ent->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), PCI_DEVICES "/%s/class", ent->d_name);
+        if (read_sysfs(path, buf, sizeof(buf)))
+            continue;
+        class = strtoul(buf, NULL, 16);
+        snprintf(path, sizeof(path), PCI_DEVICES "/%s/vendor", ent->d_name);
+        if (read_sysfs(path, buf, sizeof(buf)))
+            continue;
+        vendor = strtoul(buf, NULL, 16);
+
+        if ((class >> 16) != PCI_CLASS_DISPLAY ||
+            (vendor != PCI_VENDOR_NVIDIA && vendor != PCI_VENDOR_AMD))
+            continue;
+
+        snprintf(path, sizeof(path), PCI_DEVICES "/%s/local_cpulist", ent->d_name);
+        if (read_sysfs(path, buf, sizeof(buf)) || parse_cpu_list(buf, mask, max))
+            continue;
+        gpus++;
+    }
+
+    closedir(dir);
+    return gpus;
+}
+
+static int set_preferred_cpus(struct cortex_ext_bpf *ext) {
+    __u8 mask[EXT_MAX_CPUS] = {};
+    __u32 n = 0;
+    int err;
+
+    if (opts.gpu_cpus) {
+        err = parse_cpu_list(opts.gpu_cpus, mask, EXT_MAX_CPUS);
+        if (err) {
+            fprintf(stderr, "Invalid --gpu-cpus list '%s'\n", opts.gpu_cpus);
+            return err;
+        }
+    } else {
+        err = find_gpu_cpus(mask, EXT_MAX_CPUS);
+        if (err <= 0)
+            printf("No GPU found, inference tasks may run on any CPU\n");
+    }
+
+    for (int cpu = 0; cpu < EXT_MAX_CPUS && n < EXT_MAX_PREFERRED; cpu++) {
+        if (!mask[cpu])
+            continue;
+        ext->rodata->cpu_preferred[cpu] = 1;
+        ext->rodata->preferred_cpus[n++] = cpu;
+    }
+    ext->rodata->nr_preferred = n;
+    return 0;
+}
+
+// Load the sched_ext policy on top of the telemetry object, sharing its
+// process_metrics map
+static int load_sched_ext(struct cortex_sched_bpf *skel, struct cortex_ext_bpf **extp,
+                          struct bpf_link **linkp) {
+    struct cortex_ext_bpf *ext;
+    int err;
+
+    ext = cortex_ext_bpf__open();
+    if (!ext) {
+        err = -errno;
+        fprintf(stderr, "Failed to open sched_ext skeleton: %s\n", strerror(-err));
+        return err;
+    }
+    *extp = ext;
+
+    err = bpf_map__reuse_fd(ext->maps.process_metrics, bpf_map__fd(skel->maps.process_metrics));
+    if (err)
+        return err;
+
+    err = set_preferred_cpus(ext);
+    if (err)
+        return err;
+
+    err = cortex_ext_bpf__load(ext);
+    if (err) {
+        fprintf(stderr, "Failed to load sched_ext policy: %s\n", strerror(-err));
+        return err;
+    }
+
+    *linkp = bpf_map__attach_struct_ops(ext->maps.cortex_ops);
+    if (!*linkp) {
+        err = -errno;
+        fprintf(stderr, "Failed to enable sched_ext policy: %s\n", strerror(-err));
+        return err;
+    }
+
+    printf("sched_ext policy enabled (%u preferred CPUs)\n", ext->rodata->nr_preferred);
+    return 0;
+}
+
+// =============================================================================
+// EVENTS
+// =============================================================================
+
+static const char *event_name(__u32 type) {
+    switch (type) {
+    case EVENT_EXEC:
+        return "exec";
+    case EVENT_DETECTED:
+        return "detected";
+    case EVENT_BOOST:
+        return "boost";
+    case EVENT_EXIT:
+        return "exit";
+    case EVENT_GPU_PRESSURE:
+        return "gpu-mem";
+    default:
+        return "unknown";
+    }
+}
+
+static int handle_event(void *ctx, void *data, size_t size) {
+    const struct sched_event *e = data;
+    (void)ctx;
+
+    if (size < sizeof(*e))
+        return 0;
+    // Boost changes arrive every sweep; only log them when asked to
+    if (e->type == EVENT_BOOST && !opts.verbose)
+        return 0;
+
+    printf("%-8s %-16.*s PID %-7u boost %u\n", event_name(e->type), COMM_LEN, e->comm,
+           e->tgid, e->priority_boost);
+    return 0;
+}
+
+// Wait for events until a signal arrives. ring_buffer__poll() sleeps in
+// epoll_wait(), which a signal always interrupts; a signal that lands just
+// before the call is noticed after at most one flush timeout.
+static int consume_events(struct cortex_sched_bpf *skel, struct cortex_ext_bpf *ext) {
+    struct ring_buffer *rb;
+    int err = 0;
+
+    rb = ring_buffer__new(bpf_map__fd(skel->maps.events), handle_event, NULL, NULL);
+    if (!rb) {
+        err = -errno;
+        fprintf(stderr, "Failed to open event ring buffer: %s\n", strerror(-err));
+        return err;
+    }
+
+    while (!exiting) {
+        // The kernel ejects a misbehaving policy; tasks are back on CFS
+        if (ext && ext->bss->exit_kind) {
+            printf("sched_ext policy disabled: %s\n", ext->bss->exit_reason);
+            ext = NULL;
+        }
+
+        err = ring_buffer__poll(rb, EVENT_FLUSH_MS);
+        if (err == -EINTR) {
+            err = 0;
+            continue;
+        }
+        if (err < 0) {
+            fprintf(stderr, "Polling event ring buffer failed: %s\n", strerror(-err));
+            break;
+        }
+        // Timed out: pick up events queued without a wakeup
+        if (err == 0)
+            err = ring_buffer__consume(rb);
+        if (err > 0)
+            fflush(stdout);
+        err = 0;
+    }
+
+    ring_buffer__free(rb);
+    return err;
+}
+
+// =============================================================================
+// MAIN
+// =============================================================================
+
+int main(int argc, char **argv) {
+    struct cortex_sched_bpf *skel = NULL;
+    struct cortex_ext_bpf *ext = NULL;
+    struct bpf_link *ext_link = NULL;
+    int err;
+
+    if (parse_args(argc, argv))
+        return 1;
+
+    libbpf_set_print(print_libbpf);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    err = claim_pid_file();
+    if (err)
+        return 1;
+
+    skel = cortex_sched_bpf__open();
+    if (!skel) {
+        err = -errno;
+        fprintf(stderr, "Failed to open BPF skeleton: %s\n", strerror(-err));
+        goto cleanup;
+    }
+
+    skel->rodata->nr_cpus = libbpf_num_possible_cpus();
+    skel->rodata->sweep_period_ns = opts.sweep_ms * 1000000ULL;
+    skel->rodata->gpu_uprobes = opts.gpu_uprobes;
+
+    // The uprobes are attached by hand below, to the libraries found
+    if (!opts.gpu_uprobes) {
+        bpf_program__set_autoload(skel->progs.handle_sync_enter, false);
+        bpf_program__set_autoload(skel->progs.handle_sync_exit, false);
+        bpf_program__set_autoload(skel->progs.handle_launch, false);
+        bpf_program__set_autoload(skel->progs.handle_gpu_alloc, false);
+        bpf_program__set_autoload(skel->progs.handle_gpu_alloc_pitch, false);
+    }
+    if (opts.no_ioctl)
+        bpf_program__set_autoload(skel->progs.handle_ioctl, false);
+
+    // The per-process LRU maps; sched_ext reuses process_metrics as is
+    bpf_map__set_max_entries(skel->maps.process_metrics, opts.max_procs);
+    bpf_map__set_max_entries(skel->maps.process_counters, opts.max_procs);
+    bpf_map__set_max_entries(skel->maps.tracked_tgids, opts.max_procs);
+
+    err = set_pin_paths(skel->obj);
+    if (err)
+        goto cleanup;
+
+    err = cortex_sched_bpf__load(skel);
+    if (err) {
+        fprintf(stderr, "Failed to load BPF object: %s\n", strerror(-err));
+        goto cleanup;
+    }
+
+    err = load_known_comms(skel);
+    if (err)
+        goto cleanup;
+
+    err = write_sample_config(skel);
+    if (err) {
+        fprintf(stderr, "Cannot set probe sampling: %s\n", strerror(-err));
+        goto cleanup;
+    }
+
+    err = cortex_sched_bpf__attach(skel);
+    if (err) {
+        fprintf(stderr, "Failed to attach BPF programs: %s\n", strerror(-err));
+        goto cleanup;
+    }
+
+    if (opts.gpu_uprobes) {
+        err = attach_gpu_uprobes(skel);
+        if (err)
+            goto cleanup;
+    }
+
+    err = start_sweep(skel);
+    if (err) {
+        fprintf(stderr, "Failed to start detection sweep: %s\n", strerror(-err));
+        goto cleanup;
+    }
+
+    err = track_running(skel);
+    if (err < 0)
+        fprintf(stderr, "Initial /proc scan failed: %s\n", strerror(-err));
+
+    if (opts.sched_ext) {
+        err = load_sched_ext(skel, &ext, &ext_link);
+        if (err)
+            goto cleanup;
+    }
+
+    printf("eBPF ML scheduler loaded, maps pinned at %s\n", opts.pin_dir);
+    fflush(stdout);
+
+    // The pins alone prove nothing: they may be a crashed instance's
+    if (opts.ready_fd >= 0) {
+        if (write(opts.ready_fd, "\n", 1) < 0)
+            fprintf(stderr, "Cannot signal readiness: %s\n", strerror(errno));
+        close(opts.ready_fd);
+    }
+
+    err = consume_events(skel, ext);
+    if (err)
+        goto cleanup;
+
+    printf("eBPF ML scheduler stopped\n");
+
+cleanup:
+    // Disabling the policy first hands every task back to CFS
+    bpf_link__destroy(ext_link);
+    cortex_ext_bpf__destroy(ext);
+    detach_gpu_uprobes();
+    if (skel) {
+        unpin_maps(skel->obj);
+        cortex_sched_bpf__destroy(skel);
+    }
+    unlink(opts.pid_file);
+    return err ? 1 : 0;
+}
@@ -0,0 +1,529 @@
+"""
+Fleet-wide view of the cortex-schedd maps.
+
+Every node runs a pusher that reads the pinned maps once per interval and
+sends what changed to an aggregator as one compact binary frame: per-unit
+counters (rolled up from the per-cgroup ones, since cgroup ids mean
+nothing off the node) plus the run-queue, on-CPU and off-CPU latency
+histograms of the unit's inference processes and a histogram of its
+model-load times. The aggregator merges them into a cluster-wide table
+of which models see contention, GPU-wait inflation or slow cold starts.
+
+    sudo python3 cortex_sched_loader.py push --aggregator fleet-host:9522 --interval 10
+    python3 cortex_sched_loader.py aggregate --listen :9522
+
+Frames hold deltas since the previous frame, as varints, with only the
+non-zero counters and histogram slots, and skip units with no activity.
+A busy unit costs up to about 150 bytes, so a node with a dozen busy
+models sends under 2 KB per interval, some 200 B/s at the default 10 s.
+Reading the maps is the same few batched bpf(2) calls per map as a
+Prometheus scrape.
+
+A pusher keeps running totals, and the first frame on every connection
+is a keyframe carrying them. The aggregator replaces that node's state
+with the keyframe, so neither side's restart or a dropped connection
+loses counts. The protocol is unauthenticated; run the aggregator on a
+trusted management network.
+"""
+
+import socket
+import socketserver
+import struct
+import sys
+import threading
+import time
+from dataclasses import dataclass, field
+from pathlib import Path
+
+try:
+    from .cortex_sched_loader import (
+        CGROUP_COUNTERS,
+        CGROUP_ROOT,
+        HIST_KINDS,
+        HIST_SLOTS,
+        CortexScheduler,
+        hist_delta,
+        hist_percentile,
+        unit_of_cgroup,
+    )
+except ImportError:  # Run as a script
+    from cortex_sched_loader import (
+        CGROUP_COUNTERS,
+        CGROUP_ROOT,
+        HIST_KINDS,
+        HIST_SLOTS,
+        CortexScheduler,
+        hist_delta,
+        hist_percentile,
+        unit_of_cgroup,
+    )
+
+DEFAULT_LISTEN = ":9522"
+DEFAULT_PUSH_INTERVAL = 10.0
+FRAME_MAGIC = b"CXF1"
+MAX_FRAME_BYTES = 1 << 20
+# Latency kinds are log2 microsecond slots; "load" is log2 milliseconds
+FLEET_HISTS = HIST_KINDS + ("load",)
+FLAG_KEYFRAME = 1
+# A node that missed this many intervals is reported as stale
+STALE_INTERVALS = 3
+
+
+def _put_varint(out: bytearray, value: int):
+    """Unsigned LEB128."""
+    while value > 0x7F:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def _get_varint(data: bytes, pos: int) -> tuple[int, int]:
+    value = shift = 0
+    while True:
+        if pos >= len(data) or shift > 63:
+            raise ValueError("truncated varint")
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def _put_str(out: bytearray, text: str):
+    raw = text.encode()
+    _put_varint(out, len(raw))
+    out += raw
+
+
+def _get_str(data: bytes, pos: int) -> tuple[str, int]:
+    size, pos = _get_varint(data, pos)
+    if pos + size > len(data):
+        raise ValueError("truncated string")
+    return data[pos : pos + size].decode(errors="replace"), pos + size
+
+
+@dataclass
+class UnitSample:
+    """Counters (CGROUP_COUNTERS) and histograms (FLEET_HISTS) of one unit."""
+
+    counters: dict[str, int] = field(default_factory=lambda: dict.fromkeys(CGROUP_COUNTERS, 0))
+    hists: dict[str, list[int]] = field(
+        default_factory=lambda: {kind: [0] * HIST_SLOTS for kind in FLEET_HISTS}
+    )
+
+    @property
+    def empty(self) -> bool:
+        return not any(self.counters.values()) and not any(any(h) for h in self.hists.values())
+
+    def add(self, other: "UnitSample"):
+        for name, value in other.counters.items():
+            self.counters[name] += value
+        for kind, buckets in other.hists.items():
+            mine = self.hists[kind]
+            for slot, count in enumerate(buckets):
+                mine[slot] += count
+
+    def copy(self) -> "UnitSample":
+        return UnitSample(dict(self.counters), {k: list(v) for k, v in self.hists.items()})
+
+
+@dataclass
+class Frame:
+    node: str
+    seq: int
+    sent_at: float
+    interval: float
+    keyframe: bool
+    units: dict[str, UnitSample] = field(default_factory=dict)
+
+
+def encode_frame(frame: Frame) -> bytes:
+    """Binary form of a frame (see decode_frame for the layout)."""
+    out = bytearray(FRAME_MAGIC)
+    _put_varint(out, FLAG_KEYFRAME if frame.keyframe else 0)
+    _put_varint(out, frame.seq)
+    _put_varint(out, int(frame.sent_at * 1000))
+    _put_varint(out, int(frame.interval * 1000))
+    _put_str(out, frame.node)
+    _put_varint(out, len(frame.units))
+    for unit, sample in frame.units.items():
+        _put_str(out, unit)
+        values = [sample.counters[name] for name in CGROUP_COUNTERS]
+        _put_varint(out, sum(1 << i for i, value in enumerate(values) if value))
+        for value in values:
+            if value:
+                _put_varint(out, value)
+        for kind in FLEET_HISTS:
+            slots = [(slot, n) for slot, n in enumerate(sample.hists[kind]) if n]
+            _put_varint(out, len(slots))
+            last = -1
+            for slot, count in slots:
+                _put_varint(out, slot - last - 1)  # Gap since the previous slot
+                _put_varint(out, count)
+                last = slot
+    return bytes(out)
+
+
+def decode_frame(data: bytes) -> Frame:
+    """Parse a frame; raises ValueError if it is malformed.
+
+    Layout, every integer an unsigned LEB128 varint: magic "CXF1", flags,
+    seq, send time (ms since the epoch), interval (ms), node name, unit
+    count, then per unit its name, a bitmask of the non-zero counters in
+    CGROUP_COUNTERS order followed by their values, and per FLEET_HISTS
+    kind the number of non-zero slots followed by (gap, count) pairs.
+    Strings are a byte length then UTF-8.
+    """
+    if not data.startswith(FRAME_MAGIC):
+        raise ValueError("not a fleet frame")
+    pos = len(FRAME_MAGIC)
+    flags, pos = _get_varint(data, pos)
+    seq, pos = _get_varint(data, pos)
+    sent_ms, pos = _get_varint(data, pos)
+    interval_ms, pos = _get_varint(data, pos)
+    node, pos = _get_str(data, pos)
+    count, pos = _get_varint(data, pos)
+    frame = Frame(node, seq, sent_ms / 1000, interval_ms / 1000, bool(flags & FLAG_KEYFRAME))
+    for _ in range(count):
+        unit, pos = _get_str(data, pos)
+        sample = UnitSample()
+        mask, pos = _get_varint(data, pos)
+        for i, name in enumerate(CGROUP_COUNTERS):
+            if mask & (1 << i):
+                sample.counters[name], pos = _get_varint(data, pos)
+        for kind in FLEET_HISTS:
+            nslots, pos = _get_varint(data, pos)
+            slot = -1
+            for _ in range(nslots):
+                gap, pos = _get_varint(data, pos)
+                slot += gap + 1
+                if slot >= HIST_SLOTS:
+                    raise ValueError(f"histogram slot {slot} out of range")
+                sample.hists[kind][slot], pos = _get_varint(data, pos)
+        frame.units[unit] = sample
+    if pos != len(data):
+        raise ValueError("trailing bytes after frame")
+    return frame
+
+
+def load_slot(duration_ns: int) -> int:
+    """Log2 millisecond slot of a model-load time."""
+    return min(HIST_SLOTS - 1, max(0, (duration_ns // 1_000_000).bit_length() - 1))
+
+
+class NodeDeltas:
+    """Turns the cumulative map contents into per-unit deltas.
+
+    Unit counters are compared with the previous reading (a value that
+    went down means cortex-schedd restarted and counts from zero).
+    Latency histograms are per process, so each process's buckets are
+    diffed on their own and then summed into its unit. A model load
+    counts once, when its load phase has ended.
+    """
+
+    def __init__(
+        self,
+        scheduler: CortexScheduler,
+        cgroup_root: Path = CGROUP_ROOT,
+        proc: Path = Path("/proc"),
+    ):
+        self.scheduler = scheduler
+        self.cgroup_root = Path(cgroup_root)
+        self.proc = Path(proc)
+        # Everything handed out so far, per unit: what a keyframe carries
+        self.totals: dict[str, UnitSample] = {}
+        self._counters: dict[str, dict[str, int]] = {}
+        self._hists: dict[int, dict[str, list[int]]] = {}
+        self._units: dict[int, str | None] = {}
+        self._loads_seen: set[int] = set()
+
+    def _unit_of(self, pid: int) -> str | None:
+        if pid not in self._units:
+            try:
+                text = (self.proc / str(pid) / "cgroup").read_text()
+                path = next(line[3:] for line in text.splitlines() if line.startswith("0::"))
+                self._units[pid] = unit_of_cgroup(path.strip())[0]
+            except (OSError, StopIteration):
+                self._units[pid] = None
+        return self._units[pid]
+
+    def collect(self) -> dict[str, UnitSample]:
+        """What changed since the last call, per unit with any activity."""
+        deltas: dict[str, UnitSample] = {}
+
+        def sample(unit: str) -> UnitSample:
+            return deltas.setdefault(unit, UnitSample())
+
+        for svc in self.scheduler.get_service_stats(self.cgroup_root):
+            now = {name: getattr(svc, name) for name in CGROUP_COUNTERS}
+            before = self._counters.get(svc.unit, {})
+            self._counters[svc.unit] = now
+            counters = sample(svc.unit).counters
+            for name, value in now.items():
+                then = before.get(name, 0)
+                counters[name] = value - then if value >= then else value
+
+        metrics = [m for m in self.scheduler.get_process_metrics() if m.is_inference]
+        pids = {m.pid for m in metrics}
+        for m in metrics:
+            unit = self._unit_of(m.pid)
+            if unit is None or not m.latency:
+                continue
+            before = self._hists.get(m.pid, {})
+            self._hists[m.pid] = m.latency
+            hists = sample(unit).hists
+            for kind in HIST_KINDS:
+                for slot, count in enumerate(hist_delta(m.latency[kind], before.get(kind))):
+                    hists[kind][slot] += count
+
+        loads = set()
+        for pid, phase in self.scheduler.maps["load_phase"].items():
+            pid = pid.value
+            loads.add(pid)
+            if not phase.end_ns or pid in self._loads_seen:
+                continue
+            self._loads_seen.add(pid)
+            unit = self._unit_of(pid)
+            if unit is not None:
+                sample(unit).hists["load"][load_slot(phase.end_ns - phase.start_ns)] += 1
+
+        # Forget processes that left the maps
+        for pid in self._hists.keys() - pids:
+            del self._hists[pid]
+        self._loads_seen &= loads
+        for pid in self._units.keys() - pids - loads:
+            del self._units[pid]
+
+        deltas = {unit: s for unit, s in deltas.items() if not s.empty}
+        for unit, delta in deltas.items():
+            self.totals.setdefault(unit, UnitSample()).add(delta)
+        return deltas
+
+
+def parse_address(address: str, default_host: str = "") -> tuple[str, int]:
+    """(host, port) from "HOST:PORT", "[V6]:PORT" or ":PORT"."""
+    host, _, port = address.rpartition(":")
+    return host.strip("[]") or default_host, int(port)
+
+
+class FleetPusher:
+    """Sends a node's deltas to an aggregator every interval."""
+
+    def __init__(
+        self,
+        collector: NodeDeltas,
+        aggregator: str,
+        node: str | None = None,
+        interval: float = DEFAULT_PUSH_INTERVAL,
+    ):
+        self.collector = collector
+        self.address = parse_address(aggregator, "127.0.0.1")
+        self.node = node or socket.gethostname()
+        self.interval = interval
+        self.seq = 0
+        self.bytes_sent = 0
+        self._sock: socket.socket | None = None
+
+    def next_frame(self) -> Frame:
+        """Collect, as a keyframe if there is no connection to continue."""
+        deltas = self.collector.collect()
+        keyframe = self._sock is None
+        units = {u: s.copy() for u, s in self.collector.totals.items()} if keyframe else deltas
+        self.seq += 1
+        return Frame(self.node, self.seq, time.time(), self.interval, keyframe, units)
+
+    def push(self) -> bool:
+        """Collect and send one frame; False if the aggregator is unreachable.
+
+        The counts are not lost: they are in the totals of the next
+        keyframe.
+        """
+        frame = self.next_frame()
+        data = encode_frame(frame)
+        try:
+            if self._sock is None:
+                self._sock = socket.create_connection(self.address, timeout=self.interval)
+            self._sock.sendall(struct.pack("!I", len(data)) + data)
+        except OSError:
+            self.close()
+            return False
+        self.bytes_sent += len(data) + 4
+        return True
+
+    def close(self):
+        if self._sock is not None:
+            self._sock.close()
+            self._sock = None
+
+    def run(self):
+        """Push every interval until interrupted."""
+        host, port = self.address
+        print(f"Pushing scheduler deltas as {self.node} to {host}:{port} every {self.interval}s")
+        started = time.monotonic()
+        connected = True
+        try:
+            while True:
+                tick = time.monotonic()
+                ok = self.push()
+                if ok != connected:
+                    state = "reconnected" if ok else "unreachable, keeping totals"
+                    print(f"Aggregator {host}:{port} {state}")
+                    sys.stdout.flush()
+                    connected = ok
+                time.sleep(max(0.0, self.interval - (time.monotonic() - tick)))
+        except KeyboardInterrupt:
+            elapsed = time.monotonic() - started
+            print(f"\nStopping: sent {self.bytes_sent} bytes ({self.bytes_sent / elapsed:.0f} B/s)")
+        finally:
+            self.close()
+
+
+@dataclass
+class NodeState:
+    units: dict[str, UnitSample]
+    seq: int
+    last_seen: float
+    interval: float
+    frames: int = 0
+    bytes_received: int = 0
+
+
+@dataclass
+class FleetUnit:
+    """One unit (model service name) summed over every node running it."""
+
+    unit: str
+    nodes: list[str]
+    sample: UnitSample
+
+    @property
+    def gpu_ratio(self) -> float:
+        gpu, cpu = self.sample.counters["gpu_wait_ns"], self.sample.counters["cpu_compute_ns"]
+        return gpu / (gpu + cpu) * 100 if gpu + cpu else 0.0
+
+    def percentile(self, kind: str, pct: float) -> float:
+        """Upper bound of the pct-th percentile (microseconds, or ms for load)."""
+        return hist_percentile(self.sample.hists[kind], pct)
+
+
+class FleetAggregator:
+    """Merges the frames of every node; safe to feed from several threads."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self.nodes: dict[str, NodeState] = {}
+
+    def ingest(self, frame: Frame, size: int = 0):
+        with self._lock:
+            state = self.nodes.get(frame.node)
+            if state is None:
+                # Only a delta if we missed the keyframe: earlier counts are lost
+                state = self.nodes[frame.node] = NodeState({}, 0, 0.0, frame.interval)
+            elif frame.keyframe:
+                state.units = {}
+            for unit, delta in frame.units.items():
+                state.units.setdefault(unit, UnitSample()).add(delta)
+            state.seq = frame.seq
+            state.last_seen = time.time()
+            state.interval = frame.interval
+            state.frames += 1
+            state.bytes_received += size
+
+    def stale_nodes(self, now: float | None = None) -> list[str]:
+        now = time.time() if now is None else now
+        with self._lock:
+            return sorted(
+                node
+                for node, state in self.nodes.items()
+                if now - state.last_seen > STALE_INTERVALS * state.interval
+            )
+
+    def merged(self) -> list[FleetUnit]:
+        """Every unit summed over the nodes that run it, busiest first."""
+        with self._lock:
+            units: dict[str, FleetUnit] = {}
+            for node, state in sorted(self.nodes.items()):
+                for unit, sample in state.units.items():
+                    merged = units.setdefault(unit, FleetUnit(unit, [], UnitSample()))
+                    merged.nodes.append(node)
+                    merged.sample.add(sample)
+        busiest = sorted(units.values(), key=lambda u: u.sample.counters["cpu_compute_ns"])
+        return busiest[::-1]
+
+
+def print_fleet(aggregator: FleetAggregator):
+    """Print the merged per-unit table."""
+    units = aggregator.merged()
+    stale = aggregator.stale_nodes()
+    print(f"{len(aggregator.nodes)} nodes" + (f", stale: {', '.join(stale)}" if stale else ""))
+    if not units:
+        print("No units reported yet")
+        return
+    print(
+        f"{'UNIT':<36} {'NODES':<6} {'CPU(s)':<9} {'GPU%':<6} {'RUNQ p50/p99':<14} "
+        f"{'OFFCPU p99':<11} {'LOAD p50/p99(s)':<16}"
+    )
+    print("-" * 102)
+    for u in units:
+        runq = f"{u.percentile('runq', 50):.0f}/{u.percentile('runq', 99):.0f}"
+        load = "-"
+        if any(u.sample.hists["load"]):
+            load = f"{u.percentile('load', 50) / 1e3:.1f}/{u.percentile('load', 99) / 1e3:.1f}"
+        print(
+            f"{u.unit[:35]:<36} {len(u.nodes):<6} "
+            f"{u.sample.counters['cpu_compute_ns'] / 1e9:<9.1f} {u.gpu_ratio:<6.1f} "
+            f"{runq:<14} {u.percentile('offcpu', 99):<11.0f} {load:<16}"
+        )
+
+
+class _FrameHandler(socketserver.StreamRequestHandler):
+    server: "AggregatorServer"
+
+    def handle(self):
+        while True:
+            head = self.rfile.read(4)
+            if len(head) < 4:
+                return
+            (size,) = struct.unpack("!I", head)
+            if size > MAX_FRAME_BYTES:
+                return
+            data = self.rfile.read(size)
+            try:
+                frame = decode_frame(data)
+            except ValueError:
+                return  # Drop the connection; the pusher resyncs with a keyframe
+            self.server.aggregator.ingest(frame, size + 4)
+
+
+class AggregatorServer(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+    def __init__(self, listen: str, aggregator: FleetAggregator):
+        host, port = parse_address(listen)
+        if ":" in host:
+            self.address_family = socket.AF_INET6
+        super().__init__((host, port), _FrameHandler)
+        self.aggregator = aggregator
+
+
+def aggregate(listen: str = DEFAULT_LISTEN, interval: float = DEFAULT_PUSH_INTERVAL):
+    """Receive frames on listen and print the fleet table every interval."""
+    aggregator = FleetAggregator()
+    server = AggregatorServer(listen, aggregator)
+    thread = threading.Thread(target=server.serve_forever, kwargs={"poll_interval": 5.0})
+    thread.daemon = True
+    thread.start()
+    print(f"Aggregating scheduler frames on {listen}")
+    try:
+        while True:
+            time.sleep(interval)
+            print("\033[H\033[2J", end="")  # Clear the terminal
+            print_fleet(aggregator)
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.shutdown()
+        server.server_close()
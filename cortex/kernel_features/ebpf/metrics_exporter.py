@@ -0,0 +1,233 @@
+"""
+Prometheus exporter for the cortex-schedd pinned maps.
+
+Serves /metrics in the Prometheus text format (0.0.4) on a TCP address or
+a Unix socket. Every scrape reads the maps with batch lookups, a few
+bpf(2) calls per map. Scrapes that arrive within MIN_REFRESH_S of each
+other get the cached page, so an aggressive scraper cannot make the
+exporter busier than the maps are worth.
+
+    sudo python3 cortex_sched_loader.py export --listen 127.0.0.1:9521
+    sudo python3 cortex_sched_loader.py export --listen unix:/run/cortex/sched-metrics.sock
+"""
+
+import os
+import socket
+import socketserver
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+try:
+    from .cortex_sched_loader import HIST_KINDS, HIST_SLOTS, CortexScheduler
+except ImportError:  # Run as a script
+    from cortex_sched_loader import HIST_KINDS, HIST_SLOTS, CortexScheduler
+
+DEFAULT_LISTEN = "127.0.0.1:9521"
+CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8"
+MIN_REFRESH_S = 0.5
+
+# Histogram bucket bounds in seconds: slot i holds [2^i, 2^(i+1)) us
+_BUCKET_BOUNDS = [f"{(1 << (slot + 1)) / 1e6:g}" for slot in range(HIST_SLOTS - 1)]
+
+
+def _escape(value: str) -> str:
+    return value.replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n")
+
+
+def _labels(**labels) -> str:
+    return "{" + ",".join(f'{k}="{_escape(str(v))}"' for k, v in labels.items()) + "}"
+
+
+class _Family:
+    """One metric family: HELP/TYPE header plus samples."""
+
+    def __init__(self, lines: list[str], name: str, kind: str, help_text: str):
+        self.lines = lines
+        self.name = name
+        lines.append(f"# HELP {name} {help_text}")
+        lines.append(f"# TYPE {name} {kind}")
+
+    def add(self, value: float, suffix: str = "", **labels):
+        label_text = _labels(**labels) if labels else ""
+        self.lines.append(f"{self.name}{suffix}{label_text} {value:g}")
+
+
+def render_metrics(scheduler: CortexScheduler) -> str:
+    """All scheduler metrics in Prometheus text format."""
+    start = time.perf_counter()
+    metrics, stats = scheduler.snapshot()
+    services = scheduler.get_service_stats()
+    lines: list[str] = []
+
+    # Per process (tracked processes; inference ones are flagged)
+    per_process = [
+        ("cpu_seconds_total", "counter", "On-CPU time", lambda m: m.cpu_compute_ns / 1e9),
+        ("gpu_wait_seconds_total", "counter", "GPU wait", lambda m: m.gpu_wait_ns / 1e9),
+        ("context_switches_total", "counter", "Context switches", lambda m: m.context_switches),
+        ("gpu_syncs_total", "counter", "GPU synchronizations", lambda m: m.inference_count),
+        ("kernel_launches_total", "counter", "GPU kernel launches", lambda m: m.kernel_launches),
+        ("mapped_bytes", "gauge", "Large mappings", lambda m: m.memory_alloc_mb * (1 << 20)),
+        ("inference", "gauge", "1 if an inference workload", lambda m: int(m.is_inference)),
+        ("priority_boost", "gauge", "Current priority boost (0-10)", lambda m: m.priority_boost),
+    ]
+    for suffix, kind, help_text, value in per_process:
+        family = _Family(lines, f"cortex_sched_process_{suffix}", kind, f"{help_text} per process")
+        for m in metrics:
+            family.add(value(m), pid=m.pid, comm=m.comm)
+
+    # Scheduling latency of inference processes, cumulative buckets
+    family = _Family(
+        lines,
+        "cortex_sched_latency_seconds",
+        "histogram",
+        "Run-queue wait, on-CPU slice and off-CPU time of inference processes",
+    )
+    for m in metrics:
+        if not (m.is_inference and m.latency):
+            continue
+        for kind in HIST_KINDS:
+            buckets = m.latency[kind]
+            seen = 0
+            for bound, count in zip(_BUCKET_BOUNDS, buckets):
+                seen += count
+                family.add(seen, "_bucket", pid=m.pid, comm=m.comm, kind=kind, le=bound)
+            total = sum(buckets)
+            family.add(total, "_bucket", pid=m.pid, comm=m.comm, kind=kind, le="+Inf")
+            family.add(total, "_count", pid=m.pid, comm=m.comm, kind=kind)
+
+    # Per service (cgroup), kept across process restarts
+    per_service = [
+        ("cpu_seconds_total", "On-CPU time", lambda s: s.cpu_compute_ns / 1e9),
+        ("gpu_wait_seconds_total", "Time blocked on the GPU", lambda s: s.gpu_wait_ns / 1e9),
+        ("context_switches_total", "Context switches", lambda s: s.context_switches),
+        ("gpu_syncs_total", "GPU synchronizations", lambda s: s.inference_count),
+        ("kernel_launches_total", "GPU kernel launches", lambda s: s.kernel_launches),
+        ("major_faults_total", "Page faults that read from storage", lambda s: s.major_faults),
+        ("minor_faults_total", "Other page faults", lambda s: s.minor_faults),
+    ]
+    for suffix, help_text, value in per_service:
+        name = f"cortex_sched_service_{suffix}"
+        family = _Family(lines, name, "counter", f"{help_text} per unit")
+        for svc in services:
+            family.add(value(svc), unit=svc.unit)
+
+    # Scheduler health
+    scalars = [
+        ("inference_processes", "gauge", "Inference processes", stats.total_inference_procs),
+        ("detections_total", "counter", "Inference detections", stats.detection_count),
+        ("tracker_entries", "gauge", "Entries in process_metrics", stats.tracker_entries),
+        ("tracker_capacity", "gauge", "Size of the per-process maps", stats.tracker_capacity),
+        ("tracker_evictions_total", "counter", "LRU evictions", stats.tracker_evictions),
+        ("insert_failures_total", "counter", "Failed map inserts", stats.insert_failures),
+        ("uptime_seconds", "gauge", "Time since cortex-schedd loaded", stats.uptime_seconds),
+    ]
+    for suffix, kind, help_text, value in scalars:
+        _Family(lines, f"cortex_sched_{suffix}", kind, help_text).add(value)
+
+    # Counters of sampled probes are estimates, scaled by the rate
+    sampling = scheduler.get_sampling()
+    family = _Family(lines, "cortex_sched_sample_rate", "gauge", "Events per probe sample")
+    family.add(1 if sampling.full else sampling.rate, mode=sampling.mode)
+
+    family = _Family(lines, "cortex_sched_scrape_duration_seconds", "gauge", "Map read time")
+    family.add(round(time.perf_counter() - start, 6))
+    return "\n".join(lines) + "\n"
+
+
+class _Handler(BaseHTTPRequestHandler):
+    server: "_ExporterMixin"
+
+    def do_GET(self):
+        if self.path.split("?", 1)[0] != "/metrics":
+            body = b'<a href="/metrics">/metrics</a>\n' if self.path == "/" else b"Not found\n"
+            self._reply(200 if self.path == "/" else 404, "text/html", body)
+            return
+        try:
+            body = self.server.page().encode()
+        except (OSError, ValueError) as e:
+            self._reply(503, "text/plain", f"Cannot read scheduler maps: {e}\n".encode())
+            return
+        self._reply(200, CONTENT_TYPE, body)
+
+    def _reply(self, status: int, content_type: str, body: bytes):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def address_string(self) -> str:
+        # Unix socket peers have no address
+        return self.client_address[0] if self.client_address else "unix"
+
+    def log_message(self, format, *args):
+        pass  # A line per scrape would cost more than the scrape
+
+
+class _ExporterMixin:
+    """Renders at most once per MIN_REFRESH_S and serves the cached page."""
+
+    def setup_exporter(self, scheduler: CortexScheduler):
+        self.scheduler = scheduler
+        self._lock = threading.Lock()
+        self._page = ""
+        self._rendered_at = 0.0
+
+    def page(self) -> str:
+        with self._lock:
+            now = time.monotonic()
+            if not self._page or now - self._rendered_at >= MIN_REFRESH_S:
+                self._page = render_metrics(self.scheduler)
+                self._rendered_at = now
+            return self._page
+
+
+class TCPExporter(_ExporterMixin, HTTPServer):
+    allow_reuse_address = True
+
+
+class TCP6Exporter(TCPExporter):
+    address_family = socket.AF_INET6
+
+
+class UnixExporter(_ExporterMixin, socketserver.UnixStreamServer):
+    pass
+
+
+def make_server(scheduler: CortexScheduler, listen: str = DEFAULT_LISTEN):
+    """HTTP server for "HOST:PORT", ":PORT" or "unix:PATH"."""
+    if listen.startswith("unix:"):
+        path = listen.removeprefix("unix:")
+        try:
+            os.unlink(path)  # Left over from an earlier run
+        except FileNotFoundError:
+            pass
+        server = UnixExporter(path, _Handler)
+        os.chmod(path, 0o660)
+    else:
+        host, _, port = listen.rpartition(":")
+        host = host.strip("[]")
+        server_class = TCPExporter
+        if ":" in host:
+            server_class = TCP6Exporter
+        server = server_class((host, int(port)), _Handler)
+    server.setup_exporter(scheduler)
+    return server
+
+
+def serve(scheduler: CortexScheduler, listen: str = DEFAULT_LISTEN):
+    """Serve /metrics until interrupted."""
+    server = make_server(scheduler, listen)
+    print(f"Serving scheduler metrics on {listen} (/metrics)")
+    try:
+        server.serve_forever(poll_interval=5.0)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        if listen.startswith("unix:"):
+            try:
+                os.unlink(listen.removeprefix("unix:"))
+            except FileNotFoundError:
+                pass
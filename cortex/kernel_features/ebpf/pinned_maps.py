@@ -0,0 +1,264 @@
+"""
+Read-only access to BPF maps pinned by cortex-schedd.
+
+Talks to bpf(2) directly through ctypes, so reading scheduler state needs
+neither BCC nor a compiler - only the pinned maps under /sys/fs/bpf/cortex.
+The few maps userspace feeds (gpu_budget, sample_config) are opened writable
+instead.
+"""
+
+import ctypes
+import ctypes.util
+import errno
+import os
+import platform
+import struct
+from collections.abc import Iterator
+from pathlib import Path
+
+# bpf(2) syscall number per architecture
+_NR_BPF = {"x86_64": 321, "aarch64": 280, "ppc64le": 361, "s390x": 351, "riscv64": 280}
+
+# bpf(2) commands (include/uapi/linux/bpf.h)
+BPF_MAP_LOOKUP_ELEM = 1
+BPF_MAP_UPDATE_ELEM = 2
+BPF_MAP_DELETE_ELEM = 3
+BPF_MAP_GET_NEXT_KEY = 4
+BPF_OBJ_GET = 7
+BPF_OBJ_GET_INFO_BY_FD = 15
+BPF_MAP_LOOKUP_BATCH = 24
+
+BPF_F_RDONLY = 1 << 3
+BPF_ANY = 0
+
+# Kernel-internal "not supported" errno that bpf(2) can leak to userspace
+ENOTSUPP = 524
+_NO_BATCH_ERRNOS = {errno.EINVAL, errno.EOPNOTSUPP, ENOTSUPP}
+
+# Upper bound on the value buffer of one batch call (per-CPU values are big)
+_BATCH_BUFFER_BYTES = 4 << 20
+
+# Map types whose values hold one copy per possible CPU
+BPF_MAP_TYPE_PERCPU_HASH = 5
+BPF_MAP_TYPE_PERCPU_ARRAY = 6
+BPF_MAP_TYPE_LRU_PERCPU_HASH = 10
+PERCPU_MAP_TYPES = {
+    BPF_MAP_TYPE_PERCPU_HASH,
+    BPF_MAP_TYPE_PERCPU_ARRAY,
+    BPF_MAP_TYPE_LRU_PERCPU_HASH,
+}
+
+_libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+_libc.syscall.restype = ctypes.c_long
+
+
+def _bpf(cmd: int, attr: ctypes.Array) -> int:
+    """Issue one bpf(2) call; raises OSError on failure."""
+    nr = _NR_BPF.get(platform.machine())
+    if nr is None:
+        raise OSError(errno.ENOSYS, f"bpf(2) not supported on {platform.machine()}")
+    ret = _libc.syscall(nr, cmd, attr, len(attr))
+    if ret < 0:
+        err = ctypes.get_errno()
+        raise OSError(err, os.strerror(err))
+    return ret
+
+
+def _addr(buf) -> int:
+    return ctypes.addressof(buf) if buf is not None else 0
+
+
+def parse_cpu_list(text: str) -> list[int]:
+    """Parse a kernel CPU list such as "0-3,8-11" into CPU numbers."""
+    cpus: list[int] = []
+    for part in text.strip().split(","):
+        if not part:
+            continue
+        lo, _, hi = part.partition("-")
+        cpus.extend(range(int(lo), int(hi or lo) + 1))
+    return cpus
+
+
+def num_possible_cpus() -> int:
+    """Number of per-CPU value slots the kernel returns for per-CPU maps."""
+    text = Path("/sys/devices/system/cpu/possible").read_text()
+    return max(parse_cpu_list(text)) + 1
+
+
+class PinnedMap:
+    """A pinned BPF map opened read-only, decoded with ctypes types.
+
+    items() mirrors the BCC table interface: keys and values are ctypes
+    instances, and per-CPU maps yield a list with one value per CPU. It reads
+    the whole map with BPF_MAP_LOOKUP_BATCH (a few syscalls in total) and
+    only falls back to per-key lookups on kernels without batch support.
+    Maps opened writable also take update() and delete().
+    """
+
+    def __init__(self, path: str | Path, key_type, value_type, writable: bool = False):
+        self.path = Path(path)
+        self.key_type = key_type
+        self.value_type = value_type
+
+        attr = ctypes.create_string_buffer(16)
+        pathname = ctypes.create_string_buffer(os.fsencode(self.path))
+        flags = 0 if writable else BPF_F_RDONLY
+        struct.pack_into("=QII", attr, 0, _addr(pathname), 0, flags)
+        self.fd = _bpf(BPF_OBJ_GET, attr)
+
+        self.map_type, self.key_size, self.value_size, self.max_entries = self._info()
+        if self.key_size != ctypes.sizeof(key_type) or self.value_size != ctypes.sizeof(value_type):
+            self.close()
+            raise ValueError(
+                f"{self.path.name}: layout mismatch (kernel key/value "
+                f"{self.key_size}/{self.value_size} bytes, expected "
+                f"{ctypes.sizeof(key_type)}/{ctypes.sizeof(value_type)})"
+            )
+
+        self.percpu = self.map_type in PERCPU_MAP_TYPES
+        self.ncpus = num_possible_cpus() if self.percpu else 1
+        # Per-CPU values are laid out one 8-byte-aligned slot per possible CPU
+        self._slot = (self.value_size + 7) & ~7 if self.percpu else self.value_size
+        self._batch_ok = True
+
+    def _info(self) -> tuple[int, int, int, int]:
+        info = ctypes.create_string_buffer(88)
+        attr = ctypes.create_string_buffer(16)
+        struct.pack_into("=IIQ", attr, 0, self.fd, len(info), _addr(info))
+        _bpf(BPF_OBJ_GET_INFO_BY_FD, attr)
+        map_type, _map_id, key_size, value_size, max_entries = struct.unpack_from("=5I", info)
+        return map_type, key_size, value_size, max_entries
+
+    def _decode_value(self, raw: bytes):
+        if not self.percpu:
+            return self.value_type.from_buffer_copy(raw)
+        return [
+            self.value_type.from_buffer_copy(raw, cpu * self._slot) for cpu in range(self.ncpus)
+        ]
+
+    def lookup(self, key):
+        """Return the value for key, or None if it is not in the map."""
+        if not isinstance(key, ctypes._SimpleCData | ctypes.Structure):
+            key = self.key_type(key)
+        value = ctypes.create_string_buffer(self._slot * self.ncpus)
+        attr = ctypes.create_string_buffer(32)
+        struct.pack_into("=IIQQQ", attr, 0, self.fd, 0, _addr(key), _addr(value), 0)
+        try:
+            _bpf(BPF_MAP_LOOKUP_ELEM, attr)
+        except FileNotFoundError:
+            return None
+        return self._decode_value(value.raw)
+
+    def update(self, key, value, flags: int = BPF_ANY):
+        """Insert or replace one entry (not for per-CPU maps)."""
+        if self.percpu:
+            raise ValueError(f"{self.path.name}: per-CPU values are not written from here")
+        if not isinstance(key, ctypes._SimpleCData | ctypes.Structure):
+            key = self.key_type(key)
+        attr = ctypes.create_string_buffer(32)
+        struct.pack_into("=IIQQQ", attr, 0, self.fd, 0, _addr(key), _addr(value), flags)
+        _bpf(BPF_MAP_UPDATE_ELEM, attr)
+
+    def delete(self, key) -> bool:
+        """Remove one entry; False if it was not there."""
+        if not isinstance(key, ctypes._SimpleCData | ctypes.Structure):
+            key = self.key_type(key)
+        attr = ctypes.create_string_buffer(16)
+        struct.pack_into("=IIQ", attr, 0, self.fd, 0, _addr(key))
+        try:
+            _bpf(BPF_MAP_DELETE_ELEM, attr)
+        except FileNotFoundError:
+            return False
+        return True
+
+    def keys(self) -> Iterator:
+        """Iterate over keys (one bpf(2) call per key)."""
+        key = None
+        next_key = self.key_type()
+        attr = ctypes.create_string_buffer(24)
+        while True:
+            struct.pack_into("=IIQQ", attr, 0, self.fd, 0, _addr(key), _addr(next_key))
+            try:
+                _bpf(BPF_MAP_GET_NEXT_KEY, attr)
+            except FileNotFoundError:
+                return
+            key = self.key_type.from_buffer_copy(next_key)
+            yield key
+
+    def _items_per_key(self) -> Iterator[tuple]:
+        for key in self.keys():
+            value = self.lookup(key)
+            if value is not None:  # Deleted between get_next_key and lookup
+                yield key, value
+
+    def _items_batch(self) -> list[tuple]:
+        value_bytes = self._slot * self.ncpus
+        chunk = max(1, min(self.max_entries, _BATCH_BUFFER_BYTES // value_bytes))
+        # Batch tokens are opaque; key size is always large enough
+        in_batch = None
+        out_batch = ctypes.create_string_buffer(max(self.key_size, 8))
+        keys = ctypes.create_string_buffer(self.key_size * chunk)
+        values = ctypes.create_string_buffer(value_bytes * chunk)
+        attr = ctypes.create_string_buffer(56)
+        results = []
+
+        while True:
+            struct.pack_into(
+                "=QQQQIIQQ",
+                attr,
+                0,
+                _addr(in_batch),
+                _addr(out_batch),
+                _addr(keys),
+                _addr(values),
+                chunk,
+                self.fd,
+                0,
+                0,
+            )
+            done = False
+            try:
+                _bpf(BPF_MAP_LOOKUP_BATCH, attr)
+            except OSError as e:
+                if e.errno == errno.ENOSPC and chunk < self.max_entries:
+                    # A hash bucket holds more entries than fit; grow and retry
+                    chunk = min(self.max_entries, chunk * 2)
+                    keys = ctypes.create_string_buffer(self.key_size * chunk)
+                    values = ctypes.create_string_buffer(value_bytes * chunk)
+                    continue
+                if e.errno != errno.ENOENT:
+                    raise
+                done = True  # ENOENT: this was the last (possibly partial) batch
+
+            (count,) = struct.unpack_from("=I", attr, 32)
+            raw_keys, raw_values = keys.raw, values.raw
+            for i in range(count):
+                key = self.key_type.from_buffer_copy(raw_keys, i * self.key_size)
+                value = raw_values[i * value_bytes : (i + 1) * value_bytes]
+                results.append((key, self._decode_value(value)))
+
+            if done:
+                return results
+            in_batch = ctypes.create_string_buffer(out_batch.raw)
+
+    def items(self) -> list[tuple]:
+        """Snapshot of all entries."""
+        if self._batch_ok:
+            try:
+                return self._items_batch()
+            except OSError as e:
+                if e.errno not in _NO_BATCH_ERRNOS:
+                    raise
+                self._batch_ok = False
+        return list(self._items_per_key())
+
+    def close(self):
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
@@ -0,0 +1,319 @@
+"""
+NUMA placement hints for model servers.
+
+Puts together where each tracked process runs and allocates (per-node
+on-CPU time and first-touch allocations from the numa_placement map, and
+the resident pages of its large mappings from /proc/<pid>/numa_maps)
+with the GPUs it has open and their place in the topology (GPU -> PCIe
+root -> NUMA node -> CPUs, see hardware_detect.detect_numa_topology).
+
+Host staging buffers on the far socket cost every host-to-device copy a
+trip over the socket interconnect, and kernel.numa_balancing is off
+(99-cortex-llm.conf), so a model server that started on the wrong node
+stays there. For cortex-model@ units the fix is a drop-in that confines
+the unit to the GPU's node:
+
+    [Service]
+    AllowedCPUs=0-15,32-47
+    NUMAPolicy=preferred
+    NUMAMask=0
+
+AllowedCPUs= is a cpuset and applies at once (threads move on their next
+wakeup); the memory policy applies from the next start. Other processes
+get a numactl command line instead.
+
+    sudo python3 cortex_sched_loader.py placement
+    sudo python3 cortex_sched_loader.py placement --apply
+"""
+
+import os
+import subprocess
+import sys
+from dataclasses import dataclass, field
+from pathlib import Path
+
+try:
+    from .cortex_sched_loader import CortexScheduler, unit_of_cgroup
+except ImportError:  # Run as a script
+    from cortex_sched_loader import CortexScheduler, unit_of_cgroup
+
+try:
+    from ..hardware_detect import (
+        NumaTopology,
+        detect_numa_topology,
+        format_cpu_list,
+        normalize_pci_bus_id,
+    )
+except ImportError:  # Run as a script, from ebpf/
+    sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+    from hardware_detect import (
+        NumaTopology,
+        detect_numa_topology,
+        format_cpu_list,
+        normalize_pci_bus_id,
+    )
+
+# Only mappings this large count as model weights or staging buffers
+# (same threshold the mmap probe uses)
+LARGE_MAPPING_BYTES = 100 << 20
+# Recommend pinning once this much CPU time or memory is off the GPU's node
+REMOTE_THRESHOLD_PCT = 10.0
+
+SYSTEMD_DIR = Path("/etc/systemd/system")
+DROPIN_NAME = "50-cortex-numa.conf"
+MODEL_UNIT_PREFIX = "cortex-model@"
+
+NVIDIA_GPUS_DIR = Path("/proc/driver/nvidia/gpus")
+DRM_CLASS_DIR = Path("/sys/class/drm")
+
+
+def numa_maps_by_node(text: str, min_bytes: int = LARGE_MAPPING_BYTES) -> dict[int, int]:
+    """Resident bytes per node of the mappings of at least min_bytes."""
+    by_node: dict[int, int] = {}
+    for line in text.splitlines():
+        pages: dict[int, int] = {}
+        page_size = 4096
+        for token in line.split()[2:]:
+            key, _, value = token.partition("=")
+            if key.startswith("N") and key[1:].isdigit():
+                pages[int(key[1:])] = int(value)
+            elif key == "kernelpagesize_kB":
+                page_size = int(value) * 1024
+        if sum(pages.values()) * page_size < min_bytes:
+            continue
+        for node, count in pages.items():
+            by_node[node] = by_node.get(node, 0) + count * page_size
+    return by_node
+
+
+def nvidia_minors(gpus_dir: Path = NVIDIA_GPUS_DIR) -> dict[int, str]:
+    """/dev/nvidia<minor> -> PCI bus id, from the driver's proc files."""
+    minors = {}
+    try:
+        entries = list(gpus_dir.iterdir())
+    except OSError:
+        return {}
+    for entry in entries:
+        try:
+            info = (entry / "information").read_text()
+        except OSError:
+            continue
+        for line in info.splitlines():
+            key, _, value = line.partition(":")
+            if key.strip() == "Device Minor" and value.strip().isdigit():
+                minors[int(value)] = normalize_pci_bus_id(entry.name)
+    return minors
+
+
+def process_gpus(pid: int, minors: dict[int, str], drm_dir: Path = DRM_CLASS_DIR) -> set[str]:
+    """Bus ids of the GPUs a process has open (/dev/nvidiaN, /dev/dri/*)."""
+    gpus = set()
+    fd_dir = Path(f"/proc/{pid}/fd")
+    try:
+        fds = list(fd_dir.iterdir())
+    except OSError:
+        return gpus
+    for fd in fds:
+        try:
+            target = os.readlink(fd)
+        except OSError:
+            continue
+        name = target.rsplit("/", 1)[-1]
+        if target.startswith("/dev/nvidia") and name[6:].isdigit():
+            if bus_id := minors.get(int(name[6:])):
+                gpus.add(bus_id)
+        elif target.startswith("/dev/dri/"):
+            device = os.path.realpath(drm_dir / name / "device")
+            gpus.add(normalize_pci_bus_id(os.path.basename(device)))
+    return gpus
+
+
+def process_unit(pid: int) -> str | None:
+    """The systemd unit a process runs in, from its cgroup v2 path."""
+    try:
+        text = Path(f"/proc/{pid}/cgroup").read_text()
+    except OSError:
+        return None
+    for line in text.splitlines():
+        if line.startswith("0::"):
+            unit, _ = unit_of_cgroup(line[3:])
+            return unit if unit.endswith(".service") else None
+    return None
+
+
+def _share(by_node: dict[int, int], nodes: set[int]) -> float:
+    """Percentage of the total that lies outside nodes."""
+    total = sum(by_node.values())
+    remote = sum(v for node, v in by_node.items() if node not in nodes)
+    return remote / total * 100 if total else 0.0
+
+
+@dataclass
+class Placement:
+    """Where a tracked process runs and allocates, relative to its GPUs."""
+
+    pid: int
+    comm: str
+    unit: str | None
+    gpus: list[str]
+    gpu_nodes: list[int]  # Nodes of the GPUs it has open
+    cpus: list[int]  # CPUs local to those GPUs
+    oncpu_ns: dict[int, int] = field(default_factory=dict)  # node -> on-CPU time
+    alloc_bytes: dict[int, int] = field(default_factory=dict)  # node -> first-touch bytes
+    resident_bytes: dict[int, int] = field(default_factory=dict)  # node -> large mappings
+    remote_threads: list[tuple[int, str, int]] = field(default_factory=list)  # tid, comm, cpu
+
+    @property
+    def remote_cpu_pct(self) -> float:
+        return _share(self.oncpu_ns, set(self.gpu_nodes))
+
+    @property
+    def remote_memory_pct(self) -> float:
+        # What is resident now, or what was touched if nothing large is mapped
+        return _share(self.resident_bytes or self.alloc_bytes, set(self.gpu_nodes))
+
+    @property
+    def misplaced(self) -> bool:
+        return bool(self.gpu_nodes) and (
+            self.remote_cpu_pct > REMOTE_THRESHOLD_PCT
+            or self.remote_memory_pct > REMOTE_THRESHOLD_PCT
+        )
+
+    @property
+    def model_unit(self) -> bool:
+        return bool(self.unit and self.unit.startswith(MODEL_UNIT_PREFIX))
+
+    def dropin(self) -> str:
+        """systemd drop-in confining the unit to its GPUs' nodes."""
+        nodes = ",".join(str(n) for n in self.gpu_nodes)
+        return (
+            f"# Written by cortex-sched placement: {', '.join(self.gpus)} on node {nodes}\n"
+            "[Service]\n"
+            f"AllowedCPUs={format_cpu_list(self.cpus)}\n"
+            "NUMAPolicy=preferred\n"
+            f"NUMAMask={self.gpu_nodes[0]}\n"  # preferred takes a single node
+        )
+
+    def numactl(self) -> str:
+        """Equivalent numactl prefix for processes that are not units."""
+        nodes = ",".join(str(n) for n in self.gpu_nodes)
+        return f"numactl --cpunodebind={nodes} --preferred={self.gpu_nodes[0]}"
+
+
+def get_placements(scheduler: CortexScheduler, topology: NumaTopology) -> list[Placement]:
+    """Placement of every tracked process that has a GPU open."""
+    numa = scheduler.get_numa_placement()
+    minors = nvidia_minors()
+    placements = []
+
+    for m in scheduler.get_process_metrics():
+        gpus = sorted(process_gpus(m.pid, minors))
+        gpu_nodes = sorted(
+            {g.numa_node for bus_id in gpus if (g := topology.gpu(bus_id)) and g.numa_node >= 0}
+        )
+        if not gpu_nodes:
+            continue
+
+        counters = numa.get(m.pid, {})
+        try:
+            numa_maps = Path(f"/proc/{m.pid}/numa_maps").read_text()
+        except OSError:
+            numa_maps = ""
+        cpus = sorted({cpu for node in gpu_nodes for cpu in topology.nodes.get(node, [])})
+        placements.append(
+            Placement(
+                pid=m.pid,
+                comm=m.comm,
+                unit=process_unit(m.pid),
+                gpus=gpus,
+                gpu_nodes=gpu_nodes,
+                cpus=cpus,
+                oncpu_ns={n: v for n, v in enumerate(counters.get("oncpu_ns", [])) if v},
+                alloc_bytes={n: v for n, v in enumerate(counters.get("alloc_bytes", [])) if v},
+                resident_bytes=numa_maps_by_node(numa_maps),
+                remote_threads=[
+                    (t.tid, t.comm, t.last_cpu)
+                    for t in m.threads
+                    if t.last_cpu >= 0 and t.last_cpu not in cpus
+                ],
+            )
+        )
+
+    return sorted(placements, key=lambda p: p.pid)
+
+
+def apply_dropin(placement: Placement, systemd_dir: Path = SYSTEMD_DIR) -> Path:
+    """Write the unit's drop-in, reload systemd and move its CPUs now."""
+    dropin_dir = systemd_dir / f"{placement.unit}.d"
+    dropin_dir.mkdir(parents=True, exist_ok=True)
+    path = dropin_dir / DROPIN_NAME
+    path.write_text(placement.dropin())
+    subprocess.run(["systemctl", "daemon-reload"], check=True)
+    # The cpuset takes effect immediately; NUMAPolicy= at the next start
+    subprocess.run(
+        [
+            "systemctl",
+            "set-property",
+            "--runtime",
+            placement.unit,
+            f"AllowedCPUs={format_cpu_list(placement.cpus)}",
+        ],
+        check=True,
+    )
+    return path
+
+
+def print_placements(scheduler: CortexScheduler, apply: bool = False) -> int:
+    """Print placement per GPU process; with apply, pin misplaced model units.
+
+    Returns the number of misplaced processes left unfixed.
+    """
+    topology = detect_numa_topology()
+    if not topology.multi_node:
+        print("Single NUMA node: every CPU and GPU is local, nothing to place")
+        return 0
+
+    print("TOPOLOGY")
+    for node, cpus in sorted(topology.nodes.items()):
+        gpus = [g for g in topology.gpus if g.numa_node == node]
+        names = ", ".join(f"{g.pci_bus_id} ({g.vendor}, root {g.pcie_root})" for g in gpus)
+        print(f"  node {node}: CPUs {format_cpu_list(cpus)}  GPUs: {names or '-'}")
+    print()
+
+    placements = get_placements(scheduler, topology)
+    if not placements:
+        print("No tracked process has a GPU open")
+        return 0
+
+    print(f"{'PID':<8} {'COMM':<16} {'GPU NODE':<9} {'REMOTE CPU%':<12} {'REMOTE MEM%':<12} UNIT")
+    print("-" * 90)
+    for p in placements:
+        nodes = ",".join(str(n) for n in p.gpu_nodes)
+        print(
+            f"{p.pid:<8} {p.comm[:15]:<16} {nodes:<9} {p.remote_cpu_pct:<12.1f} "
+            f"{p.remote_memory_pct:<12.1f} {p.unit or '-'}"
+        )
+
+    unfixed = 0
+    for p in placements:
+        if not p.misplaced:
+            continue
+        print()
+        print(f"{p.comm} (PID {p.pid}) runs or allocates away from its GPUs' node:")
+        for tid, comm, cpu in p.remote_threads[:5]:
+            node = topology.node_of_cpu(cpu)
+            print(f"  thread {tid} ({comm}) last ran on CPU {cpu}, node {node}")
+        if p.model_unit and apply:
+            path = apply_dropin(p)
+            print(f"  Wrote {path}; CPUs moved now, memory policy from the next restart:")
+            print(f"    systemctl restart {p.unit}")
+        elif p.model_unit:
+            unfixed += 1
+            print(f"  Add {SYSTEMD_DIR}/{p.unit}.d/{DROPIN_NAME} (or rerun with --apply):")
+            for line in p.dropin().splitlines():
+                print(f"    {line}")
+        else:
+            unfixed += 1
+            print(f"  Start it with: {p.numactl()} <command>")
+
+    return unfixed
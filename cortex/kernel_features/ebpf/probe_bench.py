@@ -0,0 +1,417 @@
+#!/usr/bin/env python3
+"""
+Probe overhead benchmark for cortex_sched.bpf.c.
+
+Measures what each program of a running cortex-schedd costs per event,
+from the kernel's own BPF run-time statistics (run_time_ns / run_cnt, the
+numbers behind kernel.bpf_stats_enabled), while synthetic storms drive
+the probes:
+
+    switch-untracked  pipe ping-pong between untracked processes
+    switch-tracked    the same between tracked processes (full accounting)
+    ioctl             NVIDIA-magic ioctls on /dev/null (GPU path)
+    mmap              model-sized anonymous mmaps (load/detection path)
+    sweep             the detection sweep, run through BPF_PROG_TEST_RUN
+
+The statistics are system wide, so other activity during a storm is
+averaged in; run it on an otherwise idle machine. Probe sampling
+(cortex_sched_loader.py sampling) lowers the average cost of the switch
+and ioctl paths, so compare runs made with the same setting. Results are
+JSON with --json, and --baseline compares them against an earlier run and
+fails on regressions.
+
+Usage:
+    sudo python3 probe_bench.py [--events N] [--json] [--baseline FILE]
+"""
+
+import argparse
+import contextlib
+import ctypes
+import errno
+import fcntl
+import json
+import mmap
+import os
+import platform
+import struct
+import sys
+import time
+from dataclasses import asdict, dataclass, field
+from pathlib import Path
+
+try:
+    from .pinned_maps import _addr, _bpf
+except ImportError:  # Run as a script
+    from pinned_maps import _addr, _bpf
+
+PIN_DIR = Path("/sys/fs/bpf/cortex")
+STATS_SYSCTL = Path("/proc/sys/kernel/bpf_stats_enabled")
+
+# bpf(2) commands (include/uapi/linux/bpf.h)
+BPF_MAP_UPDATE_ELEM = 2
+BPF_OBJ_GET = 7
+BPF_PROG_TEST_RUN = 10
+BPF_PROG_GET_NEXT_ID = 11
+BPF_PROG_GET_FD_BY_ID = 13
+BPF_OBJ_GET_INFO_BY_FD = 15
+BPF_ENABLE_STATS = 32
+BPF_STATS_RUN_TIME = 0
+BPF_F_RDONLY = 1 << 3
+
+# Offsets in struct bpf_prog_info
+_INFO_SIZE = 256
+_INFO_NR_MAP_IDS = 52
+_INFO_MAP_IDS = 56
+_INFO_NAME = 64
+_INFO_RUN_TIME_NS = 192
+_INFO_RUN_CNT = 200
+
+TRACK_USER = 1 << 0
+MMAP_STORM_BYTES = 128 << 20  # Above the 100 MB handle_mmap threshold
+NVIDIA_IOCTL = 0x4600  # Magic 'F', what handle_ioctl matches on
+SWEEP_RUNS = 1000  # A sweep visits every tracked process; far fewer are needed
+
+# Programs reported per workload (kernel names are cut to 15 characters)
+WORKLOAD_PROGRAMS = {
+    "switch-untracked": ("handle_sched_switch", "handle_wakeup"),
+    "switch-tracked": ("handle_sched_switch", "handle_wakeup"),
+    "ioctl": ("handle_ioctl",),
+    "mmap": ("handle_mmap",),
+    "sweep": ("sweep_once",),
+}
+
+
+@dataclass
+class ProgramCost:
+    run_cnt: int
+    run_time_ns: int
+
+    @property
+    def ns_per_event(self) -> float:
+        return self.run_time_ns / self.run_cnt if self.run_cnt else 0.0
+
+
+@dataclass
+class WorkloadResult:
+    workload: str
+    iterations: int
+    wall_s: float
+    programs: dict[str, ProgramCost] = field(default_factory=dict)
+
+    def to_json(self) -> dict:
+        return {
+            **asdict(self),
+            "programs": {
+                name: {**asdict(cost), "ns_per_event": round(cost.ns_per_event, 1)}
+                for name, cost in self.programs.items()
+            },
+        }
+
+
+def _prog_info(fd: int, map_ids: ctypes.Array | None = None) -> bytes:
+    info = ctypes.create_string_buffer(_INFO_SIZE)
+    if map_ids is not None:
+        struct.pack_into("=I", info, _INFO_NR_MAP_IDS, len(map_ids))
+        struct.pack_into("=Q", info, _INFO_MAP_IDS, ctypes.addressof(map_ids))
+    attr = ctypes.create_string_buffer(16)
+    struct.pack_into("=IIQ", attr, 0, fd, len(info), _addr(info))
+    _bpf(BPF_OBJ_GET_INFO_BY_FD, attr)
+    return info.raw
+
+
+def decode_prog_info(raw: bytes) -> tuple[str, ProgramCost]:
+    """Name and run-time statistics from a struct bpf_prog_info."""
+    name = raw[_INFO_NAME : _INFO_NAME + 16].split(b"\0", 1)[0].decode()
+    (run_time_ns,) = struct.unpack_from("=Q", raw, _INFO_RUN_TIME_NS)
+    (run_cnt,) = struct.unpack_from("=Q", raw, _INFO_RUN_CNT)
+    return name, ProgramCost(run_cnt=run_cnt, run_time_ns=run_time_ns)
+
+
+def _map_id(path: Path, flags: int = 0) -> tuple[int, int]:
+    """(fd, id) of a pinned map."""
+    attr = ctypes.create_string_buffer(16)
+    pathname = ctypes.create_string_buffer(os.fsencode(path))
+    struct.pack_into("=QII", attr, 0, _addr(pathname), 0, flags)
+    fd = _bpf(BPF_OBJ_GET, attr)
+    info = ctypes.create_string_buffer(88)
+    struct.pack_into("=IIQ", attr, 0, fd, len(info), _addr(info))
+    _bpf(BPF_OBJ_GET_INFO_BY_FD, attr)
+    return fd, struct.unpack_from("=I", info, 4)[0]
+
+
+class SchedulerPrograms:
+    """The programs of the running cortex-schedd: those using its pinned maps."""
+
+    def __init__(self, pin_dir: Path = PIN_DIR):
+        self.tracked_fd, _ = _map_id(pin_dir / "tracked_tgids")
+        self.fds: dict[str, int] = {}
+
+        ours = set()
+        for pin in pin_dir.iterdir():
+            fd, map_id = _map_id(pin, BPF_F_RDONLY)
+            os.close(fd)
+            ours.add(map_id)
+
+        prog_id = 0
+        attr = ctypes.create_string_buffer(12)
+        while True:
+            struct.pack_into("=III", attr, 0, prog_id, 0, 0)
+            try:
+                _bpf(BPF_PROG_GET_NEXT_ID, attr)
+            except FileNotFoundError:
+                break
+            prog_id = struct.unpack_from("=I", attr, 4)[0]
+            struct.pack_into("=III", attr, 0, prog_id, 0, 0)
+            try:
+                fd = _bpf(BPF_PROG_GET_FD_BY_ID, attr)
+            except FileNotFoundError:
+                continue  # Unloaded meanwhile
+
+            raw = _prog_info(fd)
+            nr_maps = struct.unpack_from("=I", raw, _INFO_NR_MAP_IDS)[0]
+            map_ids = (ctypes.c_uint32 * nr_maps)()
+            if nr_maps:
+                _prog_info(fd, map_ids)
+            name, _ = decode_prog_info(raw)
+            if ours.intersection(map_ids) and name not in self.fds:
+                self.fds[name] = fd
+            else:
+                os.close(fd)
+
+        if not self.fds:
+            raise RuntimeError("no programs of cortex-schedd found")
+
+    def costs(self) -> dict[str, ProgramCost]:
+        return {name: decode_prog_info(_prog_info(fd))[1] for name, fd in self.fds.items()}
+
+    def track(self, tgid: int):
+        """Admit a process to the tracked set (accounted on every switch)."""
+        key, value = ctypes.c_uint32(tgid), ctypes.c_uint32(TRACK_USER)
+        attr = ctypes.create_string_buffer(32)
+        struct.pack_into("=IIQQQ", attr, 0, self.tracked_fd, 0, _addr(key), _addr(value), 0)
+        _bpf(BPF_MAP_UPDATE_ELEM, attr)
+
+    def test_run(self, name: str):
+        attr = ctypes.create_string_buffer(80)
+        struct.pack_into("=I", attr, 0, self.fds[name])
+        _bpf(BPF_PROG_TEST_RUN, attr)
+
+    def close(self):
+        for fd in [self.tracked_fd, *self.fds.values()]:
+            os.close(fd)
+        self.fds.clear()
+
+
+def enable_stats():
+    """Turn on BPF run-time statistics for as long as the returned handle lives.
+
+    BPF_ENABLE_STATS (Linux 5.8+) reverts by itself when the fd is closed,
+    even if we crash; older kernels need the sysctl, restored by the caller.
+    """
+    attr = ctypes.create_string_buffer(4)
+    struct.pack_into("=I", attr, 0, BPF_STATS_RUN_TIME)
+    try:
+        return _bpf(BPF_ENABLE_STATS, attr), None
+    except OSError as e:
+        if e.errno not in (errno.EINVAL, errno.ENOSYS):
+            raise
+    previous = STATS_SYSCTL.read_text().strip()
+    STATS_SYSCTL.write_text("1")
+    return None, previous
+
+
+@contextlib.contextmanager
+def stats_enabled():
+    """BPF run-time statistics on for the duration of the block."""
+    stats_fd, previous = enable_stats()
+    try:
+        yield
+    finally:
+        if stats_fd is not None:
+            os.close(stats_fd)
+        else:
+            STATS_SYSCTL.write_text(previous)
+
+
+# =============================================================================
+# STORMS
+# =============================================================================
+
+
+def _in_child(work) -> int:
+    """Run work() in a forked child, so the process it tracks goes away after."""
+    pid = os.fork()
+    if pid == 0:
+        code = 0
+        try:
+            work()
+        except BaseException:
+            code = 1
+        os._exit(code)
+    return pid
+
+
+def switch_storm(iterations: int, programs: SchedulerPrograms | None):
+    """Ping-pong one byte between two processes: two switches per round trip."""
+    ping_r, ping_w = os.pipe()
+    pong_r, pong_w = os.pipe()
+
+    def echo():
+        if programs:
+            programs.track(os.getpid())
+        for _ in range(iterations):
+            os.read(ping_r, 1)
+            os.write(pong_w, b"x")
+
+    def drive():
+        if programs:
+            programs.track(os.getpid())
+        for _ in range(iterations):
+            os.write(ping_w, b"x")
+            os.read(pong_r, 1)
+
+    pids = [_in_child(echo), _in_child(drive)]
+    for fd in (ping_r, ping_w, pong_r, pong_w):
+        os.close(fd)
+    for pid in pids:
+        os.waitpid(pid, 0)
+
+
+def ioctl_storm(iterations: int):
+    def work():
+        with open("/dev/null", "rb") as f:
+            for _ in range(iterations):
+                try:
+                    fcntl.ioctl(f.fileno(), NVIDIA_IOCTL)
+                except OSError:
+                    pass  # ENOTTY; the tracepoint already fired
+
+    os.waitpid(_in_child(work), 0)
+
+
+def mmap_storm(iterations: int):
+    def work():
+        for _ in range(iterations):
+            mmap.mmap(-1, MMAP_STORM_BYTES, flags=mmap.MAP_PRIVATE, prot=mmap.PROT_READ).close()
+
+    os.waitpid(_in_child(work), 0)
+
+
+def run_workload(programs: SchedulerPrograms, workload: str, iterations: int) -> WorkloadResult:
+    before = programs.costs()
+    start = time.perf_counter()
+
+    if workload == "switch-untracked":
+        switch_storm(iterations, None)
+    elif workload == "switch-tracked":
+        switch_storm(iterations, programs)
+    elif workload == "ioctl":
+        ioctl_storm(iterations)
+    elif workload == "mmap":
+        mmap_storm(iterations)
+    elif workload == "sweep":
+        for _ in range(iterations):
+            programs.test_run("sweep_once")
+
+    wall_s = time.perf_counter() - start
+    after = programs.costs()
+    result = WorkloadResult(workload=workload, iterations=iterations, wall_s=round(wall_s, 3))
+    for name in WORKLOAD_PROGRAMS[workload]:
+        if name[:15] in after:
+            b, a = before[name[:15]], after[name[:15]]
+            result.programs[name] = ProgramCost(
+                run_cnt=a.run_cnt - b.run_cnt, run_time_ns=a.run_time_ns - b.run_time_ns
+            )
+    return result
+
+
+def compare(results: list[dict], baseline: list[dict], max_regression_pct: float) -> list[str]:
+    """Regressions of ns/event against a baseline run, as readable lines."""
+    base = {
+        (r["workload"], name): cost["ns_per_event"]
+        for r in baseline
+        for name, cost in r["programs"].items()
+    }
+    regressions = []
+    for r in results:
+        for name, cost in r["programs"].items():
+            before = base.get((r["workload"], name))
+            if not before:
+                continue
+            change = (cost["ns_per_event"] - before) / before * 100
+            if change > max_regression_pct:
+                regressions.append(
+                    f"{r['workload']}/{name}: {before:.0f} -> {cost['ns_per_event']:.0f} "
+                    f"ns/event (+{change:.0f}%)"
+                )
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Cortex eBPF probe overhead benchmark")
+    parser.add_argument("--pin-dir", type=Path, default=PIN_DIR, help="BPF map pin directory")
+    parser.add_argument(
+        "--events", type=int, default=200_000, help="iterations per storm (default 200000)"
+    )
+    parser.add_argument(
+        "--workload",
+        action="append",
+        choices=list(WORKLOAD_PROGRAMS),
+        help="run only this workload (repeatable)",
+    )
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    parser.add_argument("--baseline", type=Path, help="earlier --json output to compare with")
+    parser.add_argument(
+        "--max-regression",
+        type=float,
+        default=20.0,
+        help="with --baseline: fail if ns/event grew by more than this percentage",
+    )
+    args = parser.parse_args()
+
+    if os.geteuid() != 0:
+        print("ERROR: This script requires root privileges")
+        sys.exit(1)
+
+    try:
+        programs = SchedulerPrograms(args.pin_dir)
+    except (OSError, RuntimeError) as e:
+        print(f"ERROR: cannot find a running cortex-schedd: {e}")
+        sys.exit(1)
+
+    try:
+        with stats_enabled():
+            results = [
+                run_workload(programs, workload, SWEEP_RUNS if workload == "sweep" else args.events)
+                for workload in args.workload or WORKLOAD_PROGRAMS
+            ]
+    finally:
+        programs.close()
+
+    output = {
+        "kernel": platform.release(),
+        "machine": platform.machine(),
+        "cpus": os.cpu_count(),
+        "results": [r.to_json() for r in results],
+    }
+
+    if args.json:
+        print(json.dumps(output, indent=2))
+    else:
+        print(f"{'WORKLOAD':<18} {'PROGRAM':<22} {'EVENTS':<10} {'NS/EVENT':<9}")
+        print("-" * 62)
+        for r in results:
+            for name, cost in r.programs.items():
+                print(f"{r.workload:<18} {name:<22} {cost.run_cnt:<10} {cost.ns_per_event:<9.0f}")
+
+    if args.baseline:
+        baseline = json.loads(args.baseline.read_text())["results"]
+        regressions = compare(output["results"], baseline, args.max_regression)
+        for line in regressions:
+            print(f"REGRESSION: {line}", file=sys.stderr)
+        if regressions:
+            sys.exit(2)
+
+
+if __name__ == "__main__":
+    main()
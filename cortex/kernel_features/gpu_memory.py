@@ -0,0 +1,522 @@
+#!/usr/bin/env python3
+"""
+Cortex GPU Memory Accounting
+
+Charges device memory to accelerator_limits profiles and enforces their
+GPU memory caps by refusing new sessions, not by letting the device run
+out of memory for every model on it.
+
+A sampler reads per-process device memory from NVML (NVIDIA) or ROCm SMI
+(AMD) through ctypes, so a sample costs a few library calls instead of an
+nvidia-smi process. Each process is charged to the profile whose cgroup
+it runs in (cortex-model@<profile>.service unless the profile names
+another unit or path), and each device is checked against the profile's
+caps:
+
+    gpu_memory_high  soft: over it, sessions are refused while the device
+                     has less than PRESSURE_FREE_FRACTION of it free
+    gpu_memory_max   hard: over it, sessions are always refused
+
+GPUMemoryAccountant samples every SAMPLE_INTERVAL seconds and writes the
+verdicts to STATE_FILE, where admit() reads them from any process. While
+cortex-schedd runs with --gpu-uprobes, it also keeps the headroom of each
+capped cgroup in the pinned gpu_budget map. The allocation uprobes count
+what the cgroup asks the runtime for and flag it once that outgrows the
+headroom; the accountant polls the flags and samples again at once rather
+than at the next tick.
+"""
+
+import contextlib
+import ctypes
+import ctypes.util
+import json
+import os
+import signal
+import threading
+import time
+from dataclasses import dataclass, field
+from pathlib import Path
+
+from cortex.kernel_features.accelerator_limits import (
+    AcceleratorLimitsManager,
+    ResourceLimits,
+    parse_memory_limit,
+)
+from cortex.kernel_features.ebpf.cortex_sched_loader import CGROUP_ROOT, PIN_DIR, unit_of_cgroup
+from cortex.kernel_features.ebpf.pinned_maps import PinnedMap
+
+STATE_FILE = Path(os.environ.get("CORTEX_GPU_MEMORY_STATE", "/run/cortex/gpu-memory.json"))
+SAMPLE_INTERVAL = 2.0
+PRESSURE_POLL_INTERVAL = 0.1  # Seconds between reads of the gpu_budget flags
+PRESSURE_FREE_FRACTION = 0.1  # A device with less free is short of memory
+STALE_SAMPLES = 5  # admit() ignores verdicts older than this many intervals
+MODEL_UNIT = "cortex-model@{}.service"
+
+NVML_LIB = "libnvidia-ml.so.1"
+ROCM_SMI_LIB = "librocm_smi64.so"
+
+
+class GPUBudgetValue(ctypes.Structure):
+    """Mirror of struct gpu_budget in cortex_sched.bpf.c."""
+
+    _fields_ = [
+        ("headroom_bytes", ctypes.c_uint64),
+        ("allocated_bytes", ctypes.c_uint64),
+        ("pressure_events", ctypes.c_uint64),
+        ("over", ctypes.c_uint32),
+        ("pad", ctypes.c_uint32),
+    ]
+
+
+@dataclass
+class DeviceMemory:
+    index: int
+    total_bytes: int
+    used_bytes: int
+
+    @property
+    def free_bytes(self) -> int:
+        return max(self.total_bytes - self.used_bytes, 0)
+
+
+@dataclass
+class ProcessMemory:
+    device: int
+    pid: int
+    used_bytes: int
+
+
+@dataclass
+class ProfileUsage:
+    """Device memory charged to one profile by a sample, and its verdict."""
+
+    name: str
+    devices: dict[int, int] = field(default_factory=dict)  # Device index -> bytes
+    pids: set[int] = field(default_factory=set)
+    cgroups: set[str] = field(default_factory=set)
+    state: str = "ok"  # "ok", "high" (over the soft cap) or "max" (over the hard cap)
+    admit: bool = True
+    reason: str = ""
+    headroom_bytes: int | None = None  # Room under the caps on its fullest device
+
+
+# =============================================================================
+# SAMPLERS
+# =============================================================================
+
+
+class _NvmlMemory(ctypes.Structure):
+    _fields_ = [
+        ("total", ctypes.c_ulonglong),
+        ("free", ctypes.c_ulonglong),
+        ("used", ctypes.c_ulonglong),
+    ]
+
+
+class _NvmlProcessInfo(ctypes.Structure):
+    """nvmlProcessInfo_t (v2/v3)."""
+
+    _fields_ = [
+        ("pid", ctypes.c_uint),
+        ("usedGpuMemory", ctypes.c_ulonglong),
+        ("gpuInstanceId", ctypes.c_uint),
+        ("computeInstanceId", ctypes.c_uint),
+    ]
+
+
+class NVMLSampler:
+    """Device and per-process memory from NVML."""
+
+    name = "nvml"
+    ERROR_INSUFFICIENT_SIZE = 7
+    VALUE_NOT_AVAILABLE = (1 << 64) - 1
+
+    def __init__(self, path: str | None = None):
+        self.lib = ctypes.CDLL(path or os.environ.get("CORTEX_NVML_LIB", NVML_LIB))
+        self._check(self.lib.nvmlInit_v2(), "nvmlInit_v2")
+        count = ctypes.c_uint()
+        self._check(self.lib.nvmlDeviceGetCount_v2(ctypes.byref(count)), "nvmlDeviceGetCount_v2")
+        self.handles = []
+        for i in range(count.value):
+            handle = ctypes.c_void_p()
+            self._check(
+                self.lib.nvmlDeviceGetHandleByIndex_v2(i, ctypes.byref(handle)),
+                "nvmlDeviceGetHandleByIndex_v2",
+            )
+            self.handles.append(handle)
+        self._infos = (_NvmlProcessInfo * 64)()
+
+    @staticmethod
+    def _check(ret: int, call: str):
+        if ret != 0:
+            raise OSError(f"{call} failed (NVML error {ret})")
+
+    def _processes(self, handle) -> list[_NvmlProcessInfo]:
+        while True:
+            count = ctypes.c_uint(len(self._infos))
+            ret = self.lib.nvmlDeviceGetComputeRunningProcesses_v3(
+                handle, ctypes.byref(count), self._infos
+            )
+            if ret != self.ERROR_INSUFFICIENT_SIZE:
+                self._check(ret, "nvmlDeviceGetComputeRunningProcesses_v3")
+                return self._infos[: count.value]
+            self._infos = (_NvmlProcessInfo * (count.value * 2))()
+
+    def sample(self) -> tuple[list[DeviceMemory], list[ProcessMemory]]:
+        devices, processes = [], []
+        memory = _NvmlMemory()
+        for i, handle in enumerate(self.handles):
+            self._check(
+                self.lib.nvmlDeviceGetMemoryInfo(handle, ctypes.byref(memory)),
+                "nvmlDeviceGetMemoryInfo",
+            )
+            devices.append(DeviceMemory(i, memory.total, memory.used))
+            for info in self._processes(handle):
+                used = 0 if info.usedGpuMemory == self.VALUE_NOT_AVAILABLE else info.usedGpuMemory
+                processes.append(ProcessMemory(i, info.pid, used))
+        return devices, processes
+
+    def close(self):
+        self.lib.nvmlShutdown()
+
+
+class _RsmiProcessInfo(ctypes.Structure):
+    _fields_ = [
+        ("process_id", ctypes.c_uint32),
+        ("pasid", ctypes.c_uint32),
+        ("vram_usage", ctypes.c_uint64),
+        ("sdma_usage", ctypes.c_uint64),
+        ("cu_occupancy", ctypes.c_uint32),
+    ]
+
+
+class ROCmSMISampler:
+    """Device and per-process memory from ROCm SMI."""
+
+    name = "rocm-smi"
+    MEM_TYPE_VRAM = 0
+    STATUS_INSUFFICIENT_SIZE = 11
+
+    def __init__(self, path: str | None = None):
+        path = path or os.environ.get("CORTEX_ROCM_SMI_LIB")
+        if not path:
+            path = ctypes.util.find_library("rocm_smi64")
+        if not path and Path("/opt/rocm/lib", ROCM_SMI_LIB).exists():
+            path = str(Path("/opt/rocm/lib", ROCM_SMI_LIB))
+        self.lib = ctypes.CDLL(path or ROCM_SMI_LIB)
+        self._check(self.lib.rsmi_init(ctypes.c_uint64(0)), "rsmi_init")
+        count = ctypes.c_uint32()
+        self._check(
+            self.lib.rsmi_num_monitor_devices(ctypes.byref(count)), "rsmi_num_monitor_devices"
+        )
+        self.count = count.value
+
+    @staticmethod
+    def _check(ret: int, call: str):
+        if ret != 0:
+            raise OSError(f"{call} failed (ROCm SMI status {ret})")
+
+    def _memory(self, device: int, call: str) -> int:
+        value = ctypes.c_uint64()
+        self._check(
+            getattr(self.lib, call)(device, self.MEM_TYPE_VRAM, ctypes.byref(value)), call
+        )
+        return value.value
+
+    def _pids(self) -> list[int]:
+        count = ctypes.c_uint32()
+        self._check(
+            self.lib.rsmi_compute_process_info_get(None, ctypes.byref(count)),
+            "rsmi_compute_process_info_get",
+        )
+        while True:
+            infos = (_RsmiProcessInfo * max(count.value, 1))()
+            ret = self.lib.rsmi_compute_process_info_get(infos, ctypes.byref(count))
+            if ret != self.STATUS_INSUFFICIENT_SIZE:
+                self._check(ret, "rsmi_compute_process_info_get")
+                return [info.process_id for info in infos[: count.value]]
+
+    def sample(self) -> tuple[list[DeviceMemory], list[ProcessMemory]]:
+        devices = [
+            DeviceMemory(
+                i,
+                self._memory(i, "rsmi_dev_memory_total_get"),
+                self._memory(i, "rsmi_dev_memory_usage_get"),
+            )
+            for i in range(self.count)
+        ]
+        processes = []
+        indices = (ctypes.c_uint32 * max(self.count, 1))()
+        info = _RsmiProcessInfo()
+        for pid in self._pids():
+            n = ctypes.c_uint32(len(indices))
+            if self.lib.rsmi_compute_process_gpus_get(pid, indices, ctypes.byref(n)) != 0:
+                continue  # Exited since it was listed
+            for device in indices[: n.value]:
+                ret = self.lib.rsmi_compute_process_info_by_device_get(
+                    pid, device, ctypes.byref(info)
+                )
+                if ret == 0:
+                    processes.append(ProcessMemory(device, pid, info.vram_usage))
+        return devices, processes
+
+    def close(self):
+        self.lib.rsmi_shut_down()
+
+
+def open_sampler():
+    """NVML if it loads, else ROCm SMI, else None."""
+    for sampler in (NVMLSampler, ROCmSMISampler):
+        with contextlib.suppress(OSError, AttributeError):
+            return sampler()
+    return None
+
+
+# =============================================================================
+# ACCOUNTING
+# =============================================================================
+
+
+def cgroup_of(pid: int, proc: Path = Path("/proc")) -> str | None:
+    """cgroup v2 path of a process, or None if it is gone."""
+    try:
+        text = (proc / str(pid) / "cgroup").read_text()
+    except OSError:
+        return None
+    for line in text.splitlines():
+        if line.startswith("0::"):
+            return line[3:]
+    return None
+
+
+def profile_for(path: str, profiles: list[ResourceLimits]) -> ResourceLimits | None:
+    """The profile whose unit (or cgroup subtree) a cgroup path is in."""
+    unit, _ = unit_of_cgroup(path)
+    for p in profiles:
+        want = p.cgroup or MODEL_UNIT.format(p.name)
+        if want.startswith("/"):
+            if f"{path}/".startswith(f"{want.rstrip('/')}/"):
+                return p
+        elif want == unit:
+            return p
+    return None
+
+
+def judge(usage: ProfileUsage, limits: ResourceLimits, devices: dict[int, DeviceMemory]):
+    """Set a profile's state, verdict and headroom from its per-device usage."""
+    watched = set(usage.devices) or set(limits.gpu_ids) or set(devices)
+    headroom = None
+    for index in sorted(watched):
+        device = devices.get(index)
+        if device is None:
+            continue
+        used = usage.devices.get(index, 0)
+        high = parse_memory_limit(limits.gpu_memory_high, device.total_bytes)
+        hard = parse_memory_limit(limits.gpu_memory_max, device.total_bytes)
+        if hard is not None and used >= hard:
+            usage.state, usage.admit = "max", False
+            usage.reason = f"GPU {index}: {used >> 20} MiB used, gpu_memory_max is {hard >> 20} MiB"
+        elif high is not None and used >= high and usage.state == "ok":
+            usage.state = "high"
+            if device.free_bytes < device.total_bytes * PRESSURE_FREE_FRACTION:
+                usage.admit = False
+                usage.reason = (
+                    f"GPU {index}: {used >> 20} MiB used, over gpu_memory_high "
+                    f"({high >> 20} MiB) with {device.free_bytes >> 20} MiB free"
+                )
+        cap = hard if hard is not None else high
+        if cap is not None:
+            room = max(min(cap - used, device.free_bytes), 0)
+            headroom = room if headroom is None else min(headroom, room)
+    usage.headroom_bytes = headroom
+
+
+def admit(name: str, state_file: Path | None = None) -> tuple[bool, str]:
+    """Whether profile name may start a new session, from the last sample.
+
+    Admits when no accountant has written a recent sample: without one
+    there is nothing to go by, and refusing would stop every model.
+    """
+    try:
+        state = json.loads((state_file or STATE_FILE).read_text())
+    except (OSError, ValueError):
+        return True, "no GPU memory sample"
+    if time.time() - state["sampled_at"] > STALE_SAMPLES * state["interval"]:
+        return True, "GPU memory sample is stale"
+    verdict = state["profiles"].get(name)
+    if verdict is None:
+        return True, ""
+    return verdict["admit"], verdict["reason"]
+
+
+class GPUMemoryAccountant:
+    """Samples device memory on a timer and charges it to profiles.
+
+    sample() takes one sample, writes the verdicts to state_file and the
+    headroom of capped cgroups to the pinned gpu_budget map (when
+    cortex-schedd is running). start() samples in the background, and
+    again as soon as an allocation uprobe flags a cgroup.
+    """
+
+    def __init__(
+        self,
+        manager: AcceleratorLimitsManager | None = None,
+        sampler=None,
+        interval: float = SAMPLE_INTERVAL,
+        state_file: Path | None = None,
+        proc: Path = Path("/proc"),
+        cgroup_root: Path = CGROUP_ROOT,
+        pin_dir: Path = PIN_DIR,
+    ):
+        self.manager = manager or AcceleratorLimitsManager()
+        self.sampler = sampler or open_sampler()
+        self.interval = interval
+        self.state_file = state_file or STATE_FILE
+        self.proc = proc
+        self.cgroup_root = cgroup_root
+        self.pin_dir = pin_dir
+        self._budget_map: PinnedMap | None = None
+        self._budgeted: set[int] = set()  # cgroup ids written to gpu_budget
+        self._thread: threading.Thread | None = None
+        self._stop = threading.Event()
+
+    def sample(self) -> dict[str, ProfileUsage]:
+        devices, processes = self.sampler.sample()
+        by_index = {d.index: d for d in devices}
+        profiles = self.manager.db.list_all()
+        usage = {p.name: ProfileUsage(p.name) for p in profiles}
+
+        cgroups: dict[int, str | None] = {}
+        for process in processes:
+            if process.pid not in cgroups:
+                cgroups[process.pid] = cgroup_of(process.pid, self.proc)
+            path = cgroups[process.pid]
+            limits = profile_for(path, profiles) if path else None
+            if limits is None:
+                continue
+            charged = usage[limits.name]
+            charged.devices[process.device] = (
+                charged.devices.get(process.device, 0) + process.used_bytes
+            )
+            charged.pids.add(process.pid)
+            charged.cgroups.add(path)
+        for limits in profiles:
+            judge(usage[limits.name], limits, by_index)
+
+        self._write_state(devices, usage)
+        with contextlib.suppress(OSError):
+            self._write_budgets(usage)
+        return usage
+
+    def _write_state(self, devices: list[DeviceMemory], usage: dict[str, ProfileUsage]):
+        state = {
+            "sampled_at": time.time(),
+            "interval": self.interval,
+            "sampler": self.sampler.name,
+            "devices": [
+                {"index": d.index, "total_bytes": d.total_bytes, "used_bytes": d.used_bytes}
+                for d in devices
+            ],
+            "profiles": {
+                u.name: {
+                    "devices": {str(i): b for i, b in sorted(u.devices.items())},
+                    "state": u.state,
+                    "admit": u.admit,
+                    "reason": u.reason,
+                }
+                for u in usage.values()
+            },
+        }
+        self.state_file.parent.mkdir(parents=True, exist_ok=True)
+        tmp = self.state_file.with_suffix(".tmp")
+        tmp.write_text(json.dumps(state))
+        os.replace(tmp, self.state_file)  # Readers never see half a file
+
+    def _budgets(self) -> PinnedMap | None:
+        if self._budget_map is None and (self.pin_dir / "gpu_budget").exists():
+            self._budget_map = PinnedMap(
+                self.pin_dir / "gpu_budget", ctypes.c_uint64, GPUBudgetValue, writable=True
+            )
+        return self._budget_map
+
+    def _write_budgets(self, usage: dict[str, ProfileUsage]):
+        """Reset the budgets of capped cgroups to their new headroom."""
+        budgets = self._budgets()
+        if budgets is None:
+            return
+        written = set()
+        for u in usage.values():
+            if u.headroom_bytes is None:
+                continue
+            for path in u.cgroups:
+                with contextlib.suppress(OSError):
+                    cgid = os.stat(self.cgroup_root / path.lstrip("/")).st_ino
+                    budgets.update(cgid, GPUBudgetValue(headroom_bytes=u.headroom_bytes))
+                    written.add(cgid)
+        for cgid in self._budgeted - written:
+            budgets.delete(cgid)
+        self._budgeted = written
+
+    def under_pressure(self) -> bool:
+        """Whether an allocation uprobe flagged a cgroup since the last sample."""
+        budgets = self._budget_map
+        if budgets is None or not self._budgeted:
+            return False
+        try:
+            return any(value.over for _, value in budgets.items())
+        except OSError:
+            return False
+
+    def _run(self):
+        due = 0.0
+        while not self._stop.is_set():
+            if time.monotonic() >= due or self.under_pressure():
+                with contextlib.suppress(OSError):
+                    self.sample()
+                due = time.monotonic() + self.interval
+            # Poll the flags only while there are budgets to flag
+            wait = PRESSURE_POLL_INTERVAL if self._budgeted else due - time.monotonic()
+            self._stop.wait(max(wait, 0))
+
+    def start(self):
+        if self._thread is not None:
+            return
+        self._stop.clear()
+        self._thread = threading.Thread(target=self._run, name="gpu-memory", daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        if self._thread is None:
+            return
+        self._stop.set()
+        self._thread.join()
+        self._thread = None
+        if self._budget_map is not None:
+            for cgid in self._budgeted:
+                with contextlib.suppress(OSError):
+                    self._budget_map.delete(cgid)
+            self._budgeted.clear()
+            self._budget_map.close()
+            self._budget_map = None
+
+    def run(self):
+        """Sample in the foreground until SIGINT or SIGTERM."""
+        signal.signal(signal.SIGTERM, lambda *_: self._stop.set())
+        print(f"Accounting GPU memory with {self.sampler.name} every {self.interval:g}s")
+        self.start()
+        try:
+            while self._thread.is_alive():
+                self._thread.join(1.0)
+        except KeyboardInterrupt:
+            pass
+        self.stop()
+
+    def report(self, usage: dict[str, ProfileUsage]):
+        print(f"\n{'PROFILE':<20} {'GPU MEMORY':<28} {'STATE':<8} {'SESSIONS':<10}")
+        print("-" * 70)
+        for u in usage.values():
+            memory = ", ".join(f"{i}: {b / 2**30:.1f}G" for i, b in sorted(u.devices.items()))
+            sessions = "admit" if u.admit else "refuse"
+            print(f"{u.name:<20} {memory or '-':<28} {u.state:<8} {sessions:<10}")
+            if u.reason:
+                print(f"  {u.reason}")
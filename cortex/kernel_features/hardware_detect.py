@@ -46,6 +46,7 @@ class Accelerator:
     pci_bus_id: str = ""
     index: int = 0
     features: list[str] = field(default_factory=list)
+    numa_node: int = -1  # -1: unknown, or a single-node system
 
     def to_dict(self) -> dict[str, Any]:
         d = asdict(self)
@@ -66,6 +67,7 @@ class HardwareProfile:
     max_model_size_gb: float = 0.0
     max_context_length: int = 0
     optimization_hints: list[str] = field(default_factory=list)
+    topology: "NumaTopology | None" = None
 
     def to_dict(self) -> dict[str, Any]:
         d = asdict(self)
@@ -78,6 +80,146 @@ class HardwareProfile:
         return json.dumps(self.to_dict(), indent=indent)
 
 
+@dataclass
+class GpuTopology:
+    """Where a GPU sits: its PCIe root port, NUMA node and the CPUs local to it."""
+
+    pci_bus_id: str  # Sysfs form, e.g. 0000:41:00.0
+    vendor: str
+    pcie_root: str  # Root port (or the host bridge, for GPUs directly on it)
+    numa_node: int  # -1 if the firmware does not say
+    cpus: list[int] = field(default_factory=list)
+
+
+@dataclass
+class NumaTopology:
+    """GPU -> PCIe root -> NUMA node -> CPU list, from sysfs."""
+
+    nodes: dict[int, list[int]] = field(default_factory=dict)  # node -> CPUs
+    gpus: list[GpuTopology] = field(default_factory=list)
+
+    @property
+    def multi_node(self) -> bool:
+        return len(self.nodes) > 1
+
+    def node_of_cpu(self, cpu: int) -> int:
+        for node, cpus in self.nodes.items():
+            if cpu in cpus:
+                return node
+        return -1
+
+    def gpu(self, pci_bus_id: str) -> GpuTopology | None:
+        bus_id = normalize_pci_bus_id(pci_bus_id)
+        return next((g for g in self.gpus if g.pci_bus_id == bus_id), None)
+
+
+# PCI class (base class byte) and vendor ids of the GPUs we place work near
+PCI_CLASS_DISPLAY = 0x03
+PCI_CLASS_ACCELERATOR = 0x12
+GPU_VENDORS = {0x10DE: "NVIDIA", 0x1002: "AMD", 0x8086: "Intel"}
+
+
+def parse_cpu_list(text: str) -> list[int]:
+    """Parse a kernel CPU list ("0-3,8,10-11") into CPU numbers."""
+    cpus: list[int] = []
+    for part in text.strip().split(","):
+        if not part:
+            continue
+        lo, _, hi = part.partition("-")
+        cpus.extend(range(int(lo), int(hi or lo) + 1))
+    return cpus
+
+
+def format_cpu_list(cpus) -> str:
+    """Inverse of parse_cpu_list, with ranges: [0, 1, 2, 5] -> "0-2,5"."""
+    ranges: list[str] = []
+    cpus = sorted(set(cpus))
+    start = prev = None
+    for cpu in cpus + [None]:
+        if prev is not None and cpu == prev + 1:
+            prev = cpu
+            continue
+        if start is not None:
+            ranges.append(str(start) if start == prev else f"{start}-{prev}")
+        start = prev = cpu
+    return ",".join(ranges)
+
+
+def normalize_pci_bus_id(bus_id: str) -> str:
+    """nvidia-smi's 00000000:41:00.0 (or a bare 41:00.0) in sysfs form, 0000:41:00.0."""
+    bus_id = bus_id.strip().lower()
+    domain, _, rest = bus_id.rpartition(":")
+    domain, _, bus = domain.rpartition(":")
+    return f"{int(domain or '0', 16):04x}:{bus}:{rest}"
+
+
+def _read_sysfs(path: str) -> str | None:
+    try:
+        with open(path) as f:
+            return f.read().strip()
+    except OSError:
+        return None
+
+
+def detect_numa_topology(sysfs: str = "/sys") -> NumaTopology:
+    """Read the NUMA nodes and the GPUs' place in the PCIe tree from sysfs."""
+    topology = NumaTopology()
+
+    node_dir = os.path.join(sysfs, "devices/system/node")
+    try:
+        entries = os.listdir(node_dir)
+    except OSError:
+        entries = []
+    for entry in entries:
+        if entry.startswith("node") and entry[4:].isdigit():
+            cpulist = _read_sysfs(os.path.join(node_dir, entry, "cpulist"))
+            if cpulist is not None:
+                topology.nodes[int(entry[4:])] = parse_cpu_list(cpulist)
+
+    pci_dir = os.path.join(sysfs, "bus/pci/devices")
+    try:
+        devices = sorted(os.listdir(pci_dir))
+    except OSError:
+        devices = []
+    for bus_id in devices:
+        dev = os.path.join(pci_dir, bus_id)
+        try:
+            pci_class = int(_read_sysfs(os.path.join(dev, "class")) or "0", 16) >> 16
+            vendor = int(_read_sysfs(os.path.join(dev, "vendor")) or "0", 16)
+            numa_node = int(_read_sysfs(os.path.join(dev, "numa_node")) or "-1")
+        except ValueError:
+            continue
+        if pci_class not in (PCI_CLASS_DISPLAY, PCI_CLASS_ACCELERATOR):
+            continue
+        if vendor not in GPU_VENDORS:
+            continue
+
+        # .../devices/pci0000:40/0000:40:01.1/0000:41:00.0: the component
+        # after the host bridge is the root port the GPU hangs off
+        path = os.path.realpath(dev).split("/")
+        bridges = [i for i, p in enumerate(path) if p.startswith("pci")]
+        pcie_root = ""
+        if bridges:
+            below = path[bridges[0] + 1 :]
+            pcie_root = below[0] if len(below) > 1 else path[bridges[0]]
+
+        cpulist = _read_sysfs(os.path.join(dev, "local_cpulist")) or ""
+        cpus = parse_cpu_list(cpulist)
+        if numa_node < 0 and len(topology.nodes) == 1:
+            numa_node = next(iter(topology.nodes))
+        topology.gpus.append(
+            GpuTopology(
+                pci_bus_id=bus_id,
+                vendor=GPU_VENDORS[vendor],
+                pcie_root=pcie_root,
+                numa_node=numa_node,
+                cpus=cpus or topology.nodes.get(numa_node, []),
+            )
+        )
+
+    return topology
+
+
 def run_command(cmd: list[str], timeout: int = 10) -> str | None:
     """Run a shell command and return stdout, or None on failure."""
     try:
@@ -428,6 +570,20 @@ def generate_optimization_hints(profile: HardwareProfile) -> list[str]:
         hints.append("NPU detected - use INT4/INT8 quantized models for best NPU performance")
         hints.append("Hybrid CPU+NPU inference available for larger models")
 
+    # NUMA hints: GPUs only get host memory and CPUs at full speed from
+    # their own node, and numa_balancing (off in 99-cortex-llm.conf) will
+    # not move a model server that started on the wrong one
+    topology = profile.topology
+    if topology and topology.multi_node:
+        for acc in profile.accelerators:
+            gpu = topology.gpu(acc.pci_bus_id) if acc.pci_bus_id else None
+            if gpu and gpu.numa_node >= 0:
+                hints.append(
+                    f"{acc.name} ({gpu.pci_bus_id}) is on NUMA node {gpu.numa_node} "
+                    f"(CPUs {format_cpu_list(gpu.cpus)}): pin its model service there"
+                )
+        hints.append("Run 'cortex-sched placement' to check where model servers run and allocate")
+
     # Huge pages hint
     hints.append("Run 'cortex optimize-system' to apply sysctl tuning for LLM workloads")
 
@@ -451,6 +607,13 @@ def detect_accelerators() -> HardwareProfile:
     profile.accelerators.extend(detect_amd_npu())
     profile.accelerators.extend(detect_apple_silicon())
 
+    # Place each PCI accelerator in the NUMA topology
+    profile.topology = detect_numa_topology()
+    for acc in profile.accelerators:
+        gpu = profile.topology.gpu(acc.pci_bus_id) if acc.pci_bus_id else None
+        if gpu:
+            acc.numa_node = gpu.numa_node
+
     # Calculate totals
     profile.total_vram_gb = sum(acc.vram_gb for acc in profile.accelerators)
     profile.total_system_ram_gb = get_system_ram_gb()
@@ -512,6 +675,8 @@ if __name__ == "__main__":
                 print(f"      VRAM: {acc.vram_gb} GB")
                 if acc.compute_capability:
                     print(f"      Compute: {acc.compute_capability}")
+                if acc.numa_node >= 0:
+                    print(f"      NUMA node: {acc.numa_node}")
                 if acc.features:
                     print(f"      Features: {', '.join(acc.features)}")
                 print()
@@ -3,21 +3,275 @@
 Cortex KV-Cache Manager
 
 User-space KV-cache management for LLM inference optimization.
+
+A pool is a shared segment of fixed-size KV blocks (paged-attention
+style), laid out as in kvpool/cortex_kvpool.h. It lives on hugetlbfs when
+vm.nr_hugepages has room for it, else in POSIX shared memory. Blocks are
+allocated and freed by libcortex_kvpool (kvpool/cortex_kvpool.c) with a
+lock-free free list inside the segment, so any number of server
+processes can share a pool without going through Python locks or SQLite.
+
+CachePolicy is enforced there too: lookups mark blocks with relaxed
+atomic stores (SharedMemoryPool.access), and a full pool evicts whole
+sequences picked by a clock sweep in the segment. Hit and miss counters
+live in the segment as well; the stats table is only a checkpoint of
+them, written every STATS_CHECKPOINT_INTERVAL seconds.
+
+Sequences that start with the same tokens (a shared system prompt) share
+their KV blocks: full blocks are published to a prefix index in the
+segment under a chained hash of their tokens, and KVCacheManager.attach()
+hands a new sequence the longest published prefix before allocating the
+rest. Shared blocks are reference counted and copied on write.
+
+The published blocks outlive the segment in a snapshot file
+(save_snapshot/restore_snapshot, save-state/restore-state on the command
+line): cortex-model@.service saves it when a model stops and restores it
+before the next start, so a reboot does not throw the prefix cache away.
 """
 
 import builtins
 import contextlib
+import ctypes
+import ctypes.util
+import errno
+import hashlib
 import json
+import mmap
+import os
 import sqlite3
+import threading
+import time
+import zlib
+from concurrent.futures import ThreadPoolExecutor
 from dataclasses import asdict, dataclass
 from enum import Enum
-from multiprocessing import shared_memory
+from multiprocessing import resource_tracker, shared_memory
 from pathlib import Path
 
 from cortex.utils.db_pool import get_connection_pool
 
-CORTEX_DB = Path.home() / ".cortex/kv_cache.db"
+# Pool registry ($CORTEX_KV_DB), shared by whoever creates the pools and the
+# model services that snapshot them, which cannot write a home directory
+CORTEX_DB = Path("/var/lib/cortex/kv_cache.db")
 SHM_PREFIX = "cortex_kv_"
+HUGETLBFS_DIR = Path("/dev/hugepages/cortex")
+KVPOOL_LIB = "libcortex_kvpool.so"
+
+DEFAULT_BLOCK_SIZE = 2 << 20  # 16 tokens of an 8B model's fp16 KV; one huge page
+DEFAULT_BLOCK_TOKENS = 16
+HUGE_PAGE_SIZE = 2 << 20
+PAGE_SIZE = mmap.PAGESIZE
+STATS_CHECKPOINT_INTERVAL = 30.0  # Seconds between copies of the hit counters to SQLite
+EVICT_RETRIES = 3  # Other processes may take the blocks we evicted first
+SNAPSHOT_DIR = Path(os.environ.get("CORTEX_KV_SNAPSHOT_DIR", "/var/lib/cortex/kv-snapshots"))
+SNAPSHOT_WORKERS = 4  # Blocks copied and checksummed at once by save and restore
+
+# From kvpool/cortex_kvpool.h
+KVPOOL_MAGIC = 0x4C4F4F50564B5843
+KVPOOL_VERSION = 3
+KVPOOL_F_HUGETLB = 1 << 0
+KVPOOL_USED = 1 << 63
+KVPOOL_IDLE = 1 << 62
+KVPOOL_SHARED = KVPOOL_USED | (KVPOOL_IDLE - 1)
+KVPOOL_POLICIES = {"lru": 0, "lfu": 1, "fifo": 2}  # KVPOOL_POLICY_*
+RESTORE_OWNER = KVPOOL_IDLE - 2  # Holds blocks being restored; above any sequence id
+
+SNAPSHOT_MAGIC = int.from_bytes(b"CXKVSNAP", "little")
+SNAPSHOT_VERSION = 1
+SNAPSHOT_F_VALID = 1 << 0  # Record matches the data in its slot
+
+
+class KVPoolHeader(ctypes.Structure):
+    """Mirror of struct kvpool_header (256 bytes; cache-line padded)."""
+
+    _fields_ = [
+        ("magic", ctypes.c_uint64),
+        ("version", ctypes.c_uint32),
+        ("flags", ctypes.c_uint32),
+        ("block_size", ctypes.c_uint64),
+        ("nr_blocks", ctypes.c_uint64),
+        ("meta_offset", ctypes.c_uint64),
+        ("data_offset", ctypes.c_uint64),
+        ("segment_size", ctypes.c_uint64),
+        ("created_ns", ctypes.c_uint64),
+        ("free_head", ctypes.c_uint64),
+        ("nr_free", ctypes.c_uint64),
+        ("_pad0", ctypes.c_uint64 * 6),
+        ("allocs", ctypes.c_uint64),
+        ("frees", ctypes.c_uint64),
+        ("alloc_failures", ctypes.c_uint64),
+        ("hits", ctypes.c_uint64),
+        ("misses", ctypes.c_uint64),
+        ("evictions", ctypes.c_uint64),
+        ("_pad1", ctypes.c_uint64 * 2),
+        ("policy", ctypes.c_uint32),
+        ("block_tokens", ctypes.c_uint32),
+        ("clock_hand", ctypes.c_uint64),
+        ("alloc_seq", ctypes.c_uint64),
+        ("index_offset", ctypes.c_uint64),
+        ("nr_slots", ctypes.c_uint64),
+        ("salt", ctypes.c_uint8 * 16),
+        ("_pad2", ctypes.c_uint64),
+    ]
+
+
+class KVPoolBlock(ctypes.Structure):
+    """Mirror of struct kvpool_block."""
+
+    _fields_ = [
+        ("state", ctypes.c_uint64),
+        ("next", ctypes.c_uint32),
+        ("refs", ctypes.c_uint32),
+        ("alloc_seq", ctypes.c_uint64),
+        ("prefix_hash", ctypes.c_uint64),
+        ("users", ctypes.c_uint32),
+        ("pad", ctypes.c_uint32),
+    ]
+
+
+class SnapshotHeader(ctypes.Structure):
+    """First page of a snapshot file: the geometry and salt of its pool."""
+
+    _fields_ = [
+        ("magic", ctypes.c_uint64),
+        ("version", ctypes.c_uint32),
+        ("policy", ctypes.c_uint32),
+        ("block_size", ctypes.c_uint64),
+        ("nr_blocks", ctypes.c_uint64),
+        ("block_tokens", ctypes.c_uint32),
+        ("nr_valid", ctypes.c_uint32),
+        ("records_offset", ctypes.c_uint64),
+        ("data_offset", ctypes.c_uint64),
+        ("generation", ctypes.c_uint64),  # Saves so far
+        ("saved_ns", ctypes.c_uint64),  # CLOCK_REALTIME of the last one
+        ("salt", ctypes.c_uint8 * 16),
+    ]
+
+
+class SnapshotRecord(ctypes.Structure):
+    """The saved state of one block (record i describes pool block i)."""
+
+    _fields_ = [
+        ("prefix_hash", ctypes.c_uint64),
+        ("crc", ctypes.c_uint32),  # zlib.crc32 of the block's data
+        ("refs", ctypes.c_uint32),  # Reference count when saved: restore order
+        ("flags", ctypes.c_uint32),  # SNAPSHOT_F_*
+        ("pad", ctypes.c_uint32),
+    ]
+
+
+def _align(value: int, alignment: int) -> int:
+    return (value + alignment - 1) // alignment * alignment
+
+
+def index_layout(nr_blocks: int) -> tuple[int, int]:
+    """(index_offset, nr_slots) of the prefix index after the block table."""
+    index_offset = ctypes.sizeof(KVPoolHeader) + nr_blocks * ctypes.sizeof(KVPoolBlock)
+    return index_offset, 1 << (2 * nr_blocks - 1).bit_length()
+
+
+def pool_layout(size: int, block_size: int, page_size: int = PAGE_SIZE) -> tuple[int, int, int]:
+    """(nr_blocks, data_offset, segment_size) for a pool of size data bytes."""
+    nr_blocks = size // block_size
+    if nr_blocks < 1 or nr_blocks >= 1 << 31:
+        raise ValueError(f"pool of {size} bytes cannot hold 1 to 2^31 blocks of {block_size}")
+    index_offset, nr_slots = index_layout(nr_blocks)
+    data_offset = _align(index_offset + nr_slots * ctypes.sizeof(ctypes.c_uint32), page_size)
+    return nr_blocks, data_offset, _align(data_offset + nr_blocks * block_size, page_size)
+
+
+def snapshot_layout(nr_blocks: int) -> tuple[int, int]:
+    """(records_offset, data_offset) of a snapshot file of nr_blocks blocks.
+
+    Block i is saved at data_offset + i * block_size, so the file has holes
+    where no block was ever written.
+    """
+    records = nr_blocks * ctypes.sizeof(SnapshotRecord)
+    return PAGE_SIZE, _align(PAGE_SIZE + records, PAGE_SIZE)
+
+
+def snapshot_path(name: str) -> Path:
+    return SNAPSHOT_DIR / f"{name}.snap"
+
+
+def read_snapshot_header(path: Path) -> SnapshotHeader | None:
+    """The header of a snapshot file, or None if path is not one."""
+    with open(path, "rb") as f:
+        data = f.read(ctypes.sizeof(SnapshotHeader))
+    if len(data) < ctypes.sizeof(SnapshotHeader):
+        return None
+    header = SnapshotHeader.from_buffer_copy(data)
+    if header.magic != SNAPSHOT_MAGIC or header.version != SNAPSHOT_VERSION:
+        return None
+    return header
+
+
+def hugepages_free() -> int:
+    """Bytes of free default-size huge pages (vm.nr_hugepages minus use)."""
+    meminfo = {}
+    try:
+        with open("/proc/meminfo") as f:
+            for line in f:
+                key, _, value = line.partition(":")
+                meminfo[key] = int(value.split()[0])
+    except (OSError, ValueError, IndexError):
+        return 0
+    return meminfo.get("HugePages_Free", 0) * meminfo.get("Hugepagesize", 0) * 1024
+
+
+def find_kvpool_library() -> str | None:
+    """Locate libcortex_kvpool ($CORTEX_KVPOOL_LIB, kvpool/ next to us, or ldconfig)."""
+    candidates = [
+        os.environ.get("CORTEX_KVPOOL_LIB"),
+        Path(__file__).parent / "kvpool" / KVPOOL_LIB,
+    ]
+    for candidate in candidates:
+        if candidate and os.path.exists(candidate):
+            return str(candidate)
+    return ctypes.util.find_library("cortex_kvpool")
+
+
+def _untrack(shm: shared_memory.SharedMemory):
+    # A pool outlives the process that created or attached it; without this
+    # the resource tracker unlinks the segment when that process exits
+    with contextlib.suppress(KeyError, ValueError):
+        resource_tracker.unregister(shm._name, "shared_memory")
+
+
+_kvpool = None
+
+
+def kvpool_library() -> ctypes.CDLL:
+    """The allocator library, loaded on first use."""
+    global _kvpool
+    if _kvpool is None:
+        path = find_kvpool_library()
+        if not path:
+            raise RuntimeError(
+                f"{KVPOOL_LIB} not found (build kvpool/cortex_kvpool.c or set CORTEX_KVPOOL_LIB)"
+            )
+        lib = ctypes.CDLL(path)
+        u32_array = ctypes.POINTER(ctypes.c_uint32)
+        u64_array = ctypes.POINTER(ctypes.c_uint64)
+        u32, u64 = ctypes.c_uint32, ctypes.c_uint64
+        for name, argtypes, restype in (
+            ("kvpool_alloc", [ctypes.c_void_p, u64, u32_array, u32], ctypes.c_long),
+            ("kvpool_free", [ctypes.c_void_p, u32_array, u32], ctypes.c_long),
+            ("kvpool_free_owner", [ctypes.c_void_p, u64], ctypes.c_long),
+            ("kvpool_idle", [ctypes.c_void_p, u64], ctypes.c_long),
+            ("kvpool_resume", [ctypes.c_void_p, u64], ctypes.c_long),
+            ("kvpool_access", [ctypes.c_void_p, u32_array, u32], None),
+            ("kvpool_evict", [ctypes.c_void_p, u64, u32, u64_array, u32], ctypes.c_long),
+            ("kvpool_lookup", [ctypes.c_void_p, u64_array, u32, u32_array], ctypes.c_long),
+            ("kvpool_publish", [ctypes.c_void_p, u64, u32, u64], ctypes.c_long),
+            ("kvpool_unref", [ctypes.c_void_p, u32_array, u32], ctypes.c_long),
+            ("kvpool_cow", [ctypes.c_void_p, u64, u32], ctypes.c_long),
+        ):
+            func = getattr(lib, name)
+            func.argtypes = argtypes
+            func.restype = restype
+        _kvpool = lib
+    return _kvpool
 
 
 class CachePolicy(Enum):
@@ -32,6 +286,8 @@ class CacheConfig:
     size_bytes: int
     policy: str = "lru"
     max_sequences: int = 1000
+    block_size: int = DEFAULT_BLOCK_SIZE
+    block_tokens: int = DEFAULT_BLOCK_TOKENS
 
 
 @dataclass
@@ -47,8 +303,17 @@ class CacheEntry:
 
 class CacheDatabase:
     def __init__(self):
-        CORTEX_DB.parent.mkdir(parents=True, exist_ok=True)
-        self._pool = get_connection_pool(str(CORTEX_DB), pool_size=5)
+        path = Path(os.environ.get("CORTEX_KV_DB") or CORTEX_DB)
+        try:
+            path.parent.mkdir(parents=True, exist_ok=True)
+            if not os.access(path.parent, os.W_OK):
+                raise PermissionError(f"No write permission to {path.parent}")
+        except PermissionError:
+            # Without the system registry, the pools are this user's own
+            path = Path.home() / ".cortex/kv_cache.db"
+            path.parent.mkdir(parents=True, exist_ok=True)
+        self.path = path
+        self._pool = get_connection_pool(str(path), pool_size=5)
         with self._pool.get_connection() as conn:
             conn.executescript(
                 """
@@ -65,7 +330,23 @@ class CacheDatabase:
                 "INSERT OR REPLACE INTO pools VALUES (?,?,?)",
                 (cfg.name, json.dumps(asdict(cfg)), shm),
             )
-            conn.execute("INSERT OR IGNORE INTO stats (pool) VALUES (?)", (cfg.name,))
+            # A new segment starts its counters from zero
+            conn.execute("INSERT OR REPLACE INTO stats (pool) VALUES (?)", (cfg.name,))
+            conn.commit()
+
+    def save_stats(self, counters: dict[str, tuple[int, int]]):
+        """Checkpoint the segments' (hits, misses) per pool."""
+        with self._pool.get_connection() as conn:
+            conn.executemany(
+                "UPDATE stats SET hits=?, misses=? WHERE pool=?",
+                [(hits, misses, name) for name, (hits, misses) in counters.items()],
+            )
+            conn.commit()
+
+    def get_stats(self, name: str) -> tuple[int, int]:
+        with self._pool.get_connection() as conn:
+            row = conn.execute("SELECT hits, misses FROM stats WHERE pool=?", (name,)).fetchone()
+            return tuple(row) if row else (0, 0)
 
     def get_pool(self, name: str):
         with self._pool.get_connection() as conn:
@@ -82,59 +363,827 @@ class CacheDatabase:
             ]
 
 
+class SnapshotRestore:
+    """Progress of SharedMemoryPool.restore_snapshot().
+
+    total blocks were in the snapshot and not published yet; restored of
+    them are back, failed did not match their checksum or found no room
+    in the prefix index, and skipped found no free block.
+    """
+
+    def __init__(self, total: int, skipped: int):
+        self.total = total
+        self.skipped = skipped
+        self.restored = 0
+        self.failed = 0
+        self._thread: threading.Thread | None = None
+
+    def wait(self, timeout: float | None = None) -> bool:
+        """Wait for the copies to finish; False if timeout ran out first."""
+        self._thread.join(timeout)
+        return not self._thread.is_alive()
+
+
 class SharedMemoryPool:
-    def __init__(self, name: str, size: int, create: bool = True):
+    """A pool segment mapped into this process.
+
+    hugepages: back the pool with hugetlbfs (True), POSIX shm (False), or
+    hugetlbfs whenever enough huge pages are free (None). Attaching
+    (create=False) finds whichever backing the creator chose, and the
+    eviction policy (a CachePolicy value) and tokens per block stored at
+    creation. A new pool keys its prefix hashes with a random salt, or
+    with salt (16 bytes) to restore a snapshot of another segment.
+    """
+
+    def __init__(
+        self,
+        name: str,
+        size: int,
+        create: bool = True,
+        block_size: int = DEFAULT_BLOCK_SIZE,
+        hugepages: bool | None = None,
+        policy: str = "lru",
+        block_tokens: int = DEFAULT_BLOCK_TOKENS,
+        salt: bytes | None = None,
+    ):
         self.name = f"{SHM_PREFIX}{name}"
-        self.size = size
+        self.path = HUGETLBFS_DIR / self.name
+        self.shm = None
+        self._mmap = None
+
         if create:
-            try:
-                old = shared_memory.SharedMemory(name=self.name)
-                old.close()
-                old.unlink()
-            except:
-                pass
-            self.shm = shared_memory.SharedMemory(name=self.name, create=True, size=size + 8192)
+            self._unlink_stale()
+            if hugepages is None:
+                _, _, segment_size = pool_layout(size, block_size, HUGE_PAGE_SIZE)
+                hugepages = HUGETLBFS_DIR.is_dir() and hugepages_free() >= segment_size
+            page_size = HUGE_PAGE_SIZE if hugepages else PAGE_SIZE
+            nr_blocks, data_offset, segment_size = pool_layout(size, block_size, page_size)
+            if hugepages:
+                self._map_hugetlbfs(segment_size, create=True)
+            else:
+                self.shm = shared_memory.SharedMemory(
+                    name=self.name, create=True, size=segment_size
+                )
+                _untrack(self.shm)
+            self.header = KVPoolHeader.from_buffer(self._mmap or self.shm.buf)
+            self._format(nr_blocks, block_size, data_offset, segment_size, hugepages, salt)
+            self.header.policy = KVPOOL_POLICIES[CachePolicy(policy).value]
+            self.header.block_tokens = block_tokens
+            self.header.magic = KVPOOL_MAGIC  # Last: attachers check it
         else:
-            self.shm = shared_memory.SharedMemory(name=self.name)
+            if self.path.exists():
+                self._map_hugetlbfs(self.path.stat().st_size, create=False)
+            else:
+                self.shm = shared_memory.SharedMemory(name=self.name)
+                _untrack(self.shm)
+            self.header = KVPoolHeader.from_buffer(self._mmap or self.shm.buf)
+            if self.header.magic != KVPOOL_MAGIC or self.header.version != KVPOOL_VERSION:
+                self.close()
+                raise ValueError(f"{self.name} is not a version {KVPOOL_VERSION} KV pool")
+
+        self.block_size = self.header.block_size
+        self.nr_blocks = self.header.nr_blocks
+        self.block_tokens = self.header.block_tokens
+        self.size = self.nr_blocks * self.block_size
+        # Base address for the allocator; keeps an export of the buffer,
+        # released in close()
+        self._anchor = ctypes.c_char.from_buffer(self._mmap or self.shm.buf)
+        self._base = ctypes.c_void_p(ctypes.addressof(self._anchor))
+
+    @property
+    def hugetlb(self) -> bool:
+        return bool(self.header.flags & KVPOOL_F_HUGETLB)
+
+    @property
+    def policy(self) -> str:
+        return next(p for p, v in KVPOOL_POLICIES.items() if v == self.header.policy)
+
+    @property
+    def shm_name(self) -> str:
+        """What the pools table records to find the segment again."""
+        return str(self.path) if self.hugetlb else self.name
+
+    def _unlink_stale(self):
+        with contextlib.suppress(FileNotFoundError):
+            self.path.unlink()
+        try:
+            old = shared_memory.SharedMemory(name=self.name)
+        except FileNotFoundError:
+            return
+        old.close()
+        old.unlink()
+
+    def _map_hugetlbfs(self, segment_size: int, create: bool):
+        flags = os.O_RDWR | (os.O_CREAT | os.O_EXCL if create else 0)
+        fd = os.open(self.path, flags, 0o660)
+        try:
+            if create:
+                os.ftruncate(fd, segment_size)
+            self._mmap = mmap.mmap(fd, segment_size, mmap.MAP_SHARED)
+        except OSError:
+            if create:
+                self.path.unlink()
+            raise
+        finally:
+            os.close(fd)
+
+    def _format(self, nr_blocks, block_size, data_offset, segment_size, hugepages, salt=None):
+        """Write the header and thread every block onto the free list.
+
+        A new segment reads as zeros, which is an empty prefix index. The
+        caller sets the magic once the rest of the header is in place.
+        """
+        h = self.header
+        h.block_size = block_size
+        h.nr_blocks = nr_blocks
+        h.meta_offset = ctypes.sizeof(KVPoolHeader)
+        h.index_offset, h.nr_slots = index_layout(nr_blocks)
+        h.data_offset = data_offset
+        h.segment_size = segment_size
+        h.created_ns = time.time_ns()
+        h.flags = KVPOOL_F_HUGETLB if hugepages else 0
+        h.salt[:] = salt or os.urandom(len(h.salt))
+
+        blocks = (KVPoolBlock * nr_blocks).from_buffer(self._mmap or self.shm.buf, h.meta_offset)
+        for i in range(nr_blocks - 1):
+            blocks[i].next = i + 2
+        del blocks
+        h.free_head = 1  # Block 0 on top, tag 0
+        h.nr_free = nr_blocks
+        h.version = KVPOOL_VERSION
+
+    def alloc_blocks(self, count: int, owner: int) -> list[int]:
+        """Allocate count blocks for owner (e.g. a sequence id), all or nothing."""
+        out = (ctypes.c_uint32 * count)()
+        ret = kvpool_library().kvpool_alloc(self._base, owner, out, count)
+        if ret == -errno.ENOMEM:
+            raise MemoryError(f"{self.name}: fewer than {count} free blocks")
+        if ret < 0:
+            raise ValueError(f"{self.name}: invalid allocation for owner {owner}")
+        return list(out)
+
+    def free_blocks(self, blocks: list[int]) -> int:
+        """Return blocks to the pool; returns how many were allocated."""
+        array = (ctypes.c_uint32 * len(blocks))(*blocks)
+        ret = kvpool_library().kvpool_free(self._base, array, len(blocks))
+        if ret < 0:
+            raise ValueError(f"{self.name}: block out of range in {blocks}")
+        return ret
+
+    def free_owner(self, owner: int) -> int:
+        """Free every block of owner; returns how many there were."""
+        ret = kvpool_library().kvpool_free_owner(self._base, owner)
+        if ret < 0:
+            raise ValueError(f"{self.name}: invalid owner {owner}")
+        return ret
+
+    def idle(self, owner: int) -> int:
+        """Keep owner's blocks cached but evictable; returns how many."""
+        ret = kvpool_library().kvpool_idle(self._base, owner)
+        if ret < 0:
+            raise ValueError(f"{self.name}: invalid owner {owner}")
+        return ret
+
+    def resume(self, owner: int) -> int:
+        """Take owner's idle blocks back; returns how many are left."""
+        ret = kvpool_library().kvpool_resume(self._base, owner)
+        if ret < 0:
+            raise ValueError(f"{self.name}: invalid owner {owner}")
+        return ret
+
+    def access(self, blocks: list[int]):
+        """Record a lookup: a hit on blocks, or a miss if there are none."""
+        array = (ctypes.c_uint32 * len(blocks))(*blocks)
+        kvpool_library().kvpool_access(self._base, array, len(blocks))
+
+    def evict(self, count: int, keep: int, max_owners: int = 64) -> list[int]:
+        """Evict idle owners other than keep until count blocks are freed.
+
+        Victims, idle owners and unreferenced shared blocks, are picked by
+        the pool's policy. Returns the evicted owners (fewer blocks were
+        freed if nothing else was left to evict).
+        """
+        owners = (ctypes.c_uint64 * max_owners)()
+        ret = kvpool_library().kvpool_evict(self._base, keep, count, owners, max_owners)
+        if ret < 0:
+            raise ValueError(f"{self.name}: invalid owner {keep}")
+        return list(owners[:ret])
+
+    def alloc_or_evict(self, count: int, owner: int) -> tuple[list[int], list[int]]:
+        """alloc_blocks(), evicting idle owners if the pool is full.
+
+        Returns (blocks, evicted owners). Raises MemoryError if the pool
+        cannot hold count blocks even after eviction.
+        """
+        evicted: list[int] = []
+        for _ in range(EVICT_RETRIES):
+            try:
+                return self.alloc_blocks(count, owner), evicted
+            except MemoryError:
+                if count > self.nr_blocks:
+                    raise
+                # Unreferenced shared blocks go without an owner to report
+                evictions = self.header.evictions
+                evicted += self.evict(max(count - self.header.nr_free, 1), keep=owner)
+                if self.header.evictions == evictions:
+                    raise
+        return self.alloc_blocks(count, owner), evicted
+
+    def prefix_hashes(self, tokens: list[int]) -> list[int]:
+        """Index keys of the full blocks of a token sequence.
+
+        Each hash covers a block's tokens and the hash before it, so equal
+        hashes mean equal prefixes. The hash is keyed with the pool's
+        random salt: one tenant cannot craft a prompt that maps onto
+        another tenant's blocks.
+        """
+        salt, n = bytes(self.header.salt), self.block_tokens
+        hashes, parent = [], 0
+        for start in range(0, len(tokens) - n + 1, n):
+            chunk = (ctypes.c_uint32 * n)(*tokens[start : start + n])
+            digest = hashlib.blake2b(parent.to_bytes(8, "little"), key=salt, digest_size=8)
+            digest.update(bytes(chunk))
+            parent = int.from_bytes(digest.digest(), "little")
+            hashes.append(parent)
+        return hashes
+
+    def lookup(self, tokens: list[int]) -> list[int]:
+        """Shared blocks holding the longest cached prefix of tokens.
+
+        Each comes with a reference for the caller, dropped by unref() or
+        release(). Counts as a hit, or a miss if nothing is cached.
+        """
+        hashes = self.prefix_hashes(tokens)
+        out = (ctypes.c_uint32 * len(hashes))()
+        ret = kvpool_library().kvpool_lookup(
+            self._base, (ctypes.c_uint64 * len(hashes))(*hashes), len(hashes), out
+        )
+        return list(out[:ret])
+
+    def publish(self, owner: int, blocks: list[int], tokens: list[int]) -> list[int]:
+        """Share owner's blocks holding full blocks of tokens.
+
+        blocks is the sequence's block table, one block per block_tokens
+        tokens. Returns the table to use from now on: a block whose prefix
+        another sequence published first is swapped for that one and freed.
+        Blocks that could not be published stay private.
+        """
+        table = list(blocks)
+        lib = kvpool_library()
+        for i, prefix_hash in enumerate(self.prefix_hashes(tokens)[: len(table)]):
+            ret = lib.kvpool_publish(self._base, owner, table[i], prefix_hash)
+            if ret < 0:
+                continue  # Shared already (from lookup()), or no room: stays private
+            if ret != table[i]:
+                self.free_blocks([table[i]])
+                table[i] = ret
+        return table
+
+    def unref(self, blocks: list[int]) -> int:
+        """Drop a reference on the shared blocks among blocks."""
+        array = (ctypes.c_uint32 * len(blocks))(*blocks)
+        return kvpool_library().kvpool_unref(self._base, array, len(blocks))
+
+    def cow(self, owner: int, block: int) -> int:
+        """A block owner may write to holding the data of block."""
+        ret = kvpool_library().kvpool_cow(self._base, owner, block)
+        if ret == -errno.ENOMEM:
+            raise MemoryError(f"{self.name}: no free block to copy {block} into")
+        if ret < 0:
+            raise ValueError(f"{self.name}: block {block} is not owner {owner}'s or shared")
+        return ret
+
+    def release(self, owner: int, blocks: list[int]) -> int:
+        """End a sequence: unref its shared blocks and free its own."""
+        self.unref(blocks)
+        return self.free_owner(owner)
+
+    def shared_blocks(self) -> int:
+        """Blocks in the prefix index, referenced or only cached."""
+        table = (KVPoolBlock * self.nr_blocks).from_buffer(
+            self._mmap or self.shm.buf, self.header.meta_offset
+        )
+        try:
+            return sum(1 for b in table if b.state == KVPOOL_SHARED)
+        finally:
+            del table
+
+    def _block_states(self) -> list[tuple[int, int, int, int]]:
+        """(state, alloc_seq, prefix_hash, refs) of every block."""
+        table = (KVPoolBlock * self.nr_blocks).from_buffer(
+            self._mmap or self.shm.buf, self.header.meta_offset
+        )
+        try:
+            return [(b.state, b.alloc_seq, b.prefix_hash, b.refs) for b in table]
+        finally:
+            del table
+
+    def _block_state(self, block: int) -> tuple[int, int, int]:
+        """(state, alloc_seq, prefix_hash) of one block: equal twice, it was
+        not evicted and reused in between."""
+        b = KVPoolBlock.from_buffer(
+            self._mmap or self.shm.buf,
+            self.header.meta_offset + block * ctypes.sizeof(KVPoolBlock),
+        )
+        try:
+            return b.state, b.alloc_seq, b.prefix_hash
+        finally:
+            del b
+
+    def save_snapshot(self, path: Path, workers: int = SNAPSHOT_WORKERS) -> tuple[int, int]:
+        """Save the published blocks to a snapshot file; returns (written, unchanged).
+
+        Only shared blocks are saved: a restarted server finds them again
+        by prefix hash, while private blocks belong to sequences that ended
+        with the old server. Record i of the file describes block i, so a
+        save only writes the blocks whose record has another prefix hash
+        (a hash fixes the contents) and the file is never rewritten whole.
+        workers threads copy and checksum blocks at once; os.pwrite and
+        zlib.crc32 release the GIL.
+
+        Dirty records are invalidated (and synced) before their blocks are
+        overwritten, and written back once the blocks are synced: a crash
+        mid-save leaves the blocks saved before it. A block evicted while
+        it was being copied is left out.
+        """
+        n, block_size = self.nr_blocks, self.block_size
+        records_offset, data_offset = snapshot_layout(n)
+        path.parent.mkdir(parents=True, exist_ok=True)
+        fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o640)
+        try:
+            header = read_snapshot_header(path)
+            records = (SnapshotRecord * n)()
+            if self._snapshot_matches(header):
+                records = (SnapshotRecord * n).from_buffer_copy(
+                    os.pread(fd, ctypes.sizeof(records), records_offset)
+                )
+            else:
+                os.ftruncate(fd, 0)  # Another geometry or salt: nothing in it is of use
+                header = SnapshotHeader(
+                    magic=SNAPSHOT_MAGIC,
+                    version=SNAPSHOT_VERSION,
+                    policy=self.header.policy,
+                    block_size=block_size,
+                    nr_blocks=n,
+                    block_tokens=self.block_tokens,
+                    records_offset=records_offset,
+                    data_offset=data_offset,
+                )
+                header.salt[:] = bytes(self.header.salt)
+            os.ftruncate(fd, data_offset + n * block_size)
+
+            states = enumerate(self._block_states())
+            shared = {i: state for i, state in states if state[0] == KVPOOL_SHARED}
+            valid = [bool(r.flags & SNAPSHOT_F_VALID) for r in records]
+            dirty = [i for i, s in shared.items() if not valid[i] or records[i].prefix_hash != s[2]]
+            stale = [i for i in range(n) if valid[i] and i not in shared]
+            for i in dirty + stale:
+                records[i].flags = 0
+            if dirty or stale:
+                os.pwrite(fd, records, records_offset)
+                os.fsync(fd)
+
+            def copy(i: int) -> int | None:
+                with self.block(i) as view:
+                    crc = zlib.crc32(view)
+                    os.pwrite(fd, view, data_offset + i * block_size)
+                return crc if self._block_state(i) == shared[i][:3] else None
+
+            with ThreadPoolExecutor(max_workers=workers, thread_name_prefix="kv-save") as pool:
+                crcs = dict(zip(dirty, pool.map(copy, dirty)))
+            if dirty:
+                os.fsync(fd)
+
+            written = 0
+            for i, (_, _, prefix_hash, refs) in shared.items():
+                crc = crcs.get(i, records[i].crc)
+                if crc is None:
+                    continue
+                records[i] = SnapshotRecord(prefix_hash, crc, refs, SNAPSHOT_F_VALID)
+                written += i in crcs
+            header.nr_valid = sum(1 for r in records if r.flags & SNAPSHOT_F_VALID)
+            header.generation += 1
+            header.saved_ns = time.time_ns()
+            os.pwrite(fd, records, records_offset)
+            os.pwrite(fd, header, 0)
+            os.fsync(fd)
+        finally:
+            os.close(fd)
+        return written, len(shared) - len(dirty)
+
+    def _snapshot_matches(self, header: SnapshotHeader | None) -> bool:
+        """Whether a snapshot's blocks can go into this pool."""
+        return (
+            header is not None
+            and header.block_size == self.block_size
+            and header.nr_blocks == self.nr_blocks
+            and header.block_tokens == self.block_tokens
+            and bytes(header.salt) == bytes(self.header.salt)
+        )
+
+    def restore_snapshot(
+        self, path: Path, workers: int = SNAPSHOT_WORKERS, wait: bool = True
+    ) -> "SnapshotRestore":
+        """Publish the blocks of a snapshot file again.
+
+        The file is mapped, not read: each block faults in as a worker
+        copies it into the pool, most referenced blocks first. A block is
+        published once it matches its checksum, so lookups find the hot
+        prefixes while the rest is still on its way. With wait false this
+        returns at once and the copies go on in the background; the pool
+        must stay open until SnapshotRestore.wait() returns.
+
+        Blocks whose prefix is published already are skipped, and so are
+        those that find no free block. Raises ValueError if the snapshot
+        is of a pool with another geometry or salt.
+        """
+        header = read_snapshot_header(path)
+        if not self._snapshot_matches(header):
+            raise ValueError(f"{path} is not a snapshot of {self.name}")
+        with open(path, "rb") as f:
+            # Copy-on-write only so ctypes can take the address; nothing writes to it
+            snap = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_COPY)
+        records = (SnapshotRecord * self.nr_blocks).from_buffer_copy(snap, header.records_offset)
+        published = {s[2] for s in self._block_states() if s[0] == KVPOOL_SHARED}
+        slots = sorted(
+            (
+                i
+                for i, r in enumerate(records)
+                if r.flags & SNAPSHOT_F_VALID and r.prefix_hash not in published
+            ),
+            key=lambda i: -records[i].refs,
+        )
+        blocks = self._claim(slots)
+        progress = SnapshotRestore(len(slots), len(slots) - len(blocks))
+        jobs = [(slot, block, records[slot]) for slot, block in zip(slots, blocks)]
+        progress._thread = threading.Thread(
+            target=self._restore_blocks,
+            args=(snap, header.data_offset, jobs, workers, progress),
+            name="kv-restore",
+            daemon=True,
+        )
+        progress._thread.start()
+        if wait:
+            progress.wait()
+        return progress
+
+    def _claim(self, slots: list[int]) -> list[int]:
+        """Blocks to restore slots into: the same block numbers where they
+        are free, so the next save finds its records current."""
+        got: list[int] = []
+        for _ in range(EVICT_RETRIES if slots else 0):
+            with contextlib.suppress(MemoryError):
+                free = self.header.nr_free
+                got = self.alloc_blocks(free, RESTORE_OWNER) if free else []
+                break  # Else another process allocated meanwhile
+        mine = set(got)
+        same = {s for s in slots if s in mine}
+        spare = iter(b for b in got if b not in same)
+        blocks = []
+        for slot in slots:
+            block = slot if slot in same else next(spare, None)
+            if block is None:
+                break
+            blocks.append(block)
+        kept = set(blocks)
+        if len(kept) < len(got):
+            self.free_blocks([b for b in got if b not in kept])
+        return blocks
+
+    def _restore_blocks(self, snap, data_offset, jobs, workers, progress):
+        lib = kvpool_library()
+        anchor = ctypes.c_char.from_buffer(snap)
+        source = ctypes.addressof(anchor) + data_offset
+        base, block_size = self._base.value, self.block_size
+
+        def restore(job) -> bool:
+            slot, block, record = job
+            # ctypes.memmove releases the GIL while the page faults are served
+            ctypes.memmove(base + self.block_offset(block), source + slot * block_size, block_size)
+            with self.block(block) as view:
+                intact = zlib.crc32(view) == record.crc
+            ret = -1
+            if intact:
+                ret = lib.kvpool_publish(self._base, RESTORE_OWNER, block, record.prefix_hash)
+            if ret < 0:
+                self.free_blocks([block])
+                return False
+            if ret != block:  # Published meanwhile by a server
+                self.free_blocks([block])
+            self.unref([ret])  # Cached, not referenced, as when it was saved
+            return True
+
+        try:
+            with ThreadPoolExecutor(max_workers=workers, thread_name_prefix="kv-restore") as pool:
+                for restored in pool.map(restore, jobs):
+                    progress.restored += restored
+                    progress.failed += not restored
+        finally:
+            del anchor
+            snap.close()
+
+    def block_offset(self, block: int) -> int:
+        return self.header.data_offset + block * self.block_size
+
+    def block(self, block: int) -> memoryview:
+        """Writable view of one block's data."""
+        if not 0 <= block < self.nr_blocks:
+            raise IndexError(block)
+        start = self.block_offset(block)
+        return memoryview(self._mmap or self.shm.buf)[start : start + self.block_size]
 
     def get_usage(self):
-        return self.size, 0, 0  # Simplified
+        """(capacity, used, free) in bytes."""
+        free = self.header.nr_free * self.block_size
+        return self.size, self.size - free, free
+
+    def get_stats(self) -> tuple[int, int]:
+        """(hits, misses) recorded by every process since creation."""
+        return self.header.hits, self.header.misses
+
+    def close(self):
+        """Unmap the segment; the pool stays for other processes."""
+        # ctypes views export the buffer, which must be released first
+        self.header = self._anchor = self._base = None
+        if self._mmap is not None:
+            self._mmap.close()
+        if self.shm is not None:
+            self.shm.close()
+
+    def __del__(self):
+        # Before SharedMemory's own finalizer, which fails while views exist
+        with contextlib.suppress(AttributeError, BufferError):
+            self.close()
 
     def destroy(self):
-        self.shm.close()
-        with contextlib.suppress(builtins.BaseException):
-            self.shm.unlink()
+        on_hugetlbfs = self._mmap is not None
+        self.close()
+        if on_hugetlbfs:
+            with contextlib.suppress(FileNotFoundError):
+                self.path.unlink()
+        elif self.shm is not None:
+            # unlink() unregisters from the resource tracker; _untrack() already did
+            resource_tracker.register(self.shm._name, "shared_memory")
+            with contextlib.suppress(builtins.BaseException):
+                self.shm.unlink()
 
 
 class KVCacheManager:
     def __init__(self):
         self.db = CacheDatabase()
         self.pools: dict[str, SharedMemoryPool] = {}
+        self._checkpointer: threading.Thread | None = None
+        self._stop = threading.Event()
 
-    def create_pool(self, cfg: CacheConfig) -> bool:
-        pool = SharedMemoryPool(cfg.name, cfg.size_bytes)
+    def create_pool(self, cfg: CacheConfig, salt: bytes | None = None) -> bool:
+        pool = SharedMemoryPool(
+            cfg.name,
+            cfg.size_bytes,
+            block_size=cfg.block_size,
+            policy=cfg.policy,
+            block_tokens=cfg.block_tokens,
+            salt=salt,
+        )
         self.pools[cfg.name] = pool
-        self.db.save_pool(cfg, pool.name)
-        print(f"✅ Created cache pool '{cfg.name}' ({cfg.size_bytes / 1e9:.1f} GB)")
+        self.db.save_pool(cfg, pool.shm_name)
+        backing = "hugetlbfs" if pool.hugetlb else "shm"
+        print(
+            f"✅ Created cache pool '{cfg.name}' ({cfg.size_bytes / 1e9:.1f} GB, "
+            f"{pool.nr_blocks} blocks, {backing})"
+        )
         return True
 
+    def get_pool(self, name: str) -> SharedMemoryPool | None:
+        """The pool mapped into this process, attaching on first use."""
+        pool = self.pools.get(name)
+        if pool is None:
+            row = self.db.get_pool(name)
+            if not row:
+                return None
+            try:
+                pool = SharedMemoryPool(name, row[0].size_bytes, create=False)
+            except (FileNotFoundError, ValueError):
+                return None  # Registered, but the segment is gone (reboot)
+            self.pools[name] = pool
+        return pool
+
+    def allocate(self, name: str, seq_id: int, token_count: int, size_bytes: int) -> list[int]:
+        """Allocate the blocks for size_bytes of a sequence's KV cache.
+
+        The blocks are owned by seq_id; calling again extends the sequence
+        and release() frees all of them. A full pool evicts parked
+        sequences (see park()) by its policy, and they leave the catalog.
+        Processes that only need blocks can call
+        SharedMemoryPool.alloc_or_evict() and skip it.
+        """
+        pool = self._pool(name)
+        count = -(-size_bytes // pool.block_size)
+        blocks, evicted = pool.alloc_or_evict(count, owner=seq_id)
+        self._catalog(pool, seq_id, token_count, blocks, evicted)
+        return blocks
+
+    def attach(
+        self, name: str, seq_id: int, tokens: list[int], size_bytes: int
+    ) -> tuple[list[int], int]:
+        """Block table for a new sequence, reusing a cached prompt prefix.
+
+        size_bytes is the KV size of all of tokens. Blocks with the longest
+        published prefix are shared; only the rest is allocated. Returns
+        (block table, tokens already cached): prefill can start there. At
+        least one token is always left to prefill, for the first logits.
+        """
+        pool = self._pool(name)
+        reusable = (len(tokens) - 1) // pool.block_tokens * pool.block_tokens
+        shared = pool.lookup(tokens[:reusable])
+        count = max(-(-size_bytes // pool.block_size) - len(shared), 0)
+        try:
+            blocks, evicted = pool.alloc_or_evict(count, owner=seq_id)
+        except MemoryError:
+            pool.unref(shared)
+            raise
+        self._catalog(pool, seq_id, len(tokens), blocks, evicted)
+        return shared + blocks, len(shared) * pool.block_tokens
+
+    def share(self, name: str, seq_id: int, blocks: list[int], tokens: list[int]) -> list[int]:
+        """Publish a prefilled sequence's full blocks for others to attach.
+
+        Returns the block table to keep using (see SharedMemoryPool.publish).
+        """
+        return self._pool(name).publish(seq_id, blocks, tokens)
+
+    def park(self, name: str, seq_id: int, blocks: list[int] | None = None):
+        """Keep a finished sequence's blocks cached for a later turn.
+
+        Parked sequences are what a full pool evicts; pass the block table
+        to also drop the references on shared blocks.
+        """
+        pool = self._pool(name)
+        pool.unref(blocks or [])
+        pool.idle(seq_id)
+
+    def resume(self, name: str, seq_id: int) -> bool:
+        """Take a parked sequence back; False if it was evicted meanwhile."""
+        pool = self._pool(name)
+        with self.db._pool.get_connection() as conn:
+            row = conn.execute(
+                "SELECT size FROM entries WHERE seq_id=? AND pool=?", (seq_id, name)
+            ).fetchone()
+        if row and pool.resume(seq_id) * pool.block_size == row[0]:
+            return True
+        self.release(name, seq_id)  # Partly evicted is as good as gone
+        return False
+
+    def _pool(self, name: str) -> SharedMemoryPool:
+        pool = self.get_pool(name)
+        if pool is None:
+            raise KeyError(f"No pool named '{name}'")
+        return pool
+
+    def _catalog(self, pool, seq_id, token_count, blocks, evicted):
+        name = pool.name.removeprefix(SHM_PREFIX)
+        now = time.time()
+        entry = (seq_id, name, now, now, token_count, len(blocks) * pool.block_size)
+        with self.db._pool.get_connection() as conn:
+            conn.executemany(
+                "DELETE FROM entries WHERE seq_id=? AND pool=?", [(s, name) for s in evicted]
+            )
+            conn.execute(
+                """INSERT INTO entries VALUES (?,?,?,?,0,?,?,?)
+                ON CONFLICT(seq_id, pool) DO UPDATE SET accessed=excluded.accessed,
+                    tokens=tokens+excluded.tokens, size=size+excluded.size""",
+                (*entry, pool.block_offset(blocks[0]) if blocks else 0),
+            )
+            conn.commit()
+
+    def release(self, name: str, seq_id: int, blocks: list[int] | None = None) -> int:
+        """Free every block of a sequence; returns how many it owned.
+
+        Pass the block table from attach() or share() to drop the
+        sequence's references on shared blocks too; those stay cached.
+        """
+        pool = self.get_pool(name)
+        freed = pool.release(seq_id, blocks or []) if pool else 0
+        with self.db._pool.get_connection() as conn:
+            conn.execute("DELETE FROM entries WHERE seq_id=? AND pool=?", (seq_id, name))
+            conn.commit()
+        return freed
+
+    def checkpoint_stats(self):
+        """Copy the hit/miss counters of the pools mapped here to SQLite."""
+        counters = {name: pool.get_stats() for name, pool in self.pools.items()}
+        if counters:
+            self.db.save_stats(counters)
+
+    def start_checkpointing(self, interval: float = STATS_CHECKPOINT_INTERVAL):
+        """Checkpoint the stats every interval seconds in the background."""
+        if self._checkpointer is not None:
+            return
+
+        def run():
+            while not self._stop.wait(interval):
+                with contextlib.suppress(sqlite3.Error):
+                    self.checkpoint_stats()
+
+        self._stop.clear()
+        self._checkpointer = threading.Thread(target=run, name="kv-stats", daemon=True)
+        self._checkpointer.start()
+
+    def stop_checkpointing(self):
+        """Stop the background checkpoints after a last one."""
+        if self._checkpointer is None:
+            return
+        self._stop.set()
+        self._checkpointer.join()
+        self._checkpointer = None
+        self.checkpoint_stats()
+
+    def save_state(self, name: str, path: Path | None = None) -> tuple[int, int]:
+        """Snapshot a pool's cached prefixes (see SharedMemoryPool.save_snapshot)."""
+        path = path or snapshot_path(name)
+        written, unchanged = self._pool(name).save_snapshot(path)
+        print(
+            f"✅ Saved {written + unchanged} cached blocks of '{name}' to {path} "
+            f"({written} written, {unchanged} unchanged)"
+        )
+        return written, unchanged
+
+    def restore_state(
+        self, name: str, path: Path | None = None, wait: bool = True
+    ) -> SnapshotRestore | None:
+        """Bring a pool's cached prefixes back from its snapshot.
+
+        A pool whose segment is gone (after a reboot) is created again, as
+        registered or else as the snapshot describes it, with the salt its
+        prefix hashes were saved under. Returns None if there is no
+        snapshot.
+        """
+        path = path or snapshot_path(name)
+        header = read_snapshot_header(path) if path.exists() else None
+        if header is None:
+            return None
+        pool = self.get_pool(name)
+        if pool is None:
+            row = self.db.get_pool(name)
+            if row:
+                cfg = row[0]
+            else:
+                policy = next(p for p, v in KVPOOL_POLICIES.items() if v == header.policy)
+                cfg = CacheConfig(
+                    name,
+                    header.nr_blocks * header.block_size,
+                    policy,
+                    block_size=header.block_size,
+                    block_tokens=header.block_tokens,
+                )
+            self.create_pool(cfg, salt=bytes(header.salt))
+            pool = self.pools[name]
+            with self.db._pool.get_connection() as conn:
+                # Sequences of the old segment are gone with it
+                conn.execute("DELETE FROM entries WHERE pool=?", (name,))
+                conn.commit()
+        restore = pool.restore_snapshot(path, wait=wait)
+        if wait:
+            print(
+                f"✅ Restored {restore.restored} of {restore.total} cached blocks of '{name}' "
+                f"({restore.failed} failed, {restore.skipped} without a free block)"
+            )
+        return restore
+
     def destroy_pool(self, name: str) -> bool:
-        if name in self.pools:
-            self.pools[name].destroy()
-            del self.pools[name]
+        pool = self.get_pool(name)
+        if pool:
+            pool.destroy()
+            self.pools.pop(name, None)
         with self.db._pool.get_connection() as conn:
             conn.execute("DELETE FROM pools WHERE name=?", (name,))
+            conn.execute("DELETE FROM entries WHERE pool=?", (name,))
+            conn.commit()
         print(f"✅ Destroyed pool '{name}'")
         return True
 
     def status(self, name: str = None):
         pools = [self.db.get_pool(name)] if name else [(p, "") for p in self.db.list_pools()]
-        print(f"\n{'POOL':<20} {'SIZE':<12} {'POLICY':<10}")
-        print("-" * 50)
+        print(
+            f"\n{'POOL':<20} {'SIZE':<12} {'POLICY':<10} {'USED':<10} {'SHARED':<8} "
+            f"{'HIT%':<8} {'EVICTED':<10} {'BACKING':<10}"
+        )
+        print("-" * 95)
         for item in pools:
             if item:
                 cfg = item[0] if isinstance(item, tuple) else item
-                print(f"{cfg.name:<20} {cfg.size_bytes / 1e9:.1f}G{'':<6} {cfg.policy:<10}")
+                pool = self.get_pool(cfg.name)
+                used = f"{pool.get_usage()[1] / 1e9:.1f}G" if pool else "-"
+                backing = ("hugetlbfs" if pool.hugetlb else "shm") if pool else "missing"
+                # The segment is current; the checkpoint is all that is left after a reboot
+                hits, misses = pool.get_stats() if pool else self.db.get_stats(cfg.name)
+                hit_pct = f"{hits / (hits + misses) * 100:.1f}" if hits + misses else "-"
+                evicted = pool.header.evictions if pool else "-"
+                shared = pool.shared_blocks() if pool else "-"
+                print(
+                    f"{cfg.name:<20} {cfg.size_bytes / 1e9:.1f}G{'':<6} {cfg.policy:<10} "
+                    f"{used:<10} {shared:<8} {hit_pct:<8} {evicted:<10} {backing:<10}"
+                )
+        self.checkpoint_stats()
 
 
 def main():
@@ -146,11 +1195,23 @@ def main():
     c = sub.add_parser("create")
     c.add_argument("name")
     c.add_argument("--size", required=True)
-    c.add_argument("--policy", default="lru")
+    c.add_argument("--policy", default="lru", choices=[p.value for p in CachePolicy])
+    c.add_argument(
+        "--block-tokens",
+        type=int,
+        default=DEFAULT_BLOCK_TOKENS,
+        help="tokens per KV block, the granularity of prefix sharing",
+    )
 
     sub.add_parser("destroy").add_argument("name")
     sub.add_parser("status").add_argument("name", nargs="?")
     sub.add_parser("list")
+    for cmd, verb in (("save-state", "write"), ("restore-state", "read")):
+        s = sub.add_parser(cmd)
+        s.add_argument("name")
+        s.add_argument(
+            "--path", type=Path, help=f"snapshot to {verb} (default {SNAPSHOT_DIR}/NAME.snap)"
+        )
 
     args = parser.parse_args()
     mgr = KVCacheManager()
@@ -159,9 +1220,14 @@ def main():
         size_str = args.size.upper()
         mult = {"K": 1e3, "M": 1e6, "G": 1e9}.get(size_str[-1], 1)
         size = int(float(size_str.rstrip("KMG")) * mult)
-        mgr.create_pool(CacheConfig(args.name, size, args.policy))
+        mgr.create_pool(CacheConfig(args.name, size, args.policy, block_tokens=args.block_tokens))
     elif args.cmd == "destroy":
         mgr.destroy_pool(args.name)
+    elif args.cmd == "save-state":
+        mgr.save_state(args.name, args.path)
+    elif args.cmd == "restore-state":
+        if mgr.restore_state(args.name, args.path) is None:
+            print(f"No snapshot of '{args.name}' to restore")
     elif args.cmd in ("status", "list"):
         mgr.status(getattr(args, "name", None))
 
@@ -0,0 +1,517 @@
+// SPDX-License-Identifier: Apache-2.0
+// Cortex Linux KV-cache pool allocator
+//
+// Fixed-size KV blocks (paged-attention style) in a shared segment that
+// several model server processes map at once. The free list is a Treiber
+// stack of block numbers kept in the segment itself; its head carries an
+// ABA tag, so allocation and free are a compare-and-swap each and need no
+// lock, no syscall and no round trip through Python or SQLite.
+//
+// Eviction works the same way. Lookups set a per-block reference count
+// with relaxed stores; when the pool is full, a clock hand shared by all
+// processes sweeps the blocks and picks a victim by the pool's policy:
+// CLOCK for LRU (one reference bit), GCLOCK for LFU (counts halved on
+// each pass) and the oldest allocation for FIFO. A victim's owner (one
+// sequence) is evicted as a whole, since part of a KV cache is useless.
+// Only owners that marked themselves idle qualify: a sequence being
+// decoded in another process must not lose its blocks under it.
+//
+// Blocks full of a shared prompt prefix are published to an open-addressed
+// hash index in the segment. Lookups take a reference with a compare-and-
+// swap on the block's user count and check the block afterwards, so a
+// block evicted and reused under them is let go again. Eviction only takes
+// shared blocks whose count it can swap from 0 to KVPOOL_USERS_DEAD.
+// Deleted slots are tombstones that inserts reuse; probes stop after
+// KVPOOL_MAX_PROBE slots, so a crowded index refuses a publish rather
+// than slowing every lookup down.
+//
+// kv_cache_manager.py formats the segment and loads this library with
+// ctypes. Build with:
+//   cc -O2 -Wall -shared -fPIC -o libcortex_kvpool.so cortex_kvpool.c
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cortex_kvpool.h"
+
+_Static_assert(sizeof(struct kvpool_header) == 256, "kv_cache_manager.py mirrors this layout");
+_Static_assert(sizeof(struct kvpool_block) == 40, "kv_cache_manager.py mirrors this layout");
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the segment is shared across processes");
+
+static struct kvpool_header *header(void *base) {
+    struct kvpool_header *h = base;
+
+    if (!h || h->magic != KVPOOL_MAGIC || h->version != KVPOOL_VERSION)
+        return NULL;
+    return h;
+}
+
+static struct kvpool_block *blocks(struct kvpool_header *h) {
+    return (struct kvpool_block *)((char *)h + h->meta_offset);
+}
+
+static _Atomic uint32_t *slots(struct kvpool_header *h) {
+    return (_Atomic uint32_t *)((char *)h + h->index_offset);
+}
+
+static char *block_data(struct kvpool_header *h, uint32_t block) {
+    return (char *)h + h->data_offset + (uint64_t)block * h->block_size;
+}
+
+// The largest owner is reserved for shared blocks
+static int bad_owner(uint64_t owner) {
+    return owner >= KVPOOL_OWNER_MASK;
+}
+
+static uint64_t next_head(uint64_t head, uint32_t top) {
+    return (((head >> 32) + 1) << 32) | top;
+}
+
+// Pop a free block, or -1 if none is left. Reading the next link of a
+// block another process just popped is harmless: the tag in the head has
+// changed, so the compare-and-swap fails and we retry.
+static int64_t pop(struct kvpool_header *h, struct kvpool_block *b) {
+    uint64_t head = atomic_load_explicit(&h->free_head, memory_order_acquire);
+
+    for (;;) {
+        uint32_t top = (uint32_t)head;
+        if (!top)
+            return -1;
+        uint32_t next = atomic_load_explicit(&b[top - 1].next, memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&h->free_head, &head, next_head(head, next),
+                                                  memory_order_acquire, memory_order_acquire)) {
+            atomic_fetch_sub_explicit(&h->nr_free, 1, memory_order_relaxed);
+            return top - 1;
+        }
+    }
+}
+
+static void push(struct kvpool_header *h, struct kvpool_block *b, uint32_t block) {
+    uint64_t head = atomic_load_explicit(&h->free_head, memory_order_relaxed);
+
+    do {
+        atomic_store_explicit(&b[block].next, (uint32_t)head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&h->free_head, &head,
+                                                    next_head(head, block + 1),
+                                                    memory_order_release, memory_order_relaxed));
+    atomic_fetch_add_explicit(&h->nr_free, 1, memory_order_relaxed);
+}
+
+long kvpool_alloc(void *base, uint64_t owner, uint32_t *out, uint32_t n) {
+    struct kvpool_header *h = header(base);
+
+    if (!h || bad_owner(owner))
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    uint64_t seq = atomic_fetch_add_explicit(&h->alloc_seq, 1, memory_order_relaxed);
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t block = pop(h, b);
+        if (block < 0) {
+            // All or nothing: a sequence cannot use part of its blocks
+            while (i--) {
+                atomic_store_explicit(&b[out[i]].state, 0, memory_order_relaxed);
+                push(h, b, out[i]);
+            }
+            atomic_fetch_add_explicit(&h->alloc_failures, 1, memory_order_relaxed);
+            return -ENOMEM;
+        }
+        // A new block starts referenced, so the next sweep passes it over
+        atomic_store_explicit(&b[block].refs, 1, memory_order_relaxed);
+        atomic_store_explicit(&b[block].alloc_seq, seq, memory_order_relaxed);
+        atomic_store_explicit(&b[block].state, KVPOOL_USED | owner, memory_order_relaxed);
+        out[i] = (uint32_t)block;
+    }
+
+    atomic_fetch_add_explicit(&h->allocs, n, memory_order_relaxed);
+    return n;
+}
+
+// Free one block if it is in the expected state, or if it is private and
+// expected is 0. The compare-and-swap makes sure that of two concurrent
+// frees of the same block only one puts it back on the list.
+static long free_block(struct kvpool_header *h, struct kvpool_block *b, uint32_t block,
+                       uint64_t expected) {
+    uint64_t state = expected ? expected : atomic_load_explicit(&b[block].state,
+                                                                memory_order_relaxed);
+    do {
+        if (!(state & KVPOOL_USED) || (!expected && state == KVPOOL_SHARED))
+            return 0;
+        if (expected && state != expected)
+            return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&b[block].state, &state, 0,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    push(h, b, block);
+    return 1;
+}
+
+long kvpool_free(void *base, const uint32_t *list, uint32_t n) {
+    struct kvpool_header *h = header(base);
+    long freed = 0;
+
+    if (!h)
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    uint32_t i;
+    for (i = 0; i < n && list[i] < h->nr_blocks; i++)
+        freed += free_block(h, b, list[i], 0);
+
+    atomic_fetch_add_explicit(&h->frees, freed, memory_order_relaxed);
+    return i < n ? -EINVAL : freed;
+}
+
+// Free the blocks in state, or also idle ones if state is in use
+static long free_owner(struct kvpool_header *h, struct kvpool_block *b, uint64_t state) {
+    uint64_t idle = state | KVPOOL_IDLE;
+    long freed = 0;
+
+    for (uint64_t i = 0; i < h->nr_blocks; i++) {
+        uint64_t s = atomic_load_explicit(&b[i].state, memory_order_relaxed);
+        if (s == state || s == idle)
+            freed += free_block(h, b, (uint32_t)i, s);
+    }
+
+    atomic_fetch_add_explicit(&h->frees, freed, memory_order_relaxed);
+    return freed;
+}
+
+long kvpool_free_owner(void *base, uint64_t owner) {
+    struct kvpool_header *h = header(base);
+
+    if (!h || bad_owner(owner))
+        return -EINVAL;
+    return free_owner(h, blocks(h), KVPOOL_USED | owner);
+}
+
+static long set_state(void *base, uint64_t owner, uint64_t from, uint64_t to) {
+    struct kvpool_header *h = header(base);
+    long changed = 0;
+
+    if (!h || bad_owner(owner))
+        return -EINVAL;
+
+    // Against a concurrent eviction, each block goes one way or the other
+    struct kvpool_block *b = blocks(h);
+    for (uint64_t i = 0; i < h->nr_blocks; i++) {
+        uint64_t state = from | owner;
+        changed += atomic_compare_exchange_strong_explicit(&b[i].state, &state, to | owner,
+                                                           memory_order_acq_rel,
+                                                           memory_order_relaxed);
+    }
+    return changed;
+}
+
+long kvpool_idle(void *base, uint64_t owner) {
+    return set_state(base, owner, KVPOOL_USED, KVPOOL_USED | KVPOOL_IDLE);
+}
+
+long kvpool_resume(void *base, uint64_t owner) {
+    return set_state(base, owner, KVPOOL_USED | KVPOOL_IDLE, KVPOOL_USED);
+}
+
+// Lost updates between processes only make the counts approximate
+static void touch(struct kvpool_header *h, struct kvpool_block *b, uint32_t block) {
+    _Atomic uint32_t *refs = &b[block].refs;
+    uint32_t r = atomic_load_explicit(refs, memory_order_relaxed);
+
+    if (h->policy != KVPOOL_POLICY_LFU)
+        r = 0;
+    if (r < KVPOOL_MAX_REFS)
+        atomic_store_explicit(refs, r + 1, memory_order_relaxed);
+}
+
+void kvpool_access(void *base, const uint32_t *list, uint32_t n) {
+    struct kvpool_header *h = header(base);
+
+    if (!h)
+        return;
+    if (!n) {
+        atomic_fetch_add_explicit(&h->misses, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct kvpool_block *b = blocks(h);
+    for (uint32_t i = 0; i < n; i++) {
+        if (list[i] < h->nr_blocks)
+            touch(h, b, list[i]);
+    }
+    atomic_fetch_add_explicit(&h->hits, 1, memory_order_relaxed);
+}
+
+// Blocks in use are never evicted: another process may be writing them
+static int evictable(struct kvpool_block *b, uint64_t i, uint64_t keep) {
+    uint64_t state = atomic_load_explicit(&b[i].state, memory_order_relaxed);
+
+    if (state == KVPOOL_SHARED)
+        return !atomic_load_explicit(&b[i].users, memory_order_relaxed);
+    return (state & KVPOOL_USED) && (state & KVPOOL_IDLE) && (state & KVPOOL_OWNER_MASK) != keep;
+}
+
+// Advance the shared clock hand until it rests on a used block with no
+// references left, taking one reference from each used block it passes.
+// Gives up after enough passes to drain the largest count.
+static int64_t clock_victim(struct kvpool_header *h, struct kvpool_block *b, uint64_t keep) {
+    uint64_t budget = h->nr_blocks * 10;    // log2(KVPOOL_MAX_REFS + 1) + 2 passes
+
+    while (budget--) {
+        uint64_t i = atomic_fetch_add_explicit(&h->clock_hand, 1, memory_order_relaxed);
+        i %= h->nr_blocks;
+        if (!evictable(b, i, keep))
+            continue;
+        uint32_t r = atomic_load_explicit(&b[i].refs, memory_order_relaxed);
+        if (!r)
+            return (int64_t)i;
+        atomic_store_explicit(&b[i].refs, h->policy == KVPOOL_POLICY_LFU ? r / 2 : 0,
+                              memory_order_relaxed);
+    }
+    return -1;
+}
+
+// FIFO has no second chance: the block allocated first goes first.
+static int64_t fifo_victim(struct kvpool_header *h, struct kvpool_block *b, uint64_t keep) {
+    uint64_t oldest = UINT64_MAX;
+    int64_t victim = -1;
+
+    for (uint64_t i = 0; i < h->nr_blocks; i++) {
+        if (!evictable(b, i, keep))
+            continue;
+        uint64_t seq = atomic_load_explicit(&b[i].alloc_seq, memory_order_relaxed);
+        if (seq < oldest) {
+            oldest = seq;
+            victim = (int64_t)i;
+        }
+    }
+    return victim;
+}
+
+// Callers skip an index slot whose block hash differs: that is cheaper
+// than a reference, and the check after taking one catches the rest.
+static int get_ref(struct kvpool_block *b, uint32_t block, uint64_t hash) {
+    uint32_t users = atomic_load_explicit(&b[block].users, memory_order_relaxed);
+
+    do {
+        if (users == KVPOOL_USERS_DEAD)
+            return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&b[block].users, &users, users + 1,
+                                                    memory_order_acquire, memory_order_relaxed));
+
+    if (atomic_load_explicit(&b[block].state, memory_order_acquire) == KVPOOL_SHARED &&
+        atomic_load_explicit(&b[block].prefix_hash, memory_order_relaxed) == hash)
+        return 1;
+    atomic_fetch_sub_explicit(&b[block].users, 1, memory_order_release);
+    return 0;
+}
+
+// The referenced block published under hash, or -1
+static int64_t index_find(struct kvpool_header *h, struct kvpool_block *b, uint64_t hash) {
+    _Atomic uint32_t *s = slots(h);
+    uint64_t mask = h->nr_slots - 1;
+
+    for (uint64_t i = 0; i < KVPOOL_MAX_PROBE; i++) {
+        uint32_t v = atomic_load_explicit(&s[(hash + i) & mask], memory_order_acquire);
+        if (v == KVPOOL_SLOT_EMPTY)
+            return -1;
+        if (v == KVPOOL_SLOT_DELETED || v > h->nr_blocks)
+            continue;
+        if (atomic_load_explicit(&b[v - 1].prefix_hash, memory_order_relaxed) == hash &&
+            get_ref(b, v - 1, hash))
+            return v - 1;
+    }
+    return -1;
+}
+
+static int index_insert(struct kvpool_header *h, uint32_t block, uint64_t hash) {
+    _Atomic uint32_t *s = slots(h);
+    uint64_t mask = h->nr_slots - 1;
+
+    for (uint64_t i = 0; i < KVPOOL_MAX_PROBE; i++) {
+        _Atomic uint32_t *slot = &s[(hash + i) & mask];
+        uint32_t v = atomic_load_explicit(slot, memory_order_relaxed);
+        while (v == KVPOOL_SLOT_EMPTY || v == KVPOOL_SLOT_DELETED) {
+            if (atomic_compare_exchange_weak_explicit(slot, &v, block + 1, memory_order_release,
+                                                      memory_order_relaxed))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static void index_remove(struct kvpool_header *h, uint32_t block, uint64_t hash) {
+    _Atomic uint32_t *s = slots(h);
+    uint64_t mask = h->nr_slots - 1;
+
+    for (uint64_t i = 0; i < KVPOOL_MAX_PROBE; i++) {
+        uint32_t v = block + 1;
+        if (atomic_compare_exchange_strong_explicit(&s[(hash + i) & mask], &v,
+                                                    KVPOOL_SLOT_DELETED, memory_order_relaxed,
+                                                    memory_order_relaxed))
+            return;
+    }
+}
+
+// Free an unreferenced shared block: lookups that race with this see
+// KVPOOL_USERS_DEAD or a tombstone and move on
+static long evict_shared(struct kvpool_header *h, struct kvpool_block *b, uint32_t block) {
+    uint32_t users = 0;
+
+    if (!atomic_compare_exchange_strong_explicit(&b[block].users, &users, KVPOOL_USERS_DEAD,
+                                                 memory_order_acquire, memory_order_relaxed))
+        return 0;
+    if (atomic_load_explicit(&b[block].state, memory_order_relaxed) != KVPOOL_SHARED) {
+        // Evicted and reallocated since the victim was picked
+        atomic_store_explicit(&b[block].users, 0, memory_order_release);
+        return 0;
+    }
+    index_remove(h, block, atomic_load_explicit(&b[block].prefix_hash, memory_order_relaxed));
+    long freed = free_block(h, b, block, KVPOOL_SHARED);
+    atomic_store_explicit(&b[block].users, 0, memory_order_release);
+    atomic_fetch_add_explicit(&h->frees, freed, memory_order_relaxed);
+    return freed;
+}
+
+long kvpool_evict(void *base, uint64_t keep, uint32_t want, uint64_t *owners,
+                  uint32_t max_owners) {
+    struct kvpool_header *h = header(base);
+    uint64_t freed = 0;
+    long nr = 0;
+
+    if (!h || bad_owner(keep))
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    while (freed < want && nr < max_owners) {
+        int64_t victim = h->policy == KVPOOL_POLICY_FIFO ? fifo_victim(h, b, keep)
+                                                         : clock_victim(h, b, keep);
+        if (victim < 0)
+            break;
+        uint64_t state = atomic_load_explicit(&b[victim].state, memory_order_relaxed);
+        if (state == KVPOOL_SHARED) {
+            freed += evict_shared(h, b, (uint32_t)victim);
+            continue;
+        }
+        if (!(state & KVPOOL_USED) || !(state & KVPOOL_IDLE))
+            continue;   // Freed or resumed under us
+        // Another process evicting the same owner gets 0 and looks again
+        long n = free_owner(h, b, state);
+        if (n > 0) {
+            owners[nr++] = state & KVPOOL_OWNER_MASK;
+            freed += n;
+        }
+    }
+
+    atomic_fetch_add_explicit(&h->evictions, freed, memory_order_relaxed);
+    return nr;
+}
+
+long kvpool_lookup(void *base, const uint64_t *hashes, uint32_t n, uint32_t *out) {
+    struct kvpool_header *h = header(base);
+    long found = 0;
+
+    if (!h)
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t block = index_find(h, b, hashes[i]);
+        if (block < 0)
+            break;
+        touch(h, b, (uint32_t)block);
+        out[found++] = (uint32_t)block;
+    }
+
+    atomic_fetch_add_explicit(found ? &h->hits : &h->misses, 1, memory_order_relaxed);
+    return found;
+}
+
+long kvpool_publish(void *base, uint64_t owner, uint32_t block, uint64_t hash) {
+    struct kvpool_header *h = header(base);
+
+    if (!h || bad_owner(owner) || block >= h->nr_blocks)
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    uint64_t state = KVPOOL_USED | owner;
+    if (atomic_load_explicit(&b[block].state, memory_order_relaxed) != state)
+        return -EINVAL;
+    int64_t existing = index_find(h, b, hash);
+    if (existing >= 0)
+        return existing;
+
+    // Our own reference first: the block is visible once shared.
+    // Publishing the same hash twice at once only leaves a duplicate that
+    // lookups never reach, and is evicted like any unreferenced block.
+    atomic_store_explicit(&b[block].prefix_hash, hash, memory_order_relaxed);
+    uint32_t users = atomic_load_explicit(&b[block].users, memory_order_relaxed);
+    do {
+        if (users == KVPOOL_USERS_DEAD)
+            return -EAGAIN;     // A stale eviction attempt is backing off
+    } while (!atomic_compare_exchange_weak_explicit(&b[block].users, &users, users + 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    if (!atomic_compare_exchange_strong_explicit(&b[block].state, &state, KVPOOL_SHARED,
+                                                 memory_order_release, memory_order_relaxed)) {
+        atomic_fetch_sub_explicit(&b[block].users, 1, memory_order_relaxed);
+        return -EINVAL;
+    }
+    if (index_insert(h, block, hash))
+        return block;
+
+    // Back to private. A lookup can only have reached it through the
+    // index, so no other reference exists.
+    atomic_store_explicit(&b[block].state, KVPOOL_USED | owner, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&b[block].users, 1, memory_order_relaxed);
+    return -ENOSPC;
+}
+
+static int put_ref(struct kvpool_block *b, uint32_t block) {
+    uint32_t users = atomic_load_explicit(&b[block].users, memory_order_relaxed);
+
+    do {
+        if (!users || users == KVPOOL_USERS_DEAD ||
+            atomic_load_explicit(&b[block].state, memory_order_relaxed) != KVPOOL_SHARED)
+            return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&b[block].users, &users, users - 1,
+                                                    memory_order_release, memory_order_relaxed));
+    return 1;
+}
+
+long kvpool_unref(void *base, const uint32_t *list, uint32_t n) {
+    struct kvpool_header *h = header(base);
+    long dropped = 0;
+
+    if (!h)
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    for (uint32_t i = 0; i < n; i++) {
+        if (list[i] < h->nr_blocks)
+            dropped += put_ref(b, list[i]);
+    }
+    return dropped;
+}
+
+long kvpool_cow(void *base, uint64_t owner, uint32_t block) {
+    struct kvpool_header *h = header(base);
+
+    if (!h || bad_owner(owner) || block >= h->nr_blocks)
+        return -EINVAL;
+
+    struct kvpool_block *b = blocks(h);
+    uint64_t state = atomic_load_explicit(&b[block].state, memory_order_acquire);
+    if (state == (KVPOOL_USED | owner))
+        return block;
+    if (state != KVPOOL_SHARED)
+        return -EINVAL;
+
+    uint32_t copy;
+    long ret = kvpool_alloc(base, owner, &copy, 1);
+    if (ret < 0)
+        return ret;
+    // The caller's reference keeps the block from being evicted meanwhile
+    memcpy(block_data(h, copy), block_data(h, block), h->block_size);
+    put_ref(b, block);
+    return copy;
+}
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: Apache-2.0
+// Cortex Linux KV-cache pool - segment layout shared by libcortex_kvpool
+// and kv_cache_manager.py (which mirrors these structs with ctypes).
+//
+// A pool is one shared segment (POSIX shm, or a file on hugetlbfs):
+//
+//   struct kvpool_header                   at 0
+//   struct kvpool_block[nr_blocks]       at meta_offset
+//   uint32_t prefix index[nr_slots]      at index_offset
+//   nr_blocks * block_size bytes of data at data_offset (page aligned)
+//
+// Python formats the segment; every process that maps it then allocates,
+// frees and evicts blocks with the lock-free calls below. Eviction state
+// (reference counts, the clock hand, hit/miss counters) is in the segment
+// too: no access ever goes through SQLite.
+//
+// Full blocks can be published to the prefix index, keyed by a hash of
+// the tokens in the block and the hash of the block before it. Other
+// sequences with the same token prefix then reference the same blocks
+// (the chain of hashes is a radix tree over block-sized edges). Shared
+// blocks are read-only and counted; kvpool_cow() gives a sequence its own
+// copy, and a shared block nobody references stays cached until evicted.
+
+#ifndef __CORTEX_KVPOOL_H
+#define __CORTEX_KVPOOL_H
+
+#include <stdint.h>
+
+#define KVPOOL_MAGIC    0x4c4f4f50564b5843ULL   // "CXKVPOOL" in little-endian byte order
+#define KVPOOL_VERSION  3
+
+#define KVPOOL_F_HUGETLB    (1U << 0)   // Backed by hugetlbfs pages
+
+// Block state: KVPOOL_USED | owner while allocated, 0 while free. An
+// owner marks its blocks KVPOOL_IDLE when it stops using them but wants
+// them kept; only idle and unreferenced shared blocks can be evicted.
+#define KVPOOL_USED         (1ULL << 63)
+#define KVPOOL_IDLE         (1ULL << 62)
+#define KVPOOL_OWNER_MASK   (KVPOOL_IDLE - 1)
+#define KVPOOL_SHARED       (KVPOOL_USED | KVPOOL_OWNER_MASK)  // In the prefix index
+
+// Prefix index slots: block + 1, or one of these
+#define KVPOOL_SLOT_EMPTY   0
+#define KVPOOL_SLOT_DELETED UINT32_MAX
+#define KVPOOL_MAX_PROBE    32          // Slots looked at past a hash's home slot
+#define KVPOOL_USERS_DEAD   UINT32_MAX  // Shared block being evicted
+
+#define KVPOOL_CACHELINE    64
+
+// Eviction policies (CachePolicy in kv_cache_manager.py)
+#define KVPOOL_POLICY_LRU   0   // CLOCK: one reference bit per block
+#define KVPOOL_POLICY_LFU   1   // GCLOCK: access counts, halved by each pass
+#define KVPOOL_POLICY_FIFO  2   // Oldest allocation first
+
+#define KVPOOL_MAX_REFS     255 // LFU counts saturate here
+
+struct kvpool_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;             // KVPOOL_F_*
+    uint64_t block_size;
+    uint64_t nr_blocks;
+    uint64_t meta_offset;
+    uint64_t data_offset;
+    uint64_t segment_size;
+    uint64_t created_ns;        // CLOCK_REALTIME
+
+    // Free-list head: (ABA tag << 32) | (block + 1), 0 when empty. On its
+    // own cache line, it is the one word every allocation contends on.
+    _Alignas(KVPOOL_CACHELINE) _Atomic uint64_t free_head;
+    _Atomic uint64_t nr_free;
+
+    _Alignas(KVPOOL_CACHELINE) _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    _Atomic uint64_t alloc_failures;    // Requests that found too few free blocks
+    _Atomic uint64_t hits;              // kvpool_access() calls with blocks
+    _Atomic uint64_t misses;            // ... and without
+    _Atomic uint64_t evictions;         // Blocks freed by kvpool_evict()
+
+    _Alignas(KVPOOL_CACHELINE) uint32_t policy;     // KVPOOL_POLICY_*
+    uint32_t block_tokens;              // Tokens per block (prefix hashes cover this many)
+    _Atomic uint64_t clock_hand;        // Next block the sweep looks at
+    _Atomic uint64_t alloc_seq;         // Allocation order, for FIFO
+    uint64_t index_offset;
+    uint64_t nr_slots;                  // Power of two, at least 2 * nr_blocks
+    uint8_t salt[16];                   // Random key of the prefix hashes
+};
+
+struct kvpool_block {
+    _Atomic uint64_t state;     // KVPOOL_USED | owner, or 0
+    _Atomic uint32_t next;      // Next free block + 1 (0: end of list)
+    _Atomic uint32_t refs;      // Reference bit (LRU) or access count (LFU)
+    _Atomic uint64_t alloc_seq; // When it was allocated (header alloc_seq)
+    _Atomic uint64_t prefix_hash;   // Index key while KVPOOL_SHARED
+    _Atomic uint32_t users;         // Sequences referencing it while KVPOOL_SHARED
+    uint32_t pad;
+};
+
+// Allocate n blocks for owner (< KVPOOL_OWNER_MASK), all or nothing.
+// Writes the block numbers to out and returns n, or -ENOMEM (nothing
+// allocated) / -EINVAL.
+long kvpool_alloc(void *base, uint64_t owner, uint32_t *out, uint32_t n);
+
+// Free blocks; already free and shared ones are skipped. Returns the
+// number freed, or -EINVAL for a block number out of range (nothing after
+// it is freed).
+long kvpool_free(void *base, const uint32_t *blocks, uint32_t n);
+
+// Free every block of owner, idle or not. Returns the number freed.
+long kvpool_free_owner(void *base, uint64_t owner);
+
+// Mark owner's blocks idle (cached, evictable) or in use again. Return
+// how many blocks changed; a resume that finds fewer than the owner had
+// lost the rest to eviction.
+long kvpool_idle(void *base, uint64_t owner);
+long kvpool_resume(void *base, uint64_t owner);
+
+// Record a lookup: a hit that references blocks, or a miss if n is 0.
+// Relaxed stores only; safe to call on every decode step.
+void kvpool_access(void *base, const uint32_t *blocks, uint32_t n);
+
+// Evict the idle blocks of whole owners other than keep (usually the one
+// about to allocate), and shared blocks nobody references, victims chosen
+// by the pool's policy, until at least want blocks were freed or
+// max_owners were evicted. Writes the evicted owners to owners and
+// returns how many there are.
+long kvpool_evict(void *base, uint64_t keep, uint32_t want, uint64_t *owners,
+                  uint32_t max_owners);
+
+// Find the longest published prefix of a chain of block hashes. Takes a
+// reference on each block found, writes them to out and returns how many
+// there are. Counts a hit, or a miss if there are none.
+long kvpool_lookup(void *base, const uint64_t *hashes, uint32_t n, uint32_t *out);
+
+// Publish a full block of owner under hash. The owner keeps a reference
+// and loses the block otherwise. Returns the block to use from now on:
+// block itself, or the one already published under hash (referenced, and
+// block stays the owner's to free). -EINVAL if owner does not hold block;
+// -ENOSPC if the index has no room near hash, or -EAGAIN if an eviction
+// got in the way (block stays private either way).
+long kvpool_publish(void *base, uint64_t owner, uint32_t block, uint64_t hash);
+
+// Drop one reference on each shared block; others are skipped. Returns
+// how many were dropped.
+long kvpool_unref(void *base, const uint32_t *blocks, uint32_t n);
+
+// Copy-on-write: a block of owner's own with the contents of block. A
+// block owner already holds is returned as is; for a shared one, a new
+// block gets a copy and the reference moves to it. -ENOMEM if no block is
+// free.
+long kvpool_cow(void *base, uint64_t owner, uint32_t block);
+
+#endif /* __CORTEX_KVPOOL_H */
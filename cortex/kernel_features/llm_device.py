@@ -3,13 +3,27 @@
 Cortex /dev/llm Virtual Device
 
 FUSE-based LLM interface - everything is a file.
+
+Writing a prompt queues the completion on a worker pool and returns at
+once; the response file streams it. A read blocks until bytes past its
+offset arrive (or fails with EAGAIN under O_NONBLOCK) and ends at the
+end of the completion, so
+
+    echo "Hello" > /dev/llm/claude/prompt && cat /dev/llm/claude/response
+
+prints the first tokens as soon as the model sends them. Each open of a
+response file keeps reading the completion that was current when it was
+opened.
 """
 
 import errno
+import itertools
 import json
 import os
 import stat
+import threading
 import time
+from concurrent.futures import ThreadPoolExecutor
 from dataclasses import dataclass, field
 
 try:
@@ -34,6 +48,55 @@ try:
 except ImportError:
     HAS_API = False
 
+DEFAULT_WORKERS = 4
+
+
+class ResponseStream:
+    """Append-only response bytes, read by offset while they are written.
+
+    The buffer only grows, so a read copies out just the range it asked
+    for; nothing is re-encoded or re-sliced from the start.
+    """
+
+    def __init__(self, done: bool = False):
+        self._buf = bytearray()
+        self._cond = threading.Condition()
+        self.done = done
+
+    def __len__(self) -> int:
+        return len(self._buf)
+
+    def append(self, data: bytes) -> None:
+        if not data:
+            return
+        with self._cond:
+            self._buf += data
+            self._cond.notify_all()
+
+    def finish(self) -> None:
+        with self._cond:
+            self.done = True
+            self._cond.notify_all()
+
+    def text(self) -> str:
+        with self._cond:
+            return self._buf.decode(errors="replace")
+
+    def read(self, size: int, offset: int, block: bool = True) -> bytes:
+        """Up to size bytes at offset; b"" once the completion has ended there.
+
+        Waits for the first byte past offset, or raises BlockingIOError
+        if block is false and there is none yet.
+        """
+        with self._cond:
+            while len(self._buf) <= offset and not self.done:
+                if not block:
+                    raise BlockingIOError(errno.EAGAIN, "no response data yet")
+                self._cond.wait()
+            # A view must not outlive the lock: append() resizes the buffer
+            with memoryview(self._buf) as view:
+                return bytes(view[offset : offset + size])
+
 
 @dataclass
 class Session:
@@ -41,7 +104,7 @@ class Session:
     model: str
     messages: list[dict] = field(default_factory=list)
     prompt: str = ""
-    response: str = ""
+    response: ResponseStream = field(default_factory=lambda: ResponseStream(done=True))
     temp: float = 0.7
     max_tokens: int = 4096
 
@@ -50,17 +113,26 @@ class MockLLM:
     def complete(self, model, messages, max_tokens, temp, system=None):
         return f"[Mock] Response to: {messages[-1]['content'][:50]}..."
 
+    def stream(self, model, messages, max_tokens, temp, system=None):
+        text = self.complete(model, messages, max_tokens, temp, system)
+        for i, word in enumerate(text.split(" ")):
+            yield word if i == 0 else " " + word
+
 
 class LLMDevice(Operations):
     MODELS = {"claude": "claude-3-sonnet-20240229", "sonnet": "claude-3-5-sonnet-20241022"}
 
-    def __init__(self):
+    def __init__(self, workers: int = DEFAULT_WORKERS):
         self.sessions: dict[str, Session] = {"default": Session("default", "claude")}
         self.llm = (
             anthropic.Anthropic() if HAS_API and os.environ.get("ANTHROPIC_API_KEY") else MockLLM()
         )
         self.start = time.time()
         self.requests = 0
+        self._lock = threading.Lock()
+        self._pool = ThreadPoolExecutor(max_workers=workers, thread_name_prefix="llm-complete")
+        self._handles: dict[int, ResponseStream] = {}
+        self._next_fh = itertools.count(1)
 
     def _parse(self, path):
         parts = path.strip("/").split("/")
@@ -78,9 +150,19 @@ class LLMDevice(Operations):
             return ("status", None, None)
         return ("unknown", None, None)
 
+    def _session(self, t, m) -> Session | None:
+        """The session a model or session path refers to (models share default)."""
+        if t == "model":
+            return self.sessions["default"]
+        if t == "session" and m:
+            return self.sessions.get(m)
+        return None
+
     def getattr(self, path, fh=None):
         t, m, f = self._parse(path)
         now = time.time()
+        if t == "session" and m and m not in self.sessions:
+            raise FuseOSError(errno.ENOENT)
         if t in ("root", "model", "session") and not f:
             return {
                 "st_mode": stat.S_IFDIR | 0o755,
@@ -97,7 +179,7 @@ class LLMDevice(Operations):
                 "st_nlink": 1,
                 "st_uid": os.getuid(),
                 "st_gid": os.getgid(),
-                "st_size": 0,
+                "st_size": 0,  # Files are opened direct_io, so reads ignore it
                 "st_atime": now,
                 "st_mtime": now,
                 "st_ctime": now,
@@ -117,52 +199,98 @@ class LLMDevice(Operations):
             return base + ["prompt", "response", "history"]
         return base
 
-    def read(self, path, size, offset, fh):
+    def mkdir(self, path, mode):
+        t, m, f = self._parse(path)
+        if t != "session" or not m or f:
+            raise FuseOSError(errno.EACCES)
+        with self._lock:
+            if m in self.sessions:
+                raise FuseOSError(errno.EEXIST)
+            self.sessions[m] = Session(m, "claude")
+        return 0
+
+    def read(self, path, size, offset, fi):
         t, m, f = self._parse(path)
-        s = self.sessions.get("default")
-        if t == "model" and f == "response":
-            return s.response.encode()[offset : offset + size]
+        if f == "response":
+            stream = self._handles.get(fi.fh)
+            if stream is None:
+                return b""
+            try:
+                return stream.read(size, offset, block=not fi.flags & os.O_NONBLOCK)
+            except BlockingIOError:
+                raise FuseOSError(errno.EAGAIN) from None
         if t == "status":
             return json.dumps(
                 {"status": "running", "uptime": time.time() - self.start, "requests": self.requests}
             ).encode()[offset : offset + size]
+        if f == "history" and (s := self._session(t, m)):
+            return json.dumps(s.messages).encode()[offset : offset + size]
         return b""
 
-    def write(self, path, data, offset, fh):
+    def write(self, path, data, offset, fi):
         t, m, f = self._parse(path)
-        if t == "model" and f == "prompt":
-            s = self.sessions["default"]
+        s = self._session(t, m)
+        if s is None or f != "prompt":
+            raise FuseOSError(errno.EACCES)
+        with self._lock:
+            if not s.response.done:
+                raise FuseOSError(errno.EBUSY)  # One completion per session at a time
             s.prompt = data.decode().strip()
             s.messages.append({"role": "user", "content": s.prompt})
-            try:
-                resp = (
-                    self.llm.messages.create(
-                        model=self.MODELS.get(m, "claude-3-sonnet-20240229"),
-                        max_tokens=s.max_tokens,
-                        messages=s.messages,
-                    )
-                    if HAS_API
-                    else self.llm.complete(m, s.messages, s.max_tokens, s.temp)
-                )
-                s.response = resp.content[0].text if HAS_API else resp
-            except Exception as e:
-                s.response = f"Error: {e}"
-            s.messages.append({"role": "assistant", "content": s.response})
+            s.response = ResponseStream()
             self.requests += 1
-            return len(data)
-        raise FuseOSError(errno.EACCES)
+        model = m if t == "model" else s.model
+        self._pool.submit(self._complete, s, model, list(s.messages), s.response)
+        return len(data)
+
+    def _complete(self, s: Session, model: str, messages: list[dict], stream: ResponseStream):
+        """Run one completion on a worker, streaming it into stream."""
+        try:
+            if isinstance(self.llm, MockLLM):
+                for text in self.llm.stream(model, messages, s.max_tokens, s.temp):
+                    stream.append(text.encode())
+            else:
+                with self.llm.messages.stream(
+                    model=self.MODELS.get(model, "claude-3-sonnet-20240229"),
+                    max_tokens=s.max_tokens,
+                    messages=messages,
+                ) as response:
+                    for text in response.text_stream:
+                        stream.append(text.encode())
+        except Exception as e:
+            stream.append(f"Error: {e}".encode())
+        finally:
+            s.messages.append({"role": "assistant", "content": stream.text()})
+            stream.finish()
 
     def truncate(self, path, length, fh=None):
         return 0
 
-    def open(self, path, flags):
+    def open(self, path, fi):
+        t, m, f = self._parse(path)
+        # Sizes are not known up front: read until the callback returns b""
+        fi.direct_io = True
+        fi.fh = 0
+        if f == "response" and (s := self._session(t, m)):
+            fi.fh = next(self._next_fh)
+            self._handles[fi.fh] = s.response
         return 0
 
     def create(self, path, mode, fi=None):
+        if fi is not None:
+            fi.direct_io = True
+            fi.fh = 0
         return 0
 
+    def release(self, path, fi):
+        self._handles.pop(fi.fh, None)
+        return 0
+
+    def destroy(self, path):
+        self._pool.shutdown(wait=False, cancel_futures=True)
+
 
-def mount(mountpoint, foreground=False):
+def mount(mountpoint, foreground=False, workers=DEFAULT_WORKERS):
     if not HAS_FUSE:
         print("Install fusepy: pip install fusepy")
         return
@@ -171,7 +299,8 @@ def mount(mountpoint, foreground=False):
     Path(mountpoint).mkdir(parents=True, exist_ok=True)
     print(f"Mounting /dev/llm at {mountpoint}")
     print(f'Usage: echo "Hello" > {mountpoint}/claude/prompt && cat {mountpoint}/claude/response')
-    FUSE(LLMDevice(), mountpoint, foreground=foreground, allow_other=False)
+    # raw_fi: open() sets direct_io and a per-open handle on the file info
+    FUSE(LLMDevice(workers), mountpoint, foreground=foreground, allow_other=False, raw_fi=True)
 
 
 def main():
@@ -182,11 +311,12 @@ def main():
     m = sub.add_parser("mount")
     m.add_argument("mountpoint")
     m.add_argument("-f", "--foreground", action="store_true")
+    m.add_argument("--workers", type=int, default=DEFAULT_WORKERS, help="Completions run at once")
     sub.add_parser("umount").add_argument("mountpoint")
 
     args = p.parse_args()
     if args.cmd == "mount":
-        mount(args.mountpoint, args.foreground)
+        mount(args.mountpoint, args.foreground, args.workers)
     elif args.cmd == "umount":
         import subprocess
 
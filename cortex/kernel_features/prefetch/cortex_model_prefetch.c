@@ -0,0 +1,607 @@
+// SPDX-License-Identifier: Apache-2.0
+// Cortex Linux model prefetcher
+//
+// Reads the weight shards of a model (safetensors, GGUF, ...) as fast as
+// the storage allows before the model server starts, so the server's own,
+// usually single-threaded, loader finds them in memory. Targets:
+//
+//   pagecache  Buffered reads; the page cache is warm afterwards (default)
+//   hugetlbfs  O_DIRECT reads straight into files on hugetlbfs (--stage-dir)
+//              that the server can map; a manifest lists the staged copies
+//   none       O_DIRECT reads into scratch buffers, to measure the storage
+//
+// All shards are read at once through one io_uring ring. Without io_uring
+// (old kernel, kernel.io_uring_disabled, a seccomp filter) a pread() thread
+// pool issues the same reads.
+//
+// Build with:
+//   cc -O2 -Wall -o cortex-model-prefetch cortex_model_prefetch.c -luring -lpthread
+//
+// Usage:
+//   cortex-model-prefetch [--target pagecache|hugetlbfs|none] [--stage-dir DIR]
+//                         [--queue-depth N] [--block-size MB] [--json] PATH
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <liburing.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SHARDS          1024
+#define MAX_QUEUE_DEPTH     256
+#define DEFAULT_QUEUE_DEPTH 32
+#define DEFAULT_BLOCK_MB    4
+#define SCRATCH_ALIGN       (2 << 20)   // Lets the scratch buffers use THPs
+#define DIRECT_ALIGN        4096        // A multiple of any logical block size
+#define HUGETLBFS_MAGIC     0x958458f6
+
+enum target {
+    TARGET_PAGECACHE,
+    TARGET_HUGETLBFS,
+    TARGET_NONE,
+};
+
+static const char *const target_names[] = {"pagecache", "hugetlbfs", "none"};
+
+struct options {
+    enum target target;
+    const char *stage_dir;
+    unsigned int queue_depth;
+    size_t block_size;
+    bool json;
+    const char *path;
+};
+
+static struct options opts = {
+    .target = TARGET_PAGECACHE,
+    .queue_depth = DEFAULT_QUEUE_DEPTH,
+    .block_size = DEFAULT_BLOCK_MB << 20,
+};
+
+struct shard {
+    char path[PATH_MAX];
+    int fd;
+    bool direct;            // Opened with O_DIRECT
+    off_t size;
+    off_t next;             // Next offset to hand out
+    char *dst;              // Staged hugetlbfs mapping, or NULL
+    size_t dst_len;
+};
+
+static struct shard shards[MAX_SHARDS];
+static int n_shards;
+
+static off_t total_bytes;
+static off_t done_bytes;
+
+// Block cursor, shared by the pread() workers
+static pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cursor;
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--target pagecache|hugetlbfs|none] [--stage-dir DIR]\n"
+            "       [--queue-depth N] [--block-size MB] [--json] PATH\n"
+            "\n"
+            "  PATH               Model file or directory of shards\n"
+            "  --target T         Where the data ends up (default pagecache)\n"
+            "  --stage-dir DIR    hugetlbfs directory for --target hugetlbfs\n"
+            "  --queue-depth N    Reads in flight (default %d)\n"
+            "  --block-size MB    Size of each read (default %d)\n"
+            "  --json             Print the report as JSON\n",
+            prog, DEFAULT_QUEUE_DEPTH, DEFAULT_BLOCK_MB);
+}
+
+static int parse_args(int argc, char **argv) {
+    static const struct option long_opts[] = {
+        {"target", required_argument, NULL, 't'},
+        {"stage-dir", required_argument, NULL, 's'},
+        {"queue-depth", required_argument, NULL, 'q'},
+        {"block-size", required_argument, NULL, 'b'},
+        {"json", no_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {},
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "t:s:q:b:jh", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            for (opts.target = 0; opts.target <= TARGET_NONE; opts.target++) {
+                if (!strcmp(optarg, target_names[opts.target]))
+                    break;
+            }
+            if (opts.target > TARGET_NONE) {
+                fprintf(stderr, "Unknown --target '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 's':
+            opts.stage_dir = optarg;
+            break;
+        case 'q':
+            opts.queue_depth = strtoul(optarg, NULL, 10);
+            if (!opts.queue_depth || opts.queue_depth > MAX_QUEUE_DEPTH) {
+                fprintf(stderr, "--queue-depth must be 1-%d\n", MAX_QUEUE_DEPTH);
+                return -1;
+            }
+            break;
+        case 'b':
+            opts.block_size = strtoul(optarg, NULL, 10) << 20;
+            if (!opts.block_size) {
+                fprintf(stderr, "--block-size must be a positive number of MB\n");
+                return -1;
+            }
+            break;
+        case 'j':
+            opts.json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    opts.path = argv[optind];
+
+    if (opts.target == TARGET_HUGETLBFS && !opts.stage_dir) {
+        fprintf(stderr, "--target hugetlbfs needs --stage-dir\n");
+        return -1;
+    }
+    return 0;
+}
+
+// =============================================================================
+// SHARD DISCOVERY
+// =============================================================================
+
+static bool is_weight_file(const char *path) {
+    static const char *const exts[] = {".safetensors", ".gguf", ".bin", ".pt", ".pth", NULL};
+    size_t len = strlen(path);
+
+    for (const char *const *ext = exts; *ext; ext++) {
+        size_t n = strlen(*ext);
+        if (len > n && !strcmp(path + len - n, *ext))
+            return true;
+    }
+    return false;
+}
+
+static int add_shard(const char *path, off_t size) {
+    if (n_shards == MAX_SHARDS) {
+        fprintf(stderr, "More than %d shards, ignoring %s\n", MAX_SHARDS, path);
+        return 0;
+    }
+    struct shard *s = &shards[n_shards++];
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    s->fd = -1;
+    s->size = size;
+    total_bytes += size;
+    return 0;
+}
+
+static int collect(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type == FTW_F && S_ISREG(st->st_mode) && st->st_size > 0 && is_weight_file(path))
+        return add_shard(path, st->st_size);
+    return 0;
+}
+
+static int find_shards(const char *path) {
+    struct stat st;
+
+    if (stat(path, &st)) {
+        fprintf(stderr, "Cannot access %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+    if (S_ISREG(st.st_mode))
+        return add_shard(path, st.st_size);
+    if (nftw(path, collect, 16, FTW_PHYS))
+        return -errno;
+    if (!n_shards) {
+        fprintf(stderr, "No weight files under %s\n", path);
+        return -ENOENT;
+    }
+    return 0;
+}
+
+// =============================================================================
+// OPENING AND STAGING
+// =============================================================================
+
+static int open_shard(struct shard *s) {
+    bool want_direct = opts.target != TARGET_PAGECACHE;
+
+    s->fd = open(s->path, O_RDONLY | O_CLOEXEC | (want_direct ? O_DIRECT : 0));
+    s->direct = want_direct;
+    if (s->fd < 0 && want_direct && errno == EINVAL) {
+        // The filesystem has no O_DIRECT (tmpfs, some FUSE and overlay setups)
+        s->fd = open(s->path, O_RDONLY | O_CLOEXEC);
+        s->direct = false;
+    }
+    if (s->fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", s->path, strerror(errno));
+        return -errno;
+    }
+    if (opts.target == TARGET_PAGECACHE)
+        posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return 0;
+}
+
+// Map a hugetlbfs file the size of the shard (rounded up to whole huge
+// pages) as the read destination. hugetlbfs reserves the pages at mmap
+// time, so a shortage fails here rather than with SIGBUS during the read.
+static int stage_shard(struct shard *s, int index, size_t huge_page, FILE *manifest) {
+    char staged[PATH_MAX];
+    const char *base = strrchr(s->path, '/');
+    int fd;
+
+    if (snprintf(staged, sizeof(staged), "%s/%03d-%s", opts.stage_dir, index,
+                 base ? base + 1 : s->path) >= (int)sizeof(staged))
+        return -ENAMETOOLONG;
+    fd = open(staged, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", staged, strerror(errno));
+        return -errno;
+    }
+
+    s->dst_len = ((size_t)s->size + huge_page - 1) / huge_page * huge_page;
+    if (ftruncate(fd, s->dst_len)) {
+        fprintf(stderr, "Cannot size %s: %s\n", staged, strerror(errno));
+        close(fd);
+        return -errno;
+    }
+    s->dst = mmap(NULL, s->dst_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->dst == MAP_FAILED) {
+        int err = errno;
+        s->dst = NULL;
+        fprintf(stderr, "Not enough free hugepages to stage %s (%zu MB): %s\n", s->path,
+                s->dst_len >> 20, strerror(err));
+        return -err;
+    }
+
+    fprintf(manifest, "%lld\t%s\t%s\n", (long long)s->size, s->path, staged);
+    return 0;
+}
+
+static int prepare_shards(void) {
+    FILE *manifest = NULL;
+    size_t huge_page = 0;
+    int err;
+
+    if (opts.target == TARGET_HUGETLBFS) {
+        struct statfs fs;
+        char path[PATH_MAX];
+
+        if (statfs(opts.stage_dir, &fs) || fs.f_type != HUGETLBFS_MAGIC) {
+            fprintf(stderr, "%s is not a hugetlbfs mount\n", opts.stage_dir);
+            return -EINVAL;
+        }
+        huge_page = fs.f_bsize;
+
+        // Manifest: size, source and staged path of every shard
+        snprintf(path, sizeof(path), "%s/manifest", opts.stage_dir);
+        manifest = fopen(path, "w");
+        if (!manifest) {
+            fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+            return -errno;
+        }
+    }
+
+    for (int i = 0; i < n_shards; i++) {
+        err = open_shard(&shards[i]);
+        if (!err && manifest)
+            err = stage_shard(&shards[i], i, huge_page, manifest);
+        if (err) {
+            if (manifest)
+                fclose(manifest);
+            return err;
+        }
+    }
+
+    if (manifest)
+        fclose(manifest);
+    return 0;
+}
+
+// =============================================================================
+// READING
+// =============================================================================
+
+struct block {
+    struct shard *shard;
+    off_t offset;
+    size_t len;
+    char *base;             // Scratch buffer of this slot
+    char *scratch;          // Read position in it, for unstaged shards
+};
+
+// Hand out the next block, round-robin over the shards so that all of
+// them (often on different flash channels) are read at the same time
+static bool next_block(struct block *b) {
+    for (int tried = 0; tried < n_shards; tried++) {
+        struct shard *s = &shards[cursor];
+        cursor = (cursor + 1) % n_shards;
+        if (s->next >= s->size)
+            continue;
+
+        b->shard = s;
+        b->offset = s->next;
+        b->len = opts.block_size;
+        b->scratch = b->base;
+        if (s->dst) {
+            // The staged mapping ends at the huge page after the shard's end.
+            // Read to the end of the shard, rounded up for O_DIRECT; that
+            // stays inside the mapping, which is whole huge pages.
+            size_t left = s->size - s->next;
+            if (s->direct)
+                left = (left + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+            if (left > s->dst_len - s->next)
+                left = s->dst_len - s->next;
+            if (b->len > left)
+                b->len = left;
+        }
+        s->next += opts.block_size;
+        return true;
+    }
+    return false;
+}
+
+static char *block_buffer(struct block *b) {
+    return b->shard->dst ? b->shard->dst + b->offset : b->scratch;
+}
+
+// Account a completed read; returns true if a remainder must be re-read
+static bool complete_block(struct block *b, ssize_t res) {
+    off_t end = b->offset + res;
+
+    if (res <= 0 || end >= b->shard->size) {
+        // Done, or the file shrank under us: count what exists
+        off_t left = b->shard->size - b->offset;
+        done_bytes += res > 0 ? (res < left ? res : left) : 0;
+        return false;
+    }
+    done_bytes += res;
+    if ((size_t)res == b->len)
+        return false;
+
+    // Short buffered read in the middle of the file: read the rest
+    b->offset = end;
+    b->len -= res;
+    if (!b->shard->dst)
+        b->scratch += res;
+    return true;
+}
+
+static int alloc_scratch(struct block *blocks, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        void *buf;
+        if (posix_memalign(&buf, SCRATCH_ALIGN, opts.block_size))
+            return -ENOMEM;
+        madvise(buf, opts.block_size, MADV_HUGEPAGE);
+        blocks[i].base = buf;
+    }
+    return 0;
+}
+
+static void free_scratch(struct block *blocks, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++)
+        free(blocks[i].base);
+}
+
+static int read_uring(void) {
+    struct block blocks[MAX_QUEUE_DEPTH] = {};
+    struct block *free_list[MAX_QUEUE_DEPTH];
+    unsigned int n_free = 0, inflight = 0;
+    struct io_uring ring;
+    int err, failed = 0;
+
+    err = io_uring_queue_init(opts.queue_depth, &ring, 0);
+    if (err)
+        return err;
+
+    err = alloc_scratch(blocks, opts.queue_depth);
+    if (err)
+        goto out;
+    for (unsigned int i = 0; i < opts.queue_depth; i++)
+        free_list[n_free++] = &blocks[i];
+
+    for (;;) {
+        // After a failed read only drain what is still in flight
+        while (n_free && !failed) {
+            struct block *b = free_list[n_free - 1];
+            if (!next_block(b))
+                break;
+            n_free--;
+
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_read(sqe, b->shard->fd, block_buffer(b), b->len, b->offset);
+            io_uring_sqe_set_data(sqe, b);
+            inflight++;
+        }
+        if (!inflight)
+            break;
+
+        err = io_uring_submit_and_wait(&ring, 1);
+        if (err < 0)
+            goto out;
+
+        struct io_uring_cqe *cqe;
+        unsigned int head, seen = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            struct block *b = io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            seen++;
+            inflight--;
+
+            if (res < 0) {
+                fprintf(stderr, "Read of %s at %lld failed: %s\n", b->shard->path,
+                        (long long)b->offset, strerror(-res));
+                failed = res;
+                free_list[n_free++] = b;
+                continue;
+            }
+            if (complete_block(b, res)) {
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read(sqe, b->shard->fd, block_buffer(b), b->len, b->offset);
+                io_uring_sqe_set_data(sqe, b);
+                inflight++;
+                continue;
+            }
+            free_list[n_free++] = b;
+        }
+        io_uring_cq_advance(&ring, seen);
+    }
+    err = failed;
+
+out:
+    io_uring_queue_exit(&ring);
+    free_scratch(blocks, opts.queue_depth);
+    return err;
+}
+
+struct worker {
+    pthread_t thread;
+    struct block block;
+    int err;
+};
+
+static void *pread_worker(void *arg) {
+    struct worker *w = arg;
+    struct block *b = &w->block;
+
+    for (;;) {
+        pthread_mutex_lock(&cursor_lock);
+        bool more = next_block(b);
+        pthread_mutex_unlock(&cursor_lock);
+        if (!more)
+            return NULL;
+
+        bool again;
+        do {
+            ssize_t res = pread(b->shard->fd, block_buffer(b), b->len, b->offset);
+            if (res < 0) {
+                if (errno == EINTR) {
+                    again = true;
+                    continue;
+                }
+                w->err = -errno;
+                fprintf(stderr, "Read of %s at %lld failed: %s\n", b->shard->path,
+                        (long long)b->offset, strerror(errno));
+                return NULL;
+            }
+            pthread_mutex_lock(&cursor_lock);
+            again = complete_block(b, res);
+            pthread_mutex_unlock(&cursor_lock);
+        } while (again);
+    }
+}
+
+static int read_threads(void) {
+    struct worker workers[MAX_QUEUE_DEPTH] = {};
+    struct block blocks[MAX_QUEUE_DEPTH] = {};
+    unsigned int n = opts.queue_depth, started = 0;
+    int err;
+
+    err = alloc_scratch(blocks, n);
+    if (err)
+        goto out;
+
+    for (; started < n; started++) {
+        workers[started].block.base = blocks[started].base;
+        if (pthread_create(&workers[started].thread, NULL, pread_worker, &workers[started])) {
+            err = -EAGAIN;
+            break;
+        }
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].err && !err)
+            err = workers[i].err;
+    }
+
+out:
+    free_scratch(blocks, n);
+    return err;
+}
+
+// =============================================================================
+// MAIN
+// =============================================================================
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *engine, double seconds) {
+    double gib = done_bytes / (double)(1 << 30);
+    double rate = seconds > 0 ? gib / seconds : 0;
+    bool direct = false;
+
+    for (int i = 0; i < n_shards; i++)
+        direct |= shards[i].direct;
+
+    if (opts.json) {
+        printf("{\"path\": \"%s\", \"files\": %d, \"bytes\": %lld, \"seconds\": %.3f, "
+               "\"gib_per_s\": %.3f, \"engine\": \"%s\", \"target\": \"%s\", \"direct\": %s}\n",
+               opts.path, n_shards, (long long)done_bytes, seconds, rate, engine,
+               target_names[opts.target], direct ? "true" : "false");
+        return;
+    }
+    printf("Prefetched %d files, %.1f GiB in %.1f s (%.2f GiB/s) via %s%s into %s\n", n_shards,
+           gib, seconds, rate, engine, direct ? " with O_DIRECT" : "", target_names[opts.target]);
+}
+
+int main(int argc, char **argv) {
+    const char *engine = "io_uring";
+    double start;
+    int err;
+
+    if (parse_args(argc, argv))
+        return 2;
+
+    err = find_shards(opts.path);
+    if (!err)
+        err = prepare_shards();
+    if (err)
+        return 1;
+
+    start = now_s();
+    err = read_uring();
+    if (err == -ENOSYS || err == -EPERM || err == -EACCES) {
+        engine = "pread";
+        err = read_threads();
+    }
+    if (err) {
+        fprintf(stderr, "Prefetch failed: %s\n", strerror(-err));
+        return 1;
+    }
+
+    report(engine, now_s() - start);
+
+    for (int i = 0; i < n_shards; i++) {
+        if (shards[i].dst)
+            munmap(shards[i].dst, shards[i].dst_len);
+        close(shards[i].fd);
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: Apache-2.0
+// Cortex Linux semantic cache embedder
+//
+// Batched version of SemanticCache._embed: a hashed bag of words, one
+// signed count per token at (BLAKE2b-64(token) mod dims), L2-normalized.
+// The output is bit for bit what the Python embedder computes (doubles,
+// summed in the same order), so the embeddings already stored in the
+// cache stay comparable.
+//
+// Only ASCII text is handled here: Python lowercases and classifies
+// Unicode characters, which we do not try to reproduce. A text with any
+// byte >= 0x80 is flagged and left to the Python embedder.
+//
+// semantic_cache.py loads this library with ctypes. Build with `make native`
+// from the repository root, or:
+//   cc -O2 -Wall -Wextra -shared -fPIC -o libcortex_embed.so cortex_embed.c -lm
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DIMS 4096
+
+// BLAKE2b (RFC 7693), unkeyed, 8-byte digest: all a token hash needs
+
+static const uint64_t blake2b_iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+static inline uint64_t rotr64(uint64_t x, int n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+#define G(a, b, c, d, x, y)                 \
+    do {                                    \
+        v[a] = v[a] + v[b] + (x);           \
+        v[d] = rotr64(v[d] ^ v[a], 32);     \
+        v[c] = v[c] + v[d];                 \
+        v[b] = rotr64(v[b] ^ v[c], 24);     \
+        v[a] = v[a] + v[b] + (y);           \
+        v[d] = rotr64(v[d] ^ v[a], 16);     \
+        v[c] = v[c] + v[d];                 \
+        v[b] = rotr64(v[b] ^ v[c], 63);     \
+    } while (0)
+
+static void compress(uint64_t h[8], const uint8_t block[128], uint64_t t, int last) {
+    uint64_t v[16], m[16];
+
+    for (int i = 0; i < 16; i++)
+        m[i] = load64(block + 8 * i);
+    memcpy(v, h, 8 * sizeof(uint64_t));
+    memcpy(v + 8, blake2b_iv, 8 * sizeof(uint64_t));
+    v[12] ^= t;
+    if (last)
+        v[14] = ~v[14];
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t *s = blake2b_sigma[r];
+        G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i + 8];
+}
+
+// hashlib.blake2b(token, digest_size=8).digest() read big-endian
+static uint64_t token_hash(const uint8_t *token, size_t len) {
+    uint64_t h[8];
+    uint8_t block[128];
+    uint64_t t = 0;
+
+    memcpy(h, blake2b_iv, sizeof(h));
+    h[0] ^= 0x01010000ULL | 8;     // fanout 1, depth 1, no key, 8-byte digest
+
+    while (len > 128) {
+        t += 128;
+        compress(h, token, t, 0);
+        token += 128;
+        len -= 128;
+    }
+    memset(block, 0, sizeof(block));
+    memcpy(block, token, len);
+    compress(h, block, t + len, 1);
+
+    // The digest is h[0] little-endian; Python reads those bytes big-endian
+    return __builtin_bswap64(h[0]);
+}
+
+// _tokenize: runs of [a-z0-9._-], after lowercasing
+static inline int token_char(uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.';
+}
+
+// Embed one ASCII text into out[dims]; -1 if it is not ASCII (or, for a
+// token too long for the stack buffer, if malloc fails)
+static int embed_one(const uint8_t *text, size_t len, uint32_t dims, double *out) {
+    uint8_t token[256];
+    size_t n = 0, long_start = 0;
+    int long_token = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] >= 0x80)
+            return -1;
+    }
+
+    memset(out, 0, dims * sizeof(double));
+    for (size_t i = 0; i <= len; i++) {
+        uint8_t c = i < len ? text[i] : ' ';
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (token_char(c)) {
+            if (n < sizeof(token))
+                token[n] = c;
+            else if (!long_token)
+                long_token = 1;
+            if (!n)
+                long_start = i;
+            n++;
+            continue;
+        }
+        if (!n)
+            continue;
+
+        uint64_t value;
+        if (long_token) {
+            // Rare: hash a lowercased copy of the whole run
+            uint8_t *copy = malloc(n);
+            if (!copy)
+                return -1;
+            for (size_t j = 0; j < n; j++) {
+                uint8_t d = text[long_start + j];
+                copy[j] = d >= 'A' && d <= 'Z' ? d + ('a' - 'A') : d;
+            }
+            value = token_hash(copy, n);
+            free(copy);
+        } else {
+            value = token_hash(token, n);
+        }
+        out[value % dims] += (value >> 63) ? -1.0 : 1.0;
+        n = 0;
+        long_token = 0;
+    }
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < dims; i++)
+        sum += out[i] * out[i];
+    double norm = sqrt(sum);
+    if (norm > 0) {
+        for (uint32_t i = 0; i < dims; i++)
+            out[i] /= norm;
+    }
+    return 0;
+}
+
+int cortex_embed(const char *text, size_t len, uint32_t dims, double *out) {
+    if (!dims || dims > MAX_DIMS)
+        return -1;
+    return embed_one((const uint8_t *)text, len, dims, out);
+}
+
+// Embed n texts, concatenated in buf with text i at [offsets[i],
+// offsets[i + 1]), as float32 rows of out (n * dims). Rows of texts that
+// are not ASCII are zeroed and their fallback[i] set. Returns how many
+// texts need the fallback, or -1 for bad dims.
+long cortex_embed_batch(const char *buf, const uint64_t *offsets, uint32_t n, uint32_t dims,
+                        float *out, uint8_t *fallback) {
+    double row[MAX_DIMS];
+    long missed = 0;
+
+    if (!dims || dims > MAX_DIMS)
+        return -1;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const uint8_t *text = (const uint8_t *)buf + offsets[i];
+        float *dst = out + (size_t)i * dims;
+        fallback[i] = embed_one(text, offsets[i + 1] - offsets[i], dims, row) < 0;
+        if (fallback[i]) {
+            memset(dst, 0, dims * sizeof(float));
+            missed++;
+            continue;
+        }
+        for (uint32_t j = 0; j < dims; j++)
+            dst[j] = (float)row[j];
+    }
+    return missed;
+}
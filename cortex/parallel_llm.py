@@ -5,6 +5,11 @@ Parallel LLM Executor for Cortex Linux
 Enables concurrent LLM API calls with rate limiting for 2-3x speedup.
 Batches independent queries and aggregates responses.
 
+Identical queries in flight at the same time share one API call, an
+optional SemanticCache answers repeated and near-identical prompts
+before dispatch, and concurrency adapts (AIMD) to the provider's latency
+and 429 responses.
+
 Use cases:
 - Multi-package queries (analyze multiple packages simultaneously)
 - Parallel error diagnosis
@@ -15,16 +20,29 @@ License: Apache 2.0
 """
 
 import asyncio
+import json
 import logging
+import sqlite3
 import time
+from collections import deque
 from collections.abc import Callable
 from dataclasses import dataclass, field
-from typing import Any
+from typing import TYPE_CHECKING, Any
 
 from cortex.llm_router import LLMProvider, LLMResponse, LLMRouter, TaskType
 
+if TYPE_CHECKING:
+    from cortex.semantic_cache import SemanticCache
+
 logger = logging.getLogger(__name__)
 
+# SemanticCache provider name for responses cached by the executor
+CACHE_PROVIDER = "parallel_llm"
+# Templated fan-outs differ in a word or two ("nginx" vs "redis"), which
+# the default threshold would take for a match. This one only matches
+# prompts with the same words, whatever their case, spacing and punctuation.
+CACHE_SIMILARITY = 0.9999
+
 
 @dataclass
 class ParallelQuery:
@@ -48,6 +66,8 @@ class ParallelResult:
     error: str | None = None
     success: bool = True
     execution_time: float = 0.0
+    cached: bool = False  # Answered by the SemanticCache
+    deduplicated: bool = False  # Shared the call of an identical query in flight
 
 
 @dataclass
@@ -60,6 +80,12 @@ class BatchResult:
     total_cost: float
     success_count: int
     failure_count: int
+    cache_hits: int = 0
+    deduplicated: int = 0
+
+    @property
+    def api_calls_saved(self) -> int:
+        return self.cache_hits + self.deduplicated
 
     def get_result(self, query_id: str) -> ParallelResult | None:
         """Get result by query ID."""
@@ -108,49 +134,249 @@ class RateLimiter:
                 self.tokens -= 1
 
 
+def is_rate_limited(error: Exception) -> bool:
+    """Whether a provider error is a 429 (SDK exceptions carry status_code)."""
+    status = getattr(error, "status_code", None)
+    if status is None:
+        status = getattr(getattr(error, "response", None), "status_code", None)
+    return status == 429 or type(error).__name__ == "RateLimitError" or "429" in str(error)
+
+
+class AdaptiveConcurrency:
+    """
+    AIMD limit on concurrent API calls.
+
+    The limit grows by about one per round trip while latency stays within
+    latency_tolerance times the lowest recently seen, and is halved on a
+    429 (at most once per round trip, so a burst of 429s counts as one).
+    Latency above the tolerance means requests queue at the provider and
+    trims the limit by a tenth.
+    """
+
+    def __init__(
+        self,
+        max_limit: int,
+        min_limit: int = 1,
+        latency_tolerance: float = 2.0,
+        window: int = 50,
+    ):
+        """
+        Initialize the limiter at its maximum.
+
+        Args:
+            max_limit: Most calls allowed in flight
+            min_limit: Fewest calls allowed in flight
+            latency_tolerance: Latency over the baseline that counts as congestion
+            window: Recent latencies the baseline is the minimum of
+        """
+        self.max_limit = max_limit
+        self.min_limit = min_limit
+        self.latency_tolerance = latency_tolerance
+        self.limit = float(max_limit)
+        self.in_flight = 0
+        self._latencies: deque[float] = deque(maxlen=window)
+        self._last_decrease = 0.0
+        self._waiters: deque[asyncio.Future] = deque()
+
+    async def acquire(self) -> None:
+        """Wait until a call fits under the current limit."""
+        while self.in_flight >= int(self.limit):
+            waiter = asyncio.get_running_loop().create_future()
+            self._waiters.append(waiter)
+            try:
+                await waiter
+            finally:
+                if waiter in self._waiters:
+                    self._waiters.remove(waiter)
+        self.in_flight += 1
+
+    def release(self) -> None:
+        self.in_flight -= 1
+        self._wake()
+
+    def on_success(self, latency: float) -> None:
+        self._latencies.append(latency)
+        if latency > self.latency_tolerance * min(self._latencies):
+            self._decrease(0.9)
+        else:
+            self.limit = min(float(self.max_limit), self.limit + 1 / self.limit)
+            self._wake()
+
+    def on_rate_limited(self) -> None:
+        self._decrease(0.5)
+
+    def _decrease(self, factor: float) -> None:
+        now = time.monotonic()
+        rtt = min(self._latencies) if self._latencies else 0.0
+        if now - self._last_decrease < rtt:
+            return
+        self._last_decrease = now
+        self.limit = max(float(self.min_limit), self.limit * factor)
+
+    def _wake(self) -> None:
+        for _ in range(int(self.limit) - self.in_flight):
+            if not self._waiters:
+                break
+            waiter = self._waiters.popleft()
+            if not waiter.done():
+                waiter.set_result(None)
+
+
 class ParallelLLMExecutor:
     """
     Executor for parallel LLM API calls.
 
     Batches independent queries and executes them concurrently
-    with configurable rate limiting and error handling.
+    with adaptive concurrency, request coalescing and error handling.
     """
 
     def __init__(
         self,
         router: LLMRouter | None = None,
         max_concurrent: int = 5,
-        requests_per_second: float = 5.0,
+        requests_per_second: float | None = None,
         retry_failed: bool = True,
         max_retries: int = 2,
+        cache: "SemanticCache | None" = None,
+        cache_similarity: float = CACHE_SIMILARITY,
     ):
         """
         Initialize parallel executor.
 
         Args:
             router: LLMRouter instance (creates new one if None)
-            max_concurrent: Maximum concurrent API calls
-            requests_per_second: Rate limit for API calls
+            max_concurrent: Maximum concurrent API calls; the adaptive
+                limit stays at or below it
+            requests_per_second: Optional fixed rate cap on top of the
+                adaptive limit (a provider quota, say)
             retry_failed: Whether to retry failed requests
             max_retries: Maximum retry attempts per request
+            cache: SemanticCache consulted before, and filled after, each call
+            cache_similarity: Cosine similarity a cached prompt needs to match
         """
         self.router = router or LLMRouter()
         self.max_concurrent = max_concurrent
-        self.rate_limiter = RateLimiter(requests_per_second)
+        self.rate_limiter = RateLimiter(requests_per_second) if requests_per_second else None
+        self.concurrency = AdaptiveConcurrency(max_concurrent)
         self.retry_failed = retry_failed
         self.max_retries = max_retries
-        self._semaphore = asyncio.Semaphore(max_concurrent)
+        self.cache = cache
+        self.cache_similarity = cache_similarity
+        self._in_flight: dict[tuple, asyncio.Task] = {}
+
+    @staticmethod
+    def _query_key(query: ParallelQuery) -> tuple:
+        """Queries with equal keys get the same answer (the id does not count)."""
+        return (
+            json.dumps(query.messages, sort_keys=True),
+            query.task_type,
+            query.force_provider,
+            query.temperature,
+            query.max_tokens,
+        )
+
+    @staticmethod
+    def _cache_key(query: ParallelQuery) -> dict[str, str]:
+        """SemanticCache arguments: the last user message is the prompt, the
+        rest of the conversation and the parameters partition the cache."""
+        prompt_index = max(
+            (i for i, m in enumerate(query.messages) if m.get("role") == "user"), default=-1
+        )
+        context = [m for i, m in enumerate(query.messages) if i != prompt_index]
+        params = (
+            f"[task={query.task_type.value} temperature={query.temperature} "
+            f"max_tokens={query.max_tokens}]"
+        )
+        return {
+            "prompt": query.messages[prompt_index]["content"] if prompt_index >= 0 else "",
+            "provider": CACHE_PROVIDER,
+            "model": query.force_provider.value if query.force_provider else "routed",
+            "system_prompt": json.dumps(context, sort_keys=True) + params,
+        }
+
+    async def _execute_query(self, query: ParallelQuery) -> ParallelResult:
+        """Execute a query, sharing the call of an identical one in flight."""
+        start_time = time.time()
+        key = self._query_key(query)
+        task = self._in_flight.get(key)
+        if task is not None:
+            result = await asyncio.shield(task)
+            return ParallelResult(
+                query_id=query.id,
+                response=result.response,
+                error=result.error,
+                success=result.success,
+                execution_time=time.time() - start_time,
+                cached=result.cached,
+                deduplicated=True,
+            )
+
+        task = asyncio.ensure_future(self._execute_cached(query))
+        self._in_flight[key] = task
+        try:
+            return await asyncio.shield(task)
+        finally:
+            if self._in_flight.get(key) is task:
+                del self._in_flight[key]
+
+    async def _execute_cached(self, query: ParallelQuery) -> ParallelResult:
+        """Answer from the SemanticCache if it can, else call and cache the answer."""
+        if self.cache is None:
+            return await self._execute_single(query)
+
+        start_time = time.time()
+        cache_key = self._cache_key(query)
+        try:
+            cached = await asyncio.to_thread(
+                self.cache.get_commands,
+                similarity_threshold=self.cache_similarity,
+                **cache_key,
+            )
+        except (OSError, sqlite3.Error) as e:
+            logger.warning(f"Cache lookup for {query.id} failed: {e}")
+            cached = None
+        if cached is not None and len(cached) == 3:
+            content, provider, model = cached
+            return ParallelResult(
+                query_id=query.id,
+                response=LLMResponse(
+                    content=content,
+                    provider=LLMProvider(provider),
+                    model=model,
+                    tokens_used=0,
+                    cost_usd=0.0,
+                    latency_seconds=time.time() - start_time,
+                ),
+                execution_time=time.time() - start_time,
+                cached=True,
+            )
+
+        result = await self._execute_single(query)
+        if result.success and result.response:
+            response = result.response
+            try:
+                await asyncio.to_thread(
+                    self.cache.put_commands,
+                    commands=[response.content, response.provider.value, response.model],
+                    **cache_key,
+                )
+            except (OSError, sqlite3.Error):
+                pass  # Silently fail cache writes - not critical for operation
+        return result
 
     async def _execute_single(self, query: ParallelQuery, attempt: int = 0) -> ParallelResult:
-        """Execute a single query with rate limiting and retries."""
+        """Execute a single query with adaptive concurrency and retries."""
         start_time = time.time()
 
         try:
-            await self.rate_limiter.acquire()
+            if self.rate_limiter:
+                await self.rate_limiter.acquire()
 
-            async with self._semaphore:
+            await self.concurrency.acquire()
+            try:
                 # Run sync router.complete in thread pool
-                loop = asyncio.get_event_loop()
+                loop = asyncio.get_running_loop()
+                call_start = time.monotonic()
                 response = await loop.run_in_executor(
                     None,
                     lambda: self.router.complete(
@@ -161,16 +387,21 @@ class ParallelLLMExecutor:
                         max_tokens=query.max_tokens,
                     ),
                 )
+                self.concurrency.on_success(time.monotonic() - call_start)
+            finally:
+                self.concurrency.release()
 
-                return ParallelResult(
-                    query_id=query.id,
-                    response=response,
-                    success=True,
-                    execution_time=time.time() - start_time,
-                )
+            return ParallelResult(
+                query_id=query.id,
+                response=response,
+                success=True,
+                execution_time=time.time() - start_time,
+            )
 
         except Exception as e:
             logger.warning(f"Query {query.id} failed (attempt {attempt + 1}): {e}")
+            if is_rate_limited(e):
+                self.concurrency.on_rate_limited()
 
             if self.retry_failed and attempt < self.max_retries:
                 await asyncio.sleep(0.5 * (attempt + 1))  # exponential backoff
@@ -207,27 +438,31 @@ class ParallelLLMExecutor:
         start_time = time.time()
 
         # Execute all queries concurrently
-        tasks = [self._execute_single(q) for q in queries]
+        tasks = [self._execute_query(q) for q in queries]
         results = await asyncio.gather(*tasks)
 
-        total_time = time.time() - start_time
-        total_tokens = sum(r.response.tokens_used for r in results if r.success and r.response)
-        total_cost = sum(r.response.cost_usd for r in results if r.success and r.response)
-        success_count = sum(1 for r in results if r.success)
-        failure_count = len(results) - success_count
-
+        batch = self._summarize(results, time.time() - start_time)
         logger.info(
-            f"Batch complete: {success_count}/{len(results)} succeeded "
-            f"in {total_time:.2f}s ({total_tokens} tokens, ${total_cost:.4f})"
+            f"Batch complete: {batch.success_count}/{len(results)} succeeded "
+            f"in {batch.total_time:.2f}s ({batch.total_tokens} tokens, ${batch.total_cost:.4f}, "
+            f"{batch.cache_hits} cached, {batch.deduplicated} deduplicated)"
         )
+        return batch
 
+    @staticmethod
+    def _summarize(results: list[ParallelResult], total_time: float) -> BatchResult:
+        # A deduplicated result shares its response: count its tokens once
+        billed = [r for r in results if r.success and r.response and not r.deduplicated]
+        success_count = sum(1 for r in results if r.success)
         return BatchResult(
             results=list(results),
             total_time=total_time,
-            total_tokens=total_tokens,
-            total_cost=total_cost,
+            total_tokens=sum(r.response.tokens_used for r in billed),
+            total_cost=sum(r.response.cost_usd for r in billed),
             success_count=success_count,
-            failure_count=failure_count,
+            failure_count=len(results) - success_count,
+            cache_hits=sum(1 for r in results if r.cached and not r.deduplicated),
+            deduplicated=sum(1 for r in results if r.deduplicated),
         )
 
     def execute_batch(self, queries: list[ParallelQuery]) -> BatchResult:
@@ -271,7 +506,7 @@ class ParallelLLMExecutor:
         results = []
 
         async def execute_with_notify(query: ParallelQuery) -> ParallelResult:
-            result = await self._execute_single(query)
+            result = await self._execute_query(query)
             if on_complete:
                 on_complete(result)
             return result
@@ -279,19 +514,7 @@ class ParallelLLMExecutor:
         tasks = [execute_with_notify(q) for q in queries]
         results = await asyncio.gather(*tasks)
 
-        total_time = time.time() - start_time
-        total_tokens = sum(r.response.tokens_used for r in results if r.success and r.response)
-        total_cost = sum(r.response.cost_usd for r in results if r.success and r.response)
-        success_count = sum(1 for r in results if r.success)
-
-        return BatchResult(
-            results=list(results),
-            total_time=total_time,
-            total_tokens=total_tokens,
-            total_cost=total_cost,
-            success_count=success_count,
-            failure_count=len(results) - success_count,
-        )
+        return self._summarize(results, time.time() - start_time)
 
 
 def create_package_queries(
@@ -1,20 +1,84 @@
 """Semantic caching for LLM responses with SQLite backend and LRU eviction.
 
 Provides semantic similarity matching for cached responses to reduce API calls
-and enable offline operation.
+and enable offline operation. Similarity search runs against an in-memory
+VectorIndex per (provider, model, system prompt) partition, loaded from the
+embedding column on first use and kept current by put_commands.
+
+Embeddings come from libcortex_embed (native/cortex_embed.c) when it is
+built, and from the Python embedder otherwise; both give the same vectors.
 """
 
+import ctypes
+import ctypes.util
 import hashlib
 import json
 import math
 import os
 import sqlite3
+import threading
+from array import array
 from dataclasses import dataclass
 from datetime import datetime
 from pathlib import Path
 
 from cortex.utils.db_pool import SQLiteConnectionPool, get_connection_pool
 
+try:
+    import numpy as np
+except ImportError:  # Optional: pip install cortex-linux[semantic]
+    np = None
+
+EMBEDDING_DIMS = 128
+EMBED_LIB = "libcortex_embed.so"
+
+
+def find_embed_library() -> str | None:
+    """Locate libcortex_embed ($CORTEX_EMBED_LIB, native/ next to us, or ldconfig)."""
+    candidates = [
+        os.environ.get("CORTEX_EMBED_LIB"),
+        Path(__file__).parent / "native" / EMBED_LIB,
+    ]
+    for candidate in candidates:
+        if candidate and os.path.exists(candidate):
+            return str(candidate)
+    return ctypes.util.find_library("cortex_embed")
+
+
+_embed_lib: ctypes.CDLL | None = None
+_embed_lib_loaded = False
+
+
+def embed_library() -> ctypes.CDLL | None:
+    """The native embedder, loaded on first use; None if it is not built."""
+    global _embed_lib, _embed_lib_loaded
+    if not _embed_lib_loaded:
+        _embed_lib_loaded = True
+        path = find_embed_library()
+        try:
+            lib = ctypes.CDLL(path) if path else None
+        except OSError:
+            lib = None
+        if lib is not None:
+            lib.cortex_embed.argtypes = [
+                ctypes.c_char_p,
+                ctypes.c_size_t,
+                ctypes.c_uint32,
+                ctypes.POINTER(ctypes.c_double),
+            ]
+            lib.cortex_embed.restype = ctypes.c_int
+            lib.cortex_embed_batch.argtypes = [
+                ctypes.c_char_p,
+                ctypes.POINTER(ctypes.c_uint64),
+                ctypes.c_uint32,
+                ctypes.c_uint32,
+                ctypes.c_void_p,
+                ctypes.POINTER(ctypes.c_uint8),
+            ]
+            lib.cortex_embed_batch.restype = ctypes.c_long
+        _embed_lib = lib
+    return _embed_lib
+
 
 @dataclass(frozen=True)
 class CacheStats:
@@ -41,6 +105,94 @@ class CacheStats:
         return self.hits / self.total
 
 
+class VectorIndex:
+    """Embeddings of one cache partition, for nearest-neighbour lookups.
+
+    Rows are float32 in one contiguous array. Removing an entry moves the
+    last row into its place, so rows are in no particular order. With
+    numpy a lookup is a single matrix-vector product. Without it, a Python
+    loop touches only the query's nonzero dimensions: hashed bag-of-words
+    vectors are sparse, so that is one multiply-add per entry and token.
+
+    Attributes:
+        generation: (entry count, highest id) of the partition the last
+            time the index matched the database
+    """
+
+    def __init__(self, dims: int = EMBEDDING_DIMS):
+        self.dims = dims
+        self.ids: list[int] = []
+        self.generation: tuple[int, int] = (0, 0)
+        self._rows: dict[int, int] = {}
+        self._matrix = array("f")
+
+    def __len__(self) -> int:
+        return len(self.ids)
+
+    def extend(self, entry_ids: list[int], matrix: array) -> None:
+        """Append entries not in the index yet, one float32 row each.
+
+        matrix is copied as a block (SemanticCache.embed_many output, say):
+        no row or float goes through a Python object.
+        """
+        if len(matrix) != len(entry_ids) * self.dims:
+            raise ValueError(f"expected {len(entry_ids)} rows of {self.dims} dimensions")
+        if any(entry_id in self._rows for entry_id in entry_ids):
+            raise ValueError("entry already indexed")
+        for entry_id in entry_ids:
+            self._rows[entry_id] = len(self.ids)
+            self.ids.append(entry_id)
+        self._matrix.extend(matrix)
+
+    def add(self, entry_id: int, vec: list[float]) -> None:
+        """Insert or replace the embedding of an entry."""
+        if len(vec) != self.dims:
+            raise ValueError(f"expected {self.dims} dimensions, got {len(vec)}")
+        row = self._rows.get(entry_id)
+        if row is None:
+            self._rows[entry_id] = len(self.ids)
+            self.ids.append(entry_id)
+            self._matrix.extend(vec)
+        else:
+            self._matrix[row * self.dims : (row + 1) * self.dims] = array("f", vec)
+
+    def remove(self, entry_id: int) -> None:
+        row = self._rows.pop(entry_id, None)
+        if row is None:
+            return
+        d, last = self.dims, len(self.ids) - 1
+        if row != last:
+            moved = self.ids[last]
+            self.ids[row] = moved
+            self._rows[moved] = row
+            self._matrix[row * d : (row + 1) * d] = self._matrix[last * d :]
+        self.ids.pop()
+        del self._matrix[last * d :]
+
+    def best(self, query: list[float]) -> tuple[int, float] | None:
+        """(entry id, cosine similarity) of the closest entry, or None if empty.
+
+        Embeddings are L2-normalized, so the dot product is the cosine.
+        """
+        if not self.ids:
+            return None
+        if np is not None:
+            matrix = np.frombuffer(self._matrix, dtype=np.float32).reshape(-1, self.dims)
+            scores = matrix @ np.asarray(query, dtype=np.float32)
+            row = int(scores.argmax())
+            return self.ids[row], float(scores[row])
+
+        nonzero = [(i, v) for i, v in enumerate(query) if v]
+        m, d = self._matrix, self.dims
+        best_row, best_score = 0, -math.inf
+        for row in range(len(self.ids)):
+            base = row * d
+            score = sum(m[base + i] * v for i, v in nonzero)
+            if score > best_score:
+                best_row, best_score = row, score
+        return self.ids[best_row], best_score
+
+
 class SemanticCache:
     """Semantic cache for LLM command responses.
 
@@ -74,6 +226,8 @@ class SemanticCache:
         )
         self._ensure_db_directory()
         self._pool: SQLiteConnectionPool | None = None
+        self._indexes: dict[tuple[str, str, str], VectorIndex] = {}
+        self._index_lock = threading.Lock()
         self._init_database()
 
     def _ensure_db_directory(self) -> None:
@@ -162,7 +316,46 @@ class SemanticCache:
         return buf
 
     @classmethod
-    def _embed(cls, text: str, dims: int = 128) -> list[float]:
+    def _embed(cls, text: str, dims: int = EMBEDDING_DIMS) -> list[float]:
+        lib = embed_library()
+        if lib is not None:
+            data = text.encode("utf-8", "surrogatepass")
+            out = (ctypes.c_double * dims)()
+            if lib.cortex_embed(data, len(data), dims, out) == 0:
+                return out[:]
+        return cls._embed_python(text, dims)
+
+    @classmethod
+    def embed_many(cls, texts: list[str], dims: int = EMBEDDING_DIMS) -> array:
+        """Embed a batch of texts as consecutive float32 rows of one array.
+
+        The native embedder writes the rows straight into the array; texts
+        it does not handle (non-ASCII), or all of them without the library,
+        are embedded in Python.
+        """
+        matrix = array("f", bytes(4 * dims * len(texts)))
+        lib = embed_library()
+        if lib is None or not texts:
+            fallback = [1] * len(texts)
+        else:
+            encoded = [t.encode("utf-8", "surrogatepass") for t in texts]
+            offsets = (ctypes.c_uint64 * (len(texts) + 1))()
+            for i, data in enumerate(encoded):
+                offsets[i + 1] = offsets[i] + len(data)
+            flags = (ctypes.c_uint8 * len(texts))()
+            address, _ = matrix.buffer_info()
+            data = b"".join(encoded)
+            if lib.cortex_embed_batch(data, offsets, len(texts), dims, address, flags) < 0:
+                fallback = [1] * len(texts)  # dims the library does not take
+            else:
+                fallback = flags
+        for i, text in enumerate(texts):
+            if fallback[i]:
+                matrix[i * dims : (i + 1) * dims] = array("f", cls._embed_python(text, dims))
+        return matrix
+
+    @classmethod
+    def _embed_python(cls, text: str, dims: int = EMBEDDING_DIMS) -> list[float]:
         vec = [0.0] * dims
         tokens = cls._tokenize(text)
         if not tokens:
@@ -197,11 +390,78 @@ class SemanticCache:
             dot += a[i] * b[i]
         return dot
 
-    def _record_hit(self, conn: sqlite3.Connection) -> None:
-        conn.execute("UPDATE llm_cache_stats SET hits = hits + 1 WHERE id = 1")
+    @staticmethod
+    def _generation(cur: sqlite3.Cursor, partition: tuple[str, str, str]) -> tuple[int, int]:
+        # AUTOINCREMENT ids only grow, so any insert or delete by any
+        # process changes the count or the highest id
+        cur.execute(
+            """
+            SELECT COUNT(1), COALESCE(MAX(id), 0)
+            FROM llm_cache_entries
+            WHERE provider = ? AND model = ? AND system_hash = ?
+            """,
+            partition,
+        )
+        count, max_id = cur.fetchone()
+        return int(count), int(max_id)
 
-    def _record_miss(self, conn: sqlite3.Connection) -> None:
-        conn.execute("UPDATE llm_cache_stats SET misses = misses + 1 WHERE id = 1")
+    def _index(self, cur: sqlite3.Cursor, partition: tuple[str, str, str]) -> VectorIndex:
+        """The partition's index, (re)loaded if the database has moved on.
+
+        Called with _index_lock held.
+        """
+        generation = self._generation(cur, partition)
+        index = self._indexes.get(partition)
+        if index is not None and index.generation == generation:
+            return index
+
+        index = VectorIndex()
+        if embed_library() is not None:
+            # Embedding the prompts again natively beats decoding the
+            # stored JSON, and gives the same vectors
+            cur.execute(
+                """
+                SELECT id, prompt
+                FROM llm_cache_entries
+                WHERE provider = ? AND model = ? AND system_hash = ?
+                """,
+                partition,
+            )
+            rows = cur.fetchall()
+            index.extend([r[0] for r in rows], self.embed_many([r[1] for r in rows], index.dims))
+        else:
+            cur.execute(
+                """
+                SELECT id, embedding
+                FROM llm_cache_entries
+                WHERE provider = ? AND model = ? AND system_hash = ?
+                """,
+                partition,
+            )
+            for entry_id, embedding_blob in cur.fetchall():
+                vec = self._unpack_embedding(embedding_blob)
+                if len(vec) == index.dims:
+                    index.add(entry_id, vec)
+        index.generation = generation
+        self._indexes[partition] = index
+        return index
+
+    # Lookups only read: what a hit or miss writes goes through the pool's
+    # write-behind queue, so concurrent lookups share one commit per window
+
+    def _record_hit(self, entry_id: int, now: str) -> None:
+        self._pool.defer(
+            "UPDATE llm_cache_entries SET last_accessed = ? WHERE id = ?",
+            (now, entry_id),
+            key=(entry_id,),
+        )
+        self._pool.defer_increment(
+            "UPDATE llm_cache_entries SET hit_count = hit_count + ? WHERE id = ?", (entry_id,)
+        )
+        self._pool.defer_increment("UPDATE llm_cache_stats SET hits = hits + ? WHERE id = 1")
+
+    def _record_miss(self) -> None:
+        self._pool.defer_increment("UPDATE llm_cache_stats SET misses = misses + ? WHERE id = 1")
 
     def get_commands(
         self,
@@ -210,6 +470,7 @@ class SemanticCache:
         model: str,
         system_prompt: str,
         candidate_limit: int = 200,
+        similarity_threshold: float | None = None,
     ) -> list[str] | None:
         """Retrieve cached commands for a prompt.
 
@@ -220,7 +481,9 @@ class SemanticCache:
             provider: LLM provider name
             model: Model name
             system_prompt: System prompt used for generation
-            candidate_limit: Max candidates to check for similarity
+            candidate_limit: Unused; similarity search now covers every entry
+                of the partition. Kept for compatibility.
+            similarity_threshold: Overrides the cache's threshold for this lookup
 
         Returns:
             List of commands if found, None otherwise
@@ -243,53 +506,25 @@ class SemanticCache:
             row = cur.fetchone()
             if row is not None:
                 entry_id, commands_json = row
-                cur.execute(
-                    """
-                    UPDATE llm_cache_entries
-                    SET last_accessed = ?, hit_count = hit_count + 1
-                    WHERE id = ?
-                    """,
-                    (now, entry_id),
-                )
-                self._record_hit(conn)
-                conn.commit()
+                self._record_hit(entry_id, now)
                 return json.loads(commands_json)
 
             query_vec = self._embed(prompt)
+            with self._index_lock:
+                best = self._index(cur, (provider, model, system_hash)).best(query_vec)
+
+            if similarity_threshold is None:
+                similarity_threshold = self.similarity_threshold
+            if best is not None and best[1] >= similarity_threshold:
+                cur.execute("SELECT commands_json FROM llm_cache_entries WHERE id = ?", (best[0],))
+                row = cur.fetchone()
+            else:
+                row = None
+            if row is not None:
+                self._record_hit(best[0], now)
+                return json.loads(row[0])
 
-            cur.execute(
-                """
-                SELECT id, embedding, commands_json
-                FROM llm_cache_entries
-                WHERE provider = ? AND model = ? AND system_hash = ?
-                ORDER BY last_accessed DESC
-                LIMIT ?
-                """,
-                (provider, model, system_hash, candidate_limit),
-            )
-
-            best: tuple[int, float, str] | None = None
-            for entry_id, embedding_blob, commands_json in cur.fetchall():
-                vec = self._unpack_embedding(embedding_blob)
-                sim = self._cosine(query_vec, vec)
-                if best is None or sim > best[1]:
-                    best = (entry_id, sim, commands_json)
-
-            if best is not None and best[1] >= self.similarity_threshold:
-                cur.execute(
-                    """
-                    UPDATE llm_cache_entries
-                    SET last_accessed = ?, hit_count = hit_count + 1
-                    WHERE id = ?
-                    """,
-                    (now, best[0]),
-                )
-                self._record_hit(conn)
-                conn.commit()
-                return json.loads(best[2])
-
-            self._record_miss(conn)
-            conn.commit()
+            self._record_miss()
             return None
 
     def put_commands(
@@ -314,9 +549,23 @@ class SemanticCache:
         now = self._utcnow_iso()
         vec = self._embed(prompt)
         embedding_blob = self._pack_embedding(vec)
-
-        with self._pool.get_connection() as conn:
-            conn.execute(
+        partition = (provider, model, system_hash)
+        # Eviction goes by last_accessed: apply the hits still queued first
+        self._pool.flush()
+
+        with self._pool.get_connection() as conn, self._index_lock:
+            # Take the write lock first, so nobody else writes between
+            # checking an index against the database and updating it
+            conn.execute("BEGIN IMMEDIATE")
+            self._drop_if_stale(conn.cursor(), partition)
+            replaced = conn.execute(
+                """
+                SELECT id FROM llm_cache_entries
+                WHERE provider = ? AND model = ? AND system_hash = ? AND prompt_hash = ?
+                """,
+                (*partition, prompt_hash),
+            ).fetchone()
+            cur = conn.execute(
                 """
                 INSERT OR REPLACE INTO llm_cache_entries(
                     provider, model, system_hash, prompt, prompt_hash, embedding, commands_json,
@@ -342,28 +591,64 @@ class SemanticCache:
                     prompt_hash,
                 ),
             )
-            self._evict_if_needed(conn)
+            touched = {partition} | self._evict_if_needed(conn, partition)
+
+            # The indexes left matched the database before this write, and
+            # hold its changes: they are current
+            index = self._indexes.get(partition)
+            if index is not None:
+                if replaced is not None:
+                    index.remove(replaced[0])
+                index.add(cur.lastrowid, vec)
+            for key in touched:
+                if key in self._indexes:
+                    self._indexes[key].generation = self._generation(conn.cursor(), key)
             conn.commit()
 
-    def _evict_if_needed(self, conn: sqlite3.Connection) -> None:
+    def _drop_if_stale(self, cur: sqlite3.Cursor, partition: tuple[str, str, str]) -> None:
+        """Forget the partition's index if another writer changed the partition.
+
+        It is loaded again on its next lookup. Called with _index_lock held.
+        """
+        index = self._indexes.get(partition)
+        if index is not None and index.generation != self._generation(cur, partition):
+            del self._indexes[partition]
+
+    def _evict_if_needed(
+        self, conn: sqlite3.Connection, checked: tuple[str, str, str]
+    ) -> set[tuple[str, str, str]]:
+        """Drop the least recently used entries; returns the partitions hit.
+
+        checked is the partition written to, whose index was already
+        compared with the database before the write.
+        """
         cur = conn.cursor()
         cur.execute("SELECT COUNT(1) FROM llm_cache_entries")
         count = int(cur.fetchone()[0])
         if count <= self.max_entries:
-            return
+            return set()
 
         to_delete = count - self.max_entries
         cur.execute(
             """
-            DELETE FROM llm_cache_entries
-            WHERE id IN (
-                SELECT id FROM llm_cache_entries
-                ORDER BY last_accessed ASC
-                LIMIT ?
-            )
+            SELECT id, provider, model, system_hash FROM llm_cache_entries
+            ORDER BY last_accessed ASC
+            LIMIT ?
             """,
             (to_delete,),
         )
+        victims = cur.fetchall()
+        for key in {tuple(v[1:]) for v in victims} - {checked}:
+            self._drop_if_stale(cur, key)
+        cur.executemany("DELETE FROM llm_cache_entries WHERE id = ?", [(v[0],) for v in victims])
+
+        touched = set()
+        for entry_id, *partition in victims:
+            key = tuple(partition)
+            if key in self._indexes:
+                self._indexes[key].remove(entry_id)
+            touched.add(key)
+        return touched
 
     def stats(self) -> CacheStats:
         """Get current cache statistics.
@@ -371,6 +656,7 @@ class SemanticCache:
         Returns:
             CacheStats object with hits, misses, and computed metrics
         """
+        self._pool.flush()
         with self._pool.get_connection() as conn:
             cur = conn.cursor()
             cur.execute("SELECT hits, misses FROM llm_cache_stats WHERE id = 1")
@@ -4,10 +4,18 @@ Thread-safe SQLite connection pooling for Cortex Linux.
 Provides connection pooling to prevent database lock contention
 and enable safe concurrent access in Python 3.14 free-threading mode.
 
+Hot writers can also hand writes to a write-behind queue: one writer
+thread per pool applies them in a single transaction every durability
+window, summing counter increments on the way, and flushes at exit.
+
 Author: Cortex Linux Team
 License: Apache 2.0
 """
 
+import atexit
+import itertools
+import logging
+import os
 import queue
 import sqlite3
 import threading
@@ -15,6 +23,13 @@ from collections.abc import Iterator
 from contextlib import contextmanager
 from pathlib import Path
 
+logger = logging.getLogger(__name__)
+
+# Seconds a deferred write may wait before it is committed
+DEFAULT_DURABILITY_WINDOW = float(os.environ.get("CORTEX_DB_DURABILITY_WINDOW", "0.5"))
+# Flush sooner once this many writes are pending
+MAX_PENDING_WRITES = 1000
+
 
 class SQLiteConnectionPool:
     """
@@ -32,6 +47,15 @@ class SQLiteConnectionPool:
         with pool.get_connection() as conn:
             cursor = conn.cursor()
             cursor.execute("SELECT ...")
+
+    Writes that may lag (counters, access times) can be deferred instead:
+
+        pool.defer_increment("UPDATE stats SET hits = hits + ? WHERE id = ?", (1,))
+        pool.defer("UPDATE entries SET last_seen = ? WHERE id = ?", (now, 7), key=(7,))
+
+    They are committed within durability_window seconds, in the order
+    deferred (increments last), by a writer thread that takes one pooled
+    connection per batch. Readers see them after that, or after flush().
     """
 
     def __init__(
@@ -40,6 +64,7 @@ class SQLiteConnectionPool:
         pool_size: int = 5,
         timeout: float = 5.0,
         check_same_thread: bool = False,
+        durability_window: float = DEFAULT_DURABILITY_WINDOW,
     ):
         """
         Initialize connection pool.
@@ -49,16 +74,29 @@ class SQLiteConnectionPool:
             pool_size: Number of connections to maintain in pool
             timeout: Timeout for acquiring connection (seconds)
             check_same_thread: SQLite same-thread check (False for pooling)
+            durability_window: Most seconds a deferred write waits to be
+                committed; 0 commits each one right away
         """
         self.db_path = str(db_path)
         self.pool_size = pool_size
         self.timeout = timeout
         self.check_same_thread = check_same_thread
+        self.durability_window = durability_window
 
         # Connection pool (thread-safe queue)
         self._pool: queue.Queue[sqlite3.Connection] = queue.Queue(maxsize=pool_size)
         self._pool_lock = threading.Lock()
 
+        # Write-behind queue: keyed writes (last one wins) and summed increments
+        self._pending_lock = threading.Lock()
+        self._flush_lock = threading.Lock()
+        self._pending_writes: dict[object, tuple[str, tuple]] = {}
+        self._pending_increments: dict[tuple[str, tuple], int | float] = {}
+        self._unkeyed = itertools.count()
+        self._wakeup = threading.Event()
+        self._writer: threading.Thread | None = None
+        self._closed = False
+
         # Initialize connections
         for _ in range(pool_size):
             conn = self._create_connection()
@@ -135,12 +173,119 @@ class SQLiteConnectionPool:
 
                 logging.error(f"Connection pool overflow for {self.db_path}")
 
+    def defer(self, sql: str, params: tuple = (), key: tuple | None = None) -> None:
+        """
+        Queue a write for the writer thread.
+
+        Args:
+            sql: Statement to execute
+            params: Its parameters
+            key: Identifies what the write sets: a later write of the same
+                statement and key replaces this one while both are pending
+        """
+        with self._pending_lock:
+            slot = (sql, key) if key is not None else next(self._unkeyed)
+            self._pending_writes[slot] = (sql, tuple(params))
+            pending = len(self._pending_writes) + len(self._pending_increments)
+        self._after_defer(pending)
+
+    def defer_increment(self, sql: str, key: tuple = (), amount: int | float = 1) -> None:
+        """
+        Queue a counter increment; pending ones of the same statement and key add up.
+
+        Args:
+            sql: Statement whose first parameter is the amount and the rest
+                the key, e.g. "UPDATE t SET n = n + ? WHERE id = ?"
+            key: The remaining parameters
+            amount: Added to the counter
+        """
+        with self._pending_lock:
+            slot = (sql, tuple(key))
+            self._pending_increments[slot] = self._pending_increments.get(slot, 0) + amount
+            pending = len(self._pending_writes) + len(self._pending_increments)
+        self._after_defer(pending)
+
+    def _after_defer(self, pending: int) -> None:
+        if self.durability_window <= 0 or self._closed:
+            self.flush()
+            return
+        if self._writer is None:
+            with self._pending_lock:
+                if self._writer is None:
+                    self._writer = threading.Thread(
+                        target=self._write_behind,
+                        name=f"db-writer:{Path(self.db_path).name}",
+                        daemon=True,
+                    )
+                    self._writer.start()
+        if pending >= MAX_PENDING_WRITES:
+            self._wakeup.set()
+
+    def _write_behind(self) -> None:
+        while not self._closed:
+            self._wakeup.wait(self.durability_window)
+            self._wakeup.clear()
+            try:
+                self.flush()
+            except Exception as e:  # Keep the writer alive; the batch is requeued
+                logger.error(f"Write-behind flush for {self.db_path} failed: {e}")
+
+    def flush(self) -> int:
+        """
+        Commit every pending write now, in one transaction.
+
+        Returns:
+            Number of statements executed
+
+        Raises:
+            sqlite3.Error: If the transaction failed; the writes stay queued
+        """
+        with self._flush_lock:
+            with self._pending_lock:
+                writes, self._pending_writes = self._pending_writes, {}
+                increments, self._pending_increments = self._pending_increments, {}
+            if not writes and not increments:
+                return 0
+
+            try:
+                with self.get_connection() as conn:
+                    try:
+                        for sql, params in writes.values():
+                            conn.execute(sql, params)
+                        for (sql, key), amount in increments.items():
+                            conn.execute(sql, (amount, *key))
+                        conn.commit()
+                    except BaseException:
+                        conn.rollback()
+                        raise
+            except BaseException:
+                self._requeue(writes, increments)
+                raise
+            return len(writes) + len(increments)
+
+    def _requeue(self, writes: dict, increments: dict) -> None:
+        # Put a failed batch back in front of whatever was deferred since
+        with self._pending_lock:
+            for slot, write in self._pending_writes.items():
+                writes[slot] = write
+            self._pending_writes = writes
+            for slot, amount in self._pending_increments.items():
+                increments[slot] = increments.get(slot, 0) + amount
+            self._pending_increments = increments
+
     def close_all(self):
         """
         Close all connections in the pool.
 
-        Call this during shutdown to clean up resources.
+        Pending deferred writes are flushed first. Call this during
+        shutdown to clean up resources.
         """
+        self._closed = True
+        self._wakeup.set()
+        try:
+            self.flush()
+        except (sqlite3.Error, TimeoutError) as e:
+            logger.error(f"Dropping deferred writes to {self.db_path}: {e}")
         with self._pool_lock:
             closed_count = 0
             while not self._pool.empty():
@@ -182,6 +327,7 @@ def get_connection_pool(
     db_path: str | Path,
     pool_size: int = 5,
     timeout: float = 5.0,
+    durability_window: float = DEFAULT_DURABILITY_WINDOW,
 ) -> SQLiteConnectionPool:
     """
     Get or create a connection pool for a database.
@@ -193,6 +339,8 @@ def get_connection_pool(
         db_path: Path to SQLite database file
         pool_size: Number of connections in pool (default: 5)
         timeout: Connection acquisition timeout in seconds (default: 5.0)
+        durability_window: Write-behind window of a new pool (default: 0.5,
+            or $CORTEX_DB_DURABILITY_WINDOW)
 
     Returns:
         SQLiteConnectionPool instance for the database
@@ -218,10 +366,32 @@ def get_connection_pool(
                 db_path,
                 pool_size=pool_size,
                 timeout=timeout,
+                durability_window=durability_window,
             )
         return _pools[db_path]
 
 
+def flush_all_pools() -> int:
+    """
+    Commit the deferred writes of every pool (registered to run at exit).
+
+    Returns:
+        Number of statements executed
+    """
+    with _pools_lock:
+        pools = list(_pools.values())
+    total = 0
+    for pool in pools:
+        try:
+            total += pool.flush()
+        except (sqlite3.Error, TimeoutError) as e:
+            logger.error(f"Could not flush deferred writes to {pool.db_path}: {e}")
+    return total
+
+
+atexit.register(flush_all_pools)
+
+
 def close_all_pools():
     """
     Close all connection pools.
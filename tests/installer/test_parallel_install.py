@@ -1,11 +1,52 @@
 """Tests for parallel installation execution."""
 
 import asyncio
+import os
+import tempfile
 import time
+from types import SimpleNamespace
+from unittest import mock
 
 import pytest
 
-from cortex.install_parallel import TaskStatus, run_parallel_install
+from cortex import install_parallel
+from cortex.install_parallel import (
+    DPKG_LOCK,
+    ParallelTask,
+    TaskStatus,
+    lock_domain,
+    plan_for_commands,
+    plan_from_resolver,
+    prefetch_commands,
+    run_parallel_install,
+    timing_report,
+)
+
+
+def sleep_command(seconds: float, tag: str = "") -> str:
+    return f"python -c \"import time; time.sleep({seconds}); print('{tag}')\""
+
+
+def fake_domain(command: str) -> str | None:
+    """Treat commands tagged "lock" as package-manager commands."""
+    return DPKG_LOCK if "lock" in command else None
+
+
+class FakeResolver:
+    def __init__(self, graph: dict[str, list[str]], installed: set[str] = frozenset()):
+        self.graph = graph
+        self.installed = installed
+
+    def is_package_installed(self, name):
+        return name in self.installed
+
+    def resolve_dependencies(self, name, recursive=True):
+        deps = [
+            SimpleNamespace(name=d, reason="Required dependency", is_satisfied=d in self.installed)
+            for d in self.graph.get(name, [])
+        ]
+        deps.append(SimpleNamespace(name="docs", reason="Recommended package", is_satisfied=False))
+        return SimpleNamespace(direct_dependencies=deps)
 
 
 class TestParallelExecution:
@@ -296,3 +337,207 @@ class TestParallelExecutionIntegration:
             assert tasks[2].status == TaskStatus.SUCCESS
 
         asyncio.run(run_test())
+
+
+class TestDAGScheduling:
+    """Lock domains, critical-path order, prefetch and timings."""
+
+    def test_lock_domains(self):
+        assert lock_domain("sudo apt-get install -y nginx") == DPKG_LOCK
+        assert lock_domain("sudo dpkg -i pkg.deb") == DPKG_LOCK
+        assert lock_domain("sudo add-apt-repository -y ppa:x/y") == DPKG_LOCK
+        assert lock_domain("pip3 install numpy") is None
+        assert lock_domain("curl -fsSL https://x/key | sudo apt-key add -") is None
+        assert lock_domain("apt-cache policy nginx") is None
+
+    def test_one_dpkg_at_a_time_while_pip_runs_alongside(self):
+        commands = [sleep_command(0.3, "lock"), sleep_command(0.3, "lock"), sleep_command(0.3)]
+
+        with mock.patch.object(install_parallel, "lock_domain", fake_domain):
+            success, tasks = asyncio.run(
+                run_parallel_install(commands, dependencies={0: [], 1: [], 2: []}, timeout=10)
+            )
+
+        assert success
+        first, second = sorted(tasks[:2], key=lambda t: t.start_time)
+        assert second.start_time >= first.end_time
+        assert second.wait_time() >= first.duration() - 0.05
+        # The unlocked task started with the first one, not after both
+        assert tasks[2].start_time < first.end_time
+
+    def test_critical_path_runs_first(self):
+        # Task 1 is a lone leaf; Task 2 -> Task 3 -> Task 4 is the long chain
+        commands = [sleep_command(0.05, str(i)) for i in range(4)]
+        success, tasks = asyncio.run(
+            run_parallel_install(
+                commands, dependencies={0: [], 1: [], 2: [1], 3: [2]}, timeout=10, max_workers=1
+            )
+        )
+
+        assert success
+        assert [t.priority for t in tasks] == [1.0, 3.0, 2.0, 1.0]
+        started = [t.name for t in sorted(tasks, key=lambda t: t.start_time)]
+        assert started[0] == "Task 2"
+
+        # A long enough estimate moves the leaf ahead of the chain
+        success, tasks = asyncio.run(
+            run_parallel_install(
+                commands,
+                dependencies={0: [], 1: [], 2: [1], 3: [2]},
+                timeout=10,
+                max_workers=1,
+                estimates={0: 10.0},
+            )
+        )
+        assert min(tasks, key=lambda t: t.start_time).name == "Task 1"
+
+    def test_failure_skips_all_transitive_dependents(self):
+        commands = ['python -c "exit(1)"', sleep_command(0), sleep_command(0), sleep_command(0)]
+        success, tasks = asyncio.run(
+            run_parallel_install(commands, dependencies={0: [], 1: [0], 2: [1], 3: []}, timeout=10)
+        )
+
+        assert not success
+        assert [t.status for t in tasks] == [
+            TaskStatus.FAILED,
+            TaskStatus.SKIPPED,
+            TaskStatus.SKIPPED,
+            TaskStatus.SUCCESS,
+        ]
+        assert tasks[2].error == "Skipped because Task 1 failed"
+
+    def test_unlocked_list_order_is_kept_per_domain(self):
+        commands = [sleep_command(0.05, "lock"), sleep_command(0.05, "lock")]
+        with mock.patch.object(install_parallel, "lock_domain", fake_domain):
+            success, tasks = asyncio.run(
+                run_parallel_install(commands, timeout=10, estimates={1: 5.0})
+            )
+
+        assert success
+        assert tasks[1].dependencies == ["Task 1"]
+        assert tasks[1].start_time >= tasks[0].end_time
+
+    def test_prefetch_splits_apt_installs(self):
+        prefetch, install = prefetch_commands("sudo apt-get install -y nginx", "/c")
+        assert prefetch == (
+            "sudo apt-get -o Dir::Cache::Archives=/c --download-only -y install -y nginx"
+        )
+        assert install == "sudo apt-get -o Dir::Cache::Archives=/c install -y nginx"
+        assert prefetch_commands("sudo apt-get update && sudo apt-get install -y x", "/c") is None
+        assert prefetch_commands("pip3 install numpy", "/c") is None
+
+        with tempfile.TemporaryDirectory() as root:
+            tasks = {
+                "Task 1": ParallelTask("Task 1", "sudo apt-get update", ""),
+                "Task 2": ParallelTask("Task 2", "sudo apt-get install -y a", "", ["Task 1"]),
+                "Task 3": ParallelTask("Task 3", "sudo apt-get install -y b", "", ["Task 2"]),
+            }
+            install_parallel._add_prefetches(tasks, root)
+
+            assert list(tasks) == ["Task 1", "Task 2", "Task 3", "Prefetch 1", "Prefetch 2"]
+            # Downloads for b don't wait for a to be installed
+            assert tasks["Prefetch 2"].dependencies == ["Task 1"]
+            assert tasks["Prefetch 2"].optional
+            assert tasks["Task 3"].soft_dependencies == ["Prefetch 2"]
+            assert os.path.isdir(os.path.join(root, "2", "partial"))
+            assert f"Dir::Cache::Archives={root}/2 install" in tasks["Task 3"].command
+
+    def test_optional_failure_still_releases_dependents(self):
+        with mock.patch.object(install_parallel, "_APT_INSTALL") as pattern, mock.patch.object(
+            install_parallel,
+            "prefetch_commands",
+            lambda command, _dir: ('python -c "exit(1)"', command),
+        ):
+            pattern.match.side_effect = lambda command: "Step" in command
+            success, tasks = asyncio.run(
+                run_parallel_install([sleep_command(0, "Step")], timeout=10, prefetch=True)
+            )
+
+        assert success
+        assert [t.name for t in tasks] == ["Task 1", "Prefetch 1"]
+        assert tasks[0].status == TaskStatus.SUCCESS
+        assert tasks[1].status == TaskStatus.FAILED
+        assert tasks[0].start_time >= tasks[1].end_time
+
+    def test_timing_report(self):
+        commands = [sleep_command(0.05, "lock"), sleep_command(0.05, "lock")]
+        with mock.patch.object(install_parallel, "lock_domain", fake_domain):
+            _, tasks = asyncio.run(run_parallel_install(commands, timeout=10))
+
+        lines = timing_report(tasks)
+        assert len(lines) == 3
+        assert lines[0].startswith("Task 1") and "success" in lines[0]
+        assert lines[-1].startswith("wall ") and "dpkg held" in lines[-1]
+        assert timing_report([ParallelTask("Task 1", "true", "")]) == []
+
+    def test_plan_from_resolver(self):
+        resolver = FakeResolver(
+            {"app": ["libfoo", "libc6", "tool"], "tool": ["libfoo"], "libfoo": ["tool"]},
+            installed={"libc6"},
+        )
+        commands, descriptions, deps = plan_from_resolver(resolver, ["app", "libc6"])
+
+        assert commands[0] == "sudo apt-get update"
+        # libfoo <-> tool is a cycle: one edge of it is dropped
+        assert commands[1:] == [
+            "sudo apt-get install -y tool",
+            "sudo apt-get install -y libfoo",
+            "sudo apt-get install -y app",
+        ]
+        assert descriptions[3] == "Install app"
+        assert deps == {0: [], 1: [0], 2: [0, 1], 3: [0, 2, 1]}
+        assert plan_from_resolver(resolver, ["libc6"]) == ([], [], {})
+
+    def test_plain_apt_installs_run_as_the_resolver_graph(self):
+        resolver = FakeResolver({"nginx": ["libpcre3"]})
+        commands = ["sudo apt-get update", "sudo apt-get install -y nginx"]
+        planned, _, deps = plan_for_commands(commands, ["nginx"], resolver)
+        assert planned[1:] == [
+            "sudo apt-get install -y libpcre3",
+            "sudo apt-get install -y nginx",
+        ]
+        assert deps == {0: [], 1: [0], 2: [0, 1]}
+
+        # Anything but update/install runs as given
+        mixed = commands + ["pip3 install numpy"]
+        assert plan_for_commands(mixed, ["nginx"], resolver) == (
+            mixed,
+            ["Step 1", "Step 2", "Step 3"],
+            None,
+        )
+        installed = FakeResolver({}, installed={"nginx"})
+        assert plan_for_commands(commands, ["nginx"], installed)[0] == commands
+
+    def test_apt_installs_with_options_run_as_given(self):
+        resolver = FakeResolver({"nginx": ["libpcre3"]})
+        cases = [
+            # Both installs count: nginx is not dropped for being after -y
+            (
+                [
+                    "sudo apt-get update",
+                    "sudo apt-get -y install nginx",
+                    "sudo apt-get install -y curl",
+                ],
+                ["curl"],
+            ),
+            # Version pins and options are kept
+            (["sudo apt-get install -y nginx=1.18.0-0ubuntu1 --no-install-recommends"], ["nginx"]),
+            # -t names a release, not a package
+            (
+                ["sudo apt-get install -y -t bookworm-backports linux-image-amd64"],
+                ["bookworm-backports", "linux-image-amd64"],
+            ),
+        ]
+        for commands, packages in cases:
+            planned, descriptions, deps = plan_for_commands(commands, packages, resolver)
+            assert planned == commands
+            assert deps is None
+
+        # Bare installs in either -y position plan once they match the request
+        commands = ["sudo apt-get update", "sudo apt-get -y install nginx", "apt install -y curl"]
+        planned, _, _ = plan_for_commands(commands, ["nginx", "curl"], resolver)
+        assert planned[1:] == [
+            "sudo apt-get install -y curl",
+            "sudo apt-get install -y libpcre3",
+            "sudo apt-get install -y nginx",
+        ]
@@ -0,0 +1,731 @@
+import contextlib
+import ctypes
+import errno
+import os
+import signal
+import socket
+import struct
+import sys
+import threading
+import tempfile
+import time
+from pathlib import Path
+from unittest import mock
+
+from cortex.kernel_features import hardware_detect
+from cortex.kernel_features.ebpf import (
+    cortex_sched_loader,
+    fleet,
+    metrics_exporter,
+    pinned_maps,
+    placement,
+    probe_bench,
+)
+from cortex.kernel_features.ebpf.cortex_sched_loader import (
+    CortexScheduler,
+    HIST_SLOTS,
+    CgroupCountersValue,
+    CgroupNameValue,
+    CpuCountersValue,
+    GlobalStatsValue,
+    InferenceMetricsValue,
+    LatencyHistValue,
+    LoadCountersValue,
+    LoadPhaseValue,
+    NumaCountersValue,
+    ProbeOverhead,
+    SampleConfigValue,
+    Sampling,
+    ThreadRuntimeValue,
+    find_mapped_file,
+    hist_delta,
+    hist_percentile,
+    next_sampling,
+    unit_of_cgroup,
+)
+from cortex.kernel_features.ebpf.pinned_maps import PinnedMap, parse_cpu_list
+
+
+class FakeMap:
+    """Stands in for a PinnedMap: same items()/lookup() shape."""
+
+    def __init__(self, entries, key_type=ctypes.c_uint32):
+        self.key_type = key_type
+        self.max_entries = 10240
+        self.entries = {key_type(k).value: v for k, v in entries.items()}
+
+    def items(self):
+        return [(self.key_type(k), v) for k, v in self.entries.items()]
+
+    def lookup(self, key):
+        return self.entries.get(key)
+
+    def close(self):
+        pass
+
+
+def counters(**values):
+    return CpuCountersValue(**values)
+
+
+def latency(runq=None, oncpu=None):
+    """One CPU's histogram copy from {slot: count} dicts."""
+    value = LatencyHistValue()
+    for kind, slots in enumerate((runq or {}, oncpu or {})):
+        for slot, count in slots.items():
+            value.slots[kind][slot] = count
+    return value
+
+
+def load_phase(**values):
+    phase = LoadPhaseValue(**values)
+    phase.nr_files = 1
+    # (8 << 20) | 1 is device 08:01
+    phase.files[0].dev = (8 << 20) | 1
+    phase.files[0].ino = 4242
+    phase.files[0].mapped_bytes = 4 << 30
+    return phase
+
+
+def make_scheduler():
+    sched = CortexScheduler()
+    sched.maps = {
+        "process_metrics": FakeMap(
+            {
+                100: InferenceMetricsValue(
+                    memory_alloc_bytes=2 << 30, is_inference=1, comm=b"llama-server"
+                )
+            }
+        ),
+        # Two CPUs' copies of the same process counters
+        "process_counters": FakeMap(
+            {
+                100: [
+                    counters(gpu_wait_ns=30, cpu_compute_ns=10, context_switches=2),
+                    counters(
+                        gpu_wait_ns=30, cpu_compute_ns=30, context_switches=3, kernel_launches=7
+                    ),
+                ]
+            }
+        ),
+        "thread_runtime": FakeMap(
+            {
+                100: ThreadRuntimeValue(tgid=100, cpu_compute_ns=10, comm=b"llama-server"),
+                101: ThreadRuntimeValue(
+                    tgid=100, last_cpu=2, cpu_compute_ns=30, context_switches=1, comm=b"tokenizer"
+                ),
+            }
+        ),
+        "latency_hist": FakeMap(
+            {100: [latency(runq={3: 90}, oncpu={10: 1}), latency(runq={3: 8, 12: 2})]}
+        ),
+        "load_profile": FakeMap(
+            {
+                100: [
+                    LoadCountersValue(major_faults=10, io_read_reqs=2, io_read_ns=6000),
+                    LoadCountersValue(
+                        major_faults=5, io_read_bytes=64 << 20, io_read_reqs=1, io_read_max_ns=9000
+                    ),
+                ]
+            }
+        ),
+        "load_phase": FakeMap({100: load_phase(start_ns=1_000_000_000, end_ns=3_000_000_000)}),
+        # CPU 0 (node 0) and CPU 4 (node 1) copies
+        "numa_placement": FakeMap(
+            {
+                100: [
+                    NumaCountersValue(oncpu_ns=(10,), alloc_bytes=(3 << 30,)),
+                    NumaCountersValue(oncpu_ns=(0, 30), alloc_bytes=(0, 1 << 30)),
+                ]
+            }
+        ),
+        "cgroup_stats": FakeMap({}, ctypes.c_uint64),
+        "cgroup_names": FakeMap({}, ctypes.c_uint64),
+        "global_stats": FakeMap({}),
+    }
+    sched.running = True
+    return sched
+
+
+def test_parse_cpu_list():
+    assert parse_cpu_list("0-3,8,10-11\n") == [0, 1, 2, 3, 8, 10, 11]
+    assert parse_cpu_list("0") == [0]
+
+
+def test_percpu_counters_are_summed():
+    (proc,) = make_scheduler().get_process_metrics()
+    assert proc.pid == 100
+    assert proc.comm == "llama-server"
+    assert proc.gpu_wait_ns == 60
+    assert proc.cpu_compute_ns == 40
+    assert proc.context_switches == 5
+    assert proc.kernel_launches == 7
+    assert proc.memory_alloc_mb == 2048
+    assert proc.is_inference
+
+
+def test_threads_rolled_up_under_tgid():
+    (proc,) = make_scheduler().get_process_metrics()
+    assert [t.tid for t in proc.threads] == [101, 100]
+    assert proc.threads[0].comm == "tokenizer"
+
+
+def test_lru_evictions_and_failed_inserts_are_reported():
+    sched = make_scheduler()
+    stats = sched.snapshot()[1]
+    assert stats.tracker_entries == 1 and stats.tracker_capacity == 10240
+    assert not stats.tracker_saturated
+
+    # 5 inserted, 2 deleted on exit, 1 still present: 2 were evicted
+    sched.maps["global_stats"] = FakeMap(
+        {0: GlobalStatsValue(metrics_inserts=5, metrics_deletes=2, insert_failures=1)}
+    )
+    stats = sched.snapshot()[1]
+    assert stats.tracker_evictions == 2
+    assert stats.insert_failures == 1
+    assert stats.tracker_saturated
+
+
+def test_gpu_uprobe_flags_reach_the_daemon():
+    sched = CortexScheduler(gpu_uprobes=True, ioctl_probe=False)
+    with mock.patch.object(CortexScheduler, "find_daemon", return_value="/usr/sbin/cortex-schedd"):
+        cmd = sched.daemon_command()
+    assert "--gpu-uprobes" in cmd and "--no-ioctl" in cmd
+
+
+def test_sampling_reaches_the_daemon():
+    with mock.patch.object(CortexScheduler, "find_daemon", return_value="/usr/sbin/cortex-schedd"):
+        assert "--sample" not in CortexScheduler().daemon_command()
+        cmd = CortexScheduler(sampling=Sampling("adaptive", 32)).daemon_command()
+    assert cmd[cmd.index("--sample") + 1] == "adaptive:32"
+
+
+FAKE_SCHEDD = """\
+import os, signal, sys, time
+args = sys.argv[1:]
+pid_file = args[args.index("--pid-file") + 1]
+ready = int(args[args.index("--ready-fd") + 1])
+with open(pid_file, "w") as f:
+    f.write(f"{os.getpid()}\\n")
+if os.environ["FAKE_SCHEDD"] == "fail":
+    sys.exit(1)
+if os.environ["FAKE_SCHEDD"] == "stubborn":
+    signal.signal(signal.SIGTERM, signal.SIG_IGN)
+else:
+    signal.signal(signal.SIGTERM, lambda *_: (os.unlink(pid_file), sys.exit(0)))
+os.write(ready, b"\\n")
+os.close(ready)
+time.sleep(30)
+"""
+
+
+@contextlib.contextmanager
+def fake_daemon(mode):
+    """A cortex-schedd stand-in that fails, loads, or loads and ignores SIGTERM."""
+    with tempfile.TemporaryDirectory() as tmp:
+        daemon = Path(tmp) / "cortex-schedd"
+        daemon.write_text(f"#!{sys.executable}\n{FAKE_SCHEDD}")
+        daemon.chmod(0o755)
+        sched = CortexScheduler(pin_dir=Path(tmp) / "pins", pid_file=Path(tmp) / "schedd.pid")
+        with (
+            mock.patch.dict(os.environ, {"CORTEX_SCHEDD": str(daemon), "FAKE_SCHEDD": mode}),
+            mock.patch.object(cortex_sched_loader, "LOG_FILE", Path(tmp) / "schedd.log"),
+        ):
+            try:
+                yield sched
+            finally:
+                if pid := sched.daemon_pid():
+                    os.kill(pid, signal.SIGKILL)
+                    os.waitpid(pid, 0)
+
+
+def test_start_waits_for_the_daemon_rather_than_leftover_pins():
+    with fake_daemon("fail") as sched:
+        # Pins a crashed instance left behind
+        sched.pin_dir.mkdir()
+        (sched.pin_dir / "process_metrics").touch()
+        assert not sched.start()
+
+    with fake_daemon("load") as sched:
+        assert sched.start()
+        assert sched.stop()
+        assert sched.daemon_pid() is None
+
+
+def test_stop_reports_a_daemon_that_outlives_the_timeout():
+    with fake_daemon("stubborn") as sched:
+        assert sched.start()
+        assert not sched.stop(timeout=0.3)
+        assert sched.daemon_pid()
+
+
+def test_sampling_is_read_and_written_through_the_config_map():
+    sched = make_scheduler()
+    assert sched.get_sampling() == Sampling()
+    sched.maps["sample_config"] = FakeMap({0: SampleConfigValue(mode=2, rate=16)})
+    assert sched.get_sampling() == Sampling("adaptive", 16)
+    assert 'cortex_sched_sample_rate{mode="adaptive"} 16' in metrics_exporter.render_metrics(sched)
+
+    written = {}
+
+    class WritableMap(FakeMap):
+        def __init__(self, path, key_type, value_type, writable=False):
+            assert writable and path.name == "sample_config"
+            super().__init__({})
+
+        def update(self, key, value):
+            written[key] = (value.mode, value.rate)
+
+        def __enter__(self):
+            return self
+
+        def __exit__(self, *exc):
+            pass
+
+    with mock.patch.object(cortex_sched_loader, "PinnedMap", WritableMap):
+        sched.set_sampling(Sampling("fixed", 64))
+        sched.set_sampling(Sampling("full", 16))
+        try:
+            sched.set_sampling(Sampling("fixed", 0))
+            raise AssertionError("rate 0 accepted")
+        except ValueError:
+            pass
+    assert written == {0: (0, 1)}  # The second write replaced the first
+
+
+def test_overhead_governor_samples_harder_over_the_ceiling():
+    # Over the ceiling: at least double, and fall back to fixed sampling
+    assert next_sampling(Sampling(), 0.6, 0.5) == Sampling("fixed", 2)
+    assert next_sampling(Sampling("adaptive", 16), 2.0, 0.5) == Sampling("fixed", 64)
+    assert next_sampling(Sampling("fixed", 65536), 9.0, 0.5) == Sampling("fixed", 65536)
+    # Between a quarter of the ceiling and the ceiling: keep it
+    assert next_sampling(Sampling("fixed", 8), 0.3, 0.5) == Sampling("fixed", 8)
+    # Far under: halve back towards full tracing
+    assert next_sampling(Sampling("adaptive", 8), 0.05, 0.5) == Sampling("adaptive", 4)
+    assert next_sampling(Sampling("fixed", 2), 0.05, 0.5) == Sampling()
+    assert next_sampling(Sampling(), 0.05, 0.5) == Sampling()
+
+
+def test_probe_overhead_is_a_share_of_all_cpus():
+    overhead = ProbeOverhead(
+        window_s=2.0,
+        cpus=4,
+        sampling=Sampling(),
+        programs={
+            "handle_sched_sw": probe_bench.ProgramCost(run_cnt=1_000_000, run_time_ns=300_000_000),
+            "handle_ioctl": probe_bench.ProgramCost(run_cnt=10_000, run_time_ns=100_000_000),
+        },
+    )
+    assert overhead.cpu_pct == 5.0
+
+
+def test_thread_runtime_matches_the_bpf_struct():
+    assert ctypes.sizeof(ThreadRuntimeValue) == 72
+    assert ThreadRuntimeValue.nr_switches.offset == 56
+    assert ctypes.sizeof(SampleConfigValue) == 8
+
+
+def test_latency_histograms_summed_across_cpus():
+    (proc,) = make_scheduler().get_process_metrics()
+    assert proc.latency["runq"][3] == 98
+    assert proc.latency["runq"][12] == 2
+    assert proc.latency["oncpu"][10] == 1
+    assert sum(proc.latency["offcpu"]) == 0
+    # 98 of 100 waits were 8-16us, the slowest 2% 4-8ms
+    assert proc.latency_percentile("runq", 50) == 16
+    assert proc.latency_percentile("runq", 99) == 8192
+    assert proc.latency_percentile("offcpu", 99) == 0
+
+
+def test_hist_delta_and_percentile():
+    before = [0] * HIST_SLOTS
+    before[2] = 5
+    after = list(before)
+    after[2] += 1
+    after[20] += 3
+    delta = hist_delta(after, before)
+    assert sum(delta) == 4
+    assert hist_percentile(delta, 50) == 1 << 21
+    assert hist_percentile([0] * HIST_SLOTS, 99) == 0
+
+
+VALUE_SIZE = ctypes.sizeof(CpuCountersValue)
+
+
+def test_load_profile_rolls_up_cpus():
+    with mock.patch("pathlib.Path.read_text", side_effect=FileNotFoundError):
+        (profile,) = make_scheduler().get_load_profiles()
+    assert profile.comm == "llama-server"
+    assert not profile.loading
+    assert profile.duration_s == 2.0
+    assert profile.major_faults == 15
+    assert profile.io_read_mb == 64
+    assert profile.io_read_mb_per_s == 32
+    assert profile.io_avg_latency_us == 2
+    assert profile.io_max_latency_us == 9
+    assert profile.files[0].dev == "08:01" and profile.files[0].mapped_mb == 4096
+
+
+def test_unit_of_cgroup():
+    assert unit_of_cgroup("/cortex-inference.slice/cortex-model@llama3.service") == (
+        "cortex-model@llama3.service",
+        "cortex-inference.slice",
+    )
+    # Sub-cgroups of a delegated service roll up into the service
+    assert unit_of_cgroup("/a.slice/b.service/payload") == ("b.service", "a.slice")
+    assert unit_of_cgroup("/") == ("/", None)
+
+
+def test_service_stats_survive_restarts():
+    sched = make_scheduler()
+    with tempfile.TemporaryDirectory() as root:
+        unit_dir = Path(root) / "cortex-inference.slice" / "cortex-model@llama3.service"
+        unit_dir.mkdir(parents=True)
+        live = unit_dir.stat().st_ino
+        # A removed cgroup of the same unit (before a restart), and one whose
+        # name was never captured
+        gone, unnamed = live + 1, live + 2
+        sched.maps["cgroup_stats"] = FakeMap(
+            {
+                live: [
+                    CgroupCountersValue(cpu_compute_ns=3, gpu_wait_ns=9, major_faults=1),
+                    CgroupCountersValue(cpu_compute_ns=1, context_switches=4),
+                ],
+                gone: [CgroupCountersValue(cpu_compute_ns=6, major_faults=2)],
+                unnamed: [CgroupCountersValue(cpu_compute_ns=1)],
+            },
+            ctypes.c_uint64,
+        )
+        sched.maps["cgroup_names"] = FakeMap(
+            {gone: CgroupNameValue(name=b"cortex-model@llama3.service")}, ctypes.c_uint64
+        )
+        llama, other = sched.get_service_stats(Path(root))
+
+    assert llama.unit == "cortex-model@llama3.service"
+    assert llama.slice == "cortex-inference.slice"
+    assert llama.active and llama.cgroups == 2
+    assert llama.cpu_compute_ns == 10
+    assert llama.context_switches == 4
+    assert llama.major_faults == 3
+    assert llama.gpu_ratio == 9 / 19 * 100
+    assert other.unit == f"cgroup-{unnamed}" and not other.active
+
+
+def test_numa_topology_from_sysfs():
+    with tempfile.TemporaryDirectory() as sysfs:
+        root = Path(sysfs)
+        for node, cpus in ((0, "0-3"), (1, "4-7")):
+            (root / f"devices/system/node/node{node}").mkdir(parents=True)
+            (root / f"devices/system/node/node{node}/cpulist").write_text(cpus + "\n")
+        (root / "bus/pci/devices").mkdir(parents=True)
+        for bus_id, path, pci_class, node in (
+            ("0000:41:00.0", "pci0000:40/0000:40:01.1/0000:41:00.0", "0x030200", 1),
+            ("0000:01:00.0", "pci0000:00/0000:00:02.0/0000:01:00.0", "0x020000", 0),  # NIC
+        ):
+            dev = root / "devices" / path
+            dev.mkdir(parents=True)
+            (dev / "class").write_text(pci_class)
+            (dev / "vendor").write_text("0x10de")
+            (dev / "numa_node").write_text(str(node))
+            (dev / "local_cpulist").write_text("4-7")
+            (root / "bus/pci/devices" / bus_id).symlink_to(dev)
+        topology = hardware_detect.detect_numa_topology(sysfs)
+
+    assert topology.multi_node and topology.nodes[1] == [4, 5, 6, 7]
+    (gpu,) = topology.gpus
+    assert (gpu.pcie_root, gpu.numa_node, gpu.cpus) == ("0000:40:01.1", 1, [4, 5, 6, 7])
+    assert topology.gpu("00000000:41:00.0") is gpu
+    assert topology.node_of_cpu(5) == 1
+    assert hardware_detect.format_cpu_list([5, 0, 1, 2, 7, 6]) == "0-2,5-7"
+
+
+def test_numa_maps_by_node():
+    text = (
+        "7f0000000000 default file=/models/llama.gguf mapped=262144 N0=200000 N1=62144"
+        " kernelpagesize_kB=4\n"
+        "7f1000000000 bind:1 anon=100 dirty=100 N1=100 kernelpagesize_kB=2048\n"
+        "7f2000000000 default anon=10 N0=10 kernelpagesize_kB=4\n"  # Too small
+    )
+    assert placement.numa_maps_by_node(text) == {0: 200000 * 4096, 1: 62144 * 4096 + (200 << 20)}
+
+
+def test_placement_pins_model_unit_to_gpu_node():
+    topology = hardware_detect.NumaTopology(
+        nodes={0: [0, 1, 2, 3], 1: [4, 5, 6, 7]},
+        gpus=[hardware_detect.GpuTopology("0000:41:00.0", "NVIDIA", "0000:40:01.1", 1, [4, 5])],
+    )
+    with (
+        mock.patch.object(placement, "process_gpus", return_value={"0000:41:00.0"}),
+        mock.patch.object(placement, "process_unit", return_value="cortex-model@llama3.service"),
+        mock.patch("pathlib.Path.read_text", side_effect=FileNotFoundError),
+    ):
+        (p,) = placement.get_placements(make_scheduler(), topology)
+
+    # Node 0 has 25% of the run time and 75% of the first-touch memory
+    assert p.gpu_nodes == [1] and p.cpus == [4, 5, 6, 7]
+    assert p.remote_cpu_pct == 25 and p.remote_memory_pct == 75
+    assert p.misplaced and p.model_unit
+    assert p.remote_threads == [(101, "tokenizer", 2)]
+    assert "AllowedCPUs=4-7\nNUMAPolicy=preferred\nNUMAMask=1\n" in p.dropin()
+
+    with tempfile.TemporaryDirectory() as etc, mock.patch("subprocess.run") as run:
+        path = placement.apply_dropin(p, Path(etc))
+        assert path.read_text() == p.dropin()
+    assert path == Path(etc) / "cortex-model@llama3.service.d" / placement.DROPIN_NAME
+    assert run.call_args.args[0][-1] == "AllowedCPUs=4-7"
+
+
+def test_find_mapped_file():
+    maps = (
+        "7f0000000000-7f0100000000 r--s 00000000 08:01 4242   /models/llama-70b.gguf\n"
+        "7f0100000000-7f0100001000 rw-p 00000000 00:00 0 \n"
+    )
+    assert find_mapped_file(maps, (8 << 20) | 1, 4242) == "/models/llama-70b.gguf"
+    assert find_mapped_file(maps, (8 << 20) | 2, 4242) is None
+
+
+class FakeKernel:
+    """Minimal bpf(2) for one per-CPU hash map, batch lookups included."""
+
+    def __init__(self, entries, ncpus, batch=True):
+        self.entries = sorted(entries.items())
+        self.ncpus = ncpus
+        self.batch = batch
+        self.calls = []
+
+    def __call__(self, cmd, attr):
+        self.calls.append(cmd)
+        if cmd == pinned_maps.BPF_OBJ_GET:
+            return os.open(os.devnull, os.O_RDONLY)
+        if cmd == pinned_maps.BPF_OBJ_GET_INFO_BY_FD:
+            _fd, _len, info = struct.unpack_from("=IIQ", attr)
+            ctypes.memmove(info, struct.pack("=5I", 5, 1, 4, VALUE_SIZE, 64), 20)
+            return 0
+        if cmd == pinned_maps.BPF_MAP_LOOKUP_BATCH:
+            if not self.batch:
+                raise OSError(errno.EINVAL, "no batch")
+            in_b, out_b, keys, values, count = struct.unpack_from("=QQQQI", attr)
+            start = ctypes.c_uint32.from_address(in_b).value if in_b else 0
+            chunk = self.entries[start : start + count]
+            for i, (k, v) in enumerate(chunk):
+                ctypes.memmove(keys + 4 * i, struct.pack("=I", k), 4)
+                for cpu in range(self.ncpus):
+                    raw = bytes(CpuCountersValue(gpu_wait_ns=v, inference_count=cpu))
+                    offset = (i * self.ncpus + cpu) * VALUE_SIZE
+                    ctypes.memmove(values + offset, raw, VALUE_SIZE)
+            struct.pack_into("=I", attr, 32, len(chunk))
+            end = start + len(chunk)
+            ctypes.memmove(out_b, struct.pack("=I", end), 4)
+            if end >= len(self.entries):
+                raise OSError(errno.ENOENT, "done")
+            return 0
+        if cmd == pinned_maps.BPF_MAP_GET_NEXT_KEY:
+            _fd, _pad, key, next_key = struct.unpack_from("=IIQQ", attr)
+            cur = ctypes.c_uint32.from_address(key).value if key else None
+            later = [k for k, _ in self.entries if cur is None or k > cur]
+            if not later:
+                raise OSError(errno.ENOENT, "end")
+            ctypes.memmove(next_key, struct.pack("=I", later[0]), 4)
+            return 0
+        if cmd == pinned_maps.BPF_MAP_LOOKUP_ELEM:
+            _fd, _pad, key, values, _flags = struct.unpack_from("=IIQQQ", attr)
+            v = dict(self.entries)[ctypes.c_uint32.from_address(key).value]
+            for cpu in range(self.ncpus):
+                raw = bytes(CpuCountersValue(gpu_wait_ns=v, inference_count=cpu))
+                ctypes.memmove(values + cpu * VALUE_SIZE, raw, VALUE_SIZE)
+            return 0
+        raise AssertionError(f"unexpected bpf cmd {cmd}")
+
+
+def read_all(kernel):
+    patches = [
+        mock.patch.object(pinned_maps, "_bpf", kernel),
+        mock.patch.object(pinned_maps, "num_possible_cpus", return_value=kernel.ncpus),
+        # Room for 16 per-CPU values per batch call
+        mock.patch.object(pinned_maps, "_BATCH_BUFFER_BYTES", VALUE_SIZE * kernel.ncpus * 16),
+    ]
+    with contextlib.ExitStack() as stack:
+        for patch in patches:
+            stack.enter_context(patch)
+        path = "/sys/fs/bpf/cortex/process_counters"
+        with PinnedMap(path, ctypes.c_uint32, CpuCountersValue) as m:
+            return m.items()
+
+
+def test_batch_snapshot_uses_few_syscalls():
+    kernel = FakeKernel({pid: pid * 10 for pid in range(1, 41)}, ncpus=4)
+    items = read_all(kernel)
+
+    assert [k.value for k, _ in items] == list(range(1, 41))
+    assert all(len(per_cpu) == 4 for _, per_cpu in items)
+    assert [c.inference_count for c in items[0][1]] == [0, 1, 2, 3]
+    assert items[-1][1][0].gpu_wait_ns == 400
+    # 40 entries in chunks of 16: three batch calls, no per-key lookups
+    assert kernel.calls.count(pinned_maps.BPF_MAP_LOOKUP_BATCH) == 3
+    assert pinned_maps.BPF_MAP_LOOKUP_ELEM not in kernel.calls
+
+
+def test_falls_back_to_per_key_reads_without_batch_support():
+    kernel = FakeKernel({7: 70, 9: 90}, ncpus=2, batch=False)
+    items = read_all(kernel)
+
+    assert [(k.value, v[1].gpu_wait_ns) for k, v in items] == [(7, 70), (9, 90)]
+
+
+def test_probe_bench_decodes_prog_info():
+    raw = bytearray(probe_bench._INFO_SIZE)
+    raw[probe_bench._INFO_NAME : probe_bench._INFO_NAME + 15] = b"handle_sched_sw"
+    struct.pack_into("=QQ", raw, probe_bench._INFO_RUN_TIME_NS, 9000, 60)
+    name, cost = probe_bench.decode_prog_info(bytes(raw))
+    assert name == "handle_sched_sw"
+    assert cost.run_cnt == 60 and cost.ns_per_event == 150
+
+
+def test_probe_bench_flags_regressions():
+    def run(ns):
+        return [{"workload": "ioctl", "programs": {"handle_ioctl": {"ns_per_event": ns}}}]
+
+    assert probe_bench.compare(run(110), run(100), 20) == []
+    (line,) = probe_bench.compare(run(130), run(100), 20)
+    assert line.startswith("ioctl/handle_ioctl: 100 -> 130")
+
+
+def test_exporter_renders_prometheus_text():
+    page = metrics_exporter.render_metrics(make_scheduler())
+    assert "# TYPE cortex_sched_process_cpu_seconds_total counter" in page
+    assert 'cortex_sched_process_context_switches_total{pid="100",comm="llama-server"} 5' in page
+    # Buckets are cumulative: 98 run-queue waits up to 16us, all 100 by +Inf
+    labels = 'pid="100",comm="llama-server",kind="runq"'
+    assert f'cortex_sched_latency_seconds_bucket{{{labels},le="1.6e-05"}} 98' in page
+    assert f'cortex_sched_latency_seconds_bucket{{{labels},le="+Inf"}} 100' in page
+    assert f"cortex_sched_latency_seconds_count{{{labels}}} 100" in page
+    assert "cortex_sched_tracker_capacity 10240" in page
+
+
+def test_exporter_serves_metrics_on_unix_socket():
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "metrics.sock")
+        server = metrics_exporter.make_server(make_scheduler(), f"unix:{path}")
+        thread = threading.Thread(target=server.handle_request)
+        thread.start()
+        with socket.socket(socket.AF_UNIX) as client:
+            client.connect(path)
+            client.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+            response = b"".join(iter(lambda: client.recv(65536), b""))
+        thread.join()
+        server.server_close()
+
+    head, _, body = response.partition(b"\r\n\r\n")
+    assert head.startswith(b"HTTP/1.0 200")
+    assert b"text/plain; version=0.0.4" in head
+    assert b"cortex_sched_process_inference" in body
+
+
+def fleet_node(root: Path):
+    """A scheduler whose process 100 runs in cortex-model@llama3.service."""
+    sched = make_scheduler()
+    unit = "/cortex-inference.slice/cortex-model@llama3.service"
+    (root / "cgroup" / unit.lstrip("/")).mkdir(parents=True)
+    (root / "proc" / "100").mkdir(parents=True)
+    (root / "proc" / "100" / "cgroup").write_text(f"0::{unit}\n")
+    cgid = (root / "cgroup" / unit.lstrip("/")).stat().st_ino
+    sched.maps["cgroup_stats"] = FakeMap(
+        {cgid: [CgroupCountersValue(cpu_compute_ns=40, gpu_wait_ns=60, context_switches=5)]},
+        ctypes.c_uint64,
+    )
+    return sched, fleet.NodeDeltas(sched, root / "cgroup", root / "proc")
+
+
+def test_fleet_frames_are_compact_and_round_trip():
+    sample = fleet.UnitSample()
+    sample.counters.update(cpu_compute_ns=123_456_789, context_switches=300)
+    sample.hists["runq"][3], sample.hists["runq"][12] = 98, 2
+    sample.hists["load"][10] = 1
+    frame = fleet.Frame("gpu-07", 42, 1_700_000_000.5, 10.0, False, {"llama3.service": sample})
+
+    data = fleet.encode_frame(frame)
+    assert len(data) < 64
+    assert fleet.decode_frame(data) == frame
+    for bad in (data[:-1], b"XXXX" + data[4:], data + b"\0"):
+        try:
+            fleet.decode_frame(bad)
+            raise AssertionError("malformed frame accepted")
+        except ValueError:
+            pass
+
+
+def test_fleet_deltas_per_unit():
+    with tempfile.TemporaryDirectory() as tmp:
+        sched, node = fleet_node(Path(tmp))
+        (delta,) = node.collect().values()
+        assert delta.counters["cpu_compute_ns"] == 40 and delta.counters["gpu_wait_ns"] == 60
+        assert delta.hists["runq"][3] == 98 and delta.hists["runq"][12] == 2
+        # The 2 s model load lands in the [1024, 2048) ms slot, once
+        assert delta.hists["load"][10] == 1
+
+        assert node.collect() == {}
+
+        cgid = next(iter(sched.maps["cgroup_stats"].entries))
+        sched.maps["cgroup_stats"].entries[cgid] = [CgroupCountersValue(cpu_compute_ns=50)]
+        sched.maps["latency_hist"].entries[100][0].slots[0][3] += 5
+        (delta,) = node.collect().values()
+        # gpu_wait_ns went down: cortex-schedd restarted and counts from zero
+        assert delta.counters["cpu_compute_ns"] == 10 and delta.counters["gpu_wait_ns"] == 0
+        assert delta.hists["runq"][3] == 5 and not any(delta.hists["load"])
+        total = node.totals["cortex-model@llama3.service"]
+        assert total.counters["cpu_compute_ns"] == 50 and total.hists["runq"][3] == 103
+
+
+def test_fleet_aggregator_merges_nodes_and_resyncs_on_keyframes():
+    def unit(**counters):
+        sample = fleet.UnitSample()
+        sample.counters.update(counters)
+        sample.hists["runq"][2] = counters.get("context_switches", 0)
+        return sample
+
+    agg = fleet.FleetAggregator()
+    agg.ingest(fleet.Frame("a", 1, 0, 10, True, {"llama3": unit(cpu_compute_ns=10)}))
+    agg.ingest(fleet.Frame("a", 2, 0, 10, False, {"llama3": unit(cpu_compute_ns=5)}))
+    agg.ingest(fleet.Frame("b", 1, 0, 10, True, {"llama3": unit(context_switches=4)}))
+    agg.ingest(fleet.Frame("b", 2, 0, 10, False, {"mistral": unit(gpu_wait_ns=3)}))
+
+    llama, mistral = agg.merged()
+    assert llama.nodes == ["a", "b"] and llama.sample.counters["cpu_compute_ns"] == 15
+    assert llama.percentile("runq", 50) == 8 and mistral.gpu_ratio == 100
+
+    # Node a reconnected: its keyframe replaces what it had sent
+    agg.ingest(fleet.Frame("a", 9, 0, 10, True, {"llama3": unit(cpu_compute_ns=12)}))
+    assert agg.merged()[0].sample.counters["cpu_compute_ns"] == 12
+    assert agg.stale_nodes(now=time.time() + 31) == ["a", "b"]
+
+
+def test_fleet_pusher_sends_keyframe_then_deltas():
+    agg = fleet.FleetAggregator()
+    server = fleet.AggregatorServer("127.0.0.1:0", agg)
+    thread = threading.Thread(target=server.serve_forever, kwargs={"poll_interval": 0.05})
+    thread.start()
+    try:
+        with tempfile.TemporaryDirectory() as tmp:
+            sched, node = fleet_node(Path(tmp))
+            pusher = fleet.FleetPusher(node, f"127.0.0.1:{server.server_address[1]}", "gpu-07")
+            assert pusher.push() and pusher.push()
+            cgid = next(iter(sched.maps["cgroup_stats"].entries))
+            sched.maps["cgroup_stats"].entries[cgid][0].cpu_compute_ns = 70
+            assert pusher.push()
+            pusher.close()
+
+            deadline = time.monotonic() + 5
+            while time.monotonic() < deadline and sum(s.frames for s in agg.nodes.values()) < 3:
+                time.sleep(0.01)
+    finally:
+        server.shutdown()
+        server.server_close()
+        thread.join()
+
+    state = agg.nodes["gpu-07"]
+    assert state.frames == 3 and state.seq == 3
+    # Idle units are left out: the frame with nothing new is a few bytes
+    assert state.bytes_received == pusher.bytes_sent < 200
+    (llama,) = agg.merged()
+    assert llama.sample.counters["cpu_compute_ns"] == 70
+    assert llama.sample.hists["load"][10] == 1
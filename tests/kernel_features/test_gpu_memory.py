@@ -0,0 +1,192 @@
+import ctypes
+import json
+import os
+import tempfile
+import time
+from pathlib import Path
+from unittest import mock
+
+from cortex.kernel_features import accelerator_limits, gpu_memory
+from cortex.kernel_features.accelerator_limits import (
+    AcceleratorLimitsManager,
+    ResourceLimits,
+    parse_memory_limit,
+)
+from cortex.kernel_features.gpu_memory import (
+    DeviceMemory,
+    GPUBudgetValue,
+    GPUMemoryAccountant,
+    ProcessMemory,
+    admit,
+    profile_for,
+)
+
+GIB = 1 << 30
+
+
+class FakeSampler:
+    name = "fake"
+
+    def __init__(self, devices, processes):
+        self.devices = devices
+        self.processes = processes
+
+    def sample(self):
+        return self.devices, self.processes
+
+
+class FakeBudgets:
+    """Stands in for the pinned gpu_budget map."""
+
+    def __init__(self):
+        self.entries = {}
+
+    def update(self, key, value):
+        self.entries[key] = GPUBudgetValue.from_buffer_copy(value)
+
+    def delete(self, key):
+        return self.entries.pop(key, None) is not None
+
+    def items(self):
+        return list(self.entries.items())
+
+
+def fake_proc(root: Path, cgroups: dict[int, str]) -> Path:
+    for pid, path in cgroups.items():
+        (root / "proc" / str(pid)).mkdir(parents=True)
+        (root / "proc" / str(pid) / "cgroup").write_text(f"0::{path}\n")
+        (root / "cgroup" / path.lstrip("/")).mkdir(parents=True, exist_ok=True)
+    return root / "proc"
+
+
+def make_accountant(home: Path, profiles, devices, processes, cgroups):
+    with mock.patch.object(accelerator_limits, "CORTEX_DB", home / "limits.db"):
+        manager = AcceleratorLimitsManager()
+    for limits in profiles:
+        manager.db.save(limits)
+    return GPUMemoryAccountant(
+        manager,
+        FakeSampler(devices, processes),
+        state_file=home / "gpu-memory.json",
+        proc=fake_proc(home, cgroups),
+        cgroup_root=home / "cgroup",
+        pin_dir=home / "bpf",
+    )
+
+
+def test_parse_memory_limit():
+    assert parse_memory_limit("", 80 * GIB) is None
+    assert parse_memory_limit("24G", 80 * GIB) == 24 * GIB
+    assert parse_memory_limit("512MiB", 80 * GIB) == 512 << 20
+    assert parse_memory_limit("25%", 80 * GIB) == 20 * GIB
+    assert parse_memory_limit("4096", 80 * GIB) == 4096
+
+
+def test_presets_below_full_gpu_get_a_hard_cap():
+    assert ResourceLimits.from_preset("b", "batch").gpu_memory_max == "80%"
+    assert ResourceLimits.from_preset("i", "inference").gpu_memory_max == ""
+    # Profiles saved before the caps existed still load
+    assert ResourceLimits(name="old").gpu_memory_high == ""
+
+
+def test_processes_are_charged_to_their_model_unit():
+    profiles = [ResourceLimits(name="llama3"), ResourceLimits(name="batch", cgroup="/batch.slice")]
+    assert profile_for("/cortex-inference.slice/cortex-model@llama3.service", profiles).name == (
+        "llama3"
+    )
+    assert profile_for("/x.slice/cortex-model@llama3.service/payload", profiles).name == "llama3"
+    assert profile_for("/batch.slice/job-1.scope", profiles).name == "batch"
+    assert profile_for("/batch.slicer", profiles) is None
+    assert profile_for("/user.slice/cortex-model@mistral.service", profiles) is None
+
+
+def test_caps_refuse_sessions_over_max_and_over_high_under_pressure():
+    with tempfile.TemporaryDirectory() as tmp:
+        home = Path(tmp)
+        profiles = [
+            ResourceLimits(name="big", gpu_memory_max="40G"),
+            ResourceLimits(name="soft", gpu_memory_high="10G"),
+            ResourceLimits(name="idle", gpu_memory_high="10G", gpu_memory_max="20G"),
+        ]
+        cgroups = {
+            10: "/cortex-inference.slice/cortex-model@big.service",
+            11: "/cortex-inference.slice/cortex-model@big.service",
+            20: "/cortex-inference.slice/cortex-model@soft.service",
+            30: "/user.slice/session-1.scope",
+        }
+        devices = [DeviceMemory(0, 80 * GIB, 70 * GIB), DeviceMemory(1, 80 * GIB, 75 * GIB)]
+        processes = [
+            ProcessMemory(0, 10, 30 * GIB),
+            ProcessMemory(0, 11, 12 * GIB),
+            ProcessMemory(0, 20, 8 * GIB),
+            ProcessMemory(1, 20, 12 * GIB),
+            ProcessMemory(1, 30, 50 * GIB),
+        ]
+        accountant = make_accountant(home, profiles, devices, processes, cgroups)
+        usage = accountant.sample()
+
+        assert usage["big"].devices == {0: 42 * GIB} and usage["big"].pids == {10, 11}
+        assert (usage["big"].state, usage["big"].admit) == ("max", False)
+        assert "gpu_memory_max" in usage["big"].reason
+        # Over its soft cap on GPU 1, which has only 5 GiB (< 10%) free
+        assert (usage["soft"].state, usage["soft"].admit) == ("high", False)
+        assert usage["idle"].admit and usage["idle"].devices == {}
+
+        devices[1].used_bytes = 40 * GIB  # Room again: over the soft cap is fine
+        assert accountant.sample()["soft"].admit
+
+        state = json.loads((home / "gpu-memory.json").read_text())
+        assert state["profiles"]["big"]["devices"] == {"0": 42 * GIB}
+        assert admit("big", home / "gpu-memory.json")[0] is False
+        assert admit("soft", home / "gpu-memory.json") == (True, "")
+        assert admit("unknown", home / "gpu-memory.json") == (True, "")
+
+
+def test_admit_fails_open_without_a_recent_sample():
+    with tempfile.TemporaryDirectory() as tmp:
+        path = Path(tmp) / "gpu-memory.json"
+        assert admit("big", path)[0]
+        verdict = {"devices": {}, "state": "max", "admit": False, "reason": "full"}
+        state = {"sampled_at": time.time(), "interval": 2.0, "profiles": {"big": verdict}}
+        path.write_text(json.dumps(state))
+        assert admit("big", path) == (False, "full")
+        state["sampled_at"] -= 60
+        path.write_text(json.dumps(state))
+        assert admit("big", path) == (True, "GPU memory sample is stale")
+
+
+def test_budgets_track_the_headroom_of_capped_cgroups():
+    with tempfile.TemporaryDirectory() as tmp:
+        home = Path(tmp)
+        unit = "/cortex-inference.slice/cortex-model@llama3.service"
+        accountant = make_accountant(
+            home,
+            [ResourceLimits(name="llama3", gpu_memory_max="30G"), ResourceLimits(name="free")],
+            [DeviceMemory(0, 80 * GIB, 60 * GIB)],
+            [ProcessMemory(0, 10, 24 * GIB)],
+            {10: unit},
+        )
+        budgets = FakeBudgets()
+        accountant._budget_map = budgets
+        usage = accountant.sample()
+        assert usage["llama3"].headroom_bytes == 6 * GIB and usage["free"].headroom_bytes is None
+
+        cgid = os.stat(home / "cgroup" / unit.lstrip("/")).st_ino
+        assert list(budgets.entries) == [cgid]
+        assert budgets.entries[cgid].headroom_bytes == 6 * GIB
+        assert not accountant.under_pressure()
+        # The uprobes charged a burst past the headroom
+        budgets.entries[cgid].allocated_bytes = 8 * GIB
+        budgets.entries[cgid].over = 1
+        assert accountant.under_pressure()
+        accountant.sample()
+        assert budgets.entries[cgid].over == 0 and budgets.entries[cgid].allocated_bytes == 0
+
+        accountant.sampler.processes = []  # The service stopped
+        accountant.sample()
+        assert budgets.entries == {}
+
+
+def test_budget_value_matches_the_bpf_struct():
+    assert ctypes.sizeof(GPUBudgetValue) == 32
+    assert gpu_memory.GPUBudgetValue.over.offset == 24
@@ -1,7 +1,562 @@
-from cortex.kernel_features.kv_cache_manager import CacheConfig
+import contextlib
+import ctypes
+import io
+import os
+import shutil
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+from unittest import mock
+
+from cortex.kernel_features import kv_cache_manager
+from cortex.kernel_features.kv_cache_manager import (
+    CacheConfig,
+    KVCacheManager,
+    KVPoolHeader,
+    SharedMemoryPool,
+)
+
+KVPOOL_SRC = Path(kv_cache_manager.__file__).parent / "kvpool" / "cortex_kvpool.c"
+_built: list[str] = []
+
+
+def native_allocator():
+    """Build libcortex_kvpool once for the tests that allocate."""
+    if not _built:
+        cc = shutil.which("cc")
+        if not cc:
+            raise unittest.SkipTest("no C compiler for libcortex_kvpool")
+        lib = os.path.join(tempfile.mkdtemp(), kv_cache_manager.KVPOOL_LIB)
+        subprocess.run([cc, "-O2", "-shared", "-fPIC", "-o", lib, str(KVPOOL_SRC)], check=True)
+        _built.append(lib)
+    os.environ["CORTEX_KVPOOL_LIB"] = _built[0]
+    kv_cache_manager._kvpool = None
+
+
+@mock.patch.object(kv_cache_manager, "HUGETLBFS_DIR", Path("/nonexistent"))
+def make_pool(name, blocks=8, block_size=1 << 20, policy="lru", block_tokens=4, salt=None):
+    name = f"test_{os.getpid()}_{name}"
+    return SharedMemoryPool(
+        name,
+        blocks * block_size,
+        block_size=block_size,
+        policy=policy,
+        block_tokens=block_tokens,
+        salt=salt,
+    )
 
 
 def test_cache_config():
     cfg = CacheConfig("test", 1024 * 1024 * 16)
     assert cfg.policy == "lru"
     assert cfg.max_sequences == 1000
+    assert cfg.block_size == 2 << 20
+
+
+def test_pool_layout():
+    # static_asserts in cortex_kvpool.c
+    assert ctypes.sizeof(KVPoolHeader) == 256
+    assert ctypes.sizeof(kv_cache_manager.KVPoolBlock) == 40
+    nr_blocks, data_offset, segment_size = kv_cache_manager.pool_layout(10 << 20, 1 << 20)
+    assert nr_blocks == 10
+    assert kv_cache_manager.index_layout(10) == (256 + 10 * 40, 32)
+    assert data_offset % kv_cache_manager.PAGE_SIZE == 0 and data_offset >= 656 + 32 * 4
+    assert segment_size == data_offset + (10 << 20)
+    # Huge pages round the data start and the segment up to 2 MiB
+    _, data_offset, segment_size = kv_cache_manager.pool_layout(10 << 20, 1 << 20, 2 << 20)
+    assert data_offset == 2 << 20 and segment_size == 12 << 20
+
+
+def test_formatted_pool_is_all_free_and_attachable():
+    pool = make_pool("format")
+    try:
+        assert pool.get_usage() == (8 << 20, 0, 8 << 20)
+        assert not pool.hugetlb and pool.shm_name == pool.name
+        other = SharedMemoryPool(pool.name.removeprefix(kv_cache_manager.SHM_PREFIX), 0, False)
+        other.block(7)[:5] = b"hello"
+        assert bytes(pool.block(7)[:5]) == b"hello"
+        assert other.nr_blocks == 8 and other.policy == "lru" and other.block_tokens == 4
+        other.close()
+    finally:
+        pool.destroy()
+
+
+def test_blocks_are_allocated_all_or_nothing():
+    native_allocator()
+    pool = make_pool("alloc")
+    try:
+        first = pool.alloc_blocks(5, owner=1)
+        assert sorted(first) == [0, 1, 2, 3, 4]
+        try:
+            pool.alloc_blocks(4, owner=2)
+            raise AssertionError("allocated more blocks than the pool has")
+        except MemoryError:
+            pass
+        assert pool.get_usage()[1] == 5 << 20 and pool.header.alloc_failures == 1
+
+        second = pool.alloc_blocks(3, owner=2)
+        assert not set(first) & set(second)
+        # Double frees are ignored; an owner's blocks go back together
+        assert pool.free_blocks([second[0], second[0]]) == 1
+        assert pool.free_owner(1) == 5
+        assert pool.get_usage()[1] == 2 << 20
+    finally:
+        pool.destroy()
+
+
+def test_processes_share_a_pool_without_double_allocation():
+    native_allocator()
+    pool = make_pool("procs", blocks=16, block_size=4096)
+    name = pool.name.removeprefix(kv_cache_manager.SHM_PREFIX)
+    children = []
+    try:
+        for _ in range(4):
+            pid = os.fork()
+            if pid == 0:
+                status = 0
+                mine = SharedMemoryPool(name, 0, create=False)
+                tag = os.getpid().to_bytes(8, "little")
+                for _ in range(2000):
+                    blocks = mine.alloc_blocks(3, owner=os.getpid())
+                    for block in blocks:
+                        mine.block(block)[:8] = tag
+                    # Nobody else may have been handed the same blocks
+                    status |= any(bytes(mine.block(b)[:8]) != tag for b in blocks)
+                    mine.free_blocks(blocks)
+                mine.close()
+                os._exit(status)
+            children.append(pid)
+        statuses = [os.waitpid(pid, 0)[1] for pid in children]
+        assert statuses == [0, 0, 0, 0]
+        assert pool.header.nr_free == 16
+        assert pool.header.allocs == pool.header.frees == 4 * 2000 * 3
+    finally:
+        pool.destroy()
+
+
+def test_lru_evicts_the_sequence_not_referenced_since_the_last_sweep():
+    native_allocator()
+    pool = make_pool("lru", blocks=4)
+    try:
+        blocks = {owner: pool.alloc_blocks(1, owner) for owner in (1, 2, 3, 4)}
+        assert pool.evict(1, keep=0) == []  # All in use
+        assert [pool.idle(owner) for owner in blocks] == [1, 1, 1, 1]
+        # New blocks start referenced: the first sweep clears them all, then wraps
+        assert pool.evict(1, keep=0) == [1]
+        pool.access(blocks[2])
+        pool.alloc_blocks(1, owner=5)
+        assert pool.evict(1, keep=0) == [3]
+        # Owner 4 resumed and owner 5 never stopped: only owner 2 can go
+        assert pool.resume(4) == 1
+        assert pool.evict(4, keep=0) == [2]
+        assert pool.header.evictions == 3 and pool.get_stats() == (1, 0)
+    finally:
+        pool.destroy()
+
+
+def test_lfu_evicts_the_least_accessed_sequence():
+    native_allocator()
+    pool = make_pool("lfu", blocks=3, policy="lfu")
+    try:
+        blocks = {owner: pool.alloc_blocks(1, owner) for owner in (1, 2, 3)}
+        for owner in blocks:
+            pool.idle(owner)
+        for _ in range(5):
+            pool.access(blocks[1])
+        for _ in range(2):
+            pool.access(blocks[2])
+        pool.access([])
+        assert pool.evict(1, keep=0) == [3]
+        assert pool.evict(1, keep=0) == [2]
+        assert pool.get_stats() == (7, 1)
+    finally:
+        pool.destroy()
+
+
+def test_fifo_evicts_the_oldest_sequence_and_never_the_allocating_one():
+    native_allocator()
+    pool = make_pool("fifo", blocks=4, policy="fifo")
+    try:
+        first = pool.alloc_blocks(2, owner=1)
+        pool.alloc_blocks(1, owner=2)
+        pool.alloc_blocks(1, owner=3)
+        for owner in (1, 2, 3):
+            pool.idle(owner)
+        pool.access(first)
+        # Owner 2 grows by two blocks: owner 1 goes despite the hit, owner 2 stays
+        blocks, evicted = pool.alloc_or_evict(2, owner=2)
+        assert evicted == [1] and sorted(blocks) == sorted(first)
+        try:
+            pool.alloc_or_evict(5, owner=2)
+            raise AssertionError("allocated more blocks than the pool has")
+        except MemoryError:
+            pass
+    finally:
+        pool.destroy()
+
+
+def test_sequences_with_a_common_prefix_share_blocks():
+    native_allocator()
+    pool = make_pool("prefix")
+    try:
+        prompt = list(range(10))  # Two full blocks of 4 tokens and a partial one
+        own = pool.alloc_blocks(3, owner=1)
+        pool.block(own[0])[:6] = b"prefix"
+        assert pool.publish(1, own, prompt) == own
+        assert pool.shared_blocks() == 2 and pool.get_stats() == (0, 0)
+
+        assert pool.lookup(prompt[:8] + [99, 100]) == own[:2]
+        assert pool.lookup(prompt[:4] + [99] * 4) == own[:1]
+        assert pool.lookup([5, 4, 3, 2]) == []
+        assert pool.get_stats() == (2, 1)
+        # The first sequence ends; its prefix stays cached for the next
+        assert pool.release(1, own) == 1
+        assert pool.lookup(prompt) == own[:2]
+        assert bytes(pool.block(own[0])[:6]) == b"prefix"
+        assert pool.header.nr_free == 6
+    finally:
+        pool.destroy()
+
+
+def test_prefix_hashes_are_chained_and_salted():
+    pool = make_pool("hash")
+    other = make_pool("hash2")
+    try:
+        a = pool.prefix_hashes(list(range(8)))
+        b = pool.prefix_hashes([9, 9, 9, 9] + list(range(4, 8)))
+        assert len(a) == 2 and a[0] != b[0] and a[1] != b[1]  # Same block, other prefix
+        assert pool.prefix_hashes(list(range(7))) == a[:1]
+        assert other.prefix_hashes(list(range(8))) != a
+    finally:
+        pool.destroy()
+        other.destroy()
+
+
+def test_publishing_a_known_prefix_swaps_in_the_shared_block():
+    native_allocator()
+    pool = make_pool("dedup")
+    try:
+        first = pool.alloc_blocks(1, owner=1)
+        pool.publish(1, first, [1, 2, 3, 4])
+        second = pool.alloc_blocks(1, owner=2)
+        assert pool.publish(2, second, [1, 2, 3, 4]) == first
+        assert pool.header.nr_free == 7  # Owner 2's copy went back
+        assert pool.unref(first) == 1 and pool.unref(first) == 1 and pool.unref(first) == 0
+    finally:
+        pool.destroy()
+
+
+def test_copy_on_write_moves_the_reference_to_a_private_copy():
+    native_allocator()
+    pool = make_pool("cow")
+    try:
+        own = pool.alloc_blocks(1, owner=1)
+        assert pool.cow(1, own[0]) == own[0]  # Private already
+        pool.block(own[0])[:4] = b"kv01"
+        pool.publish(1, own, [1, 2, 3, 4])
+        shared = pool.lookup([1, 2, 3, 4])
+        copy = pool.cow(2, shared[0])
+        assert copy != own[0] and bytes(pool.block(copy)[:4]) == b"kv01"
+        # Owner 1 and the lookup took two references; the copy gave one back
+        assert pool.unref(own) == 1 and pool.unref(own) == 0
+        assert pool.free_blocks([own[0]]) == 0  # Shared blocks only go by eviction
+    finally:
+        pool.destroy()
+
+
+def test_only_unreferenced_shared_blocks_are_evicted():
+    native_allocator()
+    pool = make_pool("shared_evict", blocks=3)
+    try:
+        prompt = list(range(8))
+        own = pool.alloc_blocks(2, owner=1)
+        pool.release(1, pool.publish(1, own, prompt))
+        held = pool.lookup(prompt[:4])  # Owner 2 attaches to the first block
+        blocks, evicted = pool.alloc_or_evict(2, owner=3)
+        assert evicted == [] and own[1] in blocks  # The unreferenced block went
+        assert pool.lookup(prompt) == held
+        assert pool.header.evictions == 1
+    finally:
+        pool.destroy()
+
+
+def test_processes_share_prefixes_while_evicting():
+    native_allocator()
+    pool = make_pool("share_procs", blocks=6, block_size=4096)
+    name = pool.name.removeprefix(kv_cache_manager.SHM_PREFIX)
+    prompts = [[p] * 8 for p in range(4)]  # Two blocks each; not all fit at once
+    children = []
+    try:
+        for child in range(4):
+            pid = os.fork()
+            if pid == 0:
+                status = 0
+                mine = SharedMemoryPool(name, 0, create=False)
+                for i in range(1000):
+                    prompt = prompts[(child + i) % len(prompts)]
+                    hashes = mine.prefix_hashes(prompt)
+                    table = mine.lookup(prompt)
+                    # A shared block must hold what its publisher wrote for that prefix
+                    status |= any(
+                        bytes(mine.block(b)[:8]) != h.to_bytes(8, "little")
+                        for b, h in zip(table, hashes)
+                    )
+                    try:
+                        own, _ = mine.alloc_or_evict(2 - len(table), owner=os.getpid())
+                    except MemoryError:
+                        mine.unref(table)
+                        continue
+                    for block, h in zip(own, hashes[len(table) :]):
+                        mine.block(block)[:8] = h.to_bytes(8, "little")
+                    table = table + own
+                    if own:
+                        table = mine.publish(os.getpid(), table, prompt)
+                    # Parked between turns, the private blocks may be evicted
+                    mine.unref(table)
+                    mine.idle(os.getpid())
+                    mine.resume(os.getpid())
+                    mine.free_owner(os.getpid())
+                mine.close()
+                os._exit(status)
+            children.append(pid)
+        statuses = [os.waitpid(pid, 0)[1] for pid in children]
+        assert statuses == [0, 0, 0, 0]
+        # Every reference was dropped and every block is free or cached
+        meta = pool.header.meta_offset
+        table = (kv_cache_manager.KVPoolBlock * 6).from_buffer(pool.shm.buf, meta)
+        assert all(b.users == 0 for b in table)
+        del table
+        assert pool.header.nr_free + pool.shared_blocks() == 6
+        assert pool.header.evictions > 0
+    finally:
+        pool.destroy()
+
+
+def test_manager_catalogs_sequence_blocks():
+    native_allocator()
+    with tempfile.TemporaryDirectory() as home:
+        db = Path(home) / "kv_cache.db"
+        with (
+            mock.patch.object(kv_cache_manager, "CORTEX_DB", db),
+            mock.patch.object(kv_cache_manager, "HUGETLBFS_DIR", Path("/nonexistent")),
+        ):
+            mgr = KVCacheManager()
+            name = f"test_{os.getpid()}_mgr"
+            mgr.create_pool(CacheConfig(name, 4 << 20, block_size=1 << 20))
+            try:
+                assert len(mgr.allocate(name, seq_id=42, token_count=16, size_bytes=1)) == 1
+                assert len(mgr.allocate(name, seq_id=42, token_count=32, size_bytes=2 << 20)) == 2
+                with mgr.db._pool.get_connection() as conn:
+                    row = conn.execute("SELECT tokens, size FROM entries WHERE seq_id=42")
+                    assert row.fetchone() == (48, 3 << 20)
+                assert mgr.release(name, 42) == 3
+                assert mgr.get_pool(name).get_usage()[1] == 0
+            finally:
+                mgr.destroy_pool(name)
+
+
+def test_manager_uncatalogs_evicted_sequences_and_checkpoints_stats():
+    native_allocator()
+    with tempfile.TemporaryDirectory() as home:
+        db = Path(home) / "kv_cache.db"
+        with (
+            mock.patch.object(kv_cache_manager, "CORTEX_DB", db),
+            mock.patch.object(kv_cache_manager, "HUGETLBFS_DIR", Path("/nonexistent")),
+        ):
+            mgr = KVCacheManager()
+            name = f"test_{os.getpid()}_evict"
+            mgr.create_pool(CacheConfig(name, 4 << 20, block_size=1 << 20))
+            try:
+                mgr.allocate(name, seq_id=1, token_count=16, size_bytes=2 << 20)
+                blocks = mgr.allocate(name, seq_id=2, token_count=16, size_bytes=2 << 20)
+                mgr.park(name, 1)
+                mgr.park(name, 2)
+                mgr.allocate(name, seq_id=3, token_count=16, size_bytes=2 << 20)
+                with mgr.db._pool.get_connection() as conn:
+                    rows = conn.execute("SELECT seq_id FROM entries ORDER BY seq_id")
+                    assert rows.fetchall() == [(2,), (3,)]
+                assert mgr.resume(name, 2) and not mgr.resume(name, 1)
+
+                pool = mgr.get_pool(name)
+                pool.access(blocks)
+                pool.access([])
+                assert mgr.db.get_stats(name) == (0, 0)  # Nothing written per access
+                mgr.start_checkpointing(interval=3600)
+                mgr.stop_checkpointing()
+                assert mgr.db.get_stats(name) == (1, 1)
+            finally:
+                mgr.destroy_pool(name)
+
+
+def test_manager_attaches_new_sequences_to_cached_prefixes():
+    native_allocator()
+    with tempfile.TemporaryDirectory() as home:
+        db = Path(home) / "kv_cache.db"
+        with (
+            mock.patch.object(kv_cache_manager, "CORTEX_DB", db),
+            mock.patch.object(kv_cache_manager, "HUGETLBFS_DIR", Path("/nonexistent")),
+        ):
+            mgr = KVCacheManager()
+            name = f"test_{os.getpid()}_attach"
+            mgr.create_pool(CacheConfig(name, 8 << 20, block_size=1 << 20, block_tokens=4))
+            try:
+                system = list(range(100, 108))
+                first, cached = mgr.attach(name, 1, system + [1, 2], size_bytes=3 << 20)
+                assert len(first) == 3 and cached == 0
+                first = mgr.share(name, 1, first, system + [1, 2])
+
+                second, cached = mgr.attach(name, 2, system + [7, 8], size_bytes=3 << 20)
+                assert cached == 8 and second[:2] == first[:2] and second[2] != first[2]
+                # The whole prompt cached still leaves its last token to prefill
+                third, cached = mgr.attach(name, 3, system, size_bytes=2 << 20)
+                assert cached == 4 and third[0] == first[0]
+
+                assert mgr.get_pool(name).get_usage()[1] == 5 << 20
+                for seq, table in ((1, first), (2, second), (3, third)):
+                    mgr.release(name, seq, table)
+                # Only the shared prompt blocks remain, cached for the next request
+                assert mgr.get_pool(name).get_usage()[1] == 2 << 20
+            finally:
+                mgr.destroy_pool(name)
+
+
+def test_snapshots_save_only_changed_blocks_and_restore_them():
+    native_allocator()
+    pool = make_pool("snap")
+    copy = make_pool("snap2", salt=bytes(pool.header.salt))
+    try:
+        with tempfile.TemporaryDirectory() as tmp:
+            path = Path(tmp) / "pool.snap"
+            prompt = list(range(8))
+            table = pool.alloc_blocks(3, owner=1)
+            for i, block in enumerate(table):
+                pool.block(block)[:5] = b"kv %d." % i
+            table = pool.publish(1, table, prompt)
+            assert pool.save_snapshot(path) == (2, 0)
+            assert pool.save_snapshot(path) == (0, 2)
+
+            more = pool.alloc_blocks(1, owner=2)
+            pool.block(more[0])[:5] = b"kv 9."
+            pool.publish(2, table[:2] + more, prompt + [7, 7, 7, 7])
+            pool.release(1, table)
+            pool.release(2, table[:2] + more)
+            assert pool.save_snapshot(path) == (1, 2)
+            assert os.stat(path).st_blocks * 512 < os.stat(path).st_size  # Holes
+
+            restore = copy.restore_snapshot(path)
+            assert (restore.total, restore.restored, restore.failed) == (3, 3, 0)
+            # Same block numbers, so the next save of the copy writes nothing
+            assert copy.lookup(prompt + [7, 7, 7, 7]) == table[:2] + more
+            assert bytes(copy.block(more[0])[:5]) == b"kv 9."
+            assert copy.unref(table[:2] + more) == 3
+            assert copy.header.nr_free == 5
+            assert copy.save_snapshot(path) == (0, 3)
+            # Published already: nothing to restore
+            assert copy.restore_snapshot(path).total == 0
+    finally:
+        pool.destroy()
+        copy.destroy()
+
+
+def test_restore_drops_blocks_that_fail_their_checksum():
+    native_allocator()
+    pool = make_pool("crc")
+    copy = make_pool("crc2", salt=bytes(pool.header.salt))
+    other = make_pool("crc3")
+    try:
+        with tempfile.TemporaryDirectory() as tmp:
+            path = Path(tmp) / "pool.snap"
+            table = pool.publish(1, pool.alloc_blocks(2, owner=1), list(range(8)))
+            pool.save_snapshot(path)
+            try:
+                other.restore_snapshot(path)
+                raise AssertionError("restored prefix hashes of another salt")
+            except ValueError:
+                pass
+
+            header = kv_cache_manager.read_snapshot_header(path)
+            with open(path, "r+b") as f:
+                f.seek(header.data_offset + table[1] * pool.block_size)
+                f.write(b"torn")
+            restore = copy.restore_snapshot(path, wait=False)
+            assert restore.wait(timeout=10)
+            assert (restore.restored, restore.failed) == (1, 1)
+            assert copy.lookup(list(range(8))) == table[:1]
+            assert copy.header.nr_free == 7
+    finally:
+        pool.destroy()
+        copy.destroy()
+        other.destroy()
+
+
+def test_manager_restores_a_pool_whose_segment_is_gone():
+    native_allocator()
+    with tempfile.TemporaryDirectory() as home:
+        with (
+            mock.patch.object(kv_cache_manager, "CORTEX_DB", Path(home) / "kv_cache.db"),
+            mock.patch.object(kv_cache_manager, "SNAPSHOT_DIR", Path(home) / "snapshots"),
+            mock.patch.object(kv_cache_manager, "HUGETLBFS_DIR", Path("/nonexistent")),
+        ):
+            mgr = KVCacheManager()
+            name = f"test_{os.getpid()}_restore"
+            assert mgr.restore_state(name) is None
+            mgr.create_pool(CacheConfig(name, 4 << 20, block_size=1 << 20, block_tokens=4))
+            try:
+                system = list(range(100, 109))
+                table, _ = mgr.attach(name, 1, system, size_bytes=3 << 20)
+                mgr.release(name, 1, mgr.share(name, 1, table, system))
+                assert mgr.save_state(name) == (2, 0)
+                mgr.get_pool(name).destroy()  # A reboot
+                mgr.pools.clear()
+
+                restore = mgr.restore_state(name)
+                assert restore.restored == 2
+                _, cached = mgr.attach(name, 2, system, size_bytes=3 << 20)
+                assert cached == 8
+            finally:
+                mgr.destroy_pool(name)
+
+
+def test_save_and_restore_state_run_without_a_writable_home():
+    """As in cortex-model@.service: ProtectHome, and the registry from CORTEX_KV_DB."""
+    native_allocator()
+    with tempfile.TemporaryDirectory() as root:
+        (Path(root) / "home").write_text("")
+        db = Path(root) / "lib" / "kv_cache.db"
+
+        def cli(*args):
+            out = io.StringIO()
+            with (
+                mock.patch("sys.argv", ["kv_cache_manager", *args]),
+                contextlib.redirect_stdout(out),
+            ):
+                kv_cache_manager.main()
+            return out.getvalue()
+
+        with (
+            mock.patch.dict(
+                os.environ,
+                # ~/.cortex cannot be created
+                {"HOME": str(Path(root) / "home" / "cortex-llm"), "CORTEX_KV_DB": str(db)},
+            ),
+            mock.patch.object(kv_cache_manager, "SNAPSHOT_DIR", Path(root) / "snapshots"),
+            mock.patch.object(kv_cache_manager, "HUGETLBFS_DIR", Path("/nonexistent")),
+        ):
+            mgr = KVCacheManager()
+            name = f"test_{os.getpid()}_nohome"
+            mgr.create_pool(CacheConfig(name, 4 << 20, block_size=1 << 20, block_tokens=4))
+            try:
+                system = list(range(100, 109))
+                table, _ = mgr.attach(name, 1, system, size_bytes=3 << 20)
+                mgr.release(name, 1, mgr.share(name, 1, table, system))
+                assert "Saved 2 cached blocks" in cli("save-state", name)
+                mgr.get_pool(name).destroy()
+                mgr.pools.clear()
+
+                assert "Restored 2 of 2" in cli("restore-state", name)
+                assert mgr.db.path == db and db.exists()
+                _, cached = mgr.attach(name, 2, system, size_bytes=3 << 20)
+                assert cached == 8
+            finally:
+                mgr.destroy_pool(name)
@@ -0,0 +1,111 @@
+import errno
+import os
+import threading
+from types import SimpleNamespace
+
+import pytest
+
+from cortex.kernel_features.llm_device import FuseOSError, LLMDevice, MockLLM, ResponseStream
+
+
+class GatedLLM(MockLLM):
+    """Sends one token, then waits for the test before finishing."""
+
+    def __init__(self):
+        self.gate = threading.Event()
+
+    def stream(self, model, messages, max_tokens, temp, system=None):
+        yield "first"
+        assert self.gate.wait(5)
+        yield " rest"
+
+
+def make_device():
+    device = LLMDevice(workers=2)
+    device.llm = GatedLLM()
+    return device
+
+
+def open_file(device, path, flags=os.O_RDONLY):
+    fi = SimpleNamespace(fh=0, flags=flags, direct_io=False)
+    device.open(path, fi)
+    return fi
+
+
+def read_all(device, path):
+    fi = open_file(device, path)
+    out, offset = b"", 0
+    while chunk := device.read(path, 4096, offset, fi):
+        out += chunk
+        offset += len(chunk)
+    device.release(path, fi)
+    return out
+
+
+def test_response_stream_reads_by_offset():
+    stream = ResponseStream()
+    stream.append(b"hello ")
+    assert stream.read(3, 0) == b"hel"
+    assert stream.read(100, 3) == b"lo "
+    with pytest.raises(BlockingIOError):
+        stream.read(10, 6, block=False)
+    threading.Timer(0.05, lambda: (stream.append(b"world"), stream.finish())).start()
+    assert stream.read(10, 6) == b"world"
+    assert stream.read(10, 11) == b""
+    assert stream.text() == "hello world"
+
+
+def test_read_streams_before_completion_ends():
+    device = make_device()
+    assert device.write("/claude/prompt", b"Hello\n", 0, None) == 6
+    fi = open_file(device, "/claude/response")
+    assert fi.direct_io
+    assert device.read("/claude/response", 4096, 0, fi) == b"first"
+
+    nonblock = open_file(device, "/claude/response", os.O_RDONLY | os.O_NONBLOCK)
+    with pytest.raises(FuseOSError) as exc:
+        device.read("/claude/response", 4096, 5, nonblock)
+    assert exc.value.errno == errno.EAGAIN
+
+    # One completion at a time per session
+    with pytest.raises(FuseOSError) as exc:
+        device.write("/claude/prompt", b"again", 0, None)
+    assert exc.value.errno == errno.EBUSY
+
+    device.llm.gate.set()
+    assert device.read("/claude/response", 4096, 5, fi) == b" rest"
+    assert device.read("/claude/response", 4096, 10, fi) == b""
+    session = device.sessions["default"]
+    assert session.messages[-1] == {"role": "assistant", "content": "first rest"}
+    device.destroy("/")
+
+
+def test_sessions_complete_concurrently():
+    device = make_device()
+    device.mkdir("/sessions/a", 0o755)
+    device.mkdir("/sessions/b", 0o755)
+    with pytest.raises(FuseOSError):
+        device.mkdir("/sessions/a", 0o755)
+
+    device.write("/sessions/a/prompt", b"one", 0, None)
+    device.write("/sessions/b/prompt", b"two", 0, None)
+    # Both workers are parked in their completions, each past its first token
+    for name in ("a", "b"):
+        fi = open_file(device, f"/sessions/{name}/response")
+        assert device.read(f"/sessions/{name}/response", 4096, 0, fi) == b"first"
+
+    device.llm.gate.set()
+    assert read_all(device, "/sessions/a/response") == b"first rest"
+    assert b"first rest" in read_all(device, "/sessions/b/history")
+    with pytest.raises(FuseOSError):
+        device.getattr("/sessions/missing/prompt")
+    device.destroy("/")
+
+
+def test_mock_llm_streams_words():
+    device = LLMDevice(workers=1)
+    device.llm = MockLLM()
+    device.write("/claude/prompt", b"Hello", 0, None)
+    assert read_all(device, "/claude/response") == b"[Mock] Response to: Hello..."
+    assert device.sessions["default"].response.done
+    device.destroy("/")
@@ -8,6 +8,8 @@ Tests concurrent API calls, rate limiting, batching, and response aggregation.
 import asyncio
 import os
 import sys
+import tempfile
+import threading
 import unittest
 from unittest.mock import MagicMock, Mock, patch
 
@@ -15,6 +17,7 @@ sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
 
 from cortex.llm_router import LLMProvider, LLMResponse, TaskType
 from cortex.parallel_llm import (
+    AdaptiveConcurrency,
     BatchResult,
     ParallelLLMExecutor,
     ParallelQuery,
@@ -23,7 +26,9 @@ from cortex.parallel_llm import (
     create_error_diagnosis_queries,
     create_hardware_check_queries,
     create_package_queries,
+    is_rate_limited,
 )
+from cortex.semantic_cache import SemanticCache
 
 
 class TestParallelQuery(unittest.TestCase):
@@ -448,5 +453,139 @@ class TestAsyncExecution(unittest.TestCase):
         self.assertEqual(result.success_count, 3)
 
 
+class TestAdaptiveConcurrency(unittest.TestCase):
+    """Test the AIMD concurrency limit."""
+
+    def test_additive_increase(self):
+        """Test that fast responses raise the limit up to its maximum."""
+        limiter = AdaptiveConcurrency(max_limit=4)
+        limiter.limit = 1.0
+        for _ in range(20):
+            limiter.on_success(0.1)
+        self.assertEqual(limiter.limit, 4.0)
+
+    def test_multiplicative_decrease(self):
+        """Test that a 429 halves the limit, once per round trip."""
+        limiter = AdaptiveConcurrency(max_limit=8)
+        limiter.on_success(10.0)
+        limiter.on_rate_limited()
+        limiter.on_rate_limited()  # Same burst
+        self.assertEqual(limiter.limit, 4.0)
+
+    def test_latency_decrease(self):
+        """Test that latency well above the baseline trims the limit."""
+        limiter = AdaptiveConcurrency(max_limit=10)
+        limiter.on_success(0.0)
+        limiter.on_success(0.5)
+        self.assertEqual(limiter.limit, 9.0)
+
+    def test_acquire_waits_for_release(self):
+        """Test that calls past the limit wait for a slot."""
+        limiter = AdaptiveConcurrency(max_limit=1)
+
+        async def run_test():
+            await limiter.acquire()
+            waiter = asyncio.ensure_future(limiter.acquire())
+            await asyncio.sleep(0.01)
+            self.assertFalse(waiter.done())
+            limiter.release()
+            await asyncio.wait_for(waiter, 1)
+            self.assertEqual(limiter.in_flight, 1)
+
+        asyncio.run(run_test())
+
+    def test_is_rate_limited(self):
+        """Test recognizing provider 429s."""
+        error = Exception("Too many requests")
+        error.status_code = 429
+        self.assertTrue(is_rate_limited(error))
+        self.assertTrue(is_rate_limited(RuntimeError("Error code: 429")))
+        self.assertFalse(is_rate_limited(RuntimeError("Connection reset")))
+
+
+class TestRequestCoalescing(unittest.TestCase):
+    """Test in-flight deduplication and the semantic cache."""
+
+    def setUp(self):
+        """Create mock router."""
+        self.mock_router = Mock()
+        self.mock_response = LLMResponse(
+            content="Shared response",
+            provider=LLMProvider.CLAUDE,
+            model="claude-sonnet-4",
+            tokens_used=100,
+            cost_usd=0.001,
+            latency_seconds=0.05,
+        )
+        self.mock_router.complete.return_value = self.mock_response
+
+    def test_identical_queries_share_a_call(self):
+        """Test that concurrent identical queries make one API call."""
+        release = threading.Event()
+
+        def slow_complete(*args, **kwargs):
+            release.wait(1)
+            return self.mock_response
+
+        self.mock_router.complete.side_effect = slow_complete
+        executor = ParallelLLMExecutor(router=self.mock_router)
+        queries = create_package_queries(["nginx", "nginx", "nginx", "redis"])
+        for i, query in enumerate(queries):
+            query.id = f"q{i}"
+
+        threading.Timer(0.05, release.set).start()
+        result = executor.execute_batch(queries)
+
+        self.assertEqual(self.mock_router.complete.call_count, 2)
+        self.assertEqual(result.success_count, 4)
+        self.assertEqual(result.deduplicated, 2)
+        self.assertEqual(result.total_tokens, 200)  # Shared calls are counted once
+        self.assertEqual(result.get_result("q2").response.content, "Shared response")
+        self.assertEqual(executor._in_flight, {})
+
+    def test_semantic_cache_before_dispatch(self):
+        """Test that a cached answer skips the call, across batches."""
+        with tempfile.TemporaryDirectory() as temp_dir:
+            cache = SemanticCache(db_path=os.path.join(temp_dir, "cache.db"))
+            executor = ParallelLLMExecutor(router=self.mock_router, cache=cache)
+            first = executor.execute_batch(create_package_queries(["nginx"]))
+            self.assertEqual(first.cache_hits, 0)
+
+            again = executor.execute_batch(create_package_queries(["nginx", "redis"]))
+            self.assertEqual(self.mock_router.complete.call_count, 2)
+            self.assertEqual(again.cache_hits, 1)
+            cached = again.get_result("pkg_nginx")
+            self.assertTrue(cached.cached)
+            self.assertEqual(cached.response.content, "Shared response")
+            self.assertEqual(cached.response.provider, LLMProvider.CLAUDE)
+            self.assertEqual(cached.response.tokens_used, 0)
+
+            # Same words, different formatting: still a hit
+            variant = create_package_queries(
+                ["NGINX"], query_template="analyze the package  {package}, and describe its purpose."
+            )
+            self.assertTrue(executor.execute_batch(variant).results[0].cached)
+            self.assertEqual(self.mock_router.complete.call_count, 2)
+
+    def test_rate_limits_shrink_concurrency(self):
+        """Test that 429s lower the limit and are retried."""
+        calls = 0
+
+        def throttled(*args, **kwargs):
+            nonlocal calls
+            calls += 1
+            if calls == 1:
+                raise RuntimeError("Error code: 429 - rate_limit_error")
+            return self.mock_response
+
+        self.mock_router.complete.side_effect = throttled
+        executor = ParallelLLMExecutor(router=self.mock_router, max_concurrent=8)
+        query = ParallelQuery(id="q", messages=[{"role": "user", "content": "Test"}])
+        result = executor.execute_batch([query])
+
+        self.assertEqual(result.success_count, 1)
+        self.assertLess(executor.concurrency.limit, 8)
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -1,11 +1,37 @@
 """Unit tests for semantic cache functionality."""
 
+import ctypes
 import os
+import shutil
 import sqlite3
+import subprocess
 import tempfile
 import unittest
-
-from cortex.semantic_cache import SemanticCache
+from array import array
+from pathlib import Path
+from unittest import mock
+
+from cortex import semantic_cache
+from cortex.semantic_cache import SemanticCache, VectorIndex
+
+EMBED_SRC = Path(semantic_cache.__file__).parent / "native" / "cortex_embed.c"
+_built: list[str] = []
+
+
+def native_embedder() -> ctypes.CDLL:
+    """Build libcortex_embed once for the tests that compare embedders."""
+    if not _built:
+        cc = shutil.which("cc")
+        if not cc:
+            raise unittest.SkipTest("no C compiler for libcortex_embed")
+        lib = os.path.join(tempfile.mkdtemp(), semantic_cache.EMBED_LIB)
+        subprocess.run(
+            [cc, "-O2", "-shared", "-fPIC", "-o", lib, str(EMBED_SRC), "-lm"], check=True
+        )
+        _built.append(lib)
+    with mock.patch.dict(os.environ, {"CORTEX_EMBED_LIB": _built[0]}):
+        with mock.patch.object(semantic_cache, "_embed_lib_loaded", False):
+            return semantic_cache.embed_library()
 
 
 class TestSemanticCache(unittest.TestCase):
@@ -200,6 +226,113 @@ class TestSemanticCache(unittest.TestCase):
         sim2 = SemanticCache._cosine(vec1, vec3)
         self.assertAlmostEqual(sim2, 0.0)
 
+    def test_semantic_match_beyond_recent_window(self):
+        """Test that similarity search covers older entries, not just the recent ones."""
+        cache = SemanticCache(db_path=self.db_path, max_entries=1000, similarity_threshold=0.85)
+        cache.put_commands("install the nginx web server", "openai", "gpt-4", "sys", ["nginx"])
+        for i in range(300):
+            cache.put_commands(f"configure service{i}", "openai", "gpt-4", "sys", [f"s{i}"])
+
+        result = cache.get_commands(
+            "please install the nginx web server", "openai", "gpt-4", "sys", candidate_limit=200
+        )
+        self.assertEqual(result, ["nginx"])
+
+    def test_index_follows_replacements_and_eviction(self):
+        """Test that put_commands keeps the loaded index in step with the table."""
+        self.cache.get_commands("warm up the index", "openai", "gpt-4", "sys")
+        self.cache.put_commands("install redis server", "openai", "gpt-4", "sys", ["old"])
+        self.cache.put_commands("install redis server", "openai", "gpt-4", "sys", ["new"])
+        self.assertEqual(
+            self.cache.get_commands("install redis server now", "openai", "gpt-4", "sys"),
+            ["new"],
+        )
+        index = self.cache._indexes[("openai", "gpt-4", self.cache._system_hash("sys"))]
+        self.assertEqual(len(index), 1)
+
+        for i in range(12):
+            self.cache.put_commands(f"install package{i}", "openai", "gpt-4", "sys", [f"p{i}"])
+        self.assertEqual(len(index), 10)  # max_entries
+        self.assertIs(self.cache._indexes[next(iter(self.cache._indexes))], index)
+
+    def test_index_reloads_after_other_writers(self):
+        """Test that entries written through another cache instance are found."""
+        self.cache.get_commands("install htop", "openai", "gpt-4", "sys")
+        other = SemanticCache(db_path=self.db_path, max_entries=10, similarity_threshold=0.85)
+        other.put_commands("install htop monitor", "openai", "gpt-4", "sys", ["apt install htop"])
+
+        result = self.cache.get_commands("install htop monitor tool", "openai", "gpt-4", "sys")
+        self.assertEqual(result, ["apt install htop"])
+
+    def test_own_write_does_not_hide_other_writers(self):
+        """Test that another instance's entry is found after this instance writes too."""
+        self.cache.get_commands("install htop", "openai", "gpt-4", "sys")
+        other = SemanticCache(db_path=self.db_path, max_entries=10, similarity_threshold=0.85)
+        other.put_commands(
+            "install postgres database", "openai", "gpt-4", "sys", ["apt install postgresql"]
+        )
+        self.cache.put_commands("install redis server", "openai", "gpt-4", "sys", ["redis"])
+
+        for cache in (self.cache, other):
+            result = cache.get_commands("install postgres database now", "openai", "gpt-4", "sys")
+            self.assertEqual(result, ["apt install postgresql"])
+
+    def test_vector_index_scoring(self):
+        """Test the index with numpy (if installed) and with the Python fallback."""
+        a = SemanticCache._embed("install docker engine")
+        b = SemanticCache._embed("remove the old kernel")
+        for numpy in {semantic_cache.np, None}:
+            with mock.patch.object(semantic_cache, "np", numpy):
+                index = VectorIndex()
+                self.assertIsNone(index.best(a))
+                index.add(1, a)
+                index.add(2, b)
+                entry_id, score = index.best(a)
+                self.assertEqual(entry_id, 1)
+                self.assertAlmostEqual(score, 1.0, places=5)
+                index.remove(1)
+                self.assertEqual(index.best(a)[0], 2)
+                self.assertEqual(index.ids, [2])
+
+    def test_native_embedder_matches_python(self):
+        """Test that libcortex_embed gives exactly the Python embedder's vectors."""
+        lib = native_embedder()
+        texts = [
+            "Install Docker-CE 24.0 on Ubuntu_22.04!",
+            "",
+            "  ,;  ",
+            "x" * 127 + " " + "Y" * 128 + " " + "z" * 300,
+            "tab\tseparated\nlines\x00nul",
+            "héllo wörld",  # Non-ASCII: left to Python
+        ]
+        with mock.patch.object(semantic_cache, "_embed_lib", lib):
+            for text in texts:
+                self.assertEqual(SemanticCache._embed(text), SemanticCache._embed_python(text))
+            matrix = SemanticCache.embed_many(texts)
+        expected = array("f")
+        for text in texts:
+            expected.extend(SemanticCache._embed_python(text))
+        self.assertEqual(matrix, expected)
+
+        with mock.patch.object(semantic_cache, "_embed_lib", None):
+            self.assertEqual(SemanticCache.embed_many(texts), expected)
+
+    def test_index_loads_with_native_embedder(self):
+        """Test that an index built from the prompts natively finds the same entries."""
+        lib = native_embedder()
+        self.cache.put_commands("install docker engine", "openai", "gpt-4", "sys", ["a"])
+        self.cache.put_commands("remove the old kernel", "openai", "gpt-4", "sys", ["b"])
+        self.cache._indexes.clear()
+        with mock.patch.object(semantic_cache, "_embed_lib", lib):
+            result = self.cache.get_commands("install docker engine now", "openai", "gpt-4", "sys")
+        self.assertEqual(result, ["a"])
+
+        index = VectorIndex(dims=2)
+        index.extend([1, 2], array("f", [1.0, 0.0, 0.0, 1.0]))
+        self.assertEqual(index.best([0.0, 1.0]), (2, 1.0))
+        with self.assertRaises(ValueError):
+            index.extend([2], array("f", [1.0, 0.0]))
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -273,6 +273,101 @@ def test_connection_pool_context_manager():
         os.unlink(db_path)
 
 
+def test_connection_pool_write_behind_coalesces():
+    """Test that deferred increments from many threads land as one sum."""
+    from cortex.utils.db_pool import SQLiteConnectionPool
+
+    with tempfile.NamedTemporaryFile(suffix=".db", delete=False) as f:
+        db_path = f.name
+
+    pool = SQLiteConnectionPool(db_path, pool_size=5, durability_window=60)
+    try:
+        with pool.get_connection() as conn:
+            conn.execute("CREATE TABLE counters (id INTEGER PRIMARY KEY, n INTEGER, seen TEXT)")
+            conn.execute("INSERT INTO counters VALUES (1, 0, ''), (2, 0, '')")
+            conn.commit()
+
+        def bump(thread_id: int):
+            for i in range(100):
+                pool.defer_increment("UPDATE counters SET n = n + ? WHERE id = ?", (1 + i % 2,))
+                pool.defer(
+                    "UPDATE counters SET seen = ? WHERE id = ?", (f"t{thread_id}", 2), key=(2,)
+                )
+
+        with concurrent.futures.ThreadPoolExecutor(max_workers=10) as executor:
+            concurrent.futures.wait([executor.submit(bump, i) for i in range(10)])
+
+        # Nothing is committed before the window, reads stay synchronous
+        with pool.get_connection() as conn:
+            assert conn.execute("SELECT n FROM counters WHERE id = 1").fetchone()[0] == 0
+
+        # 1000 increments of two rows and 1000 writes of one key: three statements
+        assert pool.flush() == 3
+        assert pool.flush() == 0
+        with pool.get_connection() as conn:
+            rows = conn.execute("SELECT id, n, seen FROM counters ORDER BY id").fetchall()
+        assert rows[0] == (1, 500, "")
+        assert rows[1][1] == 500 and rows[1][2].startswith("t")
+    finally:
+        pool.close_all()
+        os.unlink(db_path)
+
+
+def test_connection_pool_write_behind_window():
+    """Test that the writer thread commits within the window, and retries failures."""
+    from cortex.utils.db_pool import SQLiteConnectionPool
+
+    with tempfile.NamedTemporaryFile(suffix=".db", delete=False) as f:
+        db_path = f.name
+
+    pool = SQLiteConnectionPool(db_path, pool_size=2, durability_window=0.05)
+    try:
+        pool.defer("INSERT INTO log (msg) VALUES (?)", ("early",))  # Table not there yet
+        with pytest.raises(Exception):
+            pool.flush()
+
+        with pool.get_connection() as conn:
+            conn.execute("CREATE TABLE log (id INTEGER PRIMARY KEY, msg TEXT)")
+            conn.commit()
+        pool.defer("INSERT INTO log (msg) VALUES (?)", ("late",))
+
+        deadline = time.time() + 5
+        rows = []
+        while time.time() < deadline and len(rows) < 2:
+            time.sleep(0.02)
+            with pool.get_connection() as conn:
+                rows = conn.execute("SELECT msg FROM log ORDER BY id").fetchall()
+        assert rows == [("early",), ("late",)]
+    finally:
+        pool.close_all()
+        os.unlink(db_path)
+
+
+def test_connection_pool_close_flushes():
+    """Test that closing the pool commits what is still deferred."""
+    import sqlite3
+
+    from cortex.utils.db_pool import SQLiteConnectionPool
+
+    with tempfile.NamedTemporaryFile(suffix=".db", delete=False) as f:
+        db_path = f.name
+
+    try:
+        with SQLiteConnectionPool(db_path, pool_size=2, durability_window=60) as pool:
+            with pool.get_connection() as conn:
+                conn.execute("CREATE TABLE stats (id INTEGER PRIMARY KEY, hits INTEGER)")
+                conn.execute("INSERT INTO stats VALUES (1, 0)")
+                conn.commit()
+            for _ in range(5):
+                pool.defer_increment("UPDATE stats SET hits = hits + ? WHERE id = 1")
+
+        conn = sqlite3.connect(db_path)
+        assert conn.execute("SELECT hits FROM stats").fetchone()[0] == 5
+        conn.close()
+    finally:
+        os.unlink(db_path)
+
+
 @pytest.mark.slow
 def test_stress_concurrent_operations():
     """Stress test with many threads performing mixed read/write operations."""